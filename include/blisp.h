@@ -3,7 +3,10 @@
 #define _LIBBLISP_H
 
 #include <stdint.h>
+#include "blisp_capture.h"
 #include "blisp_chip.h"
+#include "blisp_metrics.h"
+#include "blisp_response.h"
 #include "error_codes.h"
 
 struct blisp_segment_header {
@@ -13,17 +16,55 @@ struct blisp_segment_header {
   uint32_t crc32;
 };
 
+// Waits of the BootROM handshake. blisp_device_init sets the ones that
+// have always been used, which are also the upper limit: a handshake that
+// starts from shorter ones doubles them after every failed attempt.
+struct blisp_handshake_timing {
+  uint16_t reset_hold_ms;     // DTR pulse that resets the chip
+  uint16_t reset_release_ms;  // Until RTS (boot pin) is released
+  uint16_t boot_wait_ms;      // For the BootROM to come up
+  uint16_t response_wait_ms;  // For the "OK" after the sync bytes
+  uint16_t second_wait_ms;    // Before BL808's second handshake
+  uint32_t sync_us;           // Length of the run of 'U' sync bytes
+};
+
 struct blisp_device {
   struct blisp_chip* chip;
   void* serial_port;
   uint32_t serial_timeout; // in ms
   bool is_usb;
   uint32_t current_baud_rate;
-  uint8_t rx_buffer[5000];  // TODO:
+  uint8_t flash_write_window;  // Flash write chunks kept in flight, 1 = no pipelining
+  uint16_t flash_write_chunk_size;  // Data bytes per flash write, 0 = adapt
+  uint16_t flash_write_settled_size;  // Chunk size the last write ended up with
+  bool flash_compress;  // Send flash writes xz compressed where it pays off
+  struct blisp_handshake_timing handshake;  // Timing the handshake starts with
+  struct blisp_handshake_timing handshake_settled;  // Timing that got an "OK"
+  uint32_t handshake_response_us;  // How long that "OK" took to come
+  uint8_t rx_buffer[5000];  // Payload of the last response
   uint8_t tx_buffer[5000];
   uint16_t error_code;
+  struct blisp_response_parser response_parser;
+  struct blisp_metrics* metrics;  // NULL unless blisp_device_set_metrics
+  struct blisp_capture* capture;  // NULL unless blisp_device_set_capture
+};
+
+// A piece of a command payload. The pieces go out back to back, without
+// being copied together first.
+struct blisp_payload_part {
+  const void* data;
+  uint32_t size;
 };
 
+#define BLISP_MAX_PAYLOAD_PARTS 4
+
+// Largest flash read eflash_loader answers in a single response
+#define BLISP_FLASH_READ_MAX_SIZE 4096
+// Largest flash write data we send in a single command
+#define BLISP_FLASH_WRITE_MAX_SIZE 4096
+// Flash writes are split at page boundaries
+#define BLISP_FLASH_PAGE_SIZE 256
+
 struct blisp_boot_info {
   uint8_t boot_rom_version[4];
   uint8_t chip_id[8];  // TODO: BL60X only 6 bytes
@@ -36,6 +77,21 @@ blisp_return_t blisp_device_init(struct blisp_device* device, struct blisp_chip*
 blisp_return_t blisp_device_open(struct blisp_device* device, const char* port_name,
                                  uint32_t baudrate);
 blisp_return_t blisp_device_handshake(struct blisp_device* device, bool in_ef_loader);
+// Makes the next handshake start from much shorter waits, for chips that
+// are known to come up quickly
+void blisp_device_fast_handshake(struct blisp_device* device);
+// Starts counting into metrics, which the caller owns and has to keep
+// around until the device is closed or this is called with NULL
+void blisp_device_set_metrics(struct blisp_device* device,
+                              struct blisp_metrics* metrics);
+// Starts recording the traffic into an open capture, same ownership as
+// blisp_device_set_metrics. Records the current baud rate first.
+void blisp_device_set_capture(struct blisp_device* device,
+                              struct blisp_capture* capture);
+blisp_return_t blisp_device_set_baudrate(struct blisp_device* device,
+                                         uint32_t baudrate);
+blisp_return_t blisp_device_change_baudrate(struct blisp_device* device,
+                                            uint32_t baudrate);
 blisp_return_t blisp_device_get_boot_info(struct blisp_device* device,
                                           struct blisp_boot_info* boot_info);
 blisp_return_t blisp_device_load_boot_header(struct blisp_device* device,
@@ -61,11 +117,44 @@ blisp_return_t blisp_device_flash_write(struct blisp_device* device,
                                         uint32_t start_address,
                                         uint8_t* payload,
                                         uint32_t payload_size);
+// Split form of blisp_device_flash_write, used for pipelining: _send only
+// transmits the chunk, _wait collects the next acknowledgement.
+blisp_return_t blisp_device_flash_write_send(struct blisp_device* device,
+                                             uint32_t start_address,
+                                             uint8_t* payload,
+                                             uint32_t payload_size);
+blisp_return_t blisp_device_flash_write_wait(struct blisp_device* device);
+blisp_return_t blisp_device_flash_decompress_write_send(
+    struct blisp_device* device,
+    uint32_t start_address,
+    uint8_t* payload,
+    uint32_t payload_size);
+blisp_return_t blisp_device_flash_read(struct blisp_device* device,
+                                       uint32_t start_address,
+                                       uint8_t* data,
+                                       uint32_t length);
+blisp_return_t blisp_device_flash_read_sha256(struct blisp_device* device,
+                                              uint32_t start_address,
+                                              uint32_t length,
+                                              uint8_t* digest);
 
+// Fills the 4 byte command header for a payload made of parts. Returns the
+// payload size.
+blisp_return_t blisp_build_command_header(
+    uint8_t* header,
+    uint8_t command,
+    const struct blisp_payload_part* parts,
+    uint8_t part_count,
+    bool add_checksum);
 blisp_return_t blisp_device_program_check(struct blisp_device* device);
 blisp_return_t blisp_device_reset(struct blisp_device* device);
+void blisp_device_flush_input(struct blisp_device* device);
 void blisp_device_close(struct blisp_device* device);
 
+int32_t blisp_list_ports(const char* prefix,
+                         char** port_names,
+                         uint32_t max_ports);
+
 blisp_return_t bl808_load_clock_para(struct blisp_device* device,
                                      bool irq_en, uint32_t baudrate);
 blisp_return_t bl808_load_flash_para(struct blisp_device* device);
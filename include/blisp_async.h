@@ -0,0 +1,102 @@
+// SPDX-License-Identifier: MIT
+#ifndef _BLISP_ASYNC_H
+#define _BLISP_ASYNC_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include "blisp.h"
+
+// Non-blocking versions of the device operations, for driving many boards
+// from a single event loop. An operation is started with one of the
+// blisp_async_* calls and then advanced with blisp_async_process whenever
+// the port becomes ready (see blisp_async_events and blisp_device_get_fd)
+// or its timeout (blisp_async_timeout_ms) expires. The callback runs from
+// blisp_async_process once the operation is done, and may start the next
+// one on the same struct.
+//
+// Only one operation can run on a device at a time, and the device must
+// not be used with the blocking API meanwhile.
+
+// Flags returned by blisp_async_events
+#define BLISP_ASYNC_WANT_READ 0x01
+#define BLISP_ASYNC_WANT_WRITE 0x02
+
+struct blisp_async;
+
+typedef void (*blisp_async_callback)(struct blisp_async* async,
+                                     blisp_return_t result,
+                                     void* user_data);
+
+enum blisp_async_operation {
+  BLISP_ASYNC_IDLE,
+  BLISP_ASYNC_HANDSHAKE,
+  BLISP_ASYNC_GET_BOOT_INFO,
+  BLISP_ASYNC_FLASH_ERASE,
+  BLISP_ASYNC_FLASH_WRITE,
+  BLISP_ASYNC_PROGRAM_CHECK,
+};
+
+struct blisp_async {
+  struct blisp_device* device;
+  blisp_async_callback callback;
+  void* user_data;
+
+  enum blisp_async_operation operation;
+  uint8_t phase;  // What blisp_async_process waits for
+  uint8_t step;   // Progress within the operation
+  uint8_t attempt;
+  uint64_t deadline_us;  // 0 = no deadline
+  uint64_t started_us;   // When the operation was started
+
+  // Frame being sent: header, then the payload parts
+  uint8_t header[4];
+  uint8_t address[4];
+  struct blisp_payload_part parts[BLISP_MAX_PAYLOAD_PARTS + 1];
+  uint8_t part_count;
+  uint8_t part;
+  uint32_t part_offset;
+  bool expect_payload;
+
+  bool in_ef_loader;                  // Handshake
+  uint8_t last_byte;
+  struct blisp_boot_info* boot_info;  // Get boot info
+  uint8_t command_payload[8];         // Erase
+  const uint8_t* data;                // Flash write
+  uint32_t address_start;
+  uint32_t size;
+  uint32_t written;  // Bytes acknowledged so far
+  uint32_t chunk_size;
+};
+
+// File descriptor of the port, for poll/epoll. Not available on Windows,
+// where blisp_async_process has to be called on a timer instead.
+blisp_return_t blisp_device_get_fd(struct blisp_device* device, int* fd);
+
+void blisp_async_init(struct blisp_async* async,
+                      struct blisp_device* device,
+                      blisp_async_callback callback,
+                      void* user_data);
+
+blisp_return_t blisp_async_handshake(struct blisp_async* async,
+                                     bool in_ef_loader);
+blisp_return_t blisp_async_get_boot_info(struct blisp_async* async,
+                                         struct blisp_boot_info* boot_info);
+blisp_return_t blisp_async_flash_erase(struct blisp_async* async,
+                                       uint32_t start_address,
+                                       uint32_t end_address);
+// data must stay valid until the callback ran. async->written tells how
+// far the write got.
+blisp_return_t blisp_async_flash_write(struct blisp_async* async,
+                                       uint32_t start_address,
+                                       const uint8_t* data,
+                                       uint32_t size);
+blisp_return_t blisp_async_program_check(struct blisp_async* async);
+
+bool blisp_async_busy(const struct blisp_async* async);
+uint8_t blisp_async_events(const struct blisp_async* async);
+// Milliseconds until blisp_async_process must be called even if the port
+// stays quiet, -1 if there is no deadline.
+int32_t blisp_async_timeout_ms(const struct blisp_async* async);
+void blisp_async_process(struct blisp_async* async);
+
+#endif
@@ -0,0 +1,78 @@
+// SPDX-License-Identifier: MIT
+#ifndef _BLISP_CAPTURE_H
+#define _BLISP_CAPTURE_H
+
+#include <stdint.h>
+#include <stdio.h>
+#include "error_codes.h"
+
+// Opt-in recording of everything a device writes to and reads from its
+// port, with timestamps, so a session can be replayed later (see
+// tools/blisp-emu, blisp-replay). Off (blisp_device::capture is NULL) unless
+// blisp_device_set_capture hands the device an open capture.
+//
+// File format:
+//   "BLCAP" version
+//   records: type delta_us length data[length]
+// delta_us (time since the previous record, or the header for the first)
+// and length are LEB128 varints. Reads are recorded one by one as the port
+// delivered them, which keeps the gaps within a response.
+
+#define BLISP_CAPTURE_MAGIC "BLCAP"
+#define BLISP_CAPTURE_MAGIC_SIZE 5
+#define BLISP_CAPTURE_VERSION 1
+
+enum blisp_capture_type {
+  BLISP_CAPTURE_WRITE = 'W',      // Host to chip
+  BLISP_CAPTURE_READ = 'R',       // Chip to host
+  BLISP_CAPTURE_BAUD_RATE = 'B',  // New baud rate, 4 bytes little endian
+};
+
+struct blisp_capture {
+  FILE* file;
+  uint64_t last_us;
+};
+
+blisp_return_t blisp_capture_open(struct blisp_capture* capture,
+                                  const char* path);
+blisp_return_t blisp_capture_close(struct blisp_capture* capture);
+
+// Called by the library as it talks to the device. All of them do nothing
+// when capture is NULL. A record of size bytes is started with _begin and
+// filled by _data, _record does both at once.
+void blisp_capture_begin(struct blisp_capture* capture,
+                         enum blisp_capture_type type,
+                         uint32_t size);
+void blisp_capture_data(struct blisp_capture* capture,
+                        const void* data,
+                        uint32_t size);
+void blisp_capture_record(struct blisp_capture* capture,
+                          enum blisp_capture_type type,
+                          const void* data,
+                          uint32_t size);
+void blisp_capture_baud_rate(struct blisp_capture* capture,
+                             uint32_t baud_rate);
+
+// Walks the records of a capture held in memory
+struct blisp_capture_reader {
+  const uint8_t* data;
+  size_t size;
+  size_t offset;
+};
+
+struct blisp_capture_entry {
+  enum blisp_capture_type type;
+  uint64_t delta_us;
+  const uint8_t* data;  // Points into the reader's data
+  uint32_t size;
+};
+
+blisp_return_t blisp_capture_reader_init(struct blisp_capture_reader* reader,
+                                         const uint8_t* data,
+                                         size_t size);
+// BLISP_OK with the next record, BLISP_ERR_NO_RESPONSE at the end and
+// BLISP_ERR_INVALID_COMMAND if the rest of the capture is malformed
+blisp_return_t blisp_capture_next(struct blisp_capture_reader* reader,
+                                  struct blisp_capture_entry* entry);
+
+#endif
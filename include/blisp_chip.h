@@ -13,14 +13,22 @@ enum blisp_chip_type {
   BLISP_CHIP_BL61X,
 };
 
+// The byte of eflash_loader that selects the crystal frequency
+#define BLISP_EFLASH_LOADER_CLOCK_OFFSET 0xE0
+
 struct blisp_chip {  // TODO: Move elsewhere?
   enum blisp_chip_type type;
   const char* type_str;
   bool usb_isp_available;
   float handshake_byte_multiplier;
   const char* default_xtal;  // TODO: Make this selectable
-  int64_t (*load_eflash_loader)(uint8_t clk_type, uint8_t** firmware_buf_ptr);
+  // eflash_loader image, unpacked on first use and shared afterwards. Not
+  // thread safe until it has been called once.
+  const uint8_t* (*get_eflash_loader)(uint32_t* size);
+  uint8_t eflash_loader_clock;  // Sent at BLISP_EFLASH_LOADER_CLOCK_OFFSET
   uint32_t tcm_address;
+  uint16_t flash_write_max_size;   // Largest flash write the chip takes
+  uint16_t segment_data_max_size;  // Largest segment data chunk of the BootROM
 };
 
 extern struct blisp_chip blisp_chip_bl60x;
@@ -0,0 +1,28 @@
+// SPDX-License-Identifier: MIT
+#ifndef _BLISP_CRC32_H
+#define _BLISP_CRC32_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// CRC-32 as used by zlib, Ethernet and the BootROM (reflected, polynomial
+// 0x04C11DB7). Start with crc = 0 and feed the data in as many pieces as
+// needed, the return value is the CRC of everything so far.
+uint32_t crc32_update(uint32_t crc, const void* data, size_t data_len);
+
+// Same as crc32_update, but always with the portable slicing-by-8 code
+uint32_t crc32_update_portable(uint32_t crc, const void* data,
+                               size_t data_len);
+
+// Name of the kernel crc32_update picked for this CPU
+const char* crc32_kernel_name(void);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
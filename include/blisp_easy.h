@@ -6,17 +6,29 @@
 #include "blisp.h"
 
 struct blisp_easy_transport {
-  uint8_t type;  // 0 - memory, 1 - FILE file_handle
+  uint8_t type;  // 0 - memory, 1 - FILE file_handle, 2 - sparse FILE
   union {
     FILE* file_handle;
+    struct {
+      FILE* file_handle;
+      bool in_hole;  // Last write ended with a skipped erased block
+    } sparse_file;
     struct {
       void* data_location;
       uint32_t data_size;
       uint32_t current_position;
+      uint32_t overlay_position;  // Reads as overlay_value, UINT32_MAX: none
+      uint8_t overlay_value;
     } memory;
   } data;
 };
 
+// Erased (0xFF) blocks of this size are left as holes in sparse files
+#define BLISP_EASY_SPARSE_BLOCK_SIZE 4096
+
+// Upper bound for blisp_device::flash_write_window
+#define BLISP_EASY_MAX_WRITE_WINDOW 8
+
 enum blisp_easy_error {
   BLISP_EASY_ERR_TRANSPORT_ERROR = -100,
   BLISP_EASY_ERR_CHECK_IMAGE_FAILED = -101
@@ -26,9 +38,17 @@ typedef void (*blisp_easy_progress_callback)(uint32_t current_value,
                                              uint32_t max_value);
 
 struct blisp_easy_transport blisp_easy_transport_new_from_file(FILE* file);
+// Writes skip blocks of erased flash, leaving holes in the file. Holes read
+// back as 0x00, not 0xFF.
+struct blisp_easy_transport blisp_easy_transport_new_from_sparse_file(
+    FILE* file);
 struct blisp_easy_transport blisp_easy_transport_new_from_memory(
     void* data_location,
     uint32_t data_size);
+// Reads the chip's eflash_loader with its clock byte in place
+blisp_return_t blisp_easy_transport_new_from_eflash_loader(
+    struct blisp_chip* chip,
+    struct blisp_easy_transport* transport);
 
 int32_t blisp_easy_load_segment_data(
     struct blisp_device* device,
@@ -45,10 +65,20 @@ int32_t blisp_easy_load_ram_app(struct blisp_device* device,
                                 struct blisp_easy_transport* app_transport,
                                 blisp_easy_progress_callback progress_callback);
 
+// True if the library was built with compression support, otherwise
+// blisp_device::flash_compress is ignored.
+bool blisp_easy_flash_compress_supported(void);
+
 int32_t blisp_easy_flash_write(struct blisp_device* device,
                                struct blisp_easy_transport* data_transport,
                                uint32_t flash_location,
                                uint32_t data_size,
                                blisp_easy_progress_callback progress_callback);
 
+int32_t blisp_easy_flash_read(struct blisp_device* device,
+                              struct blisp_easy_transport* data_transport,
+                              uint32_t flash_location,
+                              uint32_t data_size,
+                              blisp_easy_progress_callback progress_callback);
+
 #endif  // BLISP_BLISP_EASY_H
@@ -0,0 +1,96 @@
+// SPDX-License-Identifier: MIT
+#ifndef _BLISP_METRICS_H
+#define _BLISP_METRICS_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include "blisp_response.h"
+
+// Opt-in counters of what a device sends and how quickly it answers. They
+// are off (blisp_device::metrics is NULL) unless blisp_device_set_metrics
+// hands the device a struct to count into. Nothing is locked: take
+// snapshots from the thread that drives the device, or while it is idle.
+
+// Latency histogram: bucket i counts round trips shorter than
+// BLISP_METRICS_BUCKET_0_US << i, the last one everything longer
+#define BLISP_METRICS_BUCKETS 16
+#define BLISP_METRICS_BUCKET_0_US 128
+
+// Commands in flight at once, enough for pipelined flash writes
+#define BLISP_METRICS_IN_FLIGHT 16
+
+struct blisp_command_metrics {
+  uint32_t count;     // Commands sent
+  uint32_t errors;    // 'FL' answers
+  uint32_t timeouts;  // No answer within the serial timeout
+  uint32_t retries;   // Sent again after an error or timeout
+  uint32_t pending;   // 'PD' answers
+  uint64_t pending_us;  // From the first 'PD' to the final answer
+  uint64_t bytes_out;   // Frames sent, header included
+  uint64_t bytes_in;    // Answer frames, 'PD' included
+  uint64_t total_us;    // Sum of round trips, send to final answer
+  uint32_t min_us;
+  uint32_t max_us;
+  uint32_t histogram[BLISP_METRICS_BUCKETS];
+};
+
+// Called for every command once its final answer came, with result
+// BLISP_RESPONSE_NONE if it timed out instead
+typedef void (*blisp_metrics_command_callback)(
+    void* user_data,
+    uint8_t command,
+    uint64_t sent_us,
+    uint64_t done_us,
+    enum blisp_response_type result);
+
+struct blisp_metrics {
+  struct blisp_command_metrics commands[256];  // By opcode
+  uint64_t bytes_out;      // Everything written to the port
+  uint64_t bytes_in;       // Everything read from it
+  uint64_t garbage_bytes;  // Read, but not part of any answer
+  uint32_t handshakes;     // Successful ones
+  uint32_t handshake_failures;
+  uint32_t handshake_attempts;  // Sync byte runs sent
+  uint64_t handshake_us;
+
+  // Optional, e.g. to draw a timeline. Not touched by blisp_metrics_reset.
+  blisp_metrics_command_callback command_callback;
+  void* command_callback_data;
+
+  // Commands waiting for their answer, oldest first. Not counters.
+  struct {
+    uint8_t command;
+    uint64_t sent_us;
+    uint64_t pending_since_us;  // 0 until the first 'PD'
+  } in_flight[BLISP_METRICS_IN_FLIGHT];
+  uint8_t in_flight_head;
+  uint8_t in_flight_count;
+};
+
+void blisp_metrics_reset(struct blisp_metrics* metrics);
+// Copies the counters, without the callback and the commands in flight
+void blisp_metrics_snapshot(const struct blisp_metrics* metrics,
+                            struct blisp_metrics* snapshot);
+// Name of a command opcode, NULL for ones the library doesn't send
+const char* blisp_command_name(uint8_t command);
+
+// Called by the library as it talks to the device. All of them do nothing
+// when metrics is NULL.
+void blisp_metrics_command_sent(struct blisp_metrics* metrics,
+                                uint8_t command,
+                                uint32_t frame_size);
+void blisp_metrics_response(struct blisp_metrics* metrics,
+                            const struct blisp_response* response,
+                            bool expect_payload);
+void blisp_metrics_timeout(struct blisp_metrics* metrics);
+void blisp_metrics_retry(struct blisp_metrics* metrics, uint8_t command);
+void blisp_metrics_traffic(struct blisp_metrics* metrics,
+                           uint32_t bytes_out,
+                           uint32_t bytes_in);
+void blisp_metrics_garbage(struct blisp_metrics* metrics, uint32_t bytes);
+void blisp_metrics_handshake(struct blisp_metrics* metrics,
+                             bool ok,
+                             uint32_t attempts,
+                             uint64_t duration_us);
+
+#endif
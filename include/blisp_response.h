@@ -0,0 +1,51 @@
+// SPDX-License-Identifier: MIT
+#ifndef _BLISP_RESPONSE_H
+#define _BLISP_RESPONSE_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+// Enough for an 'OK' frame with the largest payload the chips send
+#define BLISP_RESPONSE_BUFFER_SIZE (4 + 5000)
+
+enum blisp_response_type {
+  BLISP_RESPONSE_NONE,     // No complete frame yet
+  BLISP_RESPONSE_OK,       // 'OK', with a payload if one was expected
+  BLISP_RESPONSE_PENDING,  // 'PD', the chip is still busy
+  BLISP_RESPONSE_ERROR,    // 'FL' and an error code
+};
+
+struct blisp_response {
+  enum blisp_response_type type;
+  uint16_t error_code;
+  const uint8_t* payload;  // Valid until the parser is used again
+  uint16_t payload_length;
+};
+
+// Splits the bytes coming from the chip into response frames. Bytes go
+// straight into the parser's buffer (blisp_response_parser_space, then
+// _commit), and every call to _next takes out at most one frame. Bytes that
+// can't start a frame are skipped, so the parser resyncs on the next frame
+// instead of waiting for a timeout.
+struct blisp_response_parser {
+  uint8_t buffer[BLISP_RESPONSE_BUFFER_SIZE];
+  uint32_t start;   // First byte not consumed yet
+  uint32_t length;  // End of the received bytes
+  uint32_t skipped;  // Garbage bytes dropped since the last reset
+};
+
+void blisp_response_parser_reset(struct blisp_response_parser* parser);
+uint32_t blisp_response_parser_space(struct blisp_response_parser* parser,
+                                     uint8_t** tail);
+void blisp_response_parser_commit(struct blisp_response_parser* parser,
+                                  uint32_t count);
+// 'OK' frames don't say whether they carry a payload, the caller has to
+// know. Payloads longer than max_payload_length are treated as garbage.
+bool blisp_response_parser_next(struct blisp_response_parser* parser,
+                                bool expect_payload,
+                                uint16_t max_payload_length,
+                                struct blisp_response* response);
+uint32_t blisp_response_parser_pending(
+    const struct blisp_response_parser* parser);
+
+#endif
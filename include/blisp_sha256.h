@@ -0,0 +1,39 @@
+// SPDX-License-Identifier: MIT
+#ifndef _BLISP_SHA256_H
+#define _BLISP_SHA256_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define SHA256_DIGEST_SIZE 32
+
+struct sha256_context {
+  uint32_t state[8];
+  uint64_t length;  // in bytes
+  uint8_t buffer[64];
+  uint32_t buffer_length;
+};
+
+void sha256_init(struct sha256_context* ctx);
+void sha256_update(struct sha256_context* ctx, const void* data, size_t data_len);
+void sha256_final(struct sha256_context* ctx, uint8_t digest[SHA256_DIGEST_SIZE]);
+
+void sha256_calculate(const void* data, size_t data_len,
+                      uint8_t digest[SHA256_DIGEST_SIZE]);
+// Same as sha256_calculate, but always with the portable block function
+void sha256_calculate_portable(const void* data, size_t data_len,
+                               uint8_t digest[SHA256_DIGEST_SIZE]);
+
+// Name of the block function picked for this CPU, the SHA instructions of
+// x86 or ARMv8 when it has them
+const char* sha256_kernel_name(void);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
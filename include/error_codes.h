@@ -25,6 +25,8 @@ typedef enum {
   BLISP_ERR_NOT_IMPLEMENTED = -12,  // Non implemented function called
   BLISP_ERR_API_ERROR = -13,        // Errors outside our control from api's we
                               // integrate (Generally serial port/OS related)
+  BLISP_ERR_BUSY = -14,  // Another asynchronous operation is still running
+  BLISP_ERR_VERIFY_FAILED = -15,  // Flash doesn't hold what was written
 
 } blisp_return_t;
 #endif
\ No newline at end of file
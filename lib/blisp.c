@@ -1,6 +1,7 @@
 // SPDX-License-Identifier: MIT
 #include <blisp.h>
 #include <blisp_util.h>
+#include <inttypes.h>
 #include <libserialport.h>
 #include <stdio.h>
 #include <stdlib.h>
@@ -11,6 +12,18 @@
 #include <sys/ioctl.h>
 #endif
 
+#ifndef _WIN32
+#include <errno.h>
+#include <poll.h>
+#include <sys/uio.h>
+#endif
+
+#if defined(__SSE2__) || defined(_M_X64)
+#include <emmintrin.h>
+#elif defined(__ARM_NEON)
+#include <arm_neon.h>
+#endif
+
 #include <blisp_struct.h>
 
 #define DEBUG
@@ -23,10 +36,39 @@ static void drain(struct sp_port* port) {
 #endif
 }
 
+// Command arguments go out little endian whatever the host is
+static void blisp_put_uint32(uint8_t* dst, uint32_t value) {
+  dst[0] = value & 0xFF;
+  dst[1] = (value >> 8) & 0xFF;
+  dst[2] = (value >> 16) & 0xFF;
+  dst[3] = (value >> 24) & 0xFF;
+}
+
+static void blisp_handshake_timing_default(
+    const struct blisp_chip* chip,
+    struct blisp_handshake_timing* timing) {
+  timing->reset_hold_ms = 50;
+  timing->reset_release_ms = 100;
+  timing->boot_wait_ms = 50;
+  timing->response_wait_ms = 50;
+  timing->second_wait_ms = 300;
+  timing->sync_us = (uint32_t)(chip->handshake_byte_multiplier * 1000000.0f);
+}
+
 blisp_return_t blisp_device_init(struct blisp_device* device,
                                  struct blisp_chip* chip) {
   device->chip = chip;
   device->is_usb = false;
+  device->flash_write_window = 1;
+  device->flash_write_chunk_size = 0;
+  device->flash_write_settled_size = 0;
+  device->flash_compress = false;
+  blisp_handshake_timing_default(chip, &device->handshake);
+  device->handshake_settled = device->handshake;
+  device->handshake_response_us = 0;
+  blisp_response_parser_reset(&device->response_parser);
+  device->metrics = NULL;
+  device->capture = NULL;
   fill_crcs(&bl808_header);
 
   if (device->chip->type == BLISP_CHIP_BL808) {
@@ -119,72 +161,359 @@ blisp_return_t blisp_device_open(struct blisp_device* device,
   return BLISP_OK;
 }
 
-blisp_return_t blisp_send_command(struct blisp_device* device,
-                                  uint8_t command,
-                                  void* payload,
-                                  uint16_t payload_size,
-                                  bool add_checksum) {
-  int ret;
+// The protocol only checks the low byte of the sum of all bytes. The vector
+// paths add up bytes lane-wise modulo 256 and fold the lanes at the end.
+static uint8_t blisp_checksum_update(uint8_t checksum,
+                                     const uint8_t* data,
+                                     uint32_t size) {
+  uint32_t i = 0;
+#if defined(__SSE2__) || defined(_M_X64)
+  if (size >= 16) {
+    __m128i sum = _mm_setzero_si128();
+    for (; i + 16 <= size; i += 16) {
+      sum = _mm_add_epi8(sum, _mm_loadu_si128((const __m128i*)(data + i)));
+    }
+    sum = _mm_sad_epu8(sum, _mm_setzero_si128());
+    checksum += (uint8_t)(_mm_cvtsi128_si32(sum) +
+                          _mm_cvtsi128_si32(_mm_srli_si128(sum, 8)));
+  }
+#elif defined(__ARM_NEON)
+  if (size >= 16) {
+    uint8x16_t sum = vdupq_n_u8(0);
+    for (; i + 16 <= size; i += 16) {
+      sum = vaddq_u8(sum, vld1q_u8(data + i));
+    }
+#ifdef __aarch64__
+    checksum += vaddvq_u8(sum);
+#else
+    uint64x2_t wide = vpaddlq_u32(vpaddlq_u16(vpaddlq_u8(sum)));
+    checksum += (uint8_t)(vgetq_lane_u64(wide, 0) + vgetq_lane_u64(wide, 1));
+#endif
+  }
+#endif
+  for (; i < size; i++) {
+    checksum += data[i];
+  }
+  return checksum;
+}
+
+// Writes the header and payload parts with a single writev where the port
+// exposes a file descriptor, and through tx_buffer otherwise.
+static blisp_return_t blisp_write_parts(struct blisp_device* device,
+                                        const uint8_t* header,
+                                        const struct blisp_payload_part* parts,
+                                        uint8_t part_count,
+                                        uint32_t payload_size) {
   struct sp_port* serial_port = device->serial_port;
+  int ret;
 
-  device->tx_buffer[0] = command;
-  device->tx_buffer[1] = 0;
-  device->tx_buffer[2] = payload_size & 0xFF;
-  device->tx_buffer[3] = (payload_size >> 8) & 0xFF;
-  if (add_checksum) {
-    uint32_t checksum = 0;
-    checksum += device->tx_buffer[2] + device->tx_buffer[3];
-    for (uint16_t i = 0; i < payload_size; i++) {
-      checksum += *(uint8_t*)((uint8_t*)payload + i);
+#ifndef _WIN32
+  int fd;
+  if (sp_get_port_handle(serial_port, &fd) == SP_OK) {
+    struct iovec iov[BLISP_MAX_PAYLOAD_PARTS + 1];
+    int iov_count = 0;
+
+    iov[iov_count].iov_base = (void*)header;
+    iov[iov_count++].iov_len = 4;
+    for (uint8_t i = 0; i < part_count; i++) {
+      if (parts[i].size != 0) {
+        iov[iov_count].iov_base = (void*)parts[i].data;
+        iov[iov_count++].iov_len = parts[i].size;
+      }
+    }
+    // Same 1000 ms for the whole command as sp_blocking_write gets below
+    uint64_t deadline = monotonic_us() + 1000000;
+    for (struct iovec* next = iov; iov_count > 0;) {
+      ssize_t written = writev(fd, next, iov_count);
+      if (written < 0) {
+        if (errno != EAGAIN && errno != EINTR) {
+          blisp_dlog("Failed to write command: %d", errno);
+          return BLISP_ERR_API_ERROR;
+        }
+        uint64_t now = monotonic_us();
+        if (now >= deadline) {
+          blisp_dlog("Timed out writing command");
+          return BLISP_ERR_API_ERROR;
+        }
+        struct pollfd pfd = {.fd = fd, .events = POLLOUT};
+        ret = poll(&pfd, 1, (int)((deadline - now + 999) / 1000));
+        if (ret == 0) {
+          blisp_dlog("Timed out writing command");
+          return BLISP_ERR_API_ERROR;
+        }
+        if (ret < 0 && errno != EINTR) {
+          blisp_dlog("Failed to wait for the port: %d", errno);
+          return BLISP_ERR_API_ERROR;
+        }
+        continue;
+      }
+      while (iov_count > 0 && (size_t)written >= next->iov_len) {
+        written -= next->iov_len;
+        next++;
+        iov_count--;
+      }
+      if (iov_count > 0) {
+        next->iov_base = (uint8_t*)next->iov_base + written;
+        next->iov_len -= written;
+      }
     }
-    device->tx_buffer[1] = checksum & 0xFF;
+    blisp_capture_begin(device->capture, BLISP_CAPTURE_WRITE,
+                        4 + payload_size);
+    blisp_capture_data(device->capture, header, 4);
+    for (uint8_t i = 0; i < part_count; i++) {
+      blisp_capture_data(device->capture, parts[i].data, parts[i].size);
+    }
+    return BLISP_OK;
+  }
+#endif
+
+  if (4 + payload_size > sizeof(device->tx_buffer)) {
+    return BLISP_ERR_INVALID_COMMAND;
   }
-  if (payload_size != 0) {
-    memcpy(&device->tx_buffer[4], payload, payload_size);
+  memcpy(device->tx_buffer, header, 4);
+  uint32_t offset = 4;
+  for (uint8_t i = 0; i < part_count; i++) {
+    if (parts[i].size != 0) {
+      memcpy(&device->tx_buffer[offset], parts[i].data, parts[i].size);
+      offset += parts[i].size;
+    }
   }
-  ret =
-      sp_blocking_write(serial_port, device->tx_buffer, 4 + payload_size, 1000);
-  if (ret != (4 + payload_size)) {
+  ret = sp_blocking_write(serial_port, device->tx_buffer, offset, 1000);
+  if (ret != (int)offset) {
     blisp_dlog("Received error or not written all data: %d", ret);
     return BLISP_ERR_API_ERROR;
   }
-  drain(serial_port);
+  blisp_capture_record(device->capture, BLISP_CAPTURE_WRITE,
+                       device->tx_buffer, offset);
+  return BLISP_OK;
+}
+
+blisp_return_t blisp_build_command_header(
+    uint8_t* header,
+    uint8_t command,
+    const struct blisp_payload_part* parts,
+    uint8_t part_count,
+    bool add_checksum) {
+  uint32_t payload_size = 0;
+
+  for (uint8_t i = 0; i < part_count; i++) {
+    payload_size += parts[i].size;
+  }
+  if (payload_size > 0xFFFF || part_count > BLISP_MAX_PAYLOAD_PARTS) {
+    return BLISP_ERR_INVALID_COMMAND;
+  }
+
+  header[0] = command;
+  header[1] = 0;
+  header[2] = payload_size & 0xFF;
+  header[3] = (payload_size >> 8) & 0xFF;
+  if (add_checksum) {
+    uint8_t checksum = header[2] + header[3];
+    for (uint8_t i = 0; i < part_count; i++) {
+      checksum = blisp_checksum_update(checksum, parts[i].data, parts[i].size);
+    }
+    header[1] = checksum;
+  }
+  return payload_size;
+}
+
+static blisp_return_t blisp_send_command_parts(
+    struct blisp_device* device,
+    uint8_t command,
+    const struct blisp_payload_part* parts,
+    uint8_t part_count,
+    bool add_checksum) {
+  uint8_t header[4];
+  blisp_return_t ret;
+
+  ret = blisp_build_command_header(header, command, parts, part_count,
+                                   add_checksum);
+  if (ret < 0) {
+    return ret;
+  }
+
+  uint32_t payload_size = ret;
+  ret = blisp_write_parts(device, header, parts, part_count, payload_size);
+  if (ret != BLISP_OK) {
+    return ret;
+  }
+  drain(device->serial_port);
+  blisp_metrics_command_sent(device->metrics, command, 4 + payload_size);
 
   return BLISP_OK;
 }
 
+blisp_return_t blisp_send_command(struct blisp_device* device,
+                                  uint8_t command,
+                                  void* payload,
+                                  uint16_t payload_size,
+                                  bool add_checksum) {
+  struct blisp_payload_part part = {payload, payload_size};
+  return blisp_send_command_parts(device, command, &part, 1, add_checksum);
+}
+
 blisp_return_t blisp_receive_response(struct blisp_device* device,
                                       bool expect_payload) {
-  // TODO: Check checksum
+  // Responses carry no checksum, so a frame is only as good as its length.
+  // Whatever arrives past the current frame stays in the parser for the next
+  // call, which is what lets pipelined writes pick up several acks at once.
+  struct sp_port* serial_port = device->serial_port;
+  struct blisp_response_parser* parser = &device->response_parser;
+  struct blisp_response response;
+  uint32_t skipped = parser->skipped;
+  uint8_t* tail;
   int ret;
 
-  struct sp_port* serial_port = device->serial_port;
-  ret = sp_blocking_read(serial_port, &device->rx_buffer[0], 2, device->serial_timeout);
-  if (ret < 2) {
-    blisp_dlog("Failed to receive response, ret: %d", ret);
-    return BLISP_ERR_NO_RESPONSE;
-  } else if (device->rx_buffer[0] == 'O' && device->rx_buffer[1] == 'K') {
-    if (expect_payload) {
-      sp_blocking_read(serial_port, &device->rx_buffer[2], 2,
-                       100);  // TODO: Check if really we received the data.
-      uint16_t data_length =
-          (device->rx_buffer[3] << 8) | (device->rx_buffer[2]);
-      sp_blocking_read(serial_port, &device->rx_buffer[0], data_length, 100);
-      return data_length;
+  while (!blisp_response_parser_next(parser, expect_payload,
+                                     sizeof(device->rx_buffer), &response)) {
+    // Give up on a link that only produces garbage, e.g. at a wrong baud rate
+    if (parser->skipped - skipped > sizeof(parser->buffer)) {
+      blisp_dlog("No valid response in %" PRIu32 " bytes",
+                 parser->skipped - skipped);
+      blisp_metrics_garbage(device->metrics, parser->skipped - skipped);
+      blisp_metrics_timeout(device->metrics);
+      return BLISP_ERR_NO_RESPONSE;
     }
-    return 0;
-  } else if (device->rx_buffer[0] == 'P' && device->rx_buffer[1] == 'D') {
-    return BLISP_ERR_PENDING;  // TODO: This might be rather positive return
-                               // number?
-  } else if (device->rx_buffer[0] == 'F' && device->rx_buffer[1] == 'L') {
-    sp_blocking_read(serial_port, &device->rx_buffer[2], 2, 100);
-    device->error_code = (device->rx_buffer[3] << 8) | (device->rx_buffer[2]);
-    blisp_dlog("Chip returned error: %d", device->error_code);
-    return BLISP_ERR_CHIP_ERR;
+    uint32_t space = blisp_response_parser_space(parser, &tail);
+    ret = sp_blocking_read_next(serial_port, tail, space,
+                                device->serial_timeout);
+    if (ret <= 0) {
+      blisp_dlog("Failed to receive response, ret: %d, %" PRIu32
+                 " bytes pending",
+                 ret, blisp_response_parser_pending(parser));
+      blisp_metrics_garbage(device->metrics, parser->skipped - skipped);
+      blisp_metrics_timeout(device->metrics);
+      return BLISP_ERR_NO_RESPONSE;
+    }
+    blisp_capture_record(device->capture, BLISP_CAPTURE_READ, tail, ret);
+    blisp_response_parser_commit(parser, ret);
+    blisp_metrics_traffic(device->metrics, 0, ret);
+  }
+  if (parser->skipped != skipped) {
+    blisp_dlog("Skipped %" PRIu32 " bytes of garbage before response",
+               parser->skipped - skipped);
+    blisp_metrics_garbage(device->metrics, parser->skipped - skipped);
+  }
+  blisp_metrics_response(device->metrics, &response, expect_payload);
+
+  switch (response.type) {
+    case BLISP_RESPONSE_OK:
+      if (response.payload_length != 0) {
+        memcpy(device->rx_buffer, response.payload, response.payload_length);
+      }
+      return response.payload_length;
+    case BLISP_RESPONSE_PENDING:
+      return BLISP_ERR_PENDING;  // TODO: This might be rather positive return
+                                 // number?
+    case BLISP_RESPONSE_ERROR:
+      device->error_code = response.error_code;
+      blisp_dlog("Chip returned error: %d", device->error_code);
+      return BLISP_ERR_CHIP_ERR;
+    default:
+      return BLISP_ERR_NO_RESPONSE;
   }
-  blisp_dlog("Failed to receive any response (err: %d, %d - %d)", ret,
-             device->rx_buffer[0], device->rx_buffer[1]);
-  return BLISP_ERR_NO_RESPONSE;
+}
+
+void blisp_device_set_metrics(struct blisp_device* device,
+                              struct blisp_metrics* metrics) {
+  if (metrics != NULL) {
+    metrics->in_flight_count = 0;
+  }
+  device->metrics = metrics;
+}
+
+void blisp_device_set_capture(struct blisp_device* device,
+                              struct blisp_capture* capture) {
+  device->capture = capture;
+  blisp_capture_baud_rate(capture, device->current_baud_rate);
+}
+
+void blisp_device_fast_handshake(struct blisp_device* device) {
+  struct blisp_handshake_timing* timing = &device->handshake;
+
+  blisp_handshake_timing_default(device->chip, timing);
+  timing->reset_hold_ms /= 8;
+  timing->reset_release_ms /= 8;
+  timing->boot_wait_ms /= 8;
+  timing->response_wait_ms /= 4;
+  timing->second_wait_ms /= 4;
+  timing->sync_us /= 4;
+}
+
+static uint32_t blisp_handshake_widen_value(uint32_t value, uint32_t limit) {
+  if (value >= limit) {
+    return value;
+  }
+  return value == 0 || value >= limit / 2 ? limit : value * 2;
+}
+
+// Doubles every wait that is still below its limit. Returns false if they
+// were all at their limit already.
+static bool blisp_handshake_widen(struct blisp_handshake_timing* timing,
+                                  const struct blisp_handshake_timing* limit) {
+  struct blisp_handshake_timing before = *timing;
+
+  timing->reset_hold_ms =
+      blisp_handshake_widen_value(timing->reset_hold_ms, limit->reset_hold_ms);
+  timing->reset_release_ms = blisp_handshake_widen_value(
+      timing->reset_release_ms, limit->reset_release_ms);
+  timing->boot_wait_ms =
+      blisp_handshake_widen_value(timing->boot_wait_ms, limit->boot_wait_ms);
+  timing->response_wait_ms = blisp_handshake_widen_value(
+      timing->response_wait_ms, limit->response_wait_ms);
+  timing->second_wait_ms = blisp_handshake_widen_value(
+      timing->second_wait_ms, limit->second_wait_ms);
+  timing->sync_us =
+      blisp_handshake_widen_value(timing->sync_us, limit->sync_us);
+  return memcmp(&before, timing, sizeof(before)) != 0;
+}
+
+static void blisp_handshake_reset(struct sp_port* serial_port,
+                                  const struct blisp_handshake_timing* timing) {
+  sp_set_rts(serial_port, SP_RTS_ON);
+  sp_set_dtr(serial_port, SP_DTR_ON);
+  sleep_ms(timing->reset_hold_ms);
+  sp_set_dtr(serial_port, SP_DTR_OFF);
+  sleep_ms(timing->reset_release_ms);
+  sp_set_rts(serial_port, SP_RTS_OFF);
+  sleep_ms(timing->boot_wait_ms);  // Wait a bit so BootROM can init
+}
+
+// Reads into rx_buffer until "OK" shows up or timeout_ms pass, so a chip
+// that answers quickly isn't waited for any longer. Returns the number of
+// bytes read or a negative libserialport error.
+static int blisp_handshake_read(struct blisp_device* device,
+                                uint32_t timeout_ms,
+                                bool* ok) {
+  uint64_t deadline = monotonic_us() + (uint64_t)timeout_ms * 1000;
+  int count = 0;
+
+  *ok = false;
+  while (count < 20) {
+    uint64_t now = monotonic_us();
+    if (now >= deadline) {
+      break;
+    }
+    // A timeout of 0 would wait forever
+    unsigned int wait_ms = (unsigned int)((deadline - now + 999) / 1000);
+    int ret = sp_blocking_read_next(device->serial_port,
+                                    device->rx_buffer + count, 20 - count,
+                                    wait_ms);
+    if (ret < 0) {
+      return ret;
+    }
+    blisp_metrics_traffic(device->metrics, 0, ret);
+    blisp_capture_record(device->capture, BLISP_CAPTURE_READ,
+                         device->rx_buffer + count, ret);
+    count += ret;
+    for (int j = 1; j < count; j++) {
+      if (device->rx_buffer[j - 1] == 'O' && device->rx_buffer[j] == 'K') {
+        *ok = true;
+        return count;
+      }
+    }
+  }
+  return count;
 }
 
 blisp_return_t blisp_device_handshake(struct blisp_device* device,
@@ -193,28 +522,42 @@ blisp_return_t blisp_device_handshake(struct blisp_device* device,
   bool ok = false;
   uint8_t handshake_buffer[600];
   struct sp_port* serial_port = device->serial_port;
+  struct blisp_handshake_timing limit;
+  struct blisp_handshake_timing timing = device->handshake;
+  bool reset = !in_ef_loader && !device->is_usb;
+  bool widened = true;
+  uint8_t full_attempts = 0;
+  uint64_t start = monotonic_us();
+
+  // The handshake reads the port directly, anything buffered is stale
+  blisp_response_parser_reset(&device->response_parser);
+
+  blisp_handshake_timing_default(device->chip, &limit);
+  memset(handshake_buffer, 'U', sizeof(handshake_buffer));
+
+  // Starting from shorter waits, every failed attempt widens them and
+  // resets the chip again with those. Once they are at their limit, it
+  // takes five failed attempts to give up.
+  for (uint8_t i = 1;; i++) {
+    if (reset && widened) {
+      blisp_handshake_reset(serial_port, &timing);
+    }
 
-  if (!in_ef_loader && !device->is_usb) {
-    sp_set_rts(serial_port, SP_RTS_ON);
-    sp_set_dtr(serial_port, SP_DTR_ON);
-    sleep_ms(50);
-    sp_set_dtr(serial_port, SP_DTR_OFF);
-    sleep_ms(100);
-    sp_set_rts(serial_port, SP_RTS_OFF);
-    sleep_ms(50);  // Wait a bit so BootROM can init
-  }
-
-  uint32_t bytes_count = (uint32_t)(device->chip->handshake_byte_multiplier *
-                                    (float)device->current_baud_rate / 10.0f);
-  if (bytes_count > 600)
-    bytes_count = 600;
-  memset(handshake_buffer, 'U', bytes_count);
+    uint32_t bytes_count = (uint32_t)((uint64_t)timing.sync_us *
+                                      device->current_baud_rate / 10000000);
+    if (bytes_count > sizeof(handshake_buffer))
+      bytes_count = sizeof(handshake_buffer);
+    if (bytes_count == 0)
+      bytes_count = 1;
 
-  for (uint8_t i = 0; i < 5; i++) {
     if (!in_ef_loader) {
       if (device->is_usb) {
-        sp_blocking_write(serial_port, "BOUFFALOLAB5555RESET\0\0", 22, 100);
+        ret = sp_blocking_write(serial_port, "BOUFFALOLAB5555RESET\0\0", 22,
+                                100);
         drain(serial_port);
+        blisp_metrics_traffic(device->metrics, ret > 0 ? ret : 0, 0);
+        blisp_capture_record(device->capture, BLISP_CAPTURE_WRITE,
+                             "BOUFFALOLAB5555RESET\0\0", ret > 0 ? ret : 0);
       }
     }
     ret = sp_blocking_write(serial_port, handshake_buffer, bytes_count, 500);
@@ -222,51 +565,113 @@ blisp_return_t blisp_device_handshake(struct blisp_device* device,
     drain(serial_port);
     if (ret < 0) {
       blisp_dlog("Handshake write failed, ret %d", ret);
+      blisp_metrics_handshake(device->metrics, false, i,
+                              monotonic_us() - start);
       return BLISP_ERR_API_ERROR;
     }
+    blisp_metrics_traffic(device->metrics, ret, 0);
+    blisp_capture_record(device->capture, BLISP_CAPTURE_WRITE,
+                         handshake_buffer, ret);
 
-    if (!in_ef_loader && !device->is_usb) {
+    if (reset) {
       sp_drain(serial_port);                // Wait for write to send all data
       sp_flush(serial_port, SP_BUF_INPUT);  // Flush garbage out of RX
     }
 
     if (device->chip->type == BLISP_CHIP_BL808) {
-      sleep_ms(300);
+      sleep_ms(timing.second_wait_ms);
       static const uint8_t second_handshake[] = { 0x50, 0x00, 0x08, 0x00, 0x38, 0xF0, 0x00, 0x20, 0x00, 0x00, 0x00, 0x18 };
       ret = sp_blocking_write(serial_port, second_handshake, sizeof(second_handshake), 300);
       if (ret < 0) {
         blisp_dlog("Second handshake write failed, ret %d", ret);
+        blisp_metrics_handshake(device->metrics, false, i,
+                                monotonic_us() - start);
         return BLISP_ERR_API_ERROR;
       }
+      blisp_metrics_traffic(device->metrics, ret, 0);
+      blisp_capture_record(device->capture, BLISP_CAPTURE_WRITE,
+                           second_handshake, ret);
     }
 
-    ret = sp_blocking_read(serial_port, device->rx_buffer, 20, 50);
-    if (ret >= 2) {
-      for (uint8_t j = 0; j < (ret - 1); j++) {
-        if (device->rx_buffer[j] == 'O' && device->rx_buffer[j + 1] == 'K') {
-          ok = true;
-        }
-      }
+    uint64_t sent = monotonic_us();
+    ret = blisp_handshake_read(device, timing.response_wait_ms, &ok);
+    if (ret < 0) {
+      blisp_dlog("Handshake read failed, ret %d", ret);
+      blisp_metrics_handshake(device->metrics, false, i,
+                              monotonic_us() - start);
+      return BLISP_ERR_API_ERROR;
     }
 
     if (ok) {
+      device->handshake_settled = timing;
+      device->handshake_response_us = (uint32_t)(monotonic_us() - sent);
+      blisp_metrics_handshake(device->metrics, true, i,
+                              monotonic_us() - start);
       return BLISP_OK;
     } else {
-      blisp_dlog("Received incorrect handshake response from chip (attempt %d/5).", i+1);
+      blisp_dlog("Received incorrect handshake response from chip (attempt %d).", i);
       blisp_dlog_no_nl("Could not find 0x%02X 0x%02X ('O', 'K') in: ", 'O', 'K');
-      if (ret) {
-        for (uint8_t j=0; j <= ret; j++) {
-          blisp_dlog_no_nl("0x%02X ", device->rx_buffer[j]);
-        }
+      for (int j = 0; j < ret; j++) {
+        blisp_dlog_no_nl("0x%02X ", device->rx_buffer[j]);
       }
       blisp_dlog("");
     }
+
+    widened = blisp_handshake_widen(&timing, &limit);
+    if (!widened && ++full_attempts == 5) {
+      blisp_metrics_handshake(device->metrics, false, i,
+                              monotonic_us() - start);
+      break;
+    }
   }
 
-  blisp_dlog("Did not receive correct response from chip after 5 attempts.");
+  blisp_dlog("Did not receive correct response from chip.");
   return BLISP_ERR_NO_RESPONSE;
 }
 
+/**
+ * Changes only the host side of the link, e.g. to fall back after a failed
+ * blisp_device_change_baudrate.
+ */
+blisp_return_t blisp_device_set_baudrate(struct blisp_device* device,
+                                         uint32_t baudrate) {
+  struct sp_port* serial_port = device->serial_port;
+  enum sp_return ret = sp_set_baudrate(serial_port, baudrate);
+  if (ret != SP_OK) {
+    blisp_dlog("Set baud rate failed: %d", ret);
+    return BLISP_ERR_API_ERROR;
+  }
+  device->current_baud_rate = baudrate;
+  blisp_capture_baud_rate(device->capture, baudrate);
+  sp_flush(serial_port, SP_BUF_INPUT);
+  blisp_response_parser_reset(&device->response_parser);
+  return BLISP_OK;
+}
+
+/**
+ * Asks the eflash_loader to move to a new baud rate, then follows it on the
+ * host side. The caller should handshake again afterwards, so the loader
+ * can sync to the new rate.
+ */
+blisp_return_t blisp_device_change_baudrate(struct blisp_device* device,
+                                            uint32_t baudrate) {
+  blisp_return_t ret;
+  uint8_t payload[8];
+  blisp_put_uint32(payload + 0, device->current_baud_rate);
+  blisp_put_uint32(payload + 4, baudrate);
+
+  ret = blisp_send_command(device, 0x20, payload, 8, true);
+  if (ret < 0)
+    return ret;
+  ret = blisp_receive_response(device, false);
+  if (ret < 0)
+    return ret;
+
+  // Give the loader a moment to reconfigure its UART
+  sleep_ms(20);
+  return blisp_device_set_baudrate(device, baudrate);
+}
+
 blisp_return_t blisp_device_get_boot_info(struct blisp_device* device,
                                           struct blisp_boot_info* boot_info) {
   blisp_return_t ret;
@@ -352,8 +757,8 @@ blisp_return_t blisp_device_write_memory(struct blisp_device* device,
                                          bool wait_for_res) {
   blisp_return_t ret;
   uint8_t payload[8];
-  *(uint32_t*)(payload) = address;
-  *(uint32_t*)(payload + 4) = value;  // TODO: Endianness
+  blisp_put_uint32(payload + 0, address);
+  blisp_put_uint32(payload + 4, value);
   ret = blisp_send_command(device, 0x50, payload, 8, true);
   if (ret < 0)
     return ret;
@@ -398,8 +803,8 @@ blisp_return_t blisp_device_flash_erase(struct blisp_device* device,
                                         uint32_t start_address,
                                         uint32_t end_address) {
   uint8_t payload[8];
-  *(uint32_t*)(payload + 0) = start_address;
-  *(uint32_t*)(payload + 4) = end_address;
+  blisp_put_uint32(payload + 0, start_address);
+  blisp_put_uint32(payload + 4, end_address);
 
   blisp_return_t ret = blisp_send_command(device, 0x30, payload, 8, true);
   if (ret != BLISP_OK)
@@ -422,24 +827,121 @@ blisp_return_t blisp_device_chip_erase(struct blisp_device* device) {
   return ret;
 }
 
+static blisp_return_t blisp_device_send_flash_data(struct blisp_device* device,
+                                                   uint8_t command,
+                                                   uint32_t start_address,
+                                                   uint8_t* payload,
+                                                   uint32_t payload_size) {
+  uint8_t address[4] = {start_address & 0xFF, (start_address >> 8) & 0xFF,
+                        (start_address >> 16) & 0xFF,
+                        (start_address >> 24) & 0xFF};
+  struct blisp_payload_part parts[] = {{address, sizeof(address)},
+                                       {payload, payload_size}};
+  return blisp_send_command_parts(device, command, parts, 2, true);
+}
+
+blisp_return_t blisp_device_flash_write_send(struct blisp_device* device,
+                                             uint32_t start_address,
+                                             uint8_t* payload,
+                                             uint32_t payload_size) {
+  return blisp_device_send_flash_data(device, 0x31, start_address, payload,
+                                      payload_size);
+}
+
+/**
+ * Sends a chunk of an xz stream, which eflash_loader decompresses and
+ * programs at start_address. The acknowledgement is collected with
+ * blisp_device_flash_write_wait.
+ */
+blisp_return_t blisp_device_flash_decompress_write_send(
+    struct blisp_device* device,
+    uint32_t start_address,
+    uint8_t* payload,
+    uint32_t payload_size) {
+  return blisp_device_send_flash_data(device, 0x3F, start_address, payload,
+                                      payload_size);
+}
+
+blisp_return_t blisp_device_flash_write_wait(struct blisp_device* device) {
+  blisp_return_t ret;
+  do {
+    ret = blisp_receive_response(device, false);
+  } while (ret == BLISP_ERR_PENDING);
+
+  return ret;
+}
+
 blisp_return_t blisp_device_flash_write(struct blisp_device* device,
                                         uint32_t start_address,
                                         uint8_t* payload,
                                         uint32_t payload_size) {
-  // TODO: Add max payload size (8184?)
-  // TODO: Don't use malloc + add check
-
-  uint8_t* buffer = malloc(4 + payload_size);
-  *((uint32_t*)(buffer)) = start_address;
-  memcpy(buffer + 4, payload, payload_size);
-  blisp_return_t ret =
-      blisp_send_command(device, 0x31, buffer, payload_size + 4, true);
+  blisp_return_t ret = blisp_device_flash_write_send(device, start_address,
+                                                     payload, payload_size);
   if (ret < 0)
-    goto exit1;
-  ret = blisp_receive_response(device, false);
-exit1:
-  free(buffer);
-  return ret;
+    return ret;
+  return blisp_device_flash_write_wait(device);
+}
+
+/**
+ * Asks eflash_loader for the SHA-256 of a flash range.
+ * digest must hold 32 bytes.
+ */
+blisp_return_t blisp_device_flash_read_sha256(struct blisp_device* device,
+                                              uint32_t start_address,
+                                              uint32_t length,
+                                              uint8_t* digest) {
+  uint8_t payload[8];
+  blisp_put_uint32(payload + 0, start_address);
+  blisp_put_uint32(payload + 4, length);
+
+  blisp_return_t ret = blisp_send_command(device, 0x3D, payload, 8, true);
+  if (ret != BLISP_OK)
+    return ret;
+  do {
+    ret = blisp_receive_response(device, true);
+  } while (ret == BLISP_ERR_PENDING);
+  if (ret < 0)
+    return ret;
+  if (ret != 32) {
+    blisp_dlog("Unexpected flash hash length: %d", ret);
+    return BLISP_ERR_UNKNOWN;
+  }
+  memcpy(digest, &device->rx_buffer[0], 32);
+
+  return BLISP_OK;
+}
+
+/**
+ * Reads length bytes of flash into data. length must fit into a single
+ * response, BLISP_FLASH_READ_MAX_SIZE at most.
+ */
+blisp_return_t blisp_device_flash_read(struct blisp_device* device,
+                                       uint32_t start_address,
+                                       uint8_t* data,
+                                       uint32_t length) {
+  uint8_t payload[8];
+  blisp_put_uint32(payload + 0, start_address);
+  blisp_put_uint32(payload + 4, length);
+
+  if (length > BLISP_FLASH_READ_MAX_SIZE)
+    return BLISP_ERR_INVALID_COMMAND;
+
+  blisp_return_t ret = blisp_send_command(device, 0x32, payload, 8, true);
+  if (ret != BLISP_OK)
+    return ret;
+  do {
+    ret = blisp_receive_response(device, true);
+  } while (ret == BLISP_ERR_PENDING);
+  if (ret < 0)
+    return ret;
+  if ((uint32_t)ret != length) {
+    blisp_dlog("Unexpected flash read length: %d, expected %" PRIu32, ret,
+               length);
+    return BLISP_ERR_UNKNOWN;
+  }
+  memcpy(data, &device->rx_buffer[0], length);
+
+  return BLISP_OK;
 }
 
 blisp_return_t blisp_device_program_check(struct blisp_device* device) {
@@ -464,11 +966,50 @@ blisp_return_t blisp_device_reset(struct blisp_device* device) {
   return BLISP_OK;
 }
 
+void blisp_device_flush_input(struct blisp_device* device) {
+  struct sp_port* serial_port = device->serial_port;
+  sp_flush(serial_port, SP_BUF_INPUT);
+  blisp_response_parser_reset(&device->response_parser);
+}
+
 void blisp_device_close(struct blisp_device* device) {
   struct sp_port* serial_port = device->serial_port;
   sp_close(serial_port);
 }
 
+/**
+ * Stores the names of up to max_ports serial ports starting with prefix
+ * (every port if prefix is NULL) in port_names. The names are allocated and
+ * must be freed by the caller. Returns the number of names stored.
+ */
+int32_t blisp_list_ports(const char* prefix,
+                         char** port_names,
+                         uint32_t max_ports) {
+  struct sp_port** port_list;
+  uint32_t count = 0;
+
+  enum sp_return ret = sp_list_ports(&port_list);
+  if (ret != SP_OK) {
+    blisp_dlog("Couldn't list ports, err: %d", ret);
+    return BLISP_ERR_API_ERROR;
+  }
+  for (int i = 0; port_list[i] != NULL && count < max_ports; i++) {
+    const char* name = sp_get_port_name(port_list[i]);
+    if (prefix != NULL && strncmp(name, prefix, strlen(prefix)) != 0) {
+      continue;
+    }
+    port_names[count] = malloc(strlen(name) + 1);
+    if (port_names[count] == NULL) {
+      break;
+    }
+    strcpy(port_names[count], name);
+    count++;
+  }
+  sp_free_port_list(port_list);
+
+  return count;
+}
+
 blisp_return_t bl808_load_clock_para(struct blisp_device* device,
                                      bool irq_en, uint32_t baudrate) {
   #define bl808_load_clock_para_payload_size 36
@@ -0,0 +1,597 @@
+// SPDX-License-Identifier: MIT
+#include <blisp_async.h>
+#include <blisp_util.h>
+#include <libserialport.h>
+#include <string.h>
+
+enum blisp_async_phase {
+  BLISP_ASYNC_PHASE_SEND,     // Writing header and parts
+  BLISP_ASYNC_PHASE_RECEIVE,  // Waiting for a response frame
+  BLISP_ASYNC_PHASE_SLEEP,    // Waiting for the deadline
+  BLISP_ASYNC_PHASE_SYNC,     // Waiting for the 'OK' of a handshake
+};
+
+// Handshake steps
+enum {
+  BLISP_ASYNC_HANDSHAKE_RESET_1,
+  BLISP_ASYNC_HANDSHAKE_RESET_2,
+  BLISP_ASYNC_HANDSHAKE_SEND,
+  BLISP_ASYNC_HANDSHAKE_SENT,
+  BLISP_ASYNC_HANDSHAKE_SECOND,
+  BLISP_ASYNC_HANDSHAKE_SECOND_SENT,
+  BLISP_ASYNC_HANDSHAKE_SYNC,
+};
+
+#define BLISP_ASYNC_HANDSHAKE_ATTEMPTS 5
+
+blisp_return_t blisp_device_get_fd(struct blisp_device* device, int* fd) {
+#ifdef _WIN32
+  (void)device;
+  (void)fd;
+  return BLISP_ERR_NOT_IMPLEMENTED;
+#else
+  if (sp_get_port_handle(device->serial_port, fd) != SP_OK) {
+    return BLISP_ERR_API_ERROR;
+  }
+  return BLISP_OK;
+#endif
+}
+
+void blisp_async_init(struct blisp_async* async,
+                      struct blisp_device* device,
+                      blisp_async_callback callback,
+                      void* user_data) {
+  memset(async, 0, sizeof(*async));
+  async->device = device;
+  async->callback = callback;
+  async->user_data = user_data;
+}
+
+bool blisp_async_busy(const struct blisp_async* async) {
+  return async->operation != BLISP_ASYNC_IDLE;
+}
+
+uint8_t blisp_async_events(const struct blisp_async* async) {
+  if (!blisp_async_busy(async)) {
+    return 0;
+  }
+  switch (async->phase) {
+    case BLISP_ASYNC_PHASE_SEND:
+      return BLISP_ASYNC_WANT_WRITE;
+    case BLISP_ASYNC_PHASE_RECEIVE:
+    case BLISP_ASYNC_PHASE_SYNC:
+      return BLISP_ASYNC_WANT_READ;
+    default:
+      return 0;
+  }
+}
+
+int32_t blisp_async_timeout_ms(const struct blisp_async* async) {
+  if (!blisp_async_busy(async) || async->deadline_us == 0) {
+    return -1;
+  }
+  uint64_t now = monotonic_us();
+  if (now >= async->deadline_us) {
+    return 0;
+  }
+  // Round up, so the caller doesn't wake up just before the deadline
+  return (int32_t)((async->deadline_us - now + 999) / 1000);
+}
+
+static void blisp_async_set_deadline(struct blisp_async* async,
+                                     uint32_t timeout_ms) {
+  async->deadline_us =
+      timeout_ms == 0 ? 0 : monotonic_us() + (uint64_t)timeout_ms * 1000;
+}
+
+static void blisp_async_sleep(struct blisp_async* async, uint32_t ms) {
+  async->phase = BLISP_ASYNC_PHASE_SLEEP;
+  async->deadline_us = monotonic_us() + (uint64_t)ms * 1000;
+}
+
+static void blisp_async_finish(struct blisp_async* async, blisp_return_t ret) {
+  if (async->operation == BLISP_ASYNC_HANDSHAKE) {
+    blisp_metrics_handshake(async->device->metrics, ret == BLISP_OK,
+                            async->attempt + 1,
+                            monotonic_us() - async->started_us);
+  }
+  async->operation = BLISP_ASYNC_IDLE;
+  async->deadline_us = 0;
+  if (async->callback != NULL) {
+    async->callback(async, ret, async->user_data);
+  }
+}
+
+// Queues raw bytes, without a command header
+static void blisp_async_send_raw(struct blisp_async* async,
+                                 const struct blisp_payload_part* parts,
+                                 uint8_t part_count) {
+  memcpy(async->parts, parts, part_count * sizeof(*parts));
+  async->part_count = part_count;
+  async->part = 0;
+  async->part_offset = 0;
+  async->phase = BLISP_ASYNC_PHASE_SEND;
+  blisp_async_set_deadline(async, async->device->serial_timeout);
+}
+
+static blisp_return_t blisp_async_send_command(
+    struct blisp_async* async,
+    uint8_t command,
+    const struct blisp_payload_part* parts,
+    uint8_t part_count,
+    bool add_checksum,
+    bool expect_payload) {
+  blisp_return_t ret = blisp_build_command_header(
+      async->header, command, parts, part_count, add_checksum);
+  if (ret < 0) {
+    return ret;
+  }
+  async->parts[0].data = async->header;
+  async->parts[0].size = sizeof(async->header);
+  memcpy(&async->parts[1], parts, part_count * sizeof(*parts));
+  async->part_count = part_count + 1;
+  async->part = 0;
+  async->part_offset = 0;
+  async->expect_payload = expect_payload;
+  async->phase = BLISP_ASYNC_PHASE_SEND;
+  // A port that stops taking bytes fails the operation like a silent chip
+  blisp_async_set_deadline(async, async->device->serial_timeout);
+  return BLISP_OK;
+}
+
+// Returns BLISP_OK once everything is written, BLISP_ERR_PENDING if the
+// port can't take more right now.
+static blisp_return_t blisp_async_write(struct blisp_async* async) {
+  struct sp_port* serial_port = async->device->serial_port;
+
+  while (async->part < async->part_count) {
+    const struct blisp_payload_part* part = &async->parts[async->part];
+    if (async->part_offset < part->size) {
+      int ret = sp_nonblocking_write(
+          serial_port, (const uint8_t*)part->data + async->part_offset,
+          part->size - async->part_offset);
+      if (ret < 0) {
+        blisp_dlog("Failed to write command: %d", ret);
+        return BLISP_ERR_API_ERROR;
+      }
+      if (ret == 0) {
+        return BLISP_ERR_PENDING;
+      }
+      async->part_offset += ret;
+      if (async->part_offset < part->size) {
+        return BLISP_ERR_PENDING;
+      }
+    }
+    async->part++;
+    async->part_offset = 0;
+  }
+
+  uint32_t size = 0;
+  for (uint8_t i = 0; i < async->part_count; i++) {
+    size += async->parts[i].size;
+  }
+  blisp_capture_begin(async->device->capture, BLISP_CAPTURE_WRITE, size);
+  for (uint8_t i = 0; i < async->part_count; i++) {
+    blisp_capture_data(async->device->capture, async->parts[i].data,
+                       async->parts[i].size);
+  }
+  if (async->parts[0].data == async->header) {
+    blisp_metrics_command_sent(async->device->metrics, async->header[0], size);
+  } else {
+    blisp_metrics_traffic(async->device->metrics, size, 0);
+  }
+  return BLISP_OK;
+}
+
+// Returns the response like blisp_receive_response does, BLISP_ERR_PENDING
+// while it is incomplete.
+static blisp_return_t blisp_async_read_response(struct blisp_async* async) {
+  struct blisp_device* device = async->device;
+  struct blisp_response_parser* parser = &device->response_parser;
+  struct blisp_response response;
+  uint32_t skipped = parser->skipped;
+  uint8_t* tail;
+
+  for (;;) {
+    if (blisp_response_parser_next(parser, async->expect_payload,
+                                   sizeof(device->rx_buffer), &response)) {
+      blisp_metrics_garbage(device->metrics, parser->skipped - skipped);
+      skipped = parser->skipped;
+      blisp_metrics_response(device->metrics, &response,
+                             async->expect_payload);
+      switch (response.type) {
+        case BLISP_RESPONSE_OK:
+          if (response.payload_length != 0) {
+            memcpy(device->rx_buffer, response.payload,
+                   response.payload_length);
+          }
+          return response.payload_length;
+        case BLISP_RESPONSE_ERROR:
+          device->error_code = response.error_code;
+          blisp_dlog("Chip returned error: %d", device->error_code);
+          return BLISP_ERR_CHIP_ERR;
+        default:
+          // Still busy, give it another timeout
+          blisp_async_set_deadline(async, device->serial_timeout);
+          continue;
+      }
+    }
+    uint32_t space = blisp_response_parser_space(parser, &tail);
+    int ret = sp_nonblocking_read(device->serial_port, tail, space);
+    if (ret < 0) {
+      return BLISP_ERR_API_ERROR;
+    }
+    if (ret == 0) {
+      blisp_metrics_garbage(device->metrics, parser->skipped - skipped);
+      return BLISP_ERR_PENDING;
+    }
+    blisp_capture_record(device->capture, BLISP_CAPTURE_READ, tail, ret);
+    blisp_response_parser_commit(parser, ret);
+    blisp_metrics_traffic(device->metrics, 0, ret);
+  }
+}
+
+// Looks for the 'OK' the chip answers a handshake with
+static blisp_return_t blisp_async_read_sync(struct blisp_async* async) {
+  uint8_t buffer[32];
+
+  for (;;) {
+    int ret = sp_nonblocking_read(async->device->serial_port, buffer,
+                                  sizeof(buffer));
+    if (ret < 0) {
+      return BLISP_ERR_API_ERROR;
+    }
+    if (ret == 0) {
+      return BLISP_ERR_PENDING;
+    }
+    blisp_metrics_traffic(async->device->metrics, 0, ret);
+    blisp_capture_record(async->device->capture, BLISP_CAPTURE_READ, buffer,
+                         ret);
+    for (int i = 0; i < ret; i++) {
+      if (async->last_byte == 'O' && buffer[i] == 'K') {
+        return BLISP_OK;
+      }
+      async->last_byte = buffer[i];
+    }
+  }
+}
+
+static void blisp_async_start_sync(struct blisp_async* async) {
+  struct blisp_device* device = async->device;
+  // The 'U's are only queued, the answer can't come before they are out
+  uint32_t wire_ms = 0;
+  if (device->current_baud_rate != 0) {
+    wire_ms = 600 * 10 * 1000 / device->current_baud_rate;
+  }
+  async->last_byte = 0;
+  async->step = BLISP_ASYNC_HANDSHAKE_SYNC;
+  async->phase = BLISP_ASYNC_PHASE_SYNC;
+  blisp_async_set_deadline(async, 50 + wire_ms);
+}
+
+static void blisp_async_send_sync_bytes(struct blisp_async* async) {
+  struct blisp_device* device = async->device;
+  struct blisp_payload_part parts[2];
+  uint8_t part_count = 0;
+
+  uint32_t bytes_count = (uint32_t)(device->chip->handshake_byte_multiplier *
+                                    (float)device->current_baud_rate / 10.0f);
+  if (bytes_count > 600)
+    bytes_count = 600;
+  memset(device->tx_buffer, 'U', bytes_count);
+
+  if (!async->in_ef_loader && device->is_usb) {
+    parts[part_count].data = "BOUFFALOLAB5555RESET\0\0";
+    parts[part_count++].size = 22;
+  }
+  parts[part_count].data = device->tx_buffer;
+  parts[part_count++].size = bytes_count;
+
+  if (!async->in_ef_loader && !device->is_usb) {
+    // Flush garbage out of RX
+    sp_flush(device->serial_port, SP_BUF_INPUT);
+  }
+  blisp_response_parser_reset(&device->response_parser);
+  async->step = BLISP_ASYNC_HANDSHAKE_SENT;
+  blisp_async_send_raw(async, parts, part_count);
+}
+
+static void blisp_async_handshake_step(struct blisp_async* async,
+                                       blisp_return_t ret) {
+  struct blisp_device* device = async->device;
+  struct sp_port* serial_port = device->serial_port;
+
+  if (ret < 0 && async->step != BLISP_ASYNC_HANDSHAKE_SYNC) {
+    blisp_async_finish(async, ret);
+    return;
+  }
+
+  switch (async->step) {
+    case BLISP_ASYNC_HANDSHAKE_RESET_1:
+      sp_set_dtr(serial_port, SP_DTR_OFF);
+      async->step = BLISP_ASYNC_HANDSHAKE_RESET_2;
+      blisp_async_sleep(async, 100);
+      break;
+    case BLISP_ASYNC_HANDSHAKE_RESET_2:
+      sp_set_rts(serial_port, SP_RTS_OFF);
+      async->step = BLISP_ASYNC_HANDSHAKE_SEND;
+      blisp_async_sleep(async, 50);  // Wait a bit so BootROM can init
+      break;
+    case BLISP_ASYNC_HANDSHAKE_SEND:
+      blisp_async_send_sync_bytes(async);
+      break;
+    case BLISP_ASYNC_HANDSHAKE_SENT:
+      if (device->chip->type == BLISP_CHIP_BL808) {
+        async->step = BLISP_ASYNC_HANDSHAKE_SECOND;
+        blisp_async_sleep(async, 300);
+      } else {
+        blisp_async_start_sync(async);
+      }
+      break;
+    case BLISP_ASYNC_HANDSHAKE_SECOND: {
+      static const uint8_t second_handshake[] = {0x50, 0x00, 0x08, 0x00,
+                                                 0x38, 0xF0, 0x00, 0x20,
+                                                 0x00, 0x00, 0x00, 0x18};
+      struct blisp_payload_part part = {second_handshake,
+                                        sizeof(second_handshake)};
+      async->step = BLISP_ASYNC_HANDSHAKE_SECOND_SENT;
+      blisp_async_send_raw(async, &part, 1);
+      break;
+    }
+    case BLISP_ASYNC_HANDSHAKE_SECOND_SENT:
+      blisp_async_start_sync(async);
+      break;
+    case BLISP_ASYNC_HANDSHAKE_SYNC:
+      if (ret == BLISP_OK) {
+        blisp_response_parser_reset(&device->response_parser);
+        blisp_async_finish(async, BLISP_OK);
+        break;
+      }
+      blisp_dlog("Received incorrect handshake response from chip "
+                 "(attempt %d/%d).",
+                 async->attempt + 1, BLISP_ASYNC_HANDSHAKE_ATTEMPTS);
+      if (++async->attempt == BLISP_ASYNC_HANDSHAKE_ATTEMPTS) {
+        blisp_async_finish(async, BLISP_ERR_NO_RESPONSE);
+        break;
+      }
+      blisp_async_send_sync_bytes(async);
+      break;
+  }
+}
+
+static void blisp_async_boot_info_step(struct blisp_async* async,
+                                       blisp_return_t ret) {
+  struct blisp_device* device = async->device;
+
+  if (ret >= 0) {
+    memcpy(async->boot_info->boot_rom_version, &device->rx_buffer[0], 4);
+    if (device->chip->type == BLISP_CHIP_BL70X) {
+      memcpy(async->boot_info->chip_id, &device->rx_buffer[16], 8);
+    } else {
+      memcpy(async->boot_info->chip_id, &device->rx_buffer[12], 6);
+    }
+    ret = BLISP_OK;
+  }
+  blisp_async_finish(async, ret);
+}
+
+static void blisp_async_send_flash_chunk(struct blisp_async* async) {
+  uint32_t address = async->address_start + async->written;
+  uint32_t chunk_size = async->chunk_size;
+
+  // Only the first chunk may be short, the others start on a page
+  if (async->device->flash_write_chunk_size == 0) {
+    chunk_size -= address % BLISP_FLASH_PAGE_SIZE;
+  }
+  if (chunk_size > async->size - async->written) {
+    chunk_size = async->size - async->written;
+  }
+  async->address[0] = address & 0xFF;
+  async->address[1] = (address >> 8) & 0xFF;
+  async->address[2] = (address >> 16) & 0xFF;
+  async->address[3] = (address >> 24) & 0xFF;
+
+  struct blisp_payload_part parts[] = {
+      {async->address, sizeof(async->address)},
+      {async->data + async->written, chunk_size}};
+  // Can't fail, chunks are far below the 64 KiB payload limit
+  blisp_async_send_command(async, 0x31, parts, 2, true, false);
+}
+
+static void blisp_async_flash_write_step(struct blisp_async* async,
+                                         blisp_return_t ret) {
+  if (ret < 0) {
+    blisp_async_finish(async, ret);
+    return;
+  }
+  // Size of the chunk that was just acknowledged
+  async->written += async->parts[2].size;
+  if (async->written < async->size) {
+    blisp_async_send_flash_chunk(async);
+    return;
+  }
+  blisp_async_finish(async, BLISP_OK);
+}
+
+// Called whenever a phase is over, with the outcome of the phase
+static void blisp_async_advance(struct blisp_async* async,
+                                blisp_return_t ret) {
+  if (async->phase == BLISP_ASYNC_PHASE_SEND &&
+      async->operation != BLISP_ASYNC_HANDSHAKE && ret == BLISP_OK) {
+    // Command is out, now wait for its response
+    async->phase = BLISP_ASYNC_PHASE_RECEIVE;
+    blisp_async_set_deadline(async, async->device->serial_timeout);
+    return;
+  }
+
+  switch (async->operation) {
+    case BLISP_ASYNC_HANDSHAKE:
+      blisp_async_handshake_step(async, ret);
+      break;
+    case BLISP_ASYNC_GET_BOOT_INFO:
+      blisp_async_boot_info_step(async, ret);
+      break;
+    case BLISP_ASYNC_FLASH_WRITE:
+      blisp_async_flash_write_step(async, ret);
+      break;
+    case BLISP_ASYNC_FLASH_ERASE:
+    case BLISP_ASYNC_PROGRAM_CHECK:
+      blisp_async_finish(async, ret < 0 ? ret : BLISP_OK);
+      break;
+    default:
+      break;
+  }
+}
+
+void blisp_async_process(struct blisp_async* async) {
+  while (blisp_async_busy(async)) {
+    blisp_return_t ret;
+
+    switch (async->phase) {
+      case BLISP_ASYNC_PHASE_SEND:
+        ret = blisp_async_write(async);
+        break;
+      case BLISP_ASYNC_PHASE_RECEIVE:
+        ret = blisp_async_read_response(async);
+        break;
+      case BLISP_ASYNC_PHASE_SYNC:
+        ret = blisp_async_read_sync(async);
+        break;
+      default:
+        ret = BLISP_ERR_PENDING;
+        break;
+    }
+
+    if (ret == BLISP_ERR_PENDING) {
+      if (async->deadline_us == 0 || monotonic_us() < async->deadline_us) {
+        return;
+      }
+      if (async->phase == BLISP_ASYNC_PHASE_SLEEP) {
+        ret = BLISP_OK;
+      } else if (async->phase == BLISP_ASYNC_PHASE_SEND) {
+        blisp_dlog("Timed out writing command");
+        ret = BLISP_ERR_API_ERROR;
+      } else {
+        blisp_dlog("Timed out waiting for the chip");
+        if (async->phase == BLISP_ASYNC_PHASE_RECEIVE) {
+          blisp_metrics_timeout(async->device->metrics);
+        }
+        ret = BLISP_ERR_NO_RESPONSE;
+      }
+    }
+    blisp_async_advance(async, ret);
+  }
+}
+
+static blisp_return_t blisp_async_start(struct blisp_async* async,
+                                        enum blisp_async_operation operation) {
+  if (blisp_async_busy(async)) {
+    return BLISP_ERR_BUSY;
+  }
+  async->operation = operation;
+  async->step = 0;
+  async->attempt = 0;
+  async->deadline_us = 0;
+  async->started_us = monotonic_us();
+  return BLISP_OK;
+}
+
+// Starts an operation that is a single command and its response
+static blisp_return_t blisp_async_start_command(
+    struct blisp_async* async,
+    enum blisp_async_operation operation,
+    uint8_t command,
+    const struct blisp_payload_part* parts,
+    uint8_t part_count,
+    bool add_checksum,
+    bool expect_payload) {
+  blisp_return_t ret = blisp_async_start(async, operation);
+  if (ret < 0) {
+    return ret;
+  }
+  ret = blisp_async_send_command(async, command, parts, part_count,
+                                 add_checksum, expect_payload);
+  if (ret < 0) {
+    async->operation = BLISP_ASYNC_IDLE;
+  }
+  return ret;
+}
+
+blisp_return_t blisp_async_handshake(struct blisp_async* async,
+                                     bool in_ef_loader) {
+  struct blisp_device* device = async->device;
+  blisp_return_t ret = blisp_async_start(async, BLISP_ASYNC_HANDSHAKE);
+  if (ret < 0) {
+    return ret;
+  }
+  async->in_ef_loader = in_ef_loader;
+
+  if (!in_ef_loader && !device->is_usb) {
+    sp_set_rts(device->serial_port, SP_RTS_ON);
+    sp_set_dtr(device->serial_port, SP_DTR_ON);
+    async->step = BLISP_ASYNC_HANDSHAKE_RESET_1;
+    blisp_async_sleep(async, 50);
+  } else {
+    blisp_async_send_sync_bytes(async);
+  }
+  return BLISP_OK;
+}
+
+blisp_return_t blisp_async_get_boot_info(struct blisp_async* async,
+                                         struct blisp_boot_info* boot_info) {
+  if (blisp_async_busy(async)) {
+    return BLISP_ERR_BUSY;
+  }
+  async->boot_info = boot_info;
+  return blisp_async_start_command(async, BLISP_ASYNC_GET_BOOT_INFO, 0x10,
+                                   NULL, 0, false, true);
+}
+
+blisp_return_t blisp_async_flash_erase(struct blisp_async* async,
+                                       uint32_t start_address,
+                                       uint32_t end_address) {
+  if (blisp_async_busy(async)) {
+    return BLISP_ERR_BUSY;
+  }
+  uint8_t* payload = async->command_payload;
+  for (uint8_t i = 0; i < 4; i++) {
+    payload[i] = (start_address >> (8 * i)) & 0xFF;
+    payload[4 + i] = (end_address >> (8 * i)) & 0xFF;
+  }
+  struct blisp_payload_part part = {payload, sizeof(async->command_payload)};
+  return blisp_async_start_command(async, BLISP_ASYNC_FLASH_ERASE, 0x30,
+                                   &part, 1, true, false);
+}
+
+blisp_return_t blisp_async_flash_write(struct blisp_async* async,
+                                       uint32_t start_address,
+                                       const uint8_t* data,
+                                       uint32_t size) {
+  struct blisp_device* device = async->device;
+  if (size == 0) {
+    return BLISP_ERR_INVALID_COMMAND;
+  }
+  blisp_return_t ret = blisp_async_start(async, BLISP_ASYNC_FLASH_WRITE);
+  if (ret < 0) {
+    return ret;
+  }
+  async->address_start = start_address;
+  async->data = data;
+  async->size = size;
+  async->written = 0;
+  async->chunk_size = device->flash_write_chunk_size;
+  if (async->chunk_size == 0) {
+    async->chunk_size = device->chip->flash_write_max_size;
+  }
+  if (async->chunk_size == 0 ||
+      async->chunk_size > BLISP_FLASH_WRITE_MAX_SIZE) {
+    async->chunk_size = BLISP_FLASH_WRITE_MAX_SIZE;
+  }
+  blisp_async_send_flash_chunk(async);
+  return BLISP_OK;
+}
+
+blisp_return_t blisp_async_program_check(struct blisp_async* async) {
+  return blisp_async_start_command(async, BLISP_ASYNC_PROGRAM_CHECK, 0x3A,
+                                   NULL, 0, true, false);
+}
@@ -0,0 +1,131 @@
+// SPDX-License-Identifier: MIT
+#include "blisp_capture.h"
+#include <stdbool.h>
+#include <string.h>
+#include "blisp_util.h"
+
+static void blisp_capture_put_varint(FILE* file, uint64_t value) {
+  uint8_t bytes[10];
+  uint8_t count = 0;
+  do {
+    bytes[count] = value & 0x7F;
+    value >>= 7;
+    if (value != 0) {
+      bytes[count] |= 0x80;
+    }
+    count++;
+  } while (value != 0);
+  fwrite(bytes, 1, count, file);
+}
+
+blisp_return_t blisp_capture_open(struct blisp_capture* capture,
+                                  const char* path) {
+  capture->file = fopen(path, "wb");
+  if (capture->file == NULL) {
+    return BLISP_ERR_CANT_OPEN_FILE;
+  }
+  fwrite(BLISP_CAPTURE_MAGIC, 1, BLISP_CAPTURE_MAGIC_SIZE, capture->file);
+  fputc(BLISP_CAPTURE_VERSION, capture->file);
+  capture->last_us = monotonic_us();
+  return BLISP_OK;
+}
+
+blisp_return_t blisp_capture_close(struct blisp_capture* capture) {
+  if (capture->file == NULL) {
+    return BLISP_OK;
+  }
+  bool failed = ferror(capture->file) != 0;
+  if (fclose(capture->file) != 0) {
+    failed = true;
+  }
+  capture->file = NULL;
+  return failed ? BLISP_ERR_API_ERROR : BLISP_OK;
+}
+
+void blisp_capture_begin(struct blisp_capture* capture,
+                         enum blisp_capture_type type,
+                         uint32_t size) {
+  if (capture == NULL || capture->file == NULL) {
+    return;
+  }
+  uint64_t now = monotonic_us();
+  fputc(type, capture->file);
+  blisp_capture_put_varint(capture->file, now - capture->last_us);
+  blisp_capture_put_varint(capture->file, size);
+  capture->last_us = now;
+}
+
+void blisp_capture_data(struct blisp_capture* capture,
+                        const void* data,
+                        uint32_t size) {
+  if (capture == NULL || capture->file == NULL) {
+    return;
+  }
+  fwrite(data, 1, size, capture->file);
+}
+
+void blisp_capture_record(struct blisp_capture* capture,
+                          enum blisp_capture_type type,
+                          const void* data,
+                          uint32_t size) {
+  blisp_capture_begin(capture, type, size);
+  blisp_capture_data(capture, data, size);
+}
+
+void blisp_capture_baud_rate(struct blisp_capture* capture,
+                             uint32_t baud_rate) {
+  uint8_t bytes[4] = {baud_rate & 0xFF, (baud_rate >> 8) & 0xFF,
+                      (baud_rate >> 16) & 0xFF, baud_rate >> 24};
+  blisp_capture_record(capture, BLISP_CAPTURE_BAUD_RATE, bytes, 4);
+}
+
+blisp_return_t blisp_capture_reader_init(struct blisp_capture_reader* reader,
+                                         const uint8_t* data,
+                                         size_t size) {
+  if (size < BLISP_CAPTURE_MAGIC_SIZE + 1 ||
+      memcmp(data, BLISP_CAPTURE_MAGIC, BLISP_CAPTURE_MAGIC_SIZE) != 0 ||
+      data[BLISP_CAPTURE_MAGIC_SIZE] != BLISP_CAPTURE_VERSION) {
+    return BLISP_ERR_INVALID_COMMAND;
+  }
+  reader->data = data;
+  reader->size = size;
+  reader->offset = BLISP_CAPTURE_MAGIC_SIZE + 1;
+  return BLISP_OK;
+}
+
+static bool blisp_capture_get_varint(struct blisp_capture_reader* reader,
+                                     uint64_t* value) {
+  *value = 0;
+  for (uint8_t shift = 0; shift < 64; shift += 7) {
+    if (reader->offset == reader->size) {
+      return false;
+    }
+    uint8_t byte = reader->data[reader->offset++];
+    *value |= (uint64_t)(byte & 0x7F) << shift;
+    if ((byte & 0x80) == 0) {
+      return true;
+    }
+  }
+  return false;
+}
+
+blisp_return_t blisp_capture_next(struct blisp_capture_reader* reader,
+                                  struct blisp_capture_entry* entry) {
+  uint64_t size;
+
+  if (reader->offset == reader->size) {
+    return BLISP_ERR_NO_RESPONSE;
+  }
+  entry->type = reader->data[reader->offset++];
+  if (!blisp_capture_get_varint(reader, &entry->delta_us) ||
+      !blisp_capture_get_varint(reader, &size) ||
+      size > reader->size - reader->offset) {
+    // A capture cut short by a crash still has its records up to here
+    reader->offset = reader->size;
+    return BLISP_ERR_INVALID_COMMAND;
+  }
+  entry->data = reader->data + reader->offset;
+  entry->size = size;
+  reader->offset += size;
+  return BLISP_OK;
+}
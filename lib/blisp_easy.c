@@ -4,18 +4,52 @@
 #include "blisp_util.h"
 
 #include <inttypes.h>
+#include <stdlib.h>
 #include <string.h>
 
+#ifdef BLISP_HAS_LZMA
+#include <lzma.h>
+#endif
+
+// Chunk sizes the adaptive sizer starts from, it only grows from there once
+// the link has proven clean. The macOS and FreeBSD serial drivers used to
+// choke on larger writes.
+#if defined(__APPLE__) || defined(__FreeBSD__)
+#define BLISP_EASY_FLASH_WRITE_START_SIZE 256
+#define BLISP_EASY_SEGMENT_DATA_START_SIZE (252 * 16)
+#else
+#define BLISP_EASY_FLASH_WRITE_START_SIZE 2048
+#define BLISP_EASY_SEGMENT_DATA_START_SIZE 4092
+#endif
+// Clean acknowledgements needed before the chunk size doubles
+#define BLISP_EASY_CHUNK_GROW_AFTER 8
+// Failed attempts in a row before a write is given up
+#define BLISP_EASY_CHUNK_RETRIES 4
+// Acknowledgements carry no chunk id, so with several chunks in flight a
+// lost one only shows once the window runs dry, and every acknowledgement
+// since may have been credited to the wrong chunk. The window is drained
+// at least this often, and everything since the last drain stays buffered.
+#define BLISP_EASY_WRITE_SYNC_SIZE (64 * 1024)
+#define BLISP_EASY_CHUNK_MIN_SIZE 256
+
+// Compressed writes: every block is an independent xz stream, and the
+// dictionary has to fit into the loader's RAM.
+#define BLISP_EASY_COMPRESS_BLOCK_SIZE (64 * 1024)
+#define BLISP_EASY_COMPRESS_DICT_SIZE (32 * 1024)
+
 static blisp_return_t blisp_easy_transport_read(
     struct blisp_easy_transport* transport,
     void* buffer,
     uint32_t size) {
   if (transport->type == 0) {
+    uint32_t position = transport->data.memory.current_position;
     // TODO: Implement reading more than available
-    memcpy(buffer,
-           (uint8_t*)transport->data.memory.data_location +
-               transport->data.memory.current_position,
+    memcpy(buffer, (uint8_t*)transport->data.memory.data_location + position,
            size);
+    if (transport->data.memory.overlay_position - position < size) {
+      ((uint8_t*)buffer)[transport->data.memory.overlay_position - position] =
+          transport->data.memory.overlay_value;
+    }
     transport->data.memory.current_position += size;
     return size;
   } else {
@@ -23,6 +57,68 @@ static blisp_return_t blisp_easy_transport_read(
   }
 }
 
+static bool blisp_easy_is_erased(const uint8_t* data, uint32_t size) {
+  for (uint32_t i = 0; i < size; i++) {
+    if (data[i] != 0xFF) {
+      return false;
+    }
+  }
+  return true;
+}
+
+static int32_t blisp_easy_transport_write(
+    struct blisp_easy_transport* transport,
+    const uint8_t* buffer,
+    uint32_t size) {
+  if (transport->type == 0) {
+    if (size > transport->data.memory.data_size -
+                   transport->data.memory.current_position) {
+      return BLISP_EASY_ERR_TRANSPORT_ERROR;
+    }
+    memcpy((uint8_t*)transport->data.memory.data_location +
+               transport->data.memory.current_position,
+           buffer, size);
+    transport->data.memory.current_position += size;
+  } else if (transport->type == 1) {
+    if (fwrite(buffer, size, 1, transport->data.file_handle) != 1) {
+      return BLISP_EASY_ERR_TRANSPORT_ERROR;
+    }
+  } else {
+    FILE* file = transport->data.sparse_file.file_handle;
+    for (uint32_t offset = 0; offset < size;
+         offset += BLISP_EASY_SPARSE_BLOCK_SIZE) {
+      uint32_t block_size = size - offset;
+      if (block_size > BLISP_EASY_SPARSE_BLOCK_SIZE) {
+        block_size = BLISP_EASY_SPARSE_BLOCK_SIZE;
+      }
+      bool erased = blisp_easy_is_erased(buffer + offset, block_size);
+      if (erased) {
+        if (fseek(file, block_size, SEEK_CUR) != 0) {
+          return BLISP_EASY_ERR_TRANSPORT_ERROR;
+        }
+      } else if (fwrite(buffer + offset, block_size, 1, file) != 1) {
+        return BLISP_EASY_ERR_TRANSPORT_ERROR;
+      }
+      transport->data.sparse_file.in_hole = erased;
+    }
+  }
+  return BLISP_OK;
+}
+
+// Seeking past the end does not grow a file, so a sparse file ending in a
+// hole gets its last byte written out.
+static int32_t blisp_easy_transport_finish(
+    struct blisp_easy_transport* transport) {
+  if (transport->type == 2 && transport->data.sparse_file.in_hole) {
+    FILE* file = transport->data.sparse_file.file_handle;
+    if (fseek(file, -1, SEEK_CUR) != 0 || fputc(0xFF, file) == EOF) {
+      return BLISP_EASY_ERR_TRANSPORT_ERROR;
+    }
+    transport->data.sparse_file.in_hole = false;
+  }
+  return BLISP_OK;
+}
+
 static blisp_return_t blisp_easy_transport_size(
     struct blisp_easy_transport* transport) {
   if (transport->type == 0) {
@@ -42,11 +138,326 @@ static void blisp_easy_report_progress(blisp_easy_progress_callback callback,
   }
 }
 
+// Chunks sent to the eflash_loader whose acknowledgement is still pending.
+// The loader answers strictly in order, so the oldest entry is always the one
+// the next response belongs to.
+struct blisp_easy_write_window {
+  struct {
+    uint32_t address;
+    uint32_t size;
+  } chunks[BLISP_EASY_MAX_WRITE_WINDOW];
+  uint8_t head;
+  uint8_t count;
+};
+
+static void blisp_easy_write_window_push(struct blisp_easy_write_window* window,
+                                         uint32_t address,
+                                         uint32_t size) {
+  uint8_t tail = (window->head + window->count) % BLISP_EASY_MAX_WRITE_WINDOW;
+  window->chunks[tail].address = address;
+  window->chunks[tail].size = size;
+  window->count++;
+}
+
+static uint32_t blisp_easy_write_window_pop(
+    struct blisp_easy_write_window* window) {
+  uint32_t size = window->chunks[window->head].size;
+  window->head = (window->head + 1) % BLISP_EASY_MAX_WRITE_WINDOW;
+  window->count--;
+  return size;
+}
+
+// Collects the acknowledgements of chunks still in flight after a failure,
+// so the link is back in sync before the caller sends anything else.
+static void blisp_easy_write_window_abort(
+    struct blisp_device* device,
+    struct blisp_easy_write_window* window) {
+  while (window->count > 0) {
+    uint32_t address = window->chunks[window->head].address;
+    blisp_easy_write_window_pop(window);
+    blisp_return_t ret = blisp_device_flash_write_wait(device);
+    if (ret == BLISP_ERR_NO_RESPONSE) {
+      break;
+    } else if (ret < BLISP_OK) {
+      blisp_dlog("Chunk at 0x%08" PRIX32 " failed as well (ret: %d)", address,
+                 ret);
+    }
+  }
+  window->count = 0;
+  blisp_device_flush_input(device);
+}
+
+// Picks the size of flash write and segment data chunks. It starts from the
+// chip's limits, doubles after a run of clean acknowledgements and halves on
+// timeouts and 'FL' errors. Every back-off doubles the run needed to grow
+// again, so a marginal link settles instead of oscillating.
+struct blisp_easy_chunk_sizer {
+  uint32_t size;
+  uint32_t min_size;
+  uint32_t max_size;
+  uint32_t align;       // Chunks end on multiples of this, 1 = anywhere
+  uint32_t clean;       // Clean acknowledgements at the current size
+  uint32_t grow_after;  // Clean acknowledgements needed to grow
+  bool fixed;           // Size requested by the caller, don't adapt
+};
+
+static void blisp_easy_chunk_sizer_init(struct blisp_easy_chunk_sizer* sizer,
+                                        uint32_t start_size,
+                                        uint32_t max_size,
+                                        uint32_t align) {
+  sizer->max_size = max_size - max_size % align;
+  sizer->min_size = BLISP_EASY_CHUNK_MIN_SIZE;
+  if (sizer->min_size > sizer->max_size) {
+    sizer->min_size = sizer->max_size;
+  }
+  sizer->size = start_size > sizer->max_size ? sizer->max_size : start_size;
+  sizer->align = align;
+  sizer->clean = 0;
+  sizer->grow_after = BLISP_EASY_CHUNK_GROW_AFTER;
+  sizer->fixed = false;
+}
+
+static void blisp_easy_flash_sizer_init(struct blisp_easy_chunk_sizer* sizer,
+                                        struct blisp_device* device) {
+  uint32_t max_size = device->chip->flash_write_max_size;
+  uint32_t start_size = BLISP_EASY_FLASH_WRITE_START_SIZE;
+
+  if (max_size == 0 || max_size > BLISP_FLASH_WRITE_MAX_SIZE) {
+    max_size = BLISP_FLASH_WRITE_MAX_SIZE;
+  }
+  if (device->is_usb) {
+    // USB CDC has flow control, nothing gets lost on the way.
+    start_size = max_size;
+  } else if (device->current_baud_rate > 1000000) {
+    // Cheap USB-UART bridges tend to drop bytes in long bursts this fast.
+    start_size /= 2;
+  }
+  blisp_easy_chunk_sizer_init(sizer, start_size, max_size,
+                              BLISP_FLASH_PAGE_SIZE);
+
+  if (device->flash_write_chunk_size != 0) {
+    sizer->size = device->flash_write_chunk_size;
+    if (sizer->size > BLISP_FLASH_WRITE_MAX_SIZE) {
+      sizer->size = BLISP_FLASH_WRITE_MAX_SIZE;
+    }
+    sizer->align = 1;
+    sizer->fixed = true;
+  }
+}
+
+// Size of the next chunk at address, cut so the one after starts aligned.
+static uint32_t blisp_easy_chunk_sizer_next(
+    struct blisp_easy_chunk_sizer* sizer,
+    uint32_t address,
+    uint32_t remaining) {
+  uint32_t size = sizer->size - address % sizer->align;
+  return size > remaining ? remaining : size;
+}
+
+static void blisp_easy_chunk_sizer_clean(struct blisp_easy_chunk_sizer* sizer) {
+  if (sizer->fixed || sizer->size >= sizer->max_size) {
+    return;
+  }
+  if (++sizer->clean >= sizer->grow_after) {
+    sizer->size *= 2;
+    if (sizer->size > sizer->max_size) {
+      sizer->size = sizer->max_size;
+    }
+    sizer->clean = 0;
+  }
+}
+
+static void blisp_easy_chunk_sizer_back_off(
+    struct blisp_easy_chunk_sizer* sizer) {
+  sizer->clean = 0;
+  if (sizer->fixed || sizer->size <= sizer->min_size) {
+    return;
+  }
+  sizer->size /= 2;
+  sizer->size -= sizer->size % sizer->align;
+  if (sizer->size < sizer->min_size) {
+    sizer->size = sizer->min_size;
+  }
+  sizer->grow_after *= 2;
+}
+
+// Whether sending the same chunk again can help
+static bool blisp_easy_is_transient(int32_t ret) {
+  return ret == BLISP_ERR_NO_RESPONSE || ret == BLISP_ERR_CHIP_ERR ||
+         ret == BLISP_ERR_UNKNOWN;
+}
+
+static uint8_t blisp_easy_write_window_size(struct blisp_device* device) {
+  uint8_t window_size = device->flash_write_window;
+  if (window_size < 1) {
+    window_size = 1;
+  } else if (window_size > BLISP_EASY_MAX_WRITE_WINDOW) {
+    window_size = BLISP_EASY_MAX_WRITE_WINDOW;
+  }
+  return window_size;
+}
+
+#ifdef BLISP_HAS_LZMA
+// Waits for the acknowledgement of the oldest chunk in flight. Returns the
+// number of bytes it accounts for, or the error after aborting the window.
+static int32_t blisp_easy_write_window_wait(
+    struct blisp_device* device,
+    struct blisp_easy_write_window* window) {
+  blisp_return_t ret = blisp_device_flash_write_wait(device);
+  if (ret < BLISP_OK) {
+    fprintf(stderr, "Failed to write firmware at 0x%08" PRIX32 "! (ret:%d)\n ",
+            window->chunks[window->head].address, ret);
+    blisp_easy_write_window_pop(window);
+    blisp_easy_write_window_abort(device, window);
+    return ret;
+  }
+  return blisp_easy_write_window_pop(window);
+}
+
+// Compresses a block into a standalone xz stream the way eflash_loader
+// expects it: LZMA2 with a small dictionary and a CRC32 check. Returns the
+// stream size, or 0 if the block could not be compressed into out_size.
+static uint32_t blisp_easy_compress_block(const uint8_t* data,
+                                          uint32_t size,
+                                          uint8_t* out,
+                                          uint32_t out_size) {
+  lzma_options_lzma options;
+  size_t out_position = 0;
+
+  if (lzma_lzma_preset(&options, LZMA_PRESET_DEFAULT)) {
+    return 0;
+  }
+  options.dict_size = BLISP_EASY_COMPRESS_DICT_SIZE;
+  lzma_filter filters[] = {{.id = LZMA_FILTER_LZMA2, .options = &options},
+                           {.id = LZMA_VLI_UNKNOWN, .options = NULL}};
+  if (lzma_stream_buffer_encode(filters, LZMA_CHECK_CRC32, NULL, data, size,
+                                out, &out_position, out_size) != LZMA_OK) {
+    return 0;
+  }
+  return out_position;
+}
+
+// Like the plain path of blisp_easy_flash_write, but every block goes out as
+// its own xz stream through decompress-write if that saves enough bytes, and
+// as plain writes otherwise. The window runs dry at the end of every block,
+// which confirms it and credits it to the progress. A failed block isn't
+// sent again, a lost chunk leaves the loader's xz stream broken.
+static int32_t blisp_easy_flash_write_compressed(
+    struct blisp_device* device,
+    struct blisp_easy_transport* data_transport,
+    uint32_t flash_location,
+    uint32_t data_size,
+    blisp_easy_progress_callback progress_callback) {
+  int32_t ret = BLISP_OK;
+  uint32_t written_data = 0;
+  uint32_t packed_max_size =
+      lzma_stream_buffer_bound(BLISP_EASY_COMPRESS_BLOCK_SIZE);
+  uint8_t* block = malloc(BLISP_EASY_COMPRESS_BLOCK_SIZE);
+  uint8_t* packed = malloc(packed_max_size);
+  struct blisp_easy_write_window window = {0};
+  uint8_t window_size = blisp_easy_write_window_size(device);
+  struct blisp_easy_chunk_sizer sizer;
+
+  if (block == NULL || packed == NULL) {
+    ret = BLISP_ERR_OUT_OF_MEMORY;
+    goto exit;
+  }
+
+  // A chunk of an xz stream can't be sent again, so the size stays at what
+  // the sizer starts with.
+  blisp_easy_flash_sizer_init(&sizer, device);
+  device->flash_write_settled_size = sizer.size;
+  blisp_easy_report_progress(progress_callback, 0, data_size);
+
+  for (uint32_t offset = 0; offset < data_size;
+       offset += BLISP_EASY_COMPRESS_BLOCK_SIZE) {
+    uint32_t block_size = data_size - offset;
+    if (block_size > BLISP_EASY_COMPRESS_BLOCK_SIZE) {
+      block_size = BLISP_EASY_COMPRESS_BLOCK_SIZE;
+    }
+    ret = blisp_easy_transport_read(data_transport, block, block_size);
+    if (ret < BLISP_OK) {
+      fprintf(stderr, "Failed to read firmware chunk! (ret:%d)\n ", ret);
+      blisp_easy_write_window_abort(device, &window);
+      goto exit;
+    }
+
+    uint32_t packed_size =
+        blisp_easy_compress_block(block, block_size, packed, packed_max_size);
+    bool compressed =
+        packed_size != 0 && packed_size < block_size - block_size / 16;
+    uint8_t* data = compressed ? packed : block;
+    uint32_t size = compressed ? packed_size : block_size;
+
+    for (uint32_t sent = 0; sent < size;) {
+      uint32_t chunk_size = size - sent;
+      if (chunk_size > sizer.size) {
+        chunk_size = sizer.size;
+      }
+      if (window.count == window_size) {
+        ret = blisp_easy_write_window_wait(device, &window);
+        if (ret < BLISP_OK) {
+          goto exit;
+        }
+      }
+
+      uint32_t address = flash_location + offset + sent;
+      if (compressed) {
+        ret = blisp_device_flash_decompress_write_send(device, address,
+                                                       data + sent, chunk_size);
+      } else {
+        ret = blisp_device_flash_write_send(device, address, data + sent,
+                                            chunk_size);
+      }
+      if (ret < BLISP_OK) {
+        fprintf(stderr, "Failed to write firmware! (ret:%d)\n ", ret);
+        blisp_easy_write_window_abort(device, &window);
+        goto exit;
+      }
+      blisp_easy_write_window_push(&window, address, chunk_size);
+      sent += chunk_size;
+    }
+
+    while (window.count > 0) {
+      ret = blisp_easy_write_window_wait(device, &window);
+      if (ret < BLISP_OK) {
+        goto exit;
+      }
+    }
+    written_data += block_size;
+    blisp_easy_report_progress(progress_callback, written_data, data_size);
+  }
+  ret = BLISP_OK;
+
+exit:
+  free(block);
+  free(packed);
+  return ret;
+}
+#endif
+
+bool blisp_easy_flash_compress_supported(void) {
+#ifdef BLISP_HAS_LZMA
+  return true;
+#else
+  return false;
+#endif
+}
+
 struct blisp_easy_transport blisp_easy_transport_new_from_file(FILE* file) {
   struct blisp_easy_transport transport = {.type = 1, .data.file_handle = file};
   return transport;
 }
 
+struct blisp_easy_transport blisp_easy_transport_new_from_sparse_file(
+    FILE* file) {
+  struct blisp_easy_transport transport = {
+      .type = 2,
+      .data.sparse_file.file_handle = file,
+      .data.sparse_file.in_hole = false};
+  return transport;
+}
+
 struct blisp_easy_transport blisp_easy_transport_new_from_memory(
     void* data_location,
     uint32_t data_size) {
@@ -54,46 +465,77 @@ struct blisp_easy_transport blisp_easy_transport_new_from_memory(
       .type = 0,
       .data.memory.data_location = data_location,
       .data.memory.data_size = data_size,
-      .data.memory.current_position = 0};
+      .data.memory.current_position = 0,
+      .data.memory.overlay_position = UINT32_MAX};
   return transport;
 }
 
+blisp_return_t blisp_easy_transport_new_from_eflash_loader(
+    struct blisp_chip* chip,
+    struct blisp_easy_transport* transport) {
+  uint32_t size;
+
+  if (chip->get_eflash_loader == NULL) {
+    return BLISP_ERR_NOT_IMPLEMENTED;
+  }
+  const uint8_t* image = chip->get_eflash_loader(&size);
+  if (image == NULL || size <= BLISP_EFLASH_LOADER_CLOCK_OFFSET) {
+    return BLISP_ERR_UNKNOWN;
+  }
+  // The image is shared, so the clock byte is patched in as it is read
+  *transport = blisp_easy_transport_new_from_memory((void*)image, size);
+  transport->data.memory.overlay_position = BLISP_EFLASH_LOADER_CLOCK_OFFSET;
+  transport->data.memory.overlay_value = chip->eflash_loader_clock;
+  return BLISP_OK;
+}
+
 int32_t blisp_easy_load_segment_data(
     struct blisp_device* device,
     uint32_t segment_size,
     struct blisp_easy_transport* segment_transport,
     blisp_easy_progress_callback progress_callback) {
   int32_t ret;
-#ifdef __APPLE__
-  const uint16_t buffer_max_size = 252 * 16;
-#else
-  const uint16_t buffer_max_size = 4092;
-#endif
+  struct blisp_easy_chunk_sizer sizer;
+  uint32_t max_size = device->chip->segment_data_max_size;
 
   uint32_t sent_data = 0;
-  uint32_t buffer_size = 0;
-#ifdef _WIN32
+  uint32_t buffered = 0;  // Read from the transport, but not sent yet
+  uint32_t failures = 0;
   uint8_t buffer[4092];
-#else
-  uint8_t buffer[buffer_max_size];
-#endif
 
+  if (max_size == 0 || max_size > sizeof(buffer)) {
+    max_size = sizeof(buffer);
+  }
+  blisp_easy_chunk_sizer_init(&sizer, BLISP_EASY_SEGMENT_DATA_START_SIZE,
+                              max_size, 1);
   blisp_easy_report_progress(progress_callback, 0, segment_size);
 
   while (sent_data < segment_size) {
-    buffer_size = segment_size - sent_data;
-    if (buffer_size > buffer_max_size) {
-      buffer_size = buffer_max_size;
+    uint32_t chunk_size =
+        blisp_easy_chunk_sizer_next(&sizer, 0, segment_size - sent_data);
+    if (chunk_size > buffered) {
+      blisp_easy_transport_read(segment_transport, buffer + buffered,
+                                chunk_size - buffered);  // TODO: Error Handling
+      buffered = chunk_size;
+    }
+    ret = blisp_device_load_segment_data(device, buffer, chunk_size);
+    // The BootROM drops a chunk it answers 'FL' to, so it can be sent again.
+    // After a timeout we can't know whether it was taken.
+    if (ret == BLISP_ERR_CHIP_ERR && ++failures <= BLISP_EASY_CHUNK_RETRIES) {
+      blisp_metrics_retry(device->metrics, 0x18);
+      blisp_easy_chunk_sizer_back_off(&sizer);
+      continue;
     }
-    blisp_easy_transport_read(segment_transport, buffer,
-                              buffer_size);  // TODO: Error Handling
-    ret = blisp_device_load_segment_data(device, buffer, buffer_size);
     if (ret < BLISP_OK) {
       // TODO: Error logging fprintf(stderr, "Failed to load segment data. (ret
       // %d)\n", ret);
       return ret;
     }
-    sent_data += buffer_size;
+    failures = 0;
+    blisp_easy_chunk_sizer_clean(&sizer);
+    buffered -= chunk_size;
+    memmove(buffer, buffer + chunk_size, buffered);
+    sent_data += chunk_size;
     blisp_easy_report_progress(progress_callback, sent_data, segment_size);
   }
   return BLISP_OK;
@@ -334,40 +776,154 @@ int32_t blisp_easy_flash_write(struct blisp_device* device,
                                uint32_t data_size,
                                blisp_easy_progress_callback progress_callback) {
   int32_t ret;
-#if defined(__APPLE__) || defined(__FreeBSD__)
-  const uint16_t buffer_max_size = 372 * 1;
-#else
-  const uint16_t buffer_max_size = 2052;
+  uint32_t sent_data = 0;
+  uint32_t written_data = 0;
+  uint32_t read_data = 0;
+  uint32_t failures = 0;
+  struct blisp_easy_write_window window = {0};
+  struct blisp_easy_chunk_sizer sizer;
+  uint8_t window_size = blisp_easy_write_window_size(device);
+  // Acknowledged when the window last ran dry, so surely programmed
+  uint32_t confirmed_data = 0;
+  // Holds everything from confirmed_data to read_data, so chunks that fail
+  // can be sent again. buffer_start is where confirmed_data sits.
+  uint32_t buffer_size = BLISP_EASY_WRITE_SYNC_SIZE;
+  uint32_t buffer_start = 0;
+  uint8_t* buffer;
+
+#ifdef BLISP_HAS_LZMA
+  if (device->flash_compress) {
+    return blisp_easy_flash_write_compressed(device, data_transport,
+                                             flash_location, data_size,
+                                             progress_callback);
+  }
 #endif
 
-  uint32_t sent_data = 0;
+  buffer = malloc(buffer_size);
+  if (buffer == NULL) {
+    return BLISP_ERR_OUT_OF_MEMORY;
+  }
+  blisp_easy_flash_sizer_init(&sizer, device);
+  blisp_easy_report_progress(progress_callback, 0, data_size);
+
+  while (written_data < data_size) {
+    // Keep the window full, the loader programs one chunk while the next
+    // ones are still on the wire. Once a sync size is unconfirmed, it runs
+    // dry.
+    while (sent_data < data_size && window.count < window_size) {
+      uint32_t address = flash_location + sent_data;
+      uint32_t chunk_size = blisp_easy_chunk_sizer_next(
+          &sizer, address, data_size - sent_data);
+      if (sent_data + chunk_size - confirmed_data > buffer_size) {
+        break;
+      }
+
+      if (sent_data + chunk_size > read_data) {
+        uint32_t missing = sent_data + chunk_size - read_data;
+        uint32_t buffered = read_data - confirmed_data;
+        if (buffer_start + buffered + missing > buffer_size) {
+          memmove(buffer, buffer + buffer_start, buffered);
+          buffer_start = 0;
+        }
+        ret = blisp_easy_transport_read(
+            data_transport, buffer + buffer_start + buffered, missing);
+        if (ret < BLISP_OK) {
+          fprintf(stderr, "Failed to read firmware chunk! (ret:%d)\n ", ret);
+          blisp_easy_write_window_abort(device, &window);
+          goto exit;
+        }
+        read_data += missing;
+      }
+
+      ret = blisp_device_flash_write_send(
+          device, address,
+          buffer + buffer_start + (sent_data - confirmed_data), chunk_size);
+      if (ret < BLISP_OK) {
+        fprintf(stderr, "Failed to write firmware! (ret:%d)\n ", ret);
+        blisp_easy_write_window_abort(device, &window);
+        goto exit;
+      }
+      blisp_easy_write_window_push(&window, address, chunk_size);
+      sent_data += chunk_size;
+    }
+
+    uint32_t address = window.chunks[window.head].address;
+    ret = blisp_device_flash_write_wait(device);
+    if (ret < BLISP_OK) {
+      blisp_easy_write_window_pop(&window);
+      blisp_easy_write_window_abort(device, &window);
+      if (!blisp_easy_is_transient(ret) ||
+          ++failures > BLISP_EASY_CHUNK_RETRIES) {
+        fprintf(stderr,
+                "Failed to write firmware at 0x%08" PRIX32 "! (ret:%d)\n ",
+                address, ret);
+        goto exit;
+      }
+      // Which chunk the failure belongs to is only known with a single one
+      // in flight. Programming the same data twice is harmless, so
+      // everything since the last drain goes out again, in smaller chunks.
+      blisp_dlog("Chunk at 0x%08" PRIX32 " failed (ret: %d), resending from "
+                 "0x%08" PRIX32,
+                 address, ret, flash_location + confirmed_data);
+      blisp_metrics_retry(device->metrics, 0x31);
+      blisp_easy_chunk_sizer_back_off(&sizer);
+      sent_data = confirmed_data;
+      written_data = confirmed_data;
+      blisp_easy_report_progress(progress_callback, written_data, data_size);
+      continue;
+    }
+
+    written_data += blisp_easy_write_window_pop(&window);
+    if (window.count == 0) {
+      // Every chunk sent got its acknowledgement
+      buffer_start += written_data - confirmed_data;
+      confirmed_data = written_data;
+      failures = 0;
+    }
+    blisp_easy_chunk_sizer_clean(&sizer);
+    blisp_easy_report_progress(progress_callback, written_data, data_size);
+  }
+  ret = BLISP_OK;
+
+exit:
+  device->flash_write_settled_size = sizer.size;
+  free(buffer);
+  return ret;
+}
+
+int32_t blisp_easy_flash_read(struct blisp_device* device,
+                              struct blisp_easy_transport* data_transport,
+                              uint32_t flash_location,
+                              uint32_t data_size,
+                              blisp_easy_progress_callback progress_callback) {
+  int32_t ret;
+  uint8_t buffer[BLISP_FLASH_READ_MAX_SIZE];
+  uint32_t read_data = 0;
   uint32_t buffer_size = 0;
-#ifdef _WIN32
-  uint8_t buffer[2052];
-#else
-  uint8_t buffer[buffer_max_size];
-#endif
+
   blisp_easy_report_progress(progress_callback, 0, data_size);
 
-  while (sent_data < data_size) {
-    buffer_size = data_size - sent_data;
-    if (buffer_size > buffer_max_size) {
-      buffer_size = buffer_max_size;
+  // Every chunk goes straight to the transport, so dumps of any size need
+  // only a single chunk of memory.
+  while (read_data < data_size) {
+    buffer_size = data_size - read_data;
+    if (buffer_size > BLISP_FLASH_READ_MAX_SIZE) {
+      buffer_size = BLISP_FLASH_READ_MAX_SIZE;
     }
-    ret = blisp_easy_transport_read(data_transport, buffer, buffer_size);
+    ret = blisp_device_flash_read(device, flash_location + read_data, buffer,
+                                  buffer_size);
     if (ret < BLISP_OK) {
-      fprintf(stderr, "Failed to read firmware chunk! (ret:%d)\n ", ret);
+      fprintf(stderr, "Failed to read flash at 0x%08" PRIX32 "! (ret:%d)\n",
+              flash_location + read_data, ret);
       return ret;
     }
-
-    ret = blisp_device_flash_write(device, flash_location + sent_data, buffer,
-                                   buffer_size);
+    ret = blisp_easy_transport_write(data_transport, buffer, buffer_size);
     if (ret < BLISP_OK) {
-      fprintf(stderr, "Failed to write firmware! (ret:%d)\n ", ret);
+      fprintf(stderr, "Failed to store flash data! (ret:%d)\n", ret);
       return ret;
     }
-    sent_data += buffer_size;
-    blisp_easy_report_progress(progress_callback, sent_data, data_size);
+    read_data += buffer_size;
+    blisp_easy_report_progress(progress_callback, read_data, data_size);
   }
-  return BLISP_OK;
-}
\ No newline at end of file
+  return blisp_easy_transport_finish(data_transport);
+}
@@ -0,0 +1,217 @@
+// SPDX-License-Identifier: MIT
+#include "blisp_metrics.h"
+#include <string.h>
+#include "blisp_util.h"
+
+void blisp_metrics_reset(struct blisp_metrics* metrics) {
+  // Answers to commands sent before the reset still have to be matched up
+  uint8_t head = metrics->in_flight_head;
+  uint8_t count = metrics->in_flight_count;
+  memset(metrics->commands, 0, sizeof(metrics->commands));
+  metrics->bytes_out = 0;
+  metrics->bytes_in = 0;
+  metrics->garbage_bytes = 0;
+  metrics->handshakes = 0;
+  metrics->handshake_failures = 0;
+  metrics->handshake_attempts = 0;
+  metrics->handshake_us = 0;
+  metrics->in_flight_head = head;
+  metrics->in_flight_count = count;
+}
+
+void blisp_metrics_snapshot(const struct blisp_metrics* metrics,
+                            struct blisp_metrics* snapshot) {
+  memcpy(snapshot, metrics, sizeof(struct blisp_metrics));
+  snapshot->command_callback = NULL;
+  snapshot->command_callback_data = NULL;
+  memset(snapshot->in_flight, 0, sizeof(snapshot->in_flight));
+  snapshot->in_flight_head = 0;
+  snapshot->in_flight_count = 0;
+}
+
+const char* blisp_command_name(uint8_t command) {
+  switch (command) {
+    case 0x10:
+      return "get_boot_info";
+    case 0x11:
+      return "load_boot_header";
+    case 0x17:
+      return "load_segment_header";
+    case 0x18:
+      return "load_segment_data";
+    case 0x19:
+      return "check_image";
+    case 0x1A:
+      return "run_image";
+    case 0x20:
+      return "change_baudrate";
+    case 0x21:
+      return "reset";
+    case 0x22:
+      return "load_clock_para";
+    case 0x30:
+      return "flash_erase";
+    case 0x31:
+      return "flash_write";
+    case 0x32:
+      return "flash_read";
+    case 0x3A:
+      return "program_check";
+    case 0x3B:
+      return "load_flash_para";
+    case 0x3C:
+      return "chip_erase";
+    case 0x3D:
+      return "flash_read_sha256";
+    case 0x3F:
+      return "flash_decompress_write";
+    case 0x50:
+      return "write_memory";
+    default:
+      return NULL;
+  }
+}
+
+void blisp_metrics_command_sent(struct blisp_metrics* metrics,
+                                uint8_t command,
+                                uint32_t frame_size) {
+  if (metrics == NULL) {
+    return;
+  }
+  struct blisp_command_metrics* counters = &metrics->commands[command];
+  counters->count++;
+  counters->bytes_out += frame_size;
+  metrics->bytes_out += frame_size;
+
+  if (metrics->in_flight_count == BLISP_METRICS_IN_FLIGHT) {
+    // Nobody waited for the oldest answer, stop timing it
+    metrics->in_flight_head =
+        (metrics->in_flight_head + 1) % BLISP_METRICS_IN_FLIGHT;
+    metrics->in_flight_count--;
+  }
+  uint8_t slot = (metrics->in_flight_head + metrics->in_flight_count) %
+                 BLISP_METRICS_IN_FLIGHT;
+  metrics->in_flight[slot].command = command;
+  metrics->in_flight[slot].sent_us = monotonic_us();
+  metrics->in_flight[slot].pending_since_us = 0;
+  metrics->in_flight_count++;
+}
+
+static uint8_t blisp_metrics_bucket(uint64_t duration_us) {
+  uint8_t bucket = 0;
+  uint64_t limit = BLISP_METRICS_BUCKET_0_US;
+  while (bucket < BLISP_METRICS_BUCKETS - 1 && duration_us >= limit) {
+    bucket++;
+    limit <<= 1;
+  }
+  return bucket;
+}
+
+void blisp_metrics_response(struct blisp_metrics* metrics,
+                            const struct blisp_response* response,
+                            bool expect_payload) {
+  if (metrics == NULL || metrics->in_flight_count == 0) {
+    return;  // E.g. the handshake, which isn't a command
+  }
+  uint32_t frame_size = response->type == BLISP_RESPONSE_ERROR ? 4 : 2;
+  if (response->type == BLISP_RESPONSE_OK && expect_payload) {
+    frame_size += 2 + response->payload_length;
+  }
+  uint64_t now = monotonic_us();
+  uint8_t head = metrics->in_flight_head;
+  struct blisp_command_metrics* counters =
+      &metrics->commands[metrics->in_flight[head].command];
+  counters->bytes_in += frame_size;
+
+  if (response->type == BLISP_RESPONSE_PENDING) {
+    counters->pending++;
+    if (metrics->in_flight[head].pending_since_us == 0) {
+      metrics->in_flight[head].pending_since_us = now;
+    }
+    return;
+  }
+  if (response->type == BLISP_RESPONSE_ERROR) {
+    counters->errors++;
+  }
+  if (metrics->in_flight[head].pending_since_us != 0) {
+    counters->pending_us += now - metrics->in_flight[head].pending_since_us;
+  }
+  uint64_t duration_us = now - metrics->in_flight[head].sent_us;
+  uint32_t clamped_us = duration_us > UINT32_MAX ? UINT32_MAX : duration_us;
+  counters->total_us += duration_us;
+  if (counters->min_us == 0 || clamped_us < counters->min_us) {
+    counters->min_us = clamped_us;
+  }
+  if (clamped_us > counters->max_us) {
+    counters->max_us = clamped_us;
+  }
+  counters->histogram[blisp_metrics_bucket(duration_us)]++;
+  if (metrics->command_callback != NULL) {
+    metrics->command_callback(metrics->command_callback_data,
+                              metrics->in_flight[head].command,
+                              metrics->in_flight[head].sent_us, now,
+                              response->type);
+  }
+
+  metrics->in_flight_head = (head + 1) % BLISP_METRICS_IN_FLIGHT;
+  metrics->in_flight_count--;
+}
+
+void blisp_metrics_timeout(struct blisp_metrics* metrics) {
+  if (metrics == NULL || metrics->in_flight_count == 0) {
+    return;
+  }
+  uint8_t head = metrics->in_flight_head;
+  metrics->commands[metrics->in_flight[head].command].timeouts++;
+  // Whatever was still on the wire gets flushed or resent by the caller
+  if (metrics->command_callback != NULL) {
+    uint64_t now = monotonic_us();
+    for (uint8_t i = 0; i < metrics->in_flight_count; i++) {
+      uint8_t slot = (head + i) % BLISP_METRICS_IN_FLIGHT;
+      metrics->command_callback(metrics->command_callback_data,
+                                metrics->in_flight[slot].command,
+                                metrics->in_flight[slot].sent_us, now,
+                                BLISP_RESPONSE_NONE);
+    }
+  }
+  metrics->in_flight_count = 0;
+}
+
+void blisp_metrics_retry(struct blisp_metrics* metrics, uint8_t command) {
+  if (metrics != NULL) {
+    metrics->commands[command].retries++;
+  }
+}
+
+void blisp_metrics_traffic(struct blisp_metrics* metrics,
+                           uint32_t bytes_out,
+                           uint32_t bytes_in) {
+  if (metrics != NULL) {
+    metrics->bytes_out += bytes_out;
+    metrics->bytes_in += bytes_in;
+  }
+}
+
+void blisp_metrics_garbage(struct blisp_metrics* metrics, uint32_t bytes) {
+  if (metrics != NULL) {
+    metrics->garbage_bytes += bytes;
+  }
+}
+
+void blisp_metrics_handshake(struct blisp_metrics* metrics,
+                             bool ok,
+                             uint32_t attempts,
+                             uint64_t duration_us) {
+  if (metrics == NULL) {
+    return;
+  }
+  if (ok) {
+    metrics->handshakes++;
+  } else {
+    metrics->handshake_failures++;
+  }
+  metrics->handshake_attempts += attempts;
+  metrics->handshake_us += duration_us;
+  // A handshake starts over, nothing sent before it gets an answer
+  metrics->in_flight_count = 0;
+}
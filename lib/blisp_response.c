@@ -0,0 +1,92 @@
+// SPDX-License-Identifier: MIT
+#include "blisp_response.h"
+
+#include <string.h>
+
+void blisp_response_parser_reset(struct blisp_response_parser* parser) {
+  parser->start = 0;
+  parser->length = 0;
+  parser->skipped = 0;
+}
+
+/**
+ * Returns how many bytes can be received right now and where they go.
+ * Consumed frames are only moved out of the way here, so payloads handed
+ * out by blisp_response_parser_next stay valid until then.
+ */
+uint32_t blisp_response_parser_space(struct blisp_response_parser* parser,
+                                     uint8_t** tail) {
+  if (parser->start != 0) {
+    memmove(parser->buffer, parser->buffer + parser->start,
+            parser->length - parser->start);
+    parser->length -= parser->start;
+    parser->start = 0;
+  }
+  *tail = parser->buffer + parser->length;
+  return sizeof(parser->buffer) - parser->length;
+}
+
+void blisp_response_parser_commit(struct blisp_response_parser* parser,
+                                  uint32_t count) {
+  parser->length += count;
+}
+
+uint32_t blisp_response_parser_pending(
+    const struct blisp_response_parser* parser) {
+  return parser->length - parser->start;
+}
+
+bool blisp_response_parser_next(struct blisp_response_parser* parser,
+                                bool expect_payload,
+                                uint16_t max_payload_length,
+                                struct blisp_response* response) {
+  response->type = BLISP_RESPONSE_NONE;
+
+  while (parser->length - parser->start >= 2) {
+    const uint8_t* frame = parser->buffer + parser->start;
+    uint32_t available = parser->length - parser->start;
+
+    if (frame[0] == 'P' && frame[1] == 'D') {
+      response->type = BLISP_RESPONSE_PENDING;
+      parser->start += 2;
+      return true;
+    }
+    if (frame[0] == 'F' && frame[1] == 'L') {
+      if (available < 4) {
+        return false;
+      }
+      response->type = BLISP_RESPONSE_ERROR;
+      response->error_code = frame[2] | (frame[3] << 8);
+      parser->start += 4;
+      return true;
+    }
+    if (frame[0] == 'O' && frame[1] == 'K') {
+      if (!expect_payload) {
+        response->type = BLISP_RESPONSE_OK;
+        response->payload = NULL;
+        response->payload_length = 0;
+        parser->start += 2;
+        return true;
+      }
+      if (available < 4) {
+        return false;
+      }
+      uint16_t payload_length = frame[2] | (frame[3] << 8);
+      if (payload_length <= max_payload_length &&
+          4 + (uint32_t)payload_length <= sizeof(parser->buffer)) {
+        if (available < 4 + (uint32_t)payload_length) {
+          return false;
+        }
+        response->type = BLISP_RESPONSE_OK;
+        response->payload = frame + 4;
+        response->payload_length = payload_length;
+        parser->start += 4 + payload_length;
+        return true;
+      }
+      // An 'OK' in the middle of garbage, look for the next frame.
+    }
+    parser->start++;
+    parser->skipped++;
+  }
+  return false;
+}
@@ -0,0 +1,389 @@
+// SPDX-License-Identifier: MIT
+#include <string.h>
+
+#include "blisp_sha256.h"
+
+#if defined(__x86_64__) || defined(_M_X64) || defined(__i386__) || \
+    defined(_M_IX86)
+#define SHA256_X86
+#include <immintrin.h>
+#if defined(_MSC_VER)
+#include <intrin.h>
+#define SHA256_X86_TARGET
+#else
+#include <cpuid.h>
+#define SHA256_X86_TARGET __attribute__((target("sha,sse4.1")))
+#endif
+#elif (defined(__aarch64__) && !defined(__ARM_BIG_ENDIAN)) || \
+    defined(_M_ARM64)
+#if defined(__ARM_FEATURE_SHA2) || defined(_M_ARM64)
+// Every CPU the build targets has the SHA-256 instructions
+#define SHA256_ARM
+#define SHA256_ARM_ALWAYS
+#define SHA256_ARM_TARGET
+#elif defined(__linux__) && defined(__GNUC__)
+#define SHA256_ARM
+#include <sys/auxv.h>
+#ifndef HWCAP_SHA2
+#define HWCAP_SHA2 (1 << 6)
+#endif
+#if defined(__clang__)
+#define SHA256_ARM_TARGET __attribute__((target("crypto")))
+#else
+#define SHA256_ARM_TARGET __attribute__((target("+crypto")))
+#endif
+#endif
+#if defined(SHA256_ARM)
+#include <arm_neon.h>
+#endif
+#endif
+
+static const uint32_t sha256_k[64] = {
+    0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5, 0x3956c25b, 0x59f111f1,
+    0x923f82a4, 0xab1c5ed5, 0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3,
+    0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174, 0xe49b69c1, 0xefbe4786,
+    0x0fc19dc6, 0x240ca1cc, 0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+    0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7, 0xc6e00bf3, 0xd5a79147,
+    0x06ca6351, 0x14292967, 0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13,
+    0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85, 0xa2bfe8a1, 0xa81a664b,
+    0xc24b8b70, 0xc76c51a3, 0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+    0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5, 0x391c0cb3, 0x4ed8aa4a,
+    0x5b9cca4f, 0x682e6ff3, 0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208,
+    0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2};
+
+#define ROTR(x, n) (((x) >> (n)) | ((x) << (32 - (n))))
+
+static void sha256_transform_portable(uint32_t state[8], const uint8_t* data,
+                                      size_t blocks) {
+  uint32_t w[64];
+
+  while (blocks--) {
+    for (int i = 0; i < 16; i++) {
+      w[i] = ((uint32_t)data[i * 4] << 24) | ((uint32_t)data[i * 4 + 1] << 16) |
+             ((uint32_t)data[i * 4 + 2] << 8) | ((uint32_t)data[i * 4 + 3]);
+    }
+    for (int i = 16; i < 64; i++) {
+      uint32_t s0 = ROTR(w[i - 15], 7) ^ ROTR(w[i - 15], 18) ^ (w[i - 15] >> 3);
+      uint32_t s1 = ROTR(w[i - 2], 17) ^ ROTR(w[i - 2], 19) ^ (w[i - 2] >> 10);
+      w[i] = w[i - 16] + s0 + w[i - 7] + s1;
+    }
+
+    uint32_t a = state[0], b = state[1], c = state[2], d = state[3];
+    uint32_t e = state[4], f = state[5], g = state[6], h = state[7];
+    for (int i = 0; i < 64; i++) {
+      uint32_t s1 = ROTR(e, 6) ^ ROTR(e, 11) ^ ROTR(e, 25);
+      uint32_t ch = (e & f) ^ (~e & g);
+      uint32_t t1 = h + s1 + ch + sha256_k[i] + w[i];
+      uint32_t s0 = ROTR(a, 2) ^ ROTR(a, 13) ^ ROTR(a, 22);
+      uint32_t maj = (a & b) ^ (a & c) ^ (b & c);
+      uint32_t t2 = s0 + maj;
+      h = g;
+      g = f;
+      f = e;
+      e = d + t1;
+      d = c;
+      c = b;
+      b = a;
+      a = t1 + t2;
+    }
+    state[0] += a;
+    state[1] += b;
+    state[2] += c;
+    state[3] += d;
+    state[4] += e;
+    state[5] += f;
+    state[6] += g;
+    state[7] += h;
+
+    data += 64;
+  }
+}
+
+#if defined(SHA256_X86)
+
+// Rounds 4 * group to 4 * group + 3, then expands the message words the
+// following groups need
+SHA256_X86_TARGET
+static inline void sha256_x86_group(__m128i* state0, __m128i* state1,
+                                    int group, __m128i current,
+                                    __m128i* previous, __m128i* next) {
+  __m128i msg = _mm_add_epi32(
+      current, _mm_loadu_si128((const __m128i*)&sha256_k[group * 4]));
+  *state1 = _mm_sha256rnds2_epu32(*state1, *state0, msg);
+  *state0 =
+      _mm_sha256rnds2_epu32(*state0, *state1, _mm_shuffle_epi32(msg, 0x0E));
+  if (group >= 3 && group < 15) {
+    *next = _mm_sha256msg2_epu32(
+        _mm_add_epi32(*next, _mm_alignr_epi8(current, *previous, 4)),
+        current);
+  }
+  if (group >= 1 && group < 13) {
+    *previous = _mm_sha256msg1_epu32(*previous, current);
+  }
+}
+
+/**
+ * SHA-256 with the SHA extensions (SHA-NI). The state is kept as ABEF and
+ * CDGH, the layout sha256rnds2 works on.
+ */
+SHA256_X86_TARGET
+static void sha256_transform_x86(uint32_t state[8], const uint8_t* data,
+                                 size_t blocks) {
+  const __m128i byte_swap =
+      _mm_set_epi64x(0x0c0d0e0f08090a0bULL, 0x0405060700010203ULL);
+
+  __m128i tmp = _mm_shuffle_epi32(
+      _mm_loadu_si128((const __m128i*)&state[0]), 0xB1);  // CDAB
+  __m128i state1 = _mm_shuffle_epi32(
+      _mm_loadu_si128((const __m128i*)&state[4]), 0x1B);  // EFGH
+  __m128i state0 = _mm_alignr_epi8(tmp, state1, 8);       // ABEF
+  state1 = _mm_blend_epi16(state1, tmp, 0xF0);            // CDGH
+
+  while (blocks--) {
+    __m128i abef = state0;
+    __m128i cdgh = state1;
+    __m128i w0 = _mm_shuffle_epi8(
+        _mm_loadu_si128((const __m128i*)(data + 0)), byte_swap);
+    __m128i w1 = _mm_shuffle_epi8(
+        _mm_loadu_si128((const __m128i*)(data + 16)), byte_swap);
+    __m128i w2 = _mm_shuffle_epi8(
+        _mm_loadu_si128((const __m128i*)(data + 32)), byte_swap);
+    __m128i w3 = _mm_shuffle_epi8(
+        _mm_loadu_si128((const __m128i*)(data + 48)), byte_swap);
+    // The four words rotate through the roles, four groups at a time
+    for (int group = 0; group < 16; group += 4) {
+      sha256_x86_group(&state0, &state1, group, w0, &w3, &w1);
+      sha256_x86_group(&state0, &state1, group + 1, w1, &w0, &w2);
+      sha256_x86_group(&state0, &state1, group + 2, w2, &w1, &w3);
+      sha256_x86_group(&state0, &state1, group + 3, w3, &w2, &w0);
+    }
+    state0 = _mm_add_epi32(state0, abef);
+    state1 = _mm_add_epi32(state1, cdgh);
+    data += 64;
+  }
+
+  tmp = _mm_shuffle_epi32(state0, 0x1B);        // FEBA
+  state1 = _mm_shuffle_epi32(state1, 0xB1);     // DCHG
+  state0 = _mm_blend_epi16(tmp, state1, 0xF0);  // DCBA
+  state1 = _mm_alignr_epi8(state1, tmp, 8);     // HGFE
+  _mm_storeu_si128((__m128i*)&state[0], state0);
+  _mm_storeu_si128((__m128i*)&state[4], state1);
+}
+
+static int sha256_cpu_check(void) {
+#if defined(_MSC_VER)
+  int info[4];
+  __cpuid(info, 0);
+  if (info[0] < 7) {
+    return 0;
+  }
+  __cpuid(info, 1);
+  int sse41 = (info[2] & (1 << 19)) != 0;
+  __cpuidex(info, 7, 0);
+  return sse41 && (info[1] & (1 << 29));
+#else
+  unsigned int eax, ebx, ecx, edx;
+  if (!__get_cpuid(1, &eax, &ebx, &ecx, &edx) || !(ecx & bit_SSE4_1)) {
+    return 0;
+  }
+  return __get_cpuid_count(7, 0, &eax, &ebx, &ecx, &edx) && (ebx & bit_SHA);
+#endif
+}
+
+#elif defined(SHA256_ARM)
+
+// Rounds 4 * group to 4 * group + 3, then expands *current into the message
+// words of the group 4 further on
+SHA256_ARM_TARGET
+static inline void sha256_arm_group(uint32x4_t* state0, uint32x4_t* state1,
+                                    int group, uint32x4_t* current,
+                                    uint32x4_t next1, uint32x4_t next2,
+                                    uint32x4_t next3) {
+  uint32x4_t wk = vaddq_u32(*current, vld1q_u32(&sha256_k[group * 4]));
+  if (group < 12) {
+    *current = vsha256su1q_u32(vsha256su0q_u32(*current, next1), next2, next3);
+  }
+  uint32x4_t previous = *state0;
+  *state0 = vsha256hq_u32(*state0, *state1, wk);
+  *state1 = vsha256h2q_u32(*state1, previous, wk);
+}
+
+// SHA-256 with the ARMv8 cryptography extension, state kept as ABCD and EFGH
+SHA256_ARM_TARGET
+static void sha256_transform_arm(uint32_t state[8], const uint8_t* data,
+                                 size_t blocks) {
+  uint32x4_t state0 = vld1q_u32(&state[0]);
+  uint32x4_t state1 = vld1q_u32(&state[4]);
+
+  while (blocks--) {
+    uint32x4_t abcd = state0;
+    uint32x4_t efgh = state1;
+    uint32x4_t w0 = vreinterpretq_u32_u8(vrev32q_u8(vld1q_u8(data + 0)));
+    uint32x4_t w1 = vreinterpretq_u32_u8(vrev32q_u8(vld1q_u8(data + 16)));
+    uint32x4_t w2 = vreinterpretq_u32_u8(vrev32q_u8(vld1q_u8(data + 32)));
+    uint32x4_t w3 = vreinterpretq_u32_u8(vrev32q_u8(vld1q_u8(data + 48)));
+    for (int group = 0; group < 16; group += 4) {
+      sha256_arm_group(&state0, &state1, group, &w0, w1, w2, w3);
+      sha256_arm_group(&state0, &state1, group + 1, &w1, w2, w3, w0);
+      sha256_arm_group(&state0, &state1, group + 2, &w2, w3, w0, w1);
+      sha256_arm_group(&state0, &state1, group + 3, &w3, w0, w1, w2);
+    }
+    state0 = vaddq_u32(state0, abcd);
+    state1 = vaddq_u32(state1, efgh);
+    data += 64;
+  }
+
+  vst1q_u32(&state[0], state0);
+  vst1q_u32(&state[4], state1);
+}
+
+static int sha256_cpu_check(void) {
+#if defined(SHA256_ARM_ALWAYS)
+  return 1;
+#else
+  return (getauxval(AT_HWCAP) & HWCAP_SHA2) != 0;
+#endif
+}
+
+#endif
+
+#if defined(SHA256_X86) || defined(SHA256_ARM)
+// 0 until the first call checks the CPU, then 1 for the SHA instructions or
+// -1 for the portable code. Racing first calls all store the same value.
+static int sha256_fast_kernel;
+
+static int sha256_use_fast_kernel(void) {
+  if (sha256_fast_kernel == 0) {
+    sha256_fast_kernel = sha256_cpu_check() ? 1 : -1;
+  }
+  return sha256_fast_kernel > 0;
+}
+#endif
+
+static void sha256_transform(uint32_t state[8], const uint8_t* data,
+                             size_t blocks) {
+#if defined(SHA256_X86)
+  if (sha256_use_fast_kernel()) {
+    sha256_transform_x86(state, data, blocks);
+    return;
+  }
+#elif defined(SHA256_ARM)
+  if (sha256_use_fast_kernel()) {
+    sha256_transform_arm(state, data, blocks);
+    return;
+  }
+#endif
+  sha256_transform_portable(state, data, blocks);
+}
+
+const char* sha256_kernel_name(void) {
+#if defined(SHA256_X86)
+  if (sha256_use_fast_kernel()) {
+    return "sha-ni";
+  }
+#elif defined(SHA256_ARM)
+  if (sha256_use_fast_kernel()) {
+    return "armv8-sha2";
+  }
+#endif
+  return "portable";
+}
+
+void sha256_init(struct sha256_context* ctx) {
+  static const uint32_t initial_state[8] = {0x6a09e667, 0xbb67ae85, 0x3c6ef372,
+                                            0xa54ff53a, 0x510e527f, 0x9b05688c,
+                                            0x1f83d9ab, 0x5be0cd19};
+  memcpy(ctx->state, initial_state, sizeof(initial_state));
+  ctx->length = 0;
+  ctx->buffer_length = 0;
+}
+
+typedef void (*sha256_transform_fn)(uint32_t state[8],
+                                   const uint8_t* data,
+                                   size_t blocks);
+
+static void sha256_update_with(struct sha256_context* ctx,
+                               const void* data,
+                               size_t data_len,
+                               sha256_transform_fn transform) {
+  const uint8_t* d = (const uint8_t*)data;
+  ctx->length += data_len;
+
+  if (ctx->buffer_length > 0) {
+    size_t fill = 64 - ctx->buffer_length;
+    if (fill > data_len) {
+      fill = data_len;
+    }
+    memcpy(ctx->buffer + ctx->buffer_length, d, fill);
+    ctx->buffer_length += fill;
+    d += fill;
+    data_len -= fill;
+    if (ctx->buffer_length < 64) {
+      return;
+    }
+    transform(ctx->state, ctx->buffer, 1);
+    ctx->buffer_length = 0;
+  }
+
+  if (data_len >= 64) {
+    transform(ctx->state, d, data_len / 64);
+    d += data_len & ~(size_t)63;
+    data_len &= 63;
+  }
+
+  if (data_len > 0) {
+    memcpy(ctx->buffer, d, data_len);
+    ctx->buffer_length = data_len;
+  }
+}
+
+static void sha256_final_with(struct sha256_context* ctx,
+                              uint8_t digest[SHA256_DIGEST_SIZE],
+                              sha256_transform_fn transform) {
+  uint64_t bit_length = ctx->length * 8;
+
+  ctx->buffer[ctx->buffer_length++] = 0x80;
+  if (ctx->buffer_length > 56) {
+    memset(ctx->buffer + ctx->buffer_length, 0, 64 - ctx->buffer_length);
+    transform(ctx->state, ctx->buffer, 1);
+    ctx->buffer_length = 0;
+  }
+  memset(ctx->buffer + ctx->buffer_length, 0, 56 - ctx->buffer_length);
+  for (int i = 0; i < 8; i++) {
+    ctx->buffer[56 + i] = (uint8_t)(bit_length >> (56 - i * 8));
+  }
+  transform(ctx->state, ctx->buffer, 1);
+
+  for (int i = 0; i < 8; i++) {
+    digest[i * 4] = (uint8_t)(ctx->state[i] >> 24);
+    digest[i * 4 + 1] = (uint8_t)(ctx->state[i] >> 16);
+    digest[i * 4 + 2] = (uint8_t)(ctx->state[i] >> 8);
+    digest[i * 4 + 3] = (uint8_t)(ctx->state[i]);
+  }
+}
+
+void sha256_update(struct sha256_context* ctx, const void* data,
+                   size_t data_len) {
+  sha256_update_with(ctx, data, data_len, sha256_transform);
+}
+
+void sha256_final(struct sha256_context* ctx,
+                  uint8_t digest[SHA256_DIGEST_SIZE]) {
+  sha256_final_with(ctx, digest, sha256_transform);
+}
+
+void sha256_calculate(const void* data, size_t data_len,
+                      uint8_t digest[SHA256_DIGEST_SIZE]) {
+  struct sha256_context ctx;
+  sha256_init(&ctx);
+  sha256_update(&ctx, data, data_len);
+  sha256_final(&ctx, digest);
+}
+
+void sha256_calculate_portable(const void* data, size_t data_len,
+                               uint8_t digest[SHA256_DIGEST_SIZE]) {
+  struct sha256_context ctx;
+  sha256_init(&ctx);
+  sha256_update_with(&ctx, data, data_len, sha256_transform_portable);
+  sha256_final_with(&ctx, digest, sha256_transform_portable);
+}
@@ -1,7 +1,9 @@
 // SPDX-License-Identifier: MIT
 #include <stdarg.h>
+#include <stdbool.h>
 #include <stdint.h>
 #include <stdio.h>
+#include <string.h>
 
 #ifdef WIN32
 #  include <windows.h>
@@ -9,10 +11,20 @@
 #  include <time.h>
 #endif
 
+#include "blisp_crc32.h"
 #include "blisp_util.h"
 
+static bool dlog_quiet = false;
+
+void blisp_dlog_set_quiet(bool quiet) {
+  dlog_quiet = quiet;
+}
+
 void blisp_dlog(const char* format, ...)
 {
+  if (dlog_quiet) {
+    return;
+  }
   fflush(stdout);
   va_list args;
   va_start(args, format);
@@ -22,6 +34,9 @@ void blisp_dlog(const char* format, ...)
 }
 
 void blisp_dlog_no_nl(const char* format, ...) {
+  if (dlog_quiet) {
+    return;
+  }
   fflush(stdout);
   va_list args;
   va_start(args, format);
@@ -40,16 +55,81 @@ void sleep_ms(int milliseconds) {
 #endif
 }
 
+uint64_t monotonic_us(void) {
+#ifdef WIN32
+  LARGE_INTEGER frequency, counter;
+  QueryPerformanceFrequency(&frequency);
+  QueryPerformanceCounter(&counter);
+  return (uint64_t)(counter.QuadPart / frequency.QuadPart) * 1000000 +
+         (uint64_t)(counter.QuadPart % frequency.QuadPart) * 1000000 /
+             frequency.QuadPart;
+#else
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+#endif
+}
+
 uint32_t crc32_calculate(const void *data, size_t data_len)
 {
-  uint32_t crc = 0xffffffff;
-  const unsigned char *d = (const unsigned char *)data;
-  unsigned int tbl_idx;
-
-  while (data_len--) {
-    tbl_idx = (crc ^ *d) & 0xff;
-    crc = (crc_table[tbl_idx] ^ (crc >> 8)) & 0xffffffff;
-    d++;
+  return crc32_update(0, data, data_len);
+}
+
+// Adds the 255-terminated extension bytes of a length
+static bool lz4_read_length(const uint8_t** src,
+                            const uint8_t* src_end,
+                            size_t* length) {
+  uint8_t more;
+  do {
+    if (*src == src_end) {
+      return false;
+    }
+    more = *(*src)++;
+    *length += more;
+  } while (more == 255);
+  return true;
+}
+
+int64_t lz4_block_decode(const uint8_t* src,
+                         size_t src_size,
+                         uint8_t* dst,
+                         size_t dst_size) {
+  const uint8_t* src_end = src + src_size;
+  size_t n = 0;
+
+  while (src < src_end) {
+    uint8_t token = *src++;
+    size_t length = token >> 4;
+    if (length == 15 && !lz4_read_length(&src, src_end, &length)) {
+      return -1;
+    }
+    if (length > (size_t)(src_end - src) || length > dst_size - n) {
+      return -1;
+    }
+    memcpy(dst + n, src, length);
+    src += length;
+    n += length;
+    if (src == src_end) {
+      break;  // The last sequence has no match
+    }
+
+    if (src_end - src < 2) {
+      return -1;
+    }
+    size_t offset = src[0] | src[1] << 8;
+    src += 2;
+    length = token & 0x0F;
+    if (length == 15 && !lz4_read_length(&src, src_end, &length)) {
+      return -1;
+    }
+    length += 4;
+    if (offset == 0 || offset > n || length > dst_size - n) {
+      return -1;
+    }
+    // Matches may overlap what they produce, so byte by byte
+    for (size_t i = 0; i < length; i++, n++) {
+      dst[n] = dst[n - offset];
+    }
   }
-  return (crc & 0xffffffff) ^ 0xffffffff;
+  return n;
 }
@@ -1,19 +1,34 @@
 // SPDX-License-Identifier: MIT
-#include <stdlib.h>
-#include <string.h>
-#include "../../data/bl60x_eflash_loader.h"
 #include "blisp.h"
+#include "blisp_util.h"
+
+#ifdef BLISP_PACKED_EFLASH_LOADER
+#include "bl60x_eflash_loader_lz4.h"
+
+static uint8_t bl60x_eflash_loader[BL60X_EFLASH_LOADER_SIZE];
+static bool bl60x_eflash_loader_unpacked = false;
 
-int64_t blisp_chip_bl60x_get_eflash_loader(uint8_t clk_type, uint8_t** firmware_buf_ptr)
-{
-  (void)clk_type; // unused
+static const uint8_t* blisp_chip_bl60x_get_eflash_loader(uint32_t* size) {
+  if (!bl60x_eflash_loader_unpacked) {
+    if (lz4_block_decode(bl60x_eflash_loader_lz4,
+                         sizeof(bl60x_eflash_loader_lz4), bl60x_eflash_loader,
+                         sizeof(bl60x_eflash_loader)) !=
+        sizeof(bl60x_eflash_loader)) {
+      return NULL;
+    }
+    bl60x_eflash_loader_unpacked = true;
+  }
+  *size = sizeof(bl60x_eflash_loader);
+  return bl60x_eflash_loader;
+}
+#else
+#include "../../data/bl60x_eflash_loader.h"
 
-  uint8_t* firmware_buf = malloc(sizeof(bl60x_eflash_loader_bin));
-  memcpy(firmware_buf, bl60x_eflash_loader_bin, sizeof(bl60x_eflash_loader_bin));
-  *(firmware_buf + 0xE0) = 4; // TODO: 40 MHz clock
-  *firmware_buf_ptr = firmware_buf;
-  return sizeof(bl60x_eflash_loader_bin);
+static const uint8_t* blisp_chip_bl60x_get_eflash_loader(uint32_t* size) {
+  *size = sizeof(bl60x_eflash_loader_bin);
+  return bl60x_eflash_loader_bin;
 }
+#endif
 
 struct blisp_chip blisp_chip_bl60x = {
     .type = BLISP_CHIP_BL60X,
@@ -21,6 +36,9 @@ struct blisp_chip blisp_chip_bl60x = {
     .usb_isp_available = false,
     .default_xtal = "40m",
     .handshake_byte_multiplier = 0.006f,
-    .load_eflash_loader = blisp_chip_bl60x_get_eflash_loader,
-    .tcm_address = 0x22010000
+    .get_eflash_loader = blisp_chip_bl60x_get_eflash_loader,
+    .eflash_loader_clock = 4,  // TODO: 40 MHz clock only
+    .tcm_address = 0x22010000,
+    .flash_write_max_size = 4096,
+    .segment_data_max_size = 4092
 };
@@ -7,5 +7,7 @@ struct blisp_chip blisp_chip_bl61x = {
     .usb_isp_available = true,
     .default_xtal = "-", // ?
     .handshake_byte_multiplier = 0.003f,
-    .get_eflash_loader = NULL
+    .get_eflash_loader = NULL,
+    .flash_write_max_size = 2048,
+    .segment_data_max_size = 4092
 };
@@ -1,19 +1,34 @@
 // SPDX-License-Identifier: MIT
-#include <stdlib.h>
-#include <string.h>
-#include "../../data/bl70x_eflash_loader.h"
 #include "blisp.h"
+#include "blisp_util.h"
+
+#ifdef BLISP_PACKED_EFLASH_LOADER
+#include "bl70x_eflash_loader_lz4.h"
+
+static uint8_t bl70x_eflash_loader[BL70X_EFLASH_LOADER_SIZE];
+static bool bl70x_eflash_loader_unpacked = false;
 
-int64_t blisp_chip_bl70x_get_eflash_loader(uint8_t clk_type, uint8_t** firmware_buf_ptr)
-{
-  (void) clk_type; // ununsed
+static const uint8_t* blisp_chip_bl70x_get_eflash_loader(uint32_t* size) {
+  if (!bl70x_eflash_loader_unpacked) {
+    if (lz4_block_decode(bl70x_eflash_loader_lz4,
+                         sizeof(bl70x_eflash_loader_lz4), bl70x_eflash_loader,
+                         sizeof(bl70x_eflash_loader)) !=
+        sizeof(bl70x_eflash_loader)) {
+      return NULL;
+    }
+    bl70x_eflash_loader_unpacked = true;
+  }
+  *size = sizeof(bl70x_eflash_loader);
+  return bl70x_eflash_loader;
+}
+#else
+#include "../../data/bl70x_eflash_loader.h"
 
-  uint8_t* firmware_buf = malloc(sizeof(bl70x_eflash_loader_bin));
-  memcpy(firmware_buf, bl70x_eflash_loader_bin, sizeof(bl70x_eflash_loader_bin));
-  *(firmware_buf + 0xE0) = 1; // TODO: 32 MHz clock
-  *firmware_buf_ptr = firmware_buf;
-  return sizeof(bl70x_eflash_loader_bin);
+static const uint8_t* blisp_chip_bl70x_get_eflash_loader(uint32_t* size) {
+  *size = sizeof(bl70x_eflash_loader_bin);
+  return bl70x_eflash_loader_bin;
 }
+#endif
 
 struct blisp_chip blisp_chip_bl70x = {
     .type = BLISP_CHIP_BL70X,
@@ -21,7 +36,10 @@ struct blisp_chip blisp_chip_bl70x = {
     .usb_isp_available = true,
     .default_xtal = "32m",
     .handshake_byte_multiplier = 0.003f,
-    .load_eflash_loader = blisp_chip_bl70x_get_eflash_loader,
-    .tcm_address = 0x22010000
+    .get_eflash_loader = blisp_chip_bl70x_get_eflash_loader,
+    .eflash_loader_clock = 1,  // TODO: 32 MHz clock only
+    .tcm_address = 0x22010000,
+    .flash_write_max_size = 4096,
+    .segment_data_max_size = 4092
 };
 
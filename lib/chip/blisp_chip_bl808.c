@@ -14,7 +14,9 @@ struct blisp_chip blisp_chip_bl808 = {
     .usb_isp_available = true, // TODO: Only for BL808D :-(
     .default_xtal = "-", // XXX: bfl software marks this as "Auto (0x07)"
     .handshake_byte_multiplier = 0.006f,
-    .load_eflash_loader = NULL
+    .get_eflash_loader = NULL,
+    .flash_write_max_size = 2048,
+    .segment_data_max_size = 4092
 };
 
 struct bl808_bootheader_t bl808_header = {
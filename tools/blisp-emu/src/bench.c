@@ -0,0 +1,690 @@
+// SPDX-License-Identifier: MIT
+// End-to-end flashing benchmark. Every run starts a fresh emulator behind a
+// pty and goes through the same steps as `blisp write`, down to planning the
+// erases and writes with flash_plan, then prints one JSON object per run. The
+// device timing model and the images are fixed, so the numbers of two builds
+// can be compared directly.
+#include <getopt.h>
+#include <inttypes.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <blisp.h>
+#include <blisp_easy.h>
+#include <blisp_util.h>
+#include "emulator.h"
+#include "flash_plan.h"
+#include "pty.h"
+
+#ifndef BLISP_BENCH_REVISION
+#define BLISP_BENCH_REVISION "unknown"
+#endif
+
+#define BENCH_MAX_VALUES 16
+#define BENCH_FLASH_ADDRESS 0x10000
+#define BENCH_BLOCK_SIZE 4096
+#define BENCH_SEED 0x2545F491
+
+struct bench_list {
+  uint32_t values[BENCH_MAX_VALUES];
+  uint8_t count;
+};
+
+struct bench_options {
+  const char* revision;  // Build the results belong to
+  enum blisp_chip_type chip;
+  struct bench_list chunk_sizes;
+  struct bench_list baud_rates;
+  struct bench_list image_sizes;
+  struct bench_list sparsities;  // Percent of 4 KiB blocks left blank
+  uint8_t window;
+  bool compress;
+  uint32_t repeat;
+  uint32_t samples;  // Per-command latency samples
+  struct emu_config model;
+};
+
+struct bench_run {
+  uint32_t chunk_size;  // 0 = adaptive
+  uint32_t baud_rate;
+  uint32_t image_size;
+  uint32_t sparsity;
+  uint32_t index;
+};
+
+enum bench_phase {
+  BENCH_PHASE_CONNECT,  // Probe, handshake and boot info
+  BENCH_PHASE_LOADER,   // eflash_loader upload, check, run and handshake
+  BENCH_PHASE_ERASE,
+  BENCH_PHASE_WRITE,
+  BENCH_PHASE_CHECK,  // Program check
+  BENCH_PHASE_COUNT,
+};
+
+static const char* const bench_phase_names[BENCH_PHASE_COUNT] = {
+    "connect", "loader", "erase", "write", "check"};
+
+enum bench_command {
+  BENCH_COMMAND_BOOT_INFO,
+  BENCH_COMMAND_FLASH_READ,
+  BENCH_COMMAND_FLASH_WRITE,
+  BENCH_COMMAND_COUNT,
+};
+
+static const char* const bench_command_names[BENCH_COMMAND_COUNT] = {
+    "boot_info", "flash_read", "flash_write"};
+
+struct bench_result {
+  blisp_return_t ret;
+  const char* failed_phase;
+  uint64_t phase_us[BENCH_PHASE_COUNT];
+  uint64_t total_us;
+  uint32_t settled_chunk_size;
+  uint64_t* latency_us[BENCH_COMMAND_COUNT];
+};
+
+struct bench_emulator {
+  struct emu emu;
+  struct emu_pty pty;
+  pthread_t thread;
+  volatile sig_atomic_t stop;
+};
+
+static int bench_parse_list(const char* text, struct bench_list* list) {
+  char* end;
+
+  list->count = 0;
+  for (;;) {
+    if (list->count == BENCH_MAX_VALUES) {
+      return -1;
+    }
+    unsigned long value = strtoul(text, &end, 0);
+    if (end == text) {
+      return -1;
+    }
+    list->values[list->count++] = value;
+    if (*end == '\0') {
+      return 0;
+    }
+    if (*end != ',') {
+      return -1;
+    }
+    text = end + 1;
+  }
+}
+
+static uint32_t bench_xorshift(uint32_t* state) {
+  uint32_t x = *state;
+  x ^= x << 13;
+  x ^= x >> 17;
+  x ^= x << 5;
+  return *state = x;
+}
+
+// Firmware-like content: words from a small vocabulary, so it compresses
+// about as well as real code. Whether a block is blank only depends on its
+// index, so images of different sizes share their prefix.
+static void bench_fill_image(uint8_t* image, uint32_t size, uint32_t sparsity) {
+  uint32_t state = BENCH_SEED;
+  uint32_t words[64];
+
+  for (size_t i = 0; i < sizeof(words) / sizeof(words[0]); i++) {
+    words[i] = bench_xorshift(&state);
+  }
+  for (uint32_t offset = 0; offset < size; offset += BENCH_BLOCK_SIZE) {
+    uint32_t block_size = size - offset;
+    if (block_size > BENCH_BLOCK_SIZE) {
+      block_size = BENCH_BLOCK_SIZE;
+    }
+    uint32_t block_state = BENCH_SEED ^ (offset / BENCH_BLOCK_SIZE + 1);
+    if (bench_xorshift(&block_state) % 100 < sparsity) {
+      memset(image + offset, 0xFF, block_size);
+      continue;
+    }
+    for (uint32_t i = 0; i < block_size; i += 4) {
+      uint32_t word = words[bench_xorshift(&state) % 64];
+      uint32_t length = block_size - i < 4 ? block_size - i : 4;
+      memcpy(image + offset + i, &word, length);
+    }
+  }
+}
+
+static void* bench_emulator_thread(void* context) {
+  struct bench_emulator* emulator = context;
+  emu_pty_serve(&emulator->emu, &emulator->pty, &emulator->stop);
+  return NULL;
+}
+
+static int bench_emulator_start(struct bench_emulator* emulator,
+                                const struct emu_config* config) {
+  emulator->stop = 0;
+  if (emu_pty_open(&emulator->pty) != 0) {
+    perror("Failed to create pty");
+    return -1;
+  }
+  if (emu_init(&emulator->emu, config, emu_pty_send, &emulator->pty) != 0) {
+    fprintf(stderr, "Failed to allocate flash\n");
+    emu_pty_close(&emulator->pty);
+    return -1;
+  }
+  if (pthread_create(&emulator->thread, NULL, bench_emulator_thread,
+                     emulator) != 0) {
+    fprintf(stderr, "Failed to start the emulator\n");
+    emu_free(&emulator->emu);
+    emu_pty_close(&emulator->pty);
+    return -1;
+  }
+  return 0;
+}
+
+static void bench_emulator_stop(struct bench_emulator* emulator) {
+  emulator->stop = 1;
+  pthread_join(emulator->thread, NULL);
+  emu_free(&emulator->emu);
+  emu_pty_close(&emulator->pty);
+}
+
+// Mirrors blisp_common_prepare_flash, including the probe for a device
+// that is already in eflash_loader.
+static blisp_return_t bench_connect(struct blisp_device* device) {
+  struct blisp_boot_info boot_info;
+  uint32_t previous_timeout = device->serial_timeout;
+  blisp_return_t ret;
+
+  device->serial_timeout = 500;
+  ret = blisp_device_get_boot_info(device, &boot_info);
+  device->serial_timeout = previous_timeout;
+  if (ret == BLISP_OK) {
+    return ret;
+  }
+  ret = blisp_device_handshake(device, false);
+  if (ret != BLISP_OK) {
+    return ret;
+  }
+  return blisp_device_get_boot_info(device, &boot_info);
+}
+
+static blisp_return_t bench_load_loader(struct blisp_device* device) {
+  struct blisp_easy_transport transport;
+
+  blisp_return_t ret =
+      blisp_easy_transport_new_from_eflash_loader(device->chip, &transport);
+  if (ret != BLISP_OK) {
+    return ret;
+  }
+  ret = blisp_easy_load_ram_app(device, &transport, NULL);
+  if (ret != BLISP_OK) {
+    return ret;
+  }
+  ret = blisp_device_check_image(device);
+  if (ret != BLISP_OK) {
+    return ret;
+  }
+  ret = blisp_device_run_image(device);
+  if (ret != BLISP_OK) {
+    return ret;
+  }
+  return blisp_device_handshake(device, true);
+}
+
+static blisp_return_t bench_sample_latency(struct blisp_device* device,
+                                           const struct bench_run* run,
+                                           uint8_t* image,
+                                           uint32_t samples,
+                                           struct bench_result* result) {
+  struct blisp_boot_info boot_info;
+  uint8_t buffer[16];
+  uint32_t chunk_size = result->settled_chunk_size;
+  blisp_return_t ret = BLISP_OK;
+
+  if (chunk_size > run->image_size) {
+    chunk_size = run->image_size;
+  }
+  for (uint32_t i = 0; i < samples; i++) {
+    uint64_t start = monotonic_us();
+    ret = blisp_device_get_boot_info(device, &boot_info);
+    result->latency_us[BENCH_COMMAND_BOOT_INFO][i] = monotonic_us() - start;
+    if (ret != BLISP_OK) {
+      return ret;
+    }
+
+    start = monotonic_us();
+    ret = blisp_device_flash_read(device, BENCH_FLASH_ADDRESS, buffer,
+                                  sizeof(buffer));
+    result->latency_us[BENCH_COMMAND_FLASH_READ][i] = monotonic_us() - start;
+    if (ret != BLISP_OK) {
+      return ret;
+    }
+
+    // Programming the same data again leaves the flash unchanged.
+    start = monotonic_us();
+    ret = blisp_device_flash_write(device, BENCH_FLASH_ADDRESS, image,
+                                   chunk_size);
+    result->latency_us[BENCH_COMMAND_FLASH_WRITE][i] = monotonic_us() - start;
+    if (ret != BLISP_OK) {
+      return ret;
+    }
+  }
+  return ret;
+}
+
+static void bench_execute(const struct bench_options* options,
+                          const struct bench_run* run,
+                          uint8_t* image,
+                          struct bench_result* result) {
+  struct bench_emulator emulator;
+  struct emu_config config = options->model;
+  struct blisp_device device;
+  enum bench_phase phase = BENCH_PHASE_CONNECT;
+  uint64_t start = 0;
+  parsed_firmware_segment_t segment = {BENCH_FLASH_ADDRESS, run->image_size,
+                                       image};
+  struct flash_plan_costs costs;
+  struct flash_plan plan;
+
+  config.chip = options->chip;
+  config.wire_pacing = true;
+  config.flash_size = 4 * 1024 * 1024;
+  while (config.flash_size < BENCH_FLASH_ADDRESS + run->image_size) {
+    config.flash_size *= 2;
+  }
+  result->ret = BLISP_ERR_CANT_OPEN_DEVICE;
+  result->failed_phase = "open";
+  if (bench_emulator_start(&emulator, &config) != 0) {
+    return;
+  }
+
+  blisp_device_init(&device, options->chip == BLISP_CHIP_BL70X
+                                 ? &blisp_chip_bl70x
+                                 : &blisp_chip_bl60x);
+  device.flash_write_chunk_size = run->chunk_size;
+  device.flash_write_window = options->window;
+  device.flash_compress = options->compress;
+  result->ret = blisp_device_open(&device, emulator.pty.path, run->baud_rate);
+  if (result->ret != BLISP_OK) {
+    goto exit1;
+  }
+  // Like blisp_common_flash_image, blank runs aren't sent
+  flash_plan_get_costs(&costs, run->baud_rate, false);
+  result->ret = flash_plan_build(&plan, &segment, 1, &costs);
+  if (result->ret != BLISP_OK) {
+    result->failed_phase = "plan";
+    goto exit2;
+  }
+
+  uint64_t begin = monotonic_us();
+  for (; phase < BENCH_PHASE_COUNT; phase++) {
+    start = monotonic_us();
+    switch (phase) {
+      case BENCH_PHASE_CONNECT:
+        result->ret = bench_connect(&device);
+        break;
+      case BENCH_PHASE_LOADER:
+        result->ret = bench_load_loader(&device);
+        break;
+      case BENCH_PHASE_ERASE:
+        for (size_t i = 0; i < plan.erase_count && result->ret == BLISP_OK;
+             i++) {
+          result->ret = blisp_device_flash_erase(
+              &device, plan.erases[i].address,
+              plan.erases[i].address + plan.erases[i].length - 1);
+        }
+        break;
+      case BENCH_PHASE_WRITE:
+        for (size_t i = 0; i < plan.write_count && result->ret == BLISP_OK;
+             i++) {
+          struct blisp_easy_transport transport =
+              blisp_easy_transport_new_from_memory(plan.writes[i].data,
+                                                   plan.writes[i].length);
+          result->ret =
+              blisp_easy_flash_write(&device, &transport,
+                                     plan.writes[i].address,
+                                     plan.writes[i].length, NULL);
+        }
+        break;
+      case BENCH_PHASE_CHECK:
+        result->ret = blisp_device_program_check(&device);
+        break;
+      default:
+        break;
+    }
+    result->phase_us[phase] = monotonic_us() - start;
+    if (result->ret != BLISP_OK) {
+      result->failed_phase = bench_phase_names[phase];
+      goto exit2;
+    }
+  }
+  result->total_us = monotonic_us() - begin;
+  result->settled_chunk_size = device.flash_write_settled_size;
+
+  result->ret = bench_sample_latency(&device, run, image, options->samples,
+                                     result);
+  if (result->ret != BLISP_OK) {
+    result->failed_phase = "latency";
+    goto exit2;
+  }
+  if (memcmp(emulator.emu.flash + BENCH_FLASH_ADDRESS, image,
+             run->image_size) != 0) {
+    result->ret = BLISP_ERR_CHIP_ERR;
+    result->failed_phase = "verify";
+    goto exit2;
+  }
+  result->failed_phase = NULL;
+
+exit2:
+  flash_plan_free(&plan);
+  blisp_device_close(&device);
+exit1:
+  bench_emulator_stop(&emulator);
+}
+
+static int bench_compare(const void* a, const void* b) {
+  uint64_t x = *(const uint64_t*)a, y = *(const uint64_t*)b;
+  return x < y ? -1 : x > y;
+}
+
+static void bench_print_latency(FILE* output,
+                                uint64_t* samples,
+                                uint32_t count) {
+  if (count == 0) {
+    fputs("null", output);
+    return;
+  }
+  qsort(samples, count, sizeof(samples[0]), bench_compare);
+  fprintf(output,
+          "{\"min\":%" PRIu64 ",\"p50\":%" PRIu64 ",\"p95\":%" PRIu64
+          ",\"max\":%" PRIu64 "}",
+          samples[0], samples[count / 2], samples[count * 95 / 100],
+          samples[count - 1]);
+}
+
+static void bench_print(FILE* output,
+                        const struct bench_options* options,
+                        const struct bench_run* run,
+                        struct bench_result* result) {
+  const struct emu_config* model = &options->model;
+  bool ok = result->failed_phase == NULL;
+
+  fprintf(output,
+          "{\"revision\":\"%s\",\"chip\":\"%s\",\"chunk_size\":%" PRIu32
+          ",\"baud_rate\":%" PRIu32 ",\"image_size\":%" PRIu32
+          ",\"sparsity\":%" PRIu32 ",\"window\":%u,\"compress\":%s,\"run\":%" PRIu32,
+          options->revision,
+          options->chip == BLISP_CHIP_BL70X ? "bl70x" : "bl60x",
+          run->chunk_size, run->baud_rate, run->image_size, run->sparsity,
+          options->window, options->compress ? "true" : "false", run->index);
+  fprintf(output,
+          ",\"model\":{\"latency_us\":%" PRIu32 ",\"erase_us\":%" PRIu32
+          ",\"write_us_per_kib\":%" PRIu32 ",\"pending_us\":%" PRIu32 "}",
+          model->latency_us, model->erase_us, model->write_us_per_kib,
+          model->pending_us);
+  fprintf(output, ",\"ok\":%s", ok ? "true" : "false");
+  if (!ok) {
+    fprintf(output, ",\"error\":%d,\"failed_phase\":\"%s\"}\n", result->ret,
+            result->failed_phase);
+    fflush(output);
+    return;
+  }
+
+  fputs(",\"phase_us\":{", output);
+  for (int phase = 0; phase < BENCH_PHASE_COUNT; phase++) {
+    fprintf(output, "%s\"%s\":%" PRIu64, phase == 0 ? "" : ",",
+            bench_phase_names[phase], result->phase_us[phase]);
+  }
+  fprintf(output, ",\"total\":%" PRIu64 "}", result->total_us);
+  fprintf(output, ",\"settled_chunk_size\":%" PRIu32,
+          result->settled_chunk_size);
+  fprintf(output,
+          ",\"write_bytes_per_s\":%" PRIu64 ",\"total_bytes_per_s\":%" PRIu64,
+          (uint64_t)run->image_size * 1000000 /
+              (result->phase_us[BENCH_PHASE_WRITE] + 1),
+          (uint64_t)run->image_size * 1000000 / (result->total_us + 1));
+  fputs(",\"latency_us\":{", output);
+  for (int command = 0; command < BENCH_COMMAND_COUNT; command++) {
+    fprintf(output, "%s\"%s\":", command == 0 ? "" : ",",
+            bench_command_names[command]);
+    bench_print_latency(output, result->latency_us[command], options->samples);
+  }
+  fputs("}}\n", output);
+  fflush(output);
+}
+
+static void print_usage(void) {
+  puts(
+      "Usage: blisp-bench [options]\n"
+      "Flashes generated images into the emulator and prints one JSON object "
+      "per run.\nLists are comma separated, every combination is run.\n"
+      "\n"
+      "  -c, --chip <bl60x|bl70x>     Chip to emulate (default: bl60x)\n"
+      "  -k, --chunk-size <list>      Flash write chunk sizes, 0 = adaptive "
+      "(default:\n"
+      "                               0,1024,2048,4096)\n"
+      "  -b, --baudrate <list>        Baud rates (default: 115200,2000000)\n"
+      "  -s, --size <list>            Image sizes (default: 65536,262144)\n"
+      "  -S, --sparsity <list>        Percent of blank 4 KiB blocks (default: "
+      "0,75)\n"
+      "  -w, --window <chunks>        Flash write chunks in flight (default: "
+      "1)\n"
+      "      --compress               Use compressed flash writes\n"
+      "  -r, --repeat <n>             Runs per combination (default: 1)\n"
+      "      --samples <n>            Latency samples per command (default: "
+      "32)\n"
+      "      --latency-us <us>        Device response latency (default: 200)\n"
+      "      --erase-us <us>          Time per erased sector (default: "
+      "20000)\n"
+      "      --write-us-per-kib <us>  Time per programmed KiB (default: "
+      "1500)\n"
+      "      --pending-us <us>        'PD' interval while busy (default: "
+      "20000)\n"
+      "  -f, --fault <hex>:<n>[:kind] Fail the nth occurrence of a command in "
+      "every\n"
+      "                               run, kind is error (default), drop or "
+      "noise\n"
+      "  -o, --output <file>          Append results to file instead of "
+      "stdout\n"
+      "      --revision <text>        Build to attribute the results to "
+      "(default: " BLISP_BENCH_REVISION ")\n"
+      "  -h, --help                   Print this help and exit");
+}
+
+int main(int argc, char** argv) {
+  static const struct option long_options[] = {
+      {"chip", required_argument, NULL, 'c'},
+      {"chunk-size", required_argument, NULL, 'k'},
+      {"baudrate", required_argument, NULL, 'b'},
+      {"size", required_argument, NULL, 's'},
+      {"sparsity", required_argument, NULL, 'S'},
+      {"window", required_argument, NULL, 'w'},
+      {"compress", no_argument, NULL, 'C'},
+      {"repeat", required_argument, NULL, 'r'},
+      {"samples", required_argument, NULL, 'n'},
+      {"latency-us", required_argument, NULL, 'l'},
+      {"erase-us", required_argument, NULL, 'e'},
+      {"write-us-per-kib", required_argument, NULL, 'W'},
+      {"pending-us", required_argument, NULL, 'p'},
+      {"fault", required_argument, NULL, 'f'},
+      {"output", required_argument, NULL, 'o'},
+      {"revision", required_argument, NULL, 'R'},
+      {"help", no_argument, NULL, 'h'},
+      {NULL, 0, NULL, 0}};
+  struct bench_options options = {
+      .revision = BLISP_BENCH_REVISION,
+      .chip = BLISP_CHIP_BL60X,
+      .chunk_sizes = {{0, 1024, 2048, 4096}, 4},
+      .baud_rates = {{115200, 2000000}, 2},
+      .image_sizes = {{65536, 262144}, 2},
+      .sparsities = {{0, 75}, 2},
+      .window = 1,
+      .repeat = 1,
+      .samples = 32,
+      .model = {.latency_us = 200,
+                .erase_us = 20000,
+                .write_us_per_kib = 1500,
+                .pending_us = 20000},
+  };
+  FILE* output = stdout;
+  int ret = EXIT_SUCCESS;
+  int option;
+  bool valid = true;
+
+  while ((option = getopt_long(argc, argv, "c:k:b:s:S:w:r:f:o:h", long_options,
+                               NULL)) != -1) {
+    switch (option) {
+      case 'c':
+        if (strcmp(optarg, "bl60x") == 0) {
+          options.chip = BLISP_CHIP_BL60X;
+        } else if (strcmp(optarg, "bl70x") == 0) {
+          options.chip = BLISP_CHIP_BL70X;
+        } else {
+          valid = false;
+        }
+        break;
+      case 'k':
+        valid &= bench_parse_list(optarg, &options.chunk_sizes) == 0;
+        break;
+      case 'b':
+        valid &= bench_parse_list(optarg, &options.baud_rates) == 0;
+        break;
+      case 's':
+        valid &= bench_parse_list(optarg, &options.image_sizes) == 0;
+        break;
+      case 'S':
+        valid &= bench_parse_list(optarg, &options.sparsities) == 0;
+        break;
+      case 'w':
+        options.window = strtoul(optarg, NULL, 0);
+        break;
+      case 'C':
+        options.compress = true;
+        break;
+      case 'r':
+        options.repeat = strtoul(optarg, NULL, 0);
+        break;
+      case 'n':
+        options.samples = strtoul(optarg, NULL, 0);
+        break;
+      case 'l':
+        options.model.latency_us = strtoul(optarg, NULL, 0);
+        break;
+      case 'e':
+        options.model.erase_us = strtoul(optarg, NULL, 0);
+        break;
+      case 'W':
+        options.model.write_us_per_kib = strtoul(optarg, NULL, 0);
+        break;
+      case 'p':
+        options.model.pending_us = strtoul(optarg, NULL, 0);
+        break;
+      case 'f':
+        if (options.model.fault_count == EMU_MAX_FAULTS ||
+            emu_parse_fault(optarg, &options.model.faults
+                                        [options.model.fault_count]) != 0) {
+          valid = false;
+          break;
+        }
+        options.model.fault_count++;
+        break;
+      case 'o':
+        output = fopen(optarg, "a");
+        if (output == NULL) {
+          perror(optarg);
+          return EXIT_FAILURE;
+        }
+        break;
+      case 'R':
+        options.revision = optarg;
+        break;
+      case 'h':
+        print_usage();
+        return EXIT_SUCCESS;
+      default:
+        valid = false;
+        break;
+    }
+  }
+  for (uint8_t i = 0; i < options.chunk_sizes.count; i++) {
+    if (options.chunk_sizes.values[i] > BLISP_FLASH_WRITE_MAX_SIZE) {
+      valid = false;
+    }
+  }
+  for (uint8_t i = 0; i < options.sparsities.count; i++) {
+    if (options.sparsities.values[i] > 100) {
+      valid = false;
+    }
+  }
+  for (uint8_t i = 0; i < options.image_sizes.count; i++) {
+    if (options.image_sizes.values[i] == 0) {
+      valid = false;
+    }
+  }
+  if (!valid || options.window < 1 ||
+      options.window > BLISP_EASY_MAX_WRITE_WINDOW) {
+    print_usage();
+    return EXIT_FAILURE;
+  }
+  if (options.compress && !blisp_easy_flash_compress_supported()) {
+    fprintf(stderr, "Built without compression support\n");
+    return EXIT_FAILURE;
+  }
+
+  struct bench_result result;
+  for (int command = 0; command < BENCH_COMMAND_COUNT; command++) {
+    result.latency_us[command] =
+        calloc(options.samples + 1, sizeof(result.latency_us[command][0]));
+    if (result.latency_us[command] == NULL) {
+      fprintf(stderr, "Out of memory\n");
+      return EXIT_FAILURE;
+    }
+  }
+
+  for (uint8_t s = 0; s < options.image_sizes.count; s++) {
+    uint32_t image_size = options.image_sizes.values[s];
+    uint8_t* image = malloc(image_size);
+    if (image == NULL) {
+      fprintf(stderr, "Out of memory\n");
+      ret = EXIT_FAILURE;
+      break;
+    }
+    for (uint8_t p = 0; p < options.sparsities.count; p++) {
+      bench_fill_image(image, image_size, options.sparsities.values[p]);
+      for (uint8_t b = 0; b < options.baud_rates.count; b++) {
+        for (uint8_t k = 0; k < options.chunk_sizes.count; k++) {
+          for (uint32_t i = 0; i < options.repeat; i++) {
+            struct bench_run run = {
+                .chunk_size = options.chunk_sizes.values[k],
+                .baud_rate = options.baud_rates.values[b],
+                .image_size = image_size,
+                .sparsity = options.sparsities.values[p],
+                .index = i,
+            };
+            fprintf(stderr,
+                    "%" PRIu32 " bytes, %" PRIu32 "%% blank, %" PRIu32
+                    " baud, %" PRIu32 " byte chunks... ",
+                    run.image_size, run.sparsity, run.baud_rate,
+                    run.chunk_size);
+            bench_execute(&options, &run, image, &result);
+            if (result.failed_phase == NULL) {
+              fprintf(stderr, "%.2f s (%" PRIu32 " byte chunks)\n",
+                      result.total_us / 1e6, result.settled_chunk_size);
+            } else {
+              fprintf(stderr, "failed in %s (%d)\n", result.failed_phase,
+                      result.ret);
+              ret = EXIT_FAILURE;
+            }
+            bench_print(output, &options, &run, &result);
+          }
+        }
+      }
+    }
+    free(image);
+  }
+
+  for (int command = 0; command < BENCH_COMMAND_COUNT; command++) {
+    free(result.latency_us[command]);
+  }
+  if (output != stdout) {
+    fclose(output);
+  }
+  return ret;
+}
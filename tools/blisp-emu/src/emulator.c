@@ -0,0 +1,527 @@
+// SPDX-License-Identifier: MIT
+#include "emulator.h"
+#include <blisp_sha256.h>
+#include <blisp_util.h>
+#include <inttypes.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#ifdef BLISP_HAS_LZMA
+#include <lzma.h>
+#endif
+
+// A new run of 'U' bytes after this much silence is a new handshake attempt
+#define EMU_HANDSHAKE_GAP_US 20000
+
+static void emu_log(struct emu* emu, const char* format, ...)
+    __attribute__((format(printf, 2, 3)));
+
+static void emu_log(struct emu* emu, const char* format, ...) {
+  if (!emu->config.verbose) {
+    return;
+  }
+  va_list args;
+  va_start(args, format);
+  vfprintf(stderr, format, args);
+  va_end(args);
+  fputc('\n', stderr);
+}
+
+static void emu_sleep_us(uint64_t us) {
+  if (us == 0) {
+    return;
+  }
+  struct timespec ts;
+  ts.tv_sec = us / 1000000;
+  ts.tv_nsec = (us % 1000000) * 1000;
+  nanosleep(&ts, NULL);
+}
+
+// Time the bytes would take on a UART with 8N1 framing
+static void emu_pace(struct emu* emu, size_t size) {
+  if (emu->config.wire_pacing && emu->baud_rate != 0) {
+    emu_sleep_us((uint64_t)size * 10 * 1000000 / emu->baud_rate);
+  }
+}
+
+static void emu_send(struct emu* emu, const uint8_t* data, size_t size) {
+  emu->send(emu->send_context, data, size);
+  emu_pace(emu, size);
+}
+
+// Spends busy_us as the flash would, sending 'PD' along the way if asked to.
+static void emu_busy(struct emu* emu, uint64_t busy_us) {
+  uint32_t pending_us = emu->config.pending_us;
+  while (pending_us != 0 && busy_us > pending_us) {
+    emu_sleep_us(pending_us);
+    emu_send(emu, (const uint8_t*)"PD", 2);
+    busy_us -= pending_us;
+  }
+  emu_sleep_us(busy_us);
+}
+
+static void emu_respond_ok(struct emu* emu,
+                           const uint8_t* payload,
+                           uint16_t size) {
+  uint8_t header[4] = {'O', 'K', size & 0xFF, (size >> 8) & 0xFF};
+  emu_sleep_us(emu->config.latency_us);
+  if (payload == NULL) {
+    emu_send(emu, header, 2);
+    return;
+  }
+  emu_send(emu, header, 4);
+  emu_send(emu, payload, size);
+}
+
+static void emu_respond_error(struct emu* emu, uint16_t error) {
+  uint8_t response[4] = {'F', 'L', error & 0xFF, (error >> 8) & 0xFF};
+  emu_sleep_us(emu->config.latency_us);
+  emu_send(emu, response, 4);
+}
+
+static uint32_t emu_read_u32(const uint8_t* data) {
+  return data[0] | data[1] << 8 | data[2] << 16 | (uint32_t)data[3] << 24;
+}
+
+static bool emu_flash_range_valid(struct emu* emu,
+                                  uint32_t address,
+                                  uint32_t size) {
+  return address <= emu->config.flash_size &&
+         size <= emu->config.flash_size - address;
+}
+
+// NOR flash can only clear bits, programming never sets them back to 1.
+static void emu_flash_program(struct emu* emu,
+                              uint32_t address,
+                              const uint8_t* data,
+                              uint32_t size) {
+  for (uint32_t i = 0; i < size; i++) {
+    emu->flash[address + i] &= data[i];
+  }
+  emu_busy(emu, (uint64_t)size * emu->config.write_us_per_kib / 1024);
+}
+
+static void emu_flash_erase(struct emu* emu, uint32_t start, uint32_t end) {
+  start -= start % EMU_SECTOR_SIZE;
+  end = end - end % EMU_SECTOR_SIZE + EMU_SECTOR_SIZE;
+  if (end > emu->config.flash_size) {
+    end = emu->config.flash_size;
+  }
+  memset(emu->flash + start, 0xFF, end - start);
+  emu_busy(emu,
+           (uint64_t)(end - start) / EMU_SECTOR_SIZE * emu->config.erase_us);
+}
+
+static void emu_decompress_reset(struct emu* emu) {
+#ifdef BLISP_HAS_LZMA
+  if (emu->decompress != NULL) {
+    lzma_end(emu->decompress);
+    free(emu->decompress);
+    emu->decompress = NULL;
+  }
+#else
+  (void)emu;
+#endif
+}
+
+static uint16_t emu_decompress_write(struct emu* emu,
+                                     uint32_t address,
+                                     const uint8_t* data,
+                                     uint32_t size) {
+#ifdef BLISP_HAS_LZMA
+  uint8_t out[EMU_SECTOR_SIZE];
+
+  if (emu->decompress == NULL) {
+    lzma_stream init = LZMA_STREAM_INIT;
+    emu->decompress = malloc(sizeof(lzma_stream));
+    *(lzma_stream*)emu->decompress = init;
+    if (lzma_stream_decoder(emu->decompress, UINT64_MAX, 0) != LZMA_OK) {
+      emu_decompress_reset(emu);
+      return EMU_ERR_DECOMPRESS;
+    }
+    emu->decompress_address = address;
+  }
+  lzma_stream* stream = emu->decompress;
+  stream->next_in = data;
+  stream->avail_in = size;
+  lzma_ret ret = LZMA_OK;
+  while (ret == LZMA_OK && (stream->avail_in > 0 || stream->avail_out == 0)) {
+    stream->next_out = out;
+    stream->avail_out = sizeof(out);
+    ret = lzma_code(stream, LZMA_RUN);
+    uint32_t produced = sizeof(out) - stream->avail_out;
+    if (!emu_flash_range_valid(emu, emu->decompress_address, produced)) {
+      emu_decompress_reset(emu);
+      return EMU_ERR_FLASH_ADDR;
+    }
+    emu_flash_program(emu, emu->decompress_address, out, produced);
+    emu->decompress_address += produced;
+  }
+  if (ret == LZMA_STREAM_END) {
+    emu_decompress_reset(emu);
+  } else if (ret != LZMA_OK) {
+    emu_decompress_reset(emu);
+    return EMU_ERR_DECOMPRESS;
+  }
+  return 0;
+#else
+  (void)emu;
+  (void)address;
+  (void)data;
+  (void)size;
+  return EMU_ERR_CMD_ID;
+#endif
+}
+
+static bool emu_checksum_valid(const uint8_t* frame, uint16_t length) {
+  // Commands sent without a checksum carry 0
+  if (frame[1] == 0) {
+    return true;
+  }
+  uint32_t checksum = frame[2] + frame[3];
+  for (uint16_t i = 0; i < length; i++) {
+    checksum += frame[4 + i];
+  }
+  return (checksum & 0xFF) == frame[1];
+}
+
+static const char* const emu_fault_names[] = {"error", "drop", "noise"};
+
+static const struct emu_fault* emu_find_fault(struct emu* emu,
+                                              uint8_t command) {
+  for (uint8_t i = 0; i < emu->config.fault_count; i++) {
+    const struct emu_fault* fault = &emu->config.faults[i];
+    if (fault->command == command &&
+        fault->nth == emu->command_count[command]) {
+      return fault;
+    }
+  }
+  return NULL;
+}
+
+static void emu_boot_info(struct emu* emu) {
+  uint8_t info[24] = {0};
+  if (emu->stage == EMU_STAGE_EFLASH_LOADER) {
+    memset(info, 0xFF, 4);
+  } else {
+    info[0] = 1;
+  }
+  // Chip ID, at the offset blisp_device_get_boot_info expects for the chip
+  uint8_t offset = emu->config.chip == BLISP_CHIP_BL70X ? 16 : 12;
+  for (uint8_t i = 0; i < 6; i++) {
+    info[offset + i] = 0xA0 + i;
+  }
+  emu_respond_ok(emu, info, sizeof(info));
+}
+
+static void emu_command(struct emu* emu,
+                        uint8_t command,
+                        const uint8_t* payload,
+                        uint16_t length) {
+  uint16_t error = 0;
+
+  switch (command) {
+    case 0x10:  // Get boot info
+      emu_boot_info(emu);
+      return;
+    case 0x11:  // Load boot header
+      if (length != 176) {
+        error = EMU_ERR_CMD_LEN;
+        break;
+      }
+      emu_respond_ok(emu, NULL, 0);
+      return;
+    case 0x17:  // Load segment header, echoed back
+      if (length != 16) {
+        error = EMU_ERR_CMD_LEN;
+        break;
+      }
+      emu_respond_ok(emu, payload, length);
+      return;
+    case 0x18:  // Load segment data
+    case 0x19:  // Check image
+    case 0x22:  // Clock set
+    case 0x3A:  // Program check
+    case 0x3B:  // Flash parameters
+      emu_respond_ok(emu, NULL, 0);
+      return;
+    case 0x1A:  // Run image
+      emu_respond_ok(emu, NULL, 0);
+      emu->stage = EMU_STAGE_EFLASH_LOADER;
+      emu->synced = false;
+      return;
+    case 0x20:  // Change baud rate, the loader resyncs afterwards
+      if (length != 8) {
+        error = EMU_ERR_CMD_LEN;
+        break;
+      }
+      emu_respond_ok(emu, NULL, 0);
+      emu->synced = false;
+      return;
+    case 0x21:  // Reset
+      emu_respond_ok(emu, NULL, 0);
+      emu->stage = EMU_STAGE_BOOTROM;
+      emu->synced = false;
+      return;
+    case 0x30: {  // Flash erase, end address inclusive
+      if (length != 8) {
+        error = EMU_ERR_CMD_LEN;
+        break;
+      }
+      uint32_t start = emu_read_u32(payload);
+      uint32_t end = emu_read_u32(payload + 4);
+      if (end < start || !emu_flash_range_valid(emu, start, end - start + 1)) {
+        error = EMU_ERR_FLASH_ADDR;
+        break;
+      }
+      emu_flash_erase(emu, start, end);
+      emu_respond_ok(emu, NULL, 0);
+      return;
+    }
+    case 0x31: {  // Flash write
+      if (length < 4) {
+        error = EMU_ERR_CMD_LEN;
+        break;
+      }
+      uint32_t address = emu_read_u32(payload);
+      if (!emu_flash_range_valid(emu, address, length - 4)) {
+        error = EMU_ERR_FLASH_ADDR;
+        break;
+      }
+      emu_flash_program(emu, address, payload + 4, length - 4);
+      emu_respond_ok(emu, NULL, 0);
+      return;
+    }
+    case 0x32: {  // Flash read
+      if (length != 8) {
+        error = EMU_ERR_CMD_LEN;
+        break;
+      }
+      uint32_t address = emu_read_u32(payload);
+      uint32_t size = emu_read_u32(payload + 4);
+      if (size > 0xFFFF || !emu_flash_range_valid(emu, address, size)) {
+        error = EMU_ERR_FLASH_ADDR;
+        break;
+      }
+      emu_respond_ok(emu, emu->flash + address, size);
+      return;
+    }
+    case 0x3C:  // Chip erase
+      emu_flash_erase(emu, 0, emu->config.flash_size - 1);
+      emu_respond_ok(emu, NULL, 0);
+      return;
+    case 0x3D: {  // Flash SHA-256
+      uint8_t digest[SHA256_DIGEST_SIZE];
+      if (length != 8) {
+        error = EMU_ERR_CMD_LEN;
+        break;
+      }
+      uint32_t address = emu_read_u32(payload);
+      uint32_t size = emu_read_u32(payload + 4);
+      if (!emu_flash_range_valid(emu, address, size)) {
+        error = EMU_ERR_FLASH_ADDR;
+        break;
+      }
+      sha256_calculate(emu->flash + address, size, digest);
+      emu_respond_ok(emu, digest, sizeof(digest));
+      return;
+    }
+    case 0x3F:  // Flash decompress write
+      if (length < 4) {
+        error = EMU_ERR_CMD_LEN;
+        break;
+      }
+      error = emu_decompress_write(emu, emu_read_u32(payload), payload + 4,
+                                   length - 4);
+      if (error == 0) {
+        emu_respond_ok(emu, NULL, 0);
+        return;
+      }
+      break;
+    case 0x50: {  // Memory write
+      if (length != 8) {
+        error = EMU_ERR_CMD_LEN;
+        break;
+      }
+      uint32_t address = emu_read_u32(payload);
+      uint32_t value = emu_read_u32(payload + 4);
+      // BL70X errata: a software reset through GLB jumps into the RAM image,
+      // and blisp does not wait for an answer to it.
+      if (emu->config.chip == BLISP_CHIP_BL70X && address == 0x40000018 &&
+          (value & 0x2)) {
+        emu->stage = EMU_STAGE_EFLASH_LOADER;
+        emu->synced = false;
+        return;
+      }
+      emu_respond_ok(emu, NULL, 0);
+      return;
+    }
+    default:
+      error = EMU_ERR_CMD_ID;
+      break;
+  }
+
+  emu_log(emu, "command 0x%02X failed: 0x%04X", command, error);
+  emu_respond_error(emu, error);
+}
+
+// Handles every complete frame in rx_buffer, keeps a partial one for later.
+static size_t emu_process_frames(struct emu* emu, size_t position) {
+  while (emu->synced && emu->rx_length - position >= 4) {
+    uint8_t* frame = emu->rx_buffer + position;
+    uint8_t command = frame[0];
+
+    if (command == 'U') {
+      // The host handshakes again (e.g. after a failed baud rate switch)
+      emu->synced = false;
+      emu->handshaking = false;
+      break;
+    }
+    uint16_t length = frame[2] | frame[3] << 8;
+    if (emu->rx_length - position < 4u + length) {
+      break;
+    }
+    position += 4u + length;
+    emu->command_count[command]++;
+    emu_log(emu, "%s: command 0x%02X, %u bytes",
+            emu->stage == EMU_STAGE_BOOTROM ? "bootrom" : "eflash_loader",
+            command, length);
+
+    const struct emu_fault* fault = emu_find_fault(emu, command);
+    if (fault != NULL) {
+      emu_log(emu, "injecting %s into command 0x%02X #%" PRIu32,
+              emu_fault_names[fault->kind], command, fault->nth);
+      if (fault->kind == EMU_FAULT_NOISE) {
+        // Line noise, with a few bytes that look like the start of a frame
+        static const uint8_t noise[] = {0x00, 'O', 'X', 'P', 0x55,
+                                        'F',  0xFF, 'D', 0x0D, 0x0A};
+        emu_send(emu, noise, sizeof(noise));
+      } else {
+        if (fault->kind == EMU_FAULT_ERROR) {
+          emu_respond_error(emu, EMU_ERR_INJECTED);
+        }
+        continue;
+      }
+    }
+    if (!emu_checksum_valid(frame, length)) {
+      emu_respond_error(emu, EMU_ERR_CMD_CRC);
+      continue;
+    }
+    emu_command(emu, command, frame + 4, length);
+  }
+  return position;
+}
+
+int emu_parse_fault(const char* text, struct emu_fault* fault) {
+  char kind[8] = "error";
+  unsigned int command, nth;
+
+  if (sscanf(text, "%x:%u:%7s", &command, &nth, kind) < 2 || command > 0xFF ||
+      nth == 0) {
+    return -1;
+  }
+  fault->command = command;
+  fault->nth = nth;
+  if (strcmp(kind, "error") == 0) {
+    fault->kind = EMU_FAULT_ERROR;
+  } else if (strcmp(kind, "drop") == 0) {
+    fault->kind = EMU_FAULT_DROP;
+  } else if (strcmp(kind, "noise") == 0) {
+    fault->kind = EMU_FAULT_NOISE;
+  } else {
+    return -1;
+  }
+  return 0;
+}
+
+int emu_init(struct emu* emu,
+             const struct emu_config* config,
+             emu_send_fn send,
+             void* send_context) {
+  memset(emu, 0, sizeof(*emu));
+  emu->config = *config;
+  emu->flash = malloc(config->flash_size);
+  if (emu->flash == NULL) {
+    return -1;
+  }
+  memset(emu->flash, 0xFF, config->flash_size);
+  emu->stage = EMU_STAGE_BOOTROM;
+  emu->send = send;
+  emu->send_context = send_context;
+  return 0;
+}
+
+void emu_free(struct emu* emu) {
+  emu_decompress_reset(emu);
+  free(emu->flash);
+  emu->flash = NULL;
+}
+
+// Consumes handshake bytes at position, returns where commands start or
+// the end of the buffer.
+static size_t emu_process_handshake(struct emu* emu,
+                                    size_t position,
+                                    bool gap) {
+  while (!emu->synced && position < emu->rx_length) {
+    // Until the handshake only 'U' bytes mean anything, everything else is
+    // line noise (or a command the chip isn't listening for yet).
+    if (emu->rx_buffer[position] != 'U') {
+      if (emu->handshaking) {
+        emu->handshaking = false;
+        emu->synced = true;
+      } else {
+        position++;
+      }
+      continue;
+    }
+    if (!emu->handshaking || gap) {
+      emu_log(emu, "%s: handshake",
+              emu->stage == EMU_STAGE_BOOTROM ? "bootrom" : "eflash_loader");
+      emu->handshaking = true;
+      emu_decompress_reset(emu);
+      emu_respond_ok(emu, NULL, 0);
+      gap = false;
+    }
+    position++;
+  }
+  return position;
+}
+
+void emu_feed(struct emu* emu, const uint8_t* data, size_t size) {
+  uint64_t now = monotonic_us();
+  bool gap = now - emu->last_rx_us > EMU_HANDSHAKE_GAP_US;
+  emu->last_rx_us = now;
+  emu_pace(emu, size);
+
+  while (size > 0) {
+    size_t chunk = sizeof(emu->rx_buffer) - emu->rx_length;
+    if (chunk > size) {
+      chunk = size;
+    }
+    memcpy(emu->rx_buffer + emu->rx_length, data, chunk);
+    emu->rx_length += chunk;
+    data += chunk;
+    size -= chunk;
+
+    size_t position = 0;
+    for (;;) {
+      if (!emu->synced) {
+        position = emu_process_handshake(emu, position, gap);
+        gap = false;
+      }
+      if (!emu->synced) {
+        break;
+      }
+      position = emu_process_frames(emu, position);
+      if (emu->synced) {
+        break;  // Waiting for the rest of a frame
+      }
+    }
+    memmove(emu->rx_buffer, emu->rx_buffer + position,
+            emu->rx_length - position);
+    emu->rx_length -= position;
+  }
+}
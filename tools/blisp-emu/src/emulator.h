@@ -0,0 +1,80 @@
+// SPDX-License-Identifier: MIT
+#ifndef BLISP_EMU_EMULATOR_H
+#define BLISP_EMU_EMULATOR_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <blisp_chip.h>
+
+#define EMU_MAX_FAULTS 16
+#define EMU_SECTOR_SIZE 4096
+
+// Error codes sent back in 'FL' responses
+#define EMU_ERR_CMD_ID 0x0101
+#define EMU_ERR_CMD_LEN 0x0102
+#define EMU_ERR_CMD_CRC 0x0103
+#define EMU_ERR_FLASH_ADDR 0x0201
+#define EMU_ERR_DECOMPRESS 0x0202
+#define EMU_ERR_INJECTED 0xFFFF
+
+enum emu_fault_kind {
+  EMU_FAULT_ERROR,  // Answer with 'FL'
+  EMU_FAULT_DROP,   // Don't answer at all
+  EMU_FAULT_NOISE,  // Send stray bytes before the answer
+};
+
+// Fires on the nth occurrence of a command
+struct emu_fault {
+  uint8_t command;
+  uint32_t nth;
+  enum emu_fault_kind kind;
+};
+
+struct emu_config {
+  enum blisp_chip_type chip;  // BLISP_CHIP_BL60X or BLISP_CHIP_BL70X
+  uint32_t flash_size;
+  uint32_t latency_us;          // Added before every response
+  uint32_t erase_us;            // Per erased sector
+  uint32_t write_us_per_kib;    // Per programmed KiB
+  uint32_t pending_us;          // 'PD' interval during busy time, 0 = never
+  bool wire_pacing;             // Take as long as a UART at the baud rate
+  bool verbose;                 // Log every command to stderr
+  struct emu_fault faults[EMU_MAX_FAULTS];
+  uint8_t fault_count;
+};
+
+enum emu_stage {
+  EMU_STAGE_BOOTROM,
+  EMU_STAGE_EFLASH_LOADER,
+};
+
+typedef void (*emu_send_fn)(void* context, const uint8_t* data, size_t size);
+
+struct emu {
+  struct emu_config config;
+  uint8_t* flash;
+  enum emu_stage stage;
+  bool synced;       // Handshake done, bytes are commands
+  bool handshaking;  // Inside a run of 'U' bytes
+  uint64_t last_rx_us;
+  uint32_t baud_rate;
+  uint8_t rx_buffer[8 + 0xFFFF];
+  size_t rx_length;
+  uint32_t command_count[256];
+  emu_send_fn send;
+  void* send_context;
+  void* decompress;  // lzma_stream of an unfinished decompress-write
+  uint32_t decompress_address;
+};
+
+// Parses <hex command>:<n>[:error|drop|noise], as taken by --fault
+int emu_parse_fault(const char* text, struct emu_fault* fault);
+int emu_init(struct emu* emu,
+             const struct emu_config* config,
+             emu_send_fn send,
+             void* send_context);
+void emu_free(struct emu* emu);
+void emu_feed(struct emu* emu, const uint8_t* data, size_t size);
+
+#endif  // BLISP_EMU_EMULATOR_H
@@ -0,0 +1,196 @@
+// SPDX-License-Identifier: MIT
+// Emulates a Bouffalo chip (BootROM and eflash_loader) behind a pseudo
+// terminal, so blisp can be run and measured without hardware.
+#include <getopt.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include "emulator.h"
+#include "pty.h"
+
+static volatile sig_atomic_t stop = 0;
+
+static void handle_signal(int signal) {
+  (void)signal;
+  stop = 1;
+}
+
+static int load_flash(struct emu* emu, const char* path) {
+  FILE* file = fopen(path, "rb");
+  if (file == NULL) {
+    return -1;
+  }
+  size_t size = fread(emu->flash, 1, emu->config.flash_size, file);
+  fclose(file);
+  fprintf(stderr, "Loaded %zu bytes of flash from %s\n", size, path);
+  return 0;
+}
+
+static int dump_flash(struct emu* emu, const char* path) {
+  FILE* file = fopen(path, "wb");
+  if (file == NULL) {
+    return -1;
+  }
+  size_t size = fwrite(emu->flash, 1, emu->config.flash_size, file);
+  fclose(file);
+  return size == emu->config.flash_size ? 0 : -1;
+}
+
+static void print_usage(void) {
+  puts(
+      "Usage: blisp-emu [options]\n"
+      "Emulates a chip behind a pseudo terminal and prints its path.\n"
+      "\n"
+      "  -c, --chip <bl60x|bl70x>     Chip to emulate (default: bl60x)\n"
+      "  -s, --flash-size <bytes>     Size of the flash (default: 4 MiB)\n"
+      "  -l, --latency-us <us>        Delay before every response\n"
+      "      --erase-us <us>          Time per erased 4 KiB sector\n"
+      "      --write-us-per-kib <us>  Time per programmed KiB\n"
+      "      --pending-us <us>        Send 'PD' at this interval while busy\n"
+      "      --wire-pacing            Take as long as a UART at the host's baud "
+      "rate\n"
+      "  -f, --fault <hex>:<n>[:kind] Fail the nth occurrence of a command, "
+      "kind is\n"
+      "                               error (default), drop or noise\n"
+      "      --link <path>            Also make the pty available at path\n"
+      "      --load <file>            Initial flash contents\n"
+      "      --dump <file>            Store the flash contents on exit\n"
+      "  -v, --verbose                Log every command\n"
+      "  -h, --help                   Print this help and exit");
+}
+
+int main(int argc, char** argv) {
+  static const struct option options[] = {
+      {"chip", required_argument, NULL, 'c'},
+      {"flash-size", required_argument, NULL, 's'},
+      {"latency-us", required_argument, NULL, 'l'},
+      {"erase-us", required_argument, NULL, 'e'},
+      {"write-us-per-kib", required_argument, NULL, 'w'},
+      {"pending-us", required_argument, NULL, 'p'},
+      {"wire-pacing", no_argument, NULL, 'P'},
+      {"fault", required_argument, NULL, 'f'},
+      {"link", required_argument, NULL, 'L'},
+      {"load", required_argument, NULL, 'i'},
+      {"dump", required_argument, NULL, 'o'},
+      {"verbose", no_argument, NULL, 'v'},
+      {"help", no_argument, NULL, 'h'},
+      {NULL, 0, NULL, 0}};
+  struct emu_config config = {
+      .chip = BLISP_CHIP_BL60X,
+      .flash_size = 4 * 1024 * 1024,
+  };
+  const char *link_path = NULL, *load_path = NULL, *dump_path = NULL;
+  struct emu emu;
+  struct emu_pty pty;
+  int ret = EXIT_FAILURE;
+  int option;
+
+  while ((option = getopt_long(argc, argv, "c:s:l:f:vh", options, NULL)) !=
+         -1) {
+    switch (option) {
+      case 'c':
+        if (strcmp(optarg, "bl60x") == 0) {
+          config.chip = BLISP_CHIP_BL60X;
+        } else if (strcmp(optarg, "bl70x") == 0) {
+          config.chip = BLISP_CHIP_BL70X;
+        } else {
+          fprintf(stderr, "Unsupported chip: %s\n", optarg);
+          return EXIT_FAILURE;
+        }
+        break;
+      case 's':
+        config.flash_size = strtoul(optarg, NULL, 0);
+        break;
+      case 'l':
+        config.latency_us = strtoul(optarg, NULL, 0);
+        break;
+      case 'e':
+        config.erase_us = strtoul(optarg, NULL, 0);
+        break;
+      case 'w':
+        config.write_us_per_kib = strtoul(optarg, NULL, 0);
+        break;
+      case 'p':
+        config.pending_us = strtoul(optarg, NULL, 0);
+        break;
+      case 'P':
+        config.wire_pacing = true;
+        break;
+      case 'f':
+        if (config.fault_count == EMU_MAX_FAULTS ||
+            emu_parse_fault(optarg, &config.faults[config.fault_count]) != 0) {
+          fprintf(stderr, "Invalid fault: %s\n", optarg);
+          return EXIT_FAILURE;
+        }
+        config.fault_count++;
+        break;
+      case 'L':
+        link_path = optarg;
+        break;
+      case 'i':
+        load_path = optarg;
+        break;
+      case 'o':
+        dump_path = optarg;
+        break;
+      case 'v':
+        config.verbose = true;
+        break;
+      case 'h':
+        print_usage();
+        return EXIT_SUCCESS;
+      default:
+        print_usage();
+        return EXIT_FAILURE;
+    }
+  }
+  if (config.flash_size == 0 || config.flash_size % EMU_SECTOR_SIZE != 0) {
+    fprintf(stderr, "Flash size must be a multiple of %d\n", EMU_SECTOR_SIZE);
+    return EXIT_FAILURE;
+  }
+
+  if (emu_pty_open(&pty) != 0) {
+    perror("Failed to create pty");
+    return EXIT_FAILURE;
+  }
+
+  if (emu_init(&emu, &config, emu_pty_send, &pty) != 0) {
+    fprintf(stderr, "Failed to allocate flash\n");
+    goto exit1;
+  }
+  if (load_path != NULL && load_flash(&emu, load_path) != 0) {
+    fprintf(stderr, "Failed to load %s\n", load_path);
+    goto exit2;
+  }
+  if (link_path != NULL) {
+    unlink(link_path);
+    if (symlink(pty.path, link_path) != 0) {
+      perror("Failed to create link");
+      goto exit2;
+    }
+  }
+
+  signal(SIGINT, handle_signal);
+  signal(SIGTERM, handle_signal);
+  printf("%s\n", pty.path);
+  fflush(stdout);
+
+  if (emu_pty_serve(&emu, &pty, &stop) == 0) {
+    ret = EXIT_SUCCESS;
+  }
+
+  if (dump_path != NULL && dump_flash(&emu, dump_path) != 0) {
+    fprintf(stderr, "Failed to dump flash to %s\n", dump_path);
+    ret = EXIT_FAILURE;
+  }
+  if (link_path != NULL) {
+    unlink(link_path);
+  }
+exit2:
+  emu_free(&emu);
+exit1:
+  emu_pty_close(&pty);
+  return ret;
+}
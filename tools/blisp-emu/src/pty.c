@@ -0,0 +1,128 @@
+// SPDX-License-Identifier: MIT
+// posix_openpt() and friends are XSI, cfmakeraw() is BSD
+#define _XOPEN_SOURCE 600
+#define _DEFAULT_SOURCE
+#define _DARWIN_C_SOURCE
+#include "pty.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <termios.h>
+#include <unistd.h>
+
+int emu_pty_open(struct emu_pty* pty) {
+  struct termios tio;
+
+  pty->slave = -1;
+  pty->master = posix_openpt(O_RDWR | O_NOCTTY);
+  if (pty->master < 0) {
+    return -1;
+  }
+  if (grantpt(pty->master) != 0 || unlockpt(pty->master) != 0) {
+    goto fail;
+  }
+  snprintf(pty->path, sizeof(pty->path), "%s", ptsname(pty->master));
+  // Keeping the slave open ourselves keeps the master readable while no
+  // host is connected, and lets us read the host's line settings.
+  pty->slave = open(pty->path, O_RDWR | O_NOCTTY);
+  if (pty->slave < 0) {
+    goto fail;
+  }
+  tcgetattr(pty->slave, &tio);
+  cfmakeraw(&tio);
+  tcsetattr(pty->slave, TCSANOW, &tio);
+  fcntl(pty->master, F_SETFL, fcntl(pty->master, F_GETFL) | O_NONBLOCK);
+  return 0;
+
+fail:
+  emu_pty_close(pty);
+  return -1;
+}
+
+void emu_pty_close(struct emu_pty* pty) {
+  if (pty->slave >= 0) {
+    close(pty->slave);
+    pty->slave = -1;
+  }
+  if (pty->master >= 0) {
+    close(pty->master);
+    pty->master = -1;
+  }
+}
+
+void emu_pty_send(void* context, const uint8_t* data, size_t size) {
+  int fd = ((struct emu_pty*)context)->master;
+  while (size > 0) {
+    ssize_t written = write(fd, data, size);
+    if (written < 0) {
+      if (errno == EAGAIN || errno == EINTR) {
+        struct pollfd pfd = {.fd = fd, .events = POLLOUT};
+        poll(&pfd, 1, 100);
+        continue;
+      }
+      return;
+    }
+    data += written;
+    size -= written;
+  }
+}
+
+// The baud rate the host configured on its end, for wire pacing
+static uint32_t emu_pty_baud_rate(int fd) {
+  static const struct {
+    speed_t speed;
+    uint32_t baud_rate;
+  } speeds[] = {
+      {B9600, 9600},       {B19200, 19200},     {B38400, 38400},
+      {B57600, 57600},     {B115200, 115200},   {B230400, 230400},
+#ifdef B460800
+      {B460800, 460800},   {B500000, 500000},   {B921600, 921600},
+      {B1000000, 1000000}, {B1500000, 1500000}, {B2000000, 2000000},
+      {B3000000, 3000000},
+#endif
+  };
+  struct termios tio;
+
+  if (tcgetattr(fd, &tio) != 0) {
+    return 0;
+  }
+  speed_t speed = cfgetospeed(&tio);
+  for (size_t i = 0; i < sizeof(speeds) / sizeof(speeds[0]); i++) {
+    if (speeds[i].speed == speed) {
+      return speeds[i].baud_rate;
+    }
+  }
+  return 0;
+}
+
+int emu_pty_serve(struct emu* emu,
+                  struct emu_pty* pty,
+                  volatile sig_atomic_t* stop) {
+  uint8_t buffer[4096];
+
+  while (!*stop) {
+    struct pollfd pfd = {.fd = pty->master, .events = POLLIN};
+    int ready = poll(&pfd, 1, 50);
+    if (ready < 0 && errno != EINTR) {
+      perror("poll");
+      return -1;
+    }
+    if (ready <= 0) {
+      continue;
+    }
+    ssize_t size = read(pty->master, buffer, sizeof(buffer));
+    if (size < 0) {
+      if (errno == EAGAIN || errno == EINTR || errno == EIO) {
+        continue;
+      }
+      perror("read");
+      return -1;
+    }
+    emu->baud_rate = emu_pty_baud_rate(pty->slave);
+    emu_feed(emu, buffer, size);
+  }
+  return 0;
+}
@@ -0,0 +1,23 @@
+// SPDX-License-Identifier: MIT
+#ifndef BLISP_EMU_PTY_H
+#define BLISP_EMU_PTY_H
+
+#include <signal.h>
+#include "emulator.h"
+
+struct emu_pty {
+  int master;
+  int slave;  // Kept open so the master stays usable between hosts
+  char path[128];
+};
+
+int emu_pty_open(struct emu_pty* pty);
+void emu_pty_close(struct emu_pty* pty);
+// emu_send_fn writing to the pty, context is the struct emu_pty
+void emu_pty_send(void* context, const uint8_t* data, size_t size);
+// Feeds everything the host writes into the emulator until *stop is set
+int emu_pty_serve(struct emu* emu,
+                  struct emu_pty* pty,
+                  volatile sig_atomic_t* stop);
+
+#endif  // BLISP_EMU_PTY_H
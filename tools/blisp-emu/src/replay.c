@@ -0,0 +1,403 @@
+// SPDX-License-Identifier: MIT
+// Plays back a session recorded with blisp --capture. As a stand-in chip
+// behind a pseudo terminal it waits for every write the host made back then
+// and answers with the recorded bytes at the recorded pace, or a multiple of
+// it. --print decodes the capture with the library's response parser
+// instead and lists every command with its round trip.
+#include <blisp_capture.h>
+#include <blisp_metrics.h>
+#include <blisp_response.h>
+#include <blisp_util.h>
+#include <errno.h>
+#include <getopt.h>
+#include <inttypes.h>
+#include <poll.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include "pty.h"
+
+// Commands still waiting for an answer while --print walks the capture
+#define REPLAY_IN_FLIGHT 16
+
+static volatile sig_atomic_t stop = 0;
+
+static void handle_signal(int signal) {
+  (void)signal;
+  stop = 1;
+}
+
+static uint8_t* load_capture(const char* path, size_t* size) {
+  FILE* file = fopen(path, "rb");
+  if (file == NULL) {
+    return NULL;
+  }
+  uint8_t* data = NULL;
+  if (fseek(file, 0, SEEK_END) == 0) {
+    long length = ftell(file);
+    if (length > 0 && fseek(file, 0, SEEK_SET) == 0) {
+      data = malloc(length);
+      *size = length;
+    }
+  }
+  if (data != NULL && fread(data, 1, *size, file) != *size) {
+    free(data);
+    data = NULL;
+  }
+  fclose(file);
+  return data;
+}
+
+static void sleep_until(uint64_t deadline_us) {
+  uint64_t now = monotonic_us();
+  if (deadline_us <= now) {
+    return;
+  }
+  uint64_t us = deadline_us - now;
+  struct timespec ts;
+  ts.tv_sec = us / 1000000;
+  ts.tv_nsec = (us % 1000000) * 1000;
+  nanosleep(&ts, NULL);
+}
+
+// Reads what the host writes until size bytes came, or nothing did for
+// idle_ms. Returns the number of bytes read, *differs tells whether they
+// are not the recorded ones.
+static size_t expect_write(struct emu_pty* pty,
+                           const uint8_t* data,
+                           size_t size,
+                           uint32_t idle_ms,
+                           bool* differs) {
+  uint8_t buffer[4096];
+  size_t count = 0;
+
+  *differs = false;
+  while (count < size && !stop) {
+    size_t wanted = size - count;
+    ssize_t ret = read(pty->master, buffer,
+                       wanted < sizeof(buffer) ? wanted : sizeof(buffer));
+    if (ret > 0) {
+      if (memcmp(buffer, data + count, ret) != 0) {
+        *differs = true;
+      }
+      count += ret;
+      continue;
+    }
+    if (ret < 0 && errno != EAGAIN && errno != EINTR) {
+      break;
+    }
+    struct pollfd pfd = {.fd = pty->master, .events = POLLIN};
+    if (poll(&pfd, 1, idle_ms) == 0) {
+      break;
+    }
+  }
+  return count;
+}
+
+// Host bytes past the end of the capture, until it goes quiet
+static size_t drain_host(struct emu_pty* pty, uint32_t idle_ms) {
+  uint8_t buffer[256];
+  size_t count = 0;
+  struct pollfd pfd = {.fd = pty->master, .events = POLLIN};
+
+  while (!stop && poll(&pfd, 1, idle_ms) > 0) {
+    ssize_t ret = read(pty->master, buffer, sizeof(buffer));
+    if (ret < 0 && errno != EAGAIN && errno != EINTR) {
+      break;
+    }
+    count += ret > 0 ? ret : 0;
+  }
+  return count;
+}
+
+static int serve(struct blisp_capture_reader* reader,
+                 struct emu_pty* pty,
+                 double speed,
+                 uint32_t idle_ms,
+                 bool verbose) {
+  struct blisp_capture_entry entry;
+  uint32_t index = 0, differing = 0;
+  blisp_return_t ret;
+
+  // Answers are timed from the previous record as it happened here: the
+  // host's writes when they came in, everything else as scheduled
+  uint64_t previous_us = monotonic_us();
+  while (!stop && (ret = blisp_capture_next(reader, &entry)) == BLISP_OK) {
+    index++;
+    uint64_t delta_us = speed > 0 ? (uint64_t)(entry.delta_us / speed) : 0;
+    if (entry.type == BLISP_CAPTURE_WRITE) {
+      bool differs;
+      size_t count = expect_write(pty, entry.data, entry.size, idle_ms,
+                                  &differs);
+      if (count < entry.size) {
+        if (!stop) {
+          fprintf(stderr,
+                  "Record %" PRIu32 ": the host wrote %zu of %" PRIu32
+                  " bytes, giving up\n",
+                  index, count, entry.size);
+        }
+        return -1;
+      }
+      if (differs) {
+        differing++;
+        if (verbose) {
+          fprintf(stderr, "Record %" PRIu32 ": the host wrote other bytes\n",
+                  index);
+        }
+      }
+      previous_us = monotonic_us();
+    } else if (entry.type == BLISP_CAPTURE_READ) {
+      previous_us += delta_us;
+      sleep_until(previous_us);
+      emu_pty_send(pty, entry.data, entry.size);
+    } else {
+      previous_us += delta_us;
+    }
+  }
+  if (stop) {
+    return -1;
+  }
+  if (ret != BLISP_ERR_NO_RESPONSE) {
+    fprintf(stderr, "Capture is cut short after record %" PRIu32 "\n", index);
+  }
+
+  size_t extra = drain_host(pty, idle_ms);
+  fprintf(stderr, "Replayed %" PRIu32 " records", index);
+  if (differing != 0) {
+    fprintf(stderr, ", the host wrote other bytes in %" PRIu32, differing);
+  }
+  if (extra != 0) {
+    fprintf(stderr, ", it wrote %zu more bytes after the end", extra);
+  }
+  fputs("\n", stderr);
+  return differing == 0 && extra == 0 ? 0 : -1;
+}
+
+// Which answers carry a payload is up to the command, like in lib/blisp.c
+static bool expects_payload(uint8_t command) {
+  switch (command) {
+    case 0x10:  // get_boot_info
+    case 0x17:  // load_segment_header
+    case 0x32:  // flash_read
+    case 0x3D:  // flash_read_sha256
+      return true;
+    default:
+      return false;
+  }
+}
+
+static int print_timeline(struct blisp_capture_reader* reader) {
+  static struct blisp_response_parser parser;
+  struct blisp_capture_entry entry;
+  struct {
+    uint8_t command;
+    uint64_t sent_us;
+  } in_flight[REPLAY_IN_FLIGHT];
+  uint8_t in_flight_head = 0, in_flight_count = 0;
+  uint64_t time_us = 0, bytes_out = 0, bytes_in = 0;
+  uint32_t commands = 0;
+  blisp_return_t ret;
+
+  blisp_response_parser_reset(&parser);
+  while ((ret = blisp_capture_next(reader, &entry)) == BLISP_OK) {
+    time_us += entry.delta_us;
+    double time_ms = time_us / 1000.0;
+
+    if (entry.type == BLISP_CAPTURE_BAUD_RATE && entry.size == 4) {
+      printf("%12.3f ms  baud rate %" PRIu32 "\n", time_ms,
+             entry.data[0] | entry.data[1] << 8 | entry.data[2] << 16 |
+                 (uint32_t)entry.data[3] << 24);
+    } else if (entry.type == BLISP_CAPTURE_WRITE && entry.size != 0) {
+      bytes_out += entry.size;
+      // Sync bytes, or the reset string of the USB chips
+      if (entry.data[0] == 'U' || entry.data[0] == 'B') {
+        printf("%12.3f ms  > handshake, %" PRIu32 " bytes\n", time_ms,
+               entry.size);
+        blisp_response_parser_reset(&parser);
+        in_flight_count = 0;
+        continue;
+      }
+      const char* name = blisp_command_name(entry.data[0]);
+      printf("%12.3f ms  > %s (0x%02" PRIX8 "), %" PRIu32 " bytes\n", time_ms,
+             name != NULL ? name : "unknown", entry.data[0], entry.size);
+      if (in_flight_count < REPLAY_IN_FLIGHT) {
+        uint8_t slot = (in_flight_head + in_flight_count) % REPLAY_IN_FLIGHT;
+        in_flight[slot].command = entry.data[0];
+        in_flight[slot].sent_us = time_us;
+        in_flight_count++;
+      }
+      commands++;
+    } else if (entry.type == BLISP_CAPTURE_READ) {
+      bytes_in += entry.size;
+      for (uint32_t offset = 0; offset < entry.size;) {
+        uint8_t* tail;
+        uint32_t space = blisp_response_parser_space(&parser, &tail);
+        uint32_t count = entry.size - offset < space ? entry.size - offset
+                                                     : space;
+        memcpy(tail, entry.data + offset, count);
+        blisp_response_parser_commit(&parser, count);
+        offset += count;
+
+        struct blisp_response response;
+        bool payload = in_flight_count != 0 &&
+                       expects_payload(in_flight[in_flight_head].command);
+        while (blisp_response_parser_next(&parser, payload,
+                                          BLISP_RESPONSE_BUFFER_SIZE,
+                                          &response)) {
+          printf("%12.3f ms  < ", time_ms);
+          if (response.type == BLISP_RESPONSE_PENDING) {
+            puts("PD");
+            continue;
+          }
+          if (response.type == BLISP_RESPONSE_ERROR) {
+            printf("FL 0x%04" PRIX16, response.error_code);
+          } else if (payload) {
+            printf("OK, %" PRIu16 " bytes", response.payload_length);
+          } else {
+            printf("OK");
+          }
+          if (in_flight_count == 0) {
+            puts("");
+            continue;
+          }
+          printf(" after %.3f ms\n",
+                 (time_us - in_flight[in_flight_head].sent_us) / 1000.0);
+          in_flight_head = (in_flight_head + 1) % REPLAY_IN_FLIGHT;
+          in_flight_count--;
+          payload = in_flight_count != 0 &&
+                    expects_payload(in_flight[in_flight_head].command);
+        }
+      }
+    }
+  }
+  printf("%" PRIu32 " commands, %" PRIu64 " bytes out, %" PRIu64
+         " bytes in, %.3f ms\n",
+         commands, bytes_out, bytes_in, time_us / 1000.0);
+  if (ret != BLISP_ERR_NO_RESPONSE) {
+    fprintf(stderr, "Capture is cut short here\n");
+    return -1;
+  }
+  return 0;
+}
+
+static void print_usage(void) {
+  puts(
+      "Usage: blisp-replay [options] <capture>\n"
+      "Answers blisp with a recorded session from behind a pseudo terminal\n"
+      "and prints its path.\n"
+      "\n"
+      "      --speed <factor>         Answer this many times faster, 0 for no "
+      "waits\n"
+      "                               (default: 1)\n"
+      "      --idle-ms <ms>           Give up when the host is quiet for this "
+      "long\n"
+      "                               (default: 5000)\n"
+      "      --link <path>            Also make the pty available at path\n"
+      "      --print                  List the commands in the capture "
+      "instead\n"
+      "  -v, --verbose                Report every write that differs\n"
+      "  -h, --help                   Print this help and exit");
+}
+
+int main(int argc, char** argv) {
+  static const struct option options[] = {
+      {"speed", required_argument, NULL, 's'},
+      {"idle-ms", required_argument, NULL, 'i'},
+      {"link", required_argument, NULL, 'L'},
+      {"print", no_argument, NULL, 'P'},
+      {"verbose", no_argument, NULL, 'v'},
+      {"help", no_argument, NULL, 'h'},
+      {NULL, 0, NULL, 0}};
+  const char* link_path = NULL;
+  double speed = 1;
+  uint32_t idle_ms = 5000;
+  bool print = false, verbose = false;
+  struct blisp_capture_reader reader;
+  struct emu_pty pty;
+  size_t size = 0;
+  int ret = EXIT_FAILURE;
+  int option;
+
+  while ((option = getopt_long(argc, argv, "vh", options, NULL)) != -1) {
+    switch (option) {
+      case 's':
+        speed = strtod(optarg, NULL);
+        if (speed < 0) {
+          fprintf(stderr, "Speed cannot be negative\n");
+          return EXIT_FAILURE;
+        }
+        break;
+      case 'i':
+        idle_ms = strtoul(optarg, NULL, 0);
+        break;
+      case 'L':
+        link_path = optarg;
+        break;
+      case 'P':
+        print = true;
+        break;
+      case 'v':
+        verbose = true;
+        break;
+      case 'h':
+        print_usage();
+        return EXIT_SUCCESS;
+      default:
+        print_usage();
+        return EXIT_FAILURE;
+    }
+  }
+  if (optind != argc - 1) {
+    print_usage();
+    return EXIT_FAILURE;
+  }
+
+  uint8_t* capture = load_capture(argv[optind], &size);
+  if (capture == NULL) {
+    fprintf(stderr, "Failed to read %s\n", argv[optind]);
+    return EXIT_FAILURE;
+  }
+  if (blisp_capture_reader_init(&reader, capture, size) != BLISP_OK) {
+    fprintf(stderr, "%s is not a blisp capture\n", argv[optind]);
+    goto exit1;
+  }
+  if (print) {
+    if (print_timeline(&reader) == 0) {
+      ret = EXIT_SUCCESS;
+    }
+    goto exit1;
+  }
+
+  if (emu_pty_open(&pty) != 0) {
+    perror("Failed to create pty");
+    goto exit1;
+  }
+  if (link_path != NULL) {
+    unlink(link_path);
+    if (symlink(pty.path, link_path) != 0) {
+      perror("Failed to create link");
+      goto exit2;
+    }
+  }
+
+  signal(SIGINT, handle_signal);
+  signal(SIGTERM, handle_signal);
+  printf("%s\n", pty.path);
+  fflush(stdout);
+
+  if (serve(&reader, &pty, speed, idle_ms, verbose) == 0) {
+    ret = EXIT_SUCCESS;
+  }
+
+  if (link_path != NULL) {
+    unlink(link_path);
+  }
+exit2:
+  emu_pty_close(&pty);
+exit1:
+  free(capture);
+  return ret;
+}
@@ -0,0 +1,168 @@
+// SPDX-License-Identifier: MIT
+// Drives the non-blocking API from a poll() loop against the emulator:
+// handshake and boot info in the BootROM, then erase, write and program
+// check in eflash_loader. Fails unless the flash ends up holding the image.
+#include <errno.h>
+#include <inttypes.h>
+#include <poll.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <blisp.h>
+#include <blisp_async.h>
+#include <blisp_easy.h>
+#include "emulator.h"
+#include "pty.h"
+
+#define TEST_ADDRESS 0x10123  // Not page aligned, to get a short first chunk
+#define TEST_SIZE 10000
+
+struct test_emulator {
+  struct emu emu;
+  struct emu_pty pty;
+  pthread_t thread;
+  volatile sig_atomic_t stop;
+};
+
+static void* test_emulator_thread(void* context) {
+  struct test_emulator* emulator = context;
+  emu_pty_serve(&emulator->emu, &emulator->pty, &emulator->stop);
+  return NULL;
+}
+
+static void test_done(struct blisp_async* async,
+                      blisp_return_t result,
+                      void* user_data) {
+  (void)async;
+  *(blisp_return_t*)user_data = result;
+}
+
+// Runs the started operation to its end, the way an event loop would
+static blisp_return_t test_run(struct blisp_async* async, int fd) {
+  while (blisp_async_busy(async)) {
+    uint8_t events = blisp_async_events(async);
+    struct pollfd pfd = {.fd = fd, .events = 0};
+    if (events & BLISP_ASYNC_WANT_READ) {
+      pfd.events |= POLLIN;
+    }
+    if (events & BLISP_ASYNC_WANT_WRITE) {
+      pfd.events |= POLLOUT;
+    }
+    if (poll(&pfd, 1, blisp_async_timeout_ms(async)) < 0 && errno != EINTR) {
+      return BLISP_ERR_API_ERROR;
+    }
+    blisp_async_process(async);
+  }
+  return *(blisp_return_t*)async->user_data;
+}
+
+static blisp_return_t test_load_loader(struct blisp_device* device) {
+  struct blisp_easy_transport transport;
+
+  blisp_return_t ret =
+      blisp_easy_transport_new_from_eflash_loader(device->chip, &transport);
+  if (ret != BLISP_OK) {
+    return ret;
+  }
+  ret = blisp_easy_load_ram_app(device, &transport, NULL);
+  if (ret != BLISP_OK) {
+    return ret;
+  }
+  ret = blisp_device_check_image(device);
+  if (ret != BLISP_OK) {
+    return ret;
+  }
+  return blisp_device_run_image(device);
+}
+
+static int test_check(const char* step, blisp_return_t ret) {
+  if (ret != BLISP_OK) {
+    fprintf(stderr, "%s failed (ret: %d)\n", step, ret);
+    return 1;
+  }
+  return 0;
+}
+
+int main(void) {
+  struct test_emulator emulator = {0};
+  struct emu_config config = {.chip = BLISP_CHIP_BL60X,
+                              .flash_size = 1024 * 1024,
+                              .latency_us = 200};
+  struct blisp_device device;
+  struct blisp_async async;
+  struct blisp_boot_info boot_info;
+  blisp_return_t result = BLISP_OK;
+  uint8_t* image = malloc(TEST_SIZE);
+  int failed = 1;
+  int fd;
+
+  if (image == NULL || emu_pty_open(&emulator.pty) != 0) {
+    fprintf(stderr, "Failed to create pty\n");
+    return EXIT_FAILURE;
+  }
+  if (emu_init(&emulator.emu, &config, emu_pty_send, &emulator.pty) != 0 ||
+      pthread_create(&emulator.thread, NULL, test_emulator_thread,
+                     &emulator) != 0) {
+    fprintf(stderr, "Failed to start the emulator\n");
+    return EXIT_FAILURE;
+  }
+  for (uint32_t i = 0; i < TEST_SIZE; i++) {
+    image[i] = i * 7 + (i >> 8);
+  }
+
+  blisp_device_init(&device, &blisp_chip_bl60x);
+  if (test_check("Open", blisp_device_open(&device, emulator.pty.path,
+                                           460800)) ||
+      test_check("Port handle", blisp_device_get_fd(&device, &fd))) {
+    goto exit;
+  }
+  blisp_async_init(&async, &device, test_done, &result);
+
+  if (test_check("Handshake", blisp_async_handshake(&async, false)) ||
+      test_check("Handshake", test_run(&async, fd))) {
+    goto exit;
+  }
+  if (test_check("Boot info", blisp_async_get_boot_info(&async, &boot_info))) {
+    goto exit;
+  }
+  if (blisp_async_program_check(&async) != BLISP_ERR_BUSY) {
+    fprintf(stderr, "Second operation started while busy\n");
+    goto exit;
+  }
+  if (test_check("Boot info", test_run(&async, fd)) ||
+      test_check("Load eflash_loader", test_load_loader(&device))) {
+    goto exit;
+  }
+
+  if (test_check("Loader handshake", blisp_async_handshake(&async, true)) ||
+      test_check("Loader handshake", test_run(&async, fd)) ||
+      test_check("Erase",
+                 blisp_async_flash_erase(&async, TEST_ADDRESS,
+                                         TEST_ADDRESS + TEST_SIZE - 1)) ||
+      test_check("Erase", test_run(&async, fd)) ||
+      test_check("Write", blisp_async_flash_write(&async, TEST_ADDRESS, image,
+                                                  TEST_SIZE)) ||
+      test_check("Write", test_run(&async, fd)) ||
+      test_check("Program check", blisp_async_program_check(&async)) ||
+      test_check("Program check", test_run(&async, fd))) {
+    goto exit;
+  }
+
+  if (async.written != TEST_SIZE ||
+      memcmp(emulator.emu.flash + TEST_ADDRESS, image, TEST_SIZE) != 0) {
+    fprintf(stderr, "Flash doesn't hold the image (%" PRIu32 " bytes written)\n",
+            async.written);
+    goto exit;
+  }
+  failed = 0;
+
+exit:
+  blisp_device_close(&device);
+  emulator.stop = 1;
+  pthread_join(emulator.thread, NULL);
+  emu_free(&emulator.emu);
+  emu_pty_close(&emulator.pty);
+  free(image);
+  return failed ? EXIT_FAILURE : EXIT_SUCCESS;
+}
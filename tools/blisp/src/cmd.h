@@ -22,5 +22,9 @@ struct cmd {
 
 extern struct cmd cmd_write;
 extern struct cmd cmd_iot;
+extern struct cmd cmd_read;
+extern struct cmd cmd_multi;
+extern struct cmd cmd_serve;
+extern struct cmd cmd_job;
 
 #endif  // BLISP_CMD_H
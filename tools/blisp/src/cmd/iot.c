@@ -3,34 +3,33 @@
 
 #include "../cmd.h"
 #include "../common.h"
+#include "../trace.h"
+#include "mapped_file.h"
 
 #define REG_EXTENDED 1
 #define REG_ICASE (REG_EXTENDED << 1)
 
 static struct arg_rex* cmd;
-static struct arg_file* single_download;
+static struct arg_file *single_download, *trace_path, *capture_path;
 static struct arg_int* single_download_location;
 static struct arg_str *port_name, *chip_type;  // TODO: Make this common
-static struct arg_int *baudrate;
-static struct arg_lit* reset;
+static struct arg_int *baudrate, *flash_baudrate, *write_window;
+static struct arg_lit *reset, *compress;
 static struct arg_lit* chiperase;
 static struct arg_end* end;
-static void* cmd_iot_argtable[9];
+static void* cmd_iot_argtable[14];
 static void cmd_iot_args_print_glossary();
 
 blisp_return_t blisp_single_download(void) {
   struct blisp_device device;
+  struct blisp_capture capture = {0};
   blisp_return_t ret;
 
-  uint32_t baud = DEFAULT_BAUDRATE;
-  if (baudrate->count == 1) {
-    if (*baudrate->ival < 0) {
-      fprintf(stderr, "Baud rate cannot be negative!\n");
-      return BLISP_ERR_INVALID_COMMAND;
-    } else {
-      baud = *baudrate->ival;
-    }
-  }
+  uint32_t baud;
+  ret = blisp_common_check_link_args(baudrate, flash_baudrate, write_window,
+                                     &baud);
+  if (ret != BLISP_OK)
+    return ret;
 
   if (access(single_download->filename[0], R_OK) != 0) {
     // File not accessible, error out.
@@ -44,16 +43,51 @@ blisp_return_t blisp_single_download(void) {
   if (ret != BLISP_OK) {
     return ret;
   }
+  if (write_window->count == 1) {
+    device.flash_write_window = *write_window->ival;
+  }
+  if (compress->count) {
+    blisp_common_enable_compression(&device);
+  }
+  if (trace_path->count == 1) {
+    ret = trace_open(trace_path->filename[0]);
+    if (ret != BLISP_OK) {
+      goto exit1;
+    }
+    trace_attach(&device);
+    trace_begin("iot");
+  }
+  if (capture_path->count == 1) {
+    ret = blisp_capture_open(&capture, capture_path->filename[0]);
+    if (ret != BLISP_OK) {
+      fprintf(stderr, "Failed to open %s\n", capture_path->filename[0]);
+      goto exit1;
+    }
+    blisp_device_set_capture(&device, &capture);
+  }
+  trace_begin("prepare_flash");
   ret = blisp_common_prepare_flash(&device);
+  trace_end(ret);
   if (ret != BLISP_OK) {
     // TODO: user-friendly error messages
     fprintf(stderr, "Failed to initialize device, ret: %d\n", ret);
     goto exit1;
   }
 
+  if (flash_baudrate->count == 1) {
+    trace_begin("escalate_baudrate");
+    ret = blisp_common_escalate_baudrate(&device, *flash_baudrate->ival);
+    trace_end(ret);
+    if (ret != BLISP_OK) {
+      goto exit1;
+    }
+  }
+
   if (chiperase->count) {
     printf("Performing a chip erase, this might take a while...\n");
+    trace_begin("chip_erase");
     ret = blisp_device_chip_erase(&device);
+    trace_end(ret);
     if (ret == BLISP_OK) {
       printf("Erase complete!\n");
     } else {
@@ -62,49 +96,53 @@ blisp_return_t blisp_single_download(void) {
     goto exit1;
   }
 
-  FILE* data_file = fopen(single_download->filename[0], "rb");
-  if (data_file == NULL) {
+  mapped_file_t data = {0};
+  if (mapped_file_open(single_download->filename[0], &data) < 0) {
     fprintf(stderr, "Failed to open data file \"%s\".\n",
             single_download->filename[0]);
     ret = BLISP_ERR_CANT_OPEN_FILE;
     goto exit1;
   }
-  fseek(data_file, 0, SEEK_END);
-  int64_t data_file_size = ftell(data_file);
-  rewind(data_file);
-
-  printf("Erasing the area, this might take a while...\n");
-  ret = blisp_device_flash_erase(
-      &device, *single_download_location->ival,
-      *single_download_location->ival + data_file_size - 1);
-  if (ret != BLISP_OK) {
-    fprintf(stderr, "Failed to erase, ret: %d\n", ret);
-    goto exit2;
-  }
 
-  printf("Writing the data...\n");
-  struct blisp_easy_transport data_transport =
-      blisp_easy_transport_new_from_file(data_file);
-
-  ret = blisp_easy_flash_write(&device, &data_transport,
-                               *single_download_location->ival, data_file_size,
-                               blisp_common_progress_callback);
+  parsed_firmware_segment_t segment = {
+      .address = *single_download_location->ival,
+      .length = data.length,
+      .data = data.data,
+  };
+  parsed_firmware_file_t data_file = {
+      .payload = data.data,
+      .payload_length = data.length,
+      .payload_address = segment.address,
+      .segments = &segment,
+      .segment_count = 1,
+  };
+  trace_begin("flash_image");
+  ret = blisp_common_flash_image(&device, &data_file,
+                                 blisp_common_progress_callback);
+  trace_end(ret);
   if (ret != BLISP_OK) {
-    fprintf(stderr, "Failed to write data to flash, ret: %d\n", ret);
     goto exit2;
   }
 
   printf("Checking program...\n");
+  trace_begin("program_check");
   ret = blisp_device_program_check(&device);
+  trace_end(ret);
   if (ret != BLISP_OK) {
     fprintf(stderr, "Failed to check program, ret: %d\n", ret);
     goto exit2;
   }
   printf("Program OK!\n");
+  if (device.flash_write_settled_size != 0) {
+    printf("Flash writes settled on %u byte chunks.\n",
+           device.flash_write_settled_size);
+  }
 
   if (reset->count > 0) {  // TODO: could be common
     printf("Resetting the chip.\n");
+    trace_begin("reset");
     ret = blisp_device_reset(&device);
+    trace_end(ret);
     if (ret != BLISP_OK) {
       fprintf(stderr, "Failed to reset chip, ret: %d\n", ret);
       goto exit2;
@@ -115,10 +153,13 @@ blisp_return_t blisp_single_download(void) {
   }
 
 exit2:
-  if (data_file != NULL)
-    fclose(data_file);
+  mapped_file_close(&data);
 exit1:
+  trace_close(ret);
   blisp_device_close(&device);
+  if (blisp_capture_close(&capture) != BLISP_OK) {
+    fprintf(stderr, "Failed to write %s\n", capture_path->filename[0]);
+  }
 
   return ret;
 }
@@ -136,6 +177,15 @@ blisp_return_t cmd_iot_args_init(void) {
   cmd_iot_argtable[index++] = baudrate =
       arg_int0("b", "baudrate", "<baud rate>",
                "Serial baud rate (default: " XSTR(DEFAULT_BAUDRATE) ")");
+  cmd_iot_argtable[index++] = flash_baudrate =
+      arg_int0(NULL, "flash-baudrate", "<baud rate>",
+               "Baud rate to switch to once eflash_loader is running");
+  cmd_iot_argtable[index++] = write_window =
+      arg_int0(NULL, "window", "<chunks>",
+               "Flash write chunks kept in flight (default: 1)");
+  cmd_iot_argtable[index++] = compress =
+      arg_lit0(NULL, "compress",
+               "Send flash writes compressed where it pays off");
   cmd_iot_argtable[index++] = reset =
       arg_lit0(NULL, "reset", "Reset chip after write");
   cmd_iot_argtable[index++] = chiperase =
@@ -144,6 +194,12 @@ blisp_return_t cmd_iot_args_init(void) {
       arg_file0("s", "single-down", "<file>", "Single download file");
   cmd_iot_argtable[index++] = single_download_location =
       arg_int0("l", "single-down-loc", NULL, "Single download offset");
+  cmd_iot_argtable[index++] = trace_path =
+      arg_file0(NULL, "trace", "<file>",
+                "Write a timeline of the run in Chrome trace format");
+  cmd_iot_argtable[index++] = capture_path =
+      arg_file0(NULL, "capture", "<file>",
+                "Record the serial traffic for blisp-replay");
   cmd_iot_argtable[index++] = end = arg_end(10);
 
   if (arg_nullcheck(cmd_iot_argtable) != 0) {
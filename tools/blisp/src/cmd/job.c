@@ -0,0 +1,189 @@
+// SPDX-License-Identifier: MIT
+#include <argtable3.h>
+#include <inttypes.h>
+#include <limits.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "../cmd.h"
+#include "../serve.h"
+#include "../util.h"
+
+#ifndef _WIN32
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+#endif
+
+#define REG_EXTENDED 1
+#define REG_ICASE (REG_EXTENDED << 1)
+
+static struct arg_rex* cmd;
+static struct arg_str *job, *port_name, *socket_path;
+static struct arg_int *erase_address, *erase_length;
+static struct arg_lit* verify;
+static struct arg_file* input_file;
+static struct arg_end* end;
+static void* cmd_job_argtable[9];
+static void cmd_job_args_print_glossary();
+
+#ifndef _WIN32
+
+static int job_connect(const char* path) {
+  struct sockaddr_un address;
+
+  if (strlen(path) >= sizeof(address.sun_path)) {
+    fprintf(stderr, "Socket path \"%s\" is too long.\n", path);
+    return -1;
+  }
+  memset(&address, 0, sizeof(address));
+  address.sun_family = AF_UNIX;
+  strcpy(address.sun_path, path);
+
+  int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+  if (fd < 0) {
+    perror("socket");
+    return -1;
+  }
+  if (connect(fd, (struct sockaddr*)&address, sizeof(address)) != 0) {
+    fprintf(stderr, "No blisp serve is listening on %s.\n", path);
+    close(fd);
+    return -1;
+  }
+  return fd;
+}
+
+blisp_return_t blisp_job(void) {
+  char path[PATH_MAX] = "";
+  const char* name = job->sval[0];
+  bool needs_port = strcmp(name, "status") != 0;
+  bool needs_file = strcmp(name, "write") == 0 || strcmp(name, "verify") == 0;
+
+  if (!needs_file && strcmp(name, "status") != 0 &&
+      strcmp(name, "erase") != 0 && strcmp(name, "reset") != 0) {
+    fprintf(stderr, "Unknown job \"%s\".\n", name);
+    return BLISP_ERR_INVALID_COMMAND;
+  }
+  if (needs_port && port_name->count == 0) {
+    fprintf(stderr, "The %s job needs a port.\n", name);
+    return BLISP_ERR_INVALID_COMMAND;
+  }
+  if (needs_file) {
+    // The daemon doesn't share our working directory
+    if (input_file->count == 0 ||
+        realpath(input_file->filename[0], path) == NULL) {
+      fprintf(stderr, "The %s job needs an existing firmware file.\n", name);
+      return BLISP_ERR_CANT_OPEN_FILE;
+    }
+  }
+  if ((erase_address->count == 1 && *erase_address->ival < 0) ||
+      (erase_length->count == 1 && *erase_length->ival < 0)) {
+    fprintf(stderr, "Address and length cannot be negative!\n");
+    return BLISP_ERR_INVALID_COMMAND;
+  }
+  const char* port = port_name->count == 1 ? port_name->sval[0] : "";
+  if (strpbrk(port, "\t\n") != NULL || strpbrk(path, "\t\n") != NULL) {
+    fprintf(stderr, "Port and file names cannot contain tabs or newlines.\n");
+    return BLISP_ERR_INVALID_COMMAND;
+  }
+
+  int fd = job_connect(socket_path->count == 1 ? socket_path->sval[0]
+                                               : SERVE_DEFAULT_SOCKET);
+  if (fd < 0) {
+    return BLISP_ERR_API_ERROR;
+  }
+  FILE* answer = fdopen(fd, "r");
+  if (answer == NULL) {
+    close(fd);
+    return BLISP_ERR_API_ERROR;
+  }
+  dprintf(fd, "%s\t%s\t%d\t%d\t%d\t%s\n", name, port,
+          erase_address->count == 1 ? *erase_address->ival : 0,
+          erase_length->count == 1 ? *erase_length->ival : 0,
+          verify->count > 0, path);
+
+  blisp_return_t ret = BLISP_ERR_NO_RESPONSE;
+  char line[SERVE_LINE_SIZE];
+  while (fgets(line, sizeof(line), answer) != NULL) {
+    if (strncmp(line, SERVE_DONE, strlen(SERVE_DONE)) == 0) {
+      ret = atoi(line + strlen(SERVE_DONE));
+      break;
+    }
+    fputs(line, stdout);
+  }
+  fclose(answer);
+  if (ret == BLISP_ERR_NO_RESPONSE) {
+    fprintf(stderr, "blisp serve hung up.\n");
+  }
+  return ret;
+}
+
+#else
+
+blisp_return_t blisp_job(void) {
+  fprintf(stderr, "blisp job needs Unix domain sockets, which this build "
+                  "doesn't support.\n");
+  return BLISP_ERR_NOT_IMPLEMENTED;
+}
+
+#endif
+
+blisp_return_t cmd_job_args_init(void) {
+  size_t index = 0;
+
+  cmd_job_argtable[index++] = cmd =
+      arg_rex1(NULL, NULL, "job", NULL, REG_ICASE, NULL);
+  cmd_job_argtable[index++] = job = arg_str1(
+      NULL, NULL, "<job>", "write, verify, erase, reset or status");
+  cmd_job_argtable[index++] = port_name =
+      arg_str0("p", "port", "<port_name>", "Name/Path to the Serial Port");
+  cmd_job_argtable[index++] = socket_path =
+      arg_str0(NULL, "socket", "<path>",
+               "Socket of blisp serve (default: " SERVE_DEFAULT_SOCKET ")");
+  cmd_job_argtable[index++] = erase_address =
+      arg_int0("a", "address", "<address>", "Start of the range to erase");
+  cmd_job_argtable[index++] = erase_length = arg_int0(
+      "l", "length", "<length>", "Length to erase (default: whole chip)");
+  cmd_job_argtable[index++] = verify =
+      arg_lit0(NULL, "verify", "Check the flash after a write");
+  cmd_job_argtable[index++] = input_file =
+      arg_file0(NULL, NULL, "<input>", "Firmware to write or verify");
+  cmd_job_argtable[index++] = end = arg_end(10);
+
+  if (arg_nullcheck(cmd_job_argtable) != 0) {
+    fprintf(stderr, "insufficient memory\n");
+    return BLISP_ERR_OUT_OF_MEMORY;
+  }
+  return BLISP_OK;
+}
+
+void cmd_job_args_print_glossary(void) {
+  fputs("Usage: blisp", stdout);
+  arg_print_syntax(stdout, cmd_job_argtable, "\n");
+  puts("Hands a job to a running blisp serve and waits for it");
+  arg_print_glossary(stdout, cmd_job_argtable, "  %-25s %s\n");
+}
+
+blisp_return_t cmd_job_parse_exec(int argc, char** argv) {
+  int errors = arg_parse(argc, argv, cmd_job_argtable);
+  if (errors == 0) {
+    return blisp_job();
+  } else if (cmd->count == 1) {
+    cmd_job_args_print_glossary();
+    return BLISP_OK;
+  }
+  return BLISP_ERR_INVALID_COMMAND;
+}
+
+void cmd_job_args_print_syntax(void) {
+  arg_print_syntax(stdout, cmd_job_argtable, "\n");
+}
+
+void cmd_job_free(void) {
+  arg_freetable(cmd_job_argtable,
+                sizeof(cmd_job_argtable) / sizeof(cmd_job_argtable[0]));
+}
+
+struct cmd cmd_job = {"job", cmd_job_args_init, cmd_job_parse_exec,
+                      cmd_job_args_print_syntax, cmd_job_free};
@@ -0,0 +1,390 @@
+// SPDX-License-Identifier: MIT
+#include <argtable3.h>
+#include <blisp.h>
+#include <blisp_easy.h>
+#include <blisp_sha256.h>
+#include <blisp_util.h>
+#include <inttypes.h>
+#include <stdlib.h>
+#include <string.h>
+#include "../cmd.h"
+#include "../common.h"
+#include "parse_file.h"
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <pthread.h>
+#endif
+
+#define REG_EXTENDED 1
+#define REG_ICASE (REG_EXTENDED << 1)
+
+#define MULTI_MAX_BOARDS 64
+
+static struct arg_rex* cmd;
+static struct arg_file* binary_to_write;
+static struct arg_str *port_names, *port_match, *chip_type;
+static struct arg_int *baudrate, *flash_baudrate, *write_window;
+static struct arg_lit *reset, *compress;
+static struct arg_end* end;
+static void* cmd_multi_argtable[11];
+static void cmd_multi_args_print_glossary();
+
+// The image is parsed and hashed once, every board thread only reads it.
+struct multi_image {
+  parsed_firmware_file_t file;
+  struct bfl_boot_header boot_header;
+  uint8_t (*digests)[SHA256_DIGEST_SIZE];  // One per segment
+  uint32_t flash_baudrate;
+  bool reset;
+};
+
+struct multi_board {
+  char* port_name;
+  struct blisp_device device;
+  const struct multi_image* image;
+  const char* failed_step;  // NULL if the board passed
+  blisp_return_t ret;
+  uint64_t duration_us;
+  bool started;
+#ifdef _WIN32
+  HANDLE thread;
+#else
+  pthread_t thread;
+#endif
+};
+
+static blisp_return_t multi_flash_board(struct multi_board* board) {
+  struct blisp_device* device = &board->device;
+  const struct multi_image* image = board->image;
+  const parsed_firmware_file_t* file = &image->file;
+  blisp_return_t ret;
+
+  board->failed_step = "prepare";
+  ret = blisp_common_prepare_flash(device);
+  if (ret != BLISP_OK)
+    return ret;
+
+  board->failed_step = "baud rate";
+  ret = blisp_common_escalate_baudrate(device, image->flash_baudrate);
+  if (ret != BLISP_OK)
+    return ret;
+
+  if (file->needs_boot_struct) {
+    board->failed_step = "boot header";
+    ret = blisp_device_flash_erase(device, 0x0000,
+                                   sizeof(struct bfl_boot_header));
+    if (ret != BLISP_OK)
+      return ret;
+    ret = blisp_device_flash_write(device, 0x0000,
+                                   (uint8_t*)&image->boot_header,
+                                   sizeof(struct bfl_boot_header));
+    if (ret != BLISP_OK)
+      return ret;
+  }
+
+  board->failed_step = "write";
+  ret = blisp_common_flash_image(device, file, NULL);
+  if (ret != BLISP_OK)
+    return ret;
+
+  board->failed_step = "program check";
+  ret = blisp_device_program_check(device);
+  if (ret != BLISP_OK)
+    return ret;
+
+  board->failed_step = "verify";
+  for (size_t i = 0; i < file->segment_count; i++) {
+    uint8_t digest[SHA256_DIGEST_SIZE];
+    ret = blisp_device_flash_read_sha256(device, file->segments[i].address,
+                                         file->segments[i].length, digest);
+    if (ret != BLISP_OK)
+      return ret;
+    if (memcmp(digest, image->digests[i], SHA256_DIGEST_SIZE) != 0)
+      return BLISP_ERR_VERIFY_FAILED;
+  }
+
+  if (image->reset) {
+    board->failed_step = "reset";
+    ret = blisp_device_reset(device);
+    if (ret != BLISP_OK)
+      return ret;
+  }
+
+  board->failed_step = NULL;
+  return BLISP_OK;
+}
+
+#ifdef _WIN32
+static DWORD WINAPI multi_board_thread(LPVOID arg) {
+#else
+static void* multi_board_thread(void* arg) {
+#endif
+  struct multi_board* board = arg;
+  uint64_t start = monotonic_us();
+
+  board->ret = multi_flash_board(board);
+  board->duration_us = monotonic_us() - start;
+  blisp_device_close(&board->device);
+#ifdef _WIN32
+  return 0;
+#else
+  return NULL;
+#endif
+}
+
+static bool multi_board_start(struct multi_board* board) {
+#ifdef _WIN32
+  board->thread = CreateThread(NULL, 0, multi_board_thread, board, 0, NULL);
+  return board->thread != NULL;
+#else
+  return pthread_create(&board->thread, NULL, multi_board_thread, board) == 0;
+#endif
+}
+
+static void multi_board_join(struct multi_board* board) {
+#ifdef _WIN32
+  WaitForSingleObject(board->thread, INFINITE);
+  CloseHandle(board->thread);
+#else
+  pthread_join(board->thread, NULL);
+#endif
+}
+
+static int32_t multi_collect_ports(char** ports) {
+  int32_t count = 0;
+
+  for (int i = 0; i < port_names->count && count < MULTI_MAX_BOARDS; i++) {
+    ports[count] = malloc(strlen(port_names->sval[i]) + 1);
+    if (ports[count] == NULL) {
+      break;
+    }
+    strcpy(ports[count], port_names->sval[i]);
+    count++;
+  }
+  if (port_match->count == 1) {
+    int32_t found = blisp_list_ports(port_match->sval[0], ports + count,
+                                     MULTI_MAX_BOARDS - count);
+    if (found < 0) {
+      while (count > 0) {
+        free(ports[--count]);
+      }
+      return found;
+    }
+    count += found;
+  }
+  return count;
+}
+
+static void multi_print_report(struct multi_board* boards,
+                               int32_t board_count,
+                               uint64_t duration_us) {
+  int32_t passed = 0;
+
+  printf("\n%-24s %-6s %s\n", "Port", "Result", "Time");
+  for (int32_t i = 0; i < board_count; i++) {
+    struct multi_board* board = &boards[i];
+    if (board->failed_step == NULL) {
+      passed++;
+      printf("%-24s %-6s %6.2f s\n", board->port_name, "PASS",
+             board->duration_us / 1e6);
+    } else {
+      printf("%-24s %-6s %6.2f s  (%s, ret: %d)\n", board->port_name, "FAIL",
+             board->duration_us / 1e6, board->failed_step, board->ret);
+    }
+  }
+  printf("%" PRId32 " of %" PRId32 " boards passed in %.2f s\n", passed,
+         board_count, duration_us / 1e6);
+}
+
+blisp_return_t blisp_multi_flash(void) {
+  blisp_return_t ret = BLISP_OK;
+  struct multi_image image;
+  struct multi_board* boards = NULL;
+  char* ports[MULTI_MAX_BOARDS];
+  int32_t board_count = 0;
+
+  uint32_t baud;
+  ret = blisp_common_check_link_args(baudrate, flash_baudrate, write_window,
+                                     &baud);
+  if (ret != BLISP_OK)
+    return ret;
+
+  struct blisp_chip* chip = blisp_common_get_chip(chip_type);
+  if (chip == NULL) {
+    return BLISP_ERR_INVALID_CHIP_TYPE;
+  }
+  // All boards share the unpacked eflash_loader, unpack it before the
+  // threads race for it
+  if (chip->get_eflash_loader != NULL) {
+    uint32_t loader_size;
+    chip->get_eflash_loader(&loader_size);
+  }
+
+  memset(&image, 0, sizeof(image));
+  if (parse_firmware_file(binary_to_write->filename[0], &image.file) < 0) {
+    // `parse_firmware_file` doesn't return `blisp_return_t`
+    // so we default to the generic error.
+    return BLISP_ERR_UNKNOWN;
+  }
+  if (image.file.needs_boot_struct) {
+    fill_up_boot_header(&image.boot_header);
+    // Move the firmware to-be-flashed beyond the boot header area
+    move_parsed_firmware_file(&image.file, 0x2000);
+  }
+  image.digests = malloc(image.file.segment_count * SHA256_DIGEST_SIZE);
+  if (image.digests == NULL) {
+    ret = BLISP_ERR_OUT_OF_MEMORY;
+    goto exit;
+  }
+  for (size_t i = 0; i < image.file.segment_count; i++) {
+    sha256_calculate(image.file.segments[i].data, image.file.segments[i].length,
+                     image.digests[i]);
+  }
+  image.flash_baudrate =
+      flash_baudrate->count == 1 ? *flash_baudrate->ival : 0;
+  image.reset = reset->count > 0;
+
+  board_count = multi_collect_ports(ports);
+  if (board_count < 0) {
+    ret = board_count;
+    board_count = 0;
+    goto exit;
+  }
+  if (board_count == 0) {
+    fprintf(stderr, "No ports given or matched.\n");
+    ret = BLISP_ERR_DEVICE_NOT_FOUND;
+    goto exit;
+  }
+
+  boards = calloc(board_count, sizeof(struct multi_board));
+  if (boards == NULL) {
+    ret = BLISP_ERR_OUT_OF_MEMORY;
+    goto exit;
+  }
+
+  // Device setup touches shared chip state, so it stays on this thread.
+  for (int32_t i = 0; i < board_count; i++) {
+    struct multi_board* board = &boards[i];
+    board->port_name = ports[i];
+    board->image = &image;
+    board->failed_step = "open";
+    board->ret = blisp_device_init(&board->device, chip);
+    if (board->ret == BLISP_OK) {
+      board->ret = blisp_device_open(&board->device, board->port_name, baud);
+    }
+    if (board->ret == BLISP_OK && write_window->count == 1) {
+      board->device.flash_write_window = *write_window->ival;
+    }
+    if (board->ret == BLISP_OK && compress->count) {
+      board->device.flash_compress = blisp_easy_flash_compress_supported();
+    }
+  }
+
+  printf("Flashing %zu bytes @ 0x%08zx to %" PRId32 " boards...\n",
+         image.file.payload_length, image.file.payload_address, board_count);
+  blisp_common_set_quiet(true);
+  uint64_t start = monotonic_us();
+  for (int32_t i = 0; i < board_count; i++) {
+    if (boards[i].ret != BLISP_OK) {
+      continue;
+    }
+    boards[i].started = multi_board_start(&boards[i]);
+    if (!boards[i].started) {
+      boards[i].failed_step = "thread";
+      boards[i].ret = BLISP_ERR_UNKNOWN;
+      blisp_device_close(&boards[i].device);
+    }
+  }
+  for (int32_t i = 0; i < board_count; i++) {
+    if (boards[i].started) {
+      multi_board_join(&boards[i]);
+    }
+  }
+  blisp_common_set_quiet(false);
+  multi_print_report(boards, board_count, monotonic_us() - start);
+
+  for (int32_t i = 0; i < board_count; i++) {
+    if (boards[i].failed_step != NULL && ret == BLISP_OK) {
+      ret = boards[i].ret;
+    }
+  }
+
+exit:
+  free(boards);
+  for (int32_t i = 0; i < board_count; i++) {
+    free(ports[i]);
+  }
+  free(image.digests);
+  free_parsed_firmware_file(&image.file);
+  return ret;
+}
+
+blisp_return_t cmd_multi_args_init(void) {
+  size_t index = 0;
+
+  cmd_multi_argtable[index++] = cmd =
+      arg_rex1(NULL, NULL, "multi", NULL, REG_ICASE, NULL);
+  cmd_multi_argtable[index++] = chip_type =
+      arg_str1("c", "chip", "<chip_type>", "Chip Type");
+  cmd_multi_argtable[index++] = port_names =
+      arg_strn("p", "port", "<port_name>", 0, MULTI_MAX_BOARDS,
+               "Name/Path to a Serial Port, may be repeated");
+  cmd_multi_argtable[index++] = port_match =
+      arg_str0(NULL, "match", "<prefix>",
+               "Also flash every Serial Port whose name starts with prefix");
+  cmd_multi_argtable[index++] = baudrate =
+      arg_int0("b", "baudrate", "<baud rate>",
+               "Serial baud rate (default: " XSTR(DEFAULT_BAUDRATE) ")");
+  cmd_multi_argtable[index++] = flash_baudrate =
+      arg_int0(NULL, "flash-baudrate", "<baud rate>",
+               "Baud rate to switch to once eflash_loader is running");
+  cmd_multi_argtable[index++] = write_window =
+      arg_int0(NULL, "window", "<chunks>",
+               "Flash write chunks kept in flight (default: 1)");
+  cmd_multi_argtable[index++] = compress =
+      arg_lit0(NULL, "compress",
+               "Send flash writes compressed where it pays off");
+  cmd_multi_argtable[index++] = reset =
+      arg_lit0(NULL, "reset", "Reset chips after write");
+  cmd_multi_argtable[index++] = binary_to_write =
+      arg_file1(NULL, NULL, "<input>", "Binary to write");
+  cmd_multi_argtable[index++] = end = arg_end(10);
+
+  if (arg_nullcheck(cmd_multi_argtable) != 0) {
+    fprintf(stderr, "insufficient memory\n");
+    return BLISP_ERR_OUT_OF_MEMORY;
+  }
+  return BLISP_OK;
+}
+
+void cmd_multi_args_print_glossary(void) {
+  fputs("Usage: blisp", stdout);
+  arg_print_syntax(stdout, cmd_multi_argtable, "\n");
+  puts("Writes the same firmware to several devices at once");
+  arg_print_glossary(stdout, cmd_multi_argtable, "  %-25s %s\n");
+}
+
+blisp_return_t cmd_multi_parse_exec(int argc, char** argv) {
+  int errors = arg_parse(argc, argv, cmd_multi_argtable);
+  if (errors == 0) {
+    return blisp_multi_flash();
+  } else if (cmd->count == 1) {
+    cmd_multi_args_print_glossary();
+    return BLISP_OK;
+  }
+  return BLISP_ERR_INVALID_COMMAND;
+}
+
+void cmd_multi_args_print_syntax(void) {
+  arg_print_syntax(stdout, cmd_multi_argtable, "\n");
+}
+
+void cmd_multi_free(void) {
+  arg_freetable(cmd_multi_argtable,
+                sizeof(cmd_multi_argtable) / sizeof(cmd_multi_argtable[0]));
+}
+
+struct cmd cmd_multi = {"multi", cmd_multi_args_init, cmd_multi_parse_exec,
+                        cmd_multi_args_print_syntax, cmd_multi_free};
@@ -0,0 +1,159 @@
+// SPDX-License-Identifier: MIT
+#include <argtable3.h>
+#include <blisp_easy.h>
+#include <inttypes.h>
+
+#include "../cmd.h"
+#include "../common.h"
+
+#define REG_EXTENDED 1
+#define REG_ICASE (REG_EXTENDED << 1)
+
+static struct arg_rex* cmd;
+static struct arg_file* output_file;
+static struct arg_int *read_address, *read_length;
+static struct arg_str *port_name, *chip_type;
+static struct arg_int *baudrate, *flash_baudrate;
+static struct arg_lit* sparse;
+static struct arg_end* end;
+static void* cmd_read_argtable[10];
+static void cmd_read_args_print_glossary();
+
+blisp_return_t blisp_read_flash(void) {
+  struct blisp_device device;
+  blisp_return_t ret;
+
+  uint32_t baud;
+  ret = blisp_common_check_link_args(baudrate, flash_baudrate, NULL,
+                                     &baud);
+  if (ret != BLISP_OK)
+    return ret;
+
+  uint32_t address = 0;
+  if (read_address->count == 1) {
+    if (*read_address->ival < 0) {
+      fprintf(stderr, "Address cannot be negative!\n");
+      return BLISP_ERR_INVALID_COMMAND;
+    }
+    address = *read_address->ival;
+  }
+  if (*read_length->ival <= 0) {
+    fprintf(stderr, "Length must be positive!\n");
+    return BLISP_ERR_INVALID_COMMAND;
+  }
+  uint32_t length = *read_length->ival;
+
+  FILE* data_file = fopen(output_file->filename[0], "wb");
+  if (data_file == NULL) {
+    fprintf(stderr, "Failed to open output file \"%s\".\n",
+            output_file->filename[0]);
+    return BLISP_ERR_CANT_OPEN_FILE;
+  }
+
+  ret = blisp_common_init_device(&device, port_name, chip_type, baud);
+  if (ret != BLISP_OK) {
+    goto exit2;
+  }
+  ret = blisp_common_prepare_flash(&device);
+  if (ret != BLISP_OK) {
+    // TODO: user-friendly error messages
+    fprintf(stderr, "Failed to initialize device, ret: %d\n", ret);
+    goto exit1;
+  }
+
+  if (flash_baudrate->count == 1) {
+    ret = blisp_common_escalate_baudrate(&device, *flash_baudrate->ival);
+    if (ret != BLISP_OK) {
+      goto exit1;
+    }
+  }
+
+  printf("Reading %" PRIu32 " bytes @ 0x%08" PRIx32 "...\n", length, address);
+  struct blisp_easy_transport data_transport =
+      sparse->count ? blisp_easy_transport_new_from_sparse_file(data_file)
+                    : blisp_easy_transport_new_from_file(data_file);
+
+  ret = blisp_easy_flash_read(&device, &data_transport, address, length,
+                              blisp_common_progress_callback);
+  if (ret != BLISP_OK) {
+    fprintf(stderr, "Failed to read flash, ret: %d\n", ret);
+    goto exit1;
+  }
+  printf("Read complete!\n");
+
+exit1:
+  blisp_device_close(&device);
+exit2:
+  if (fclose(data_file) != 0 && ret == BLISP_OK) {
+    fprintf(stderr, "Failed to write output file \"%s\".\n",
+            output_file->filename[0]);
+    ret = BLISP_ERR_CANT_OPEN_FILE;
+  }
+
+  return ret;
+}
+
+blisp_return_t cmd_read_args_init(void) {
+  size_t index = 0;
+
+  cmd_read_argtable[index++] = cmd =
+      arg_rex1(NULL, NULL, "read", NULL, REG_ICASE, NULL);
+  cmd_read_argtable[index++] = chip_type =
+      arg_str1("c", "chip", "<chip_type>", "Chip Type");
+  cmd_read_argtable[index++] = port_name =
+      arg_str0("p", "port", "<port_name>",
+               "Name/Path to the Serial Port (empty for search)");
+  cmd_read_argtable[index++] = baudrate =
+      arg_int0("b", "baudrate", "<baud rate>",
+               "Serial baud rate (default: " XSTR(DEFAULT_BAUDRATE) ")");
+  cmd_read_argtable[index++] = flash_baudrate =
+      arg_int0(NULL, "flash-baudrate", "<baud rate>",
+               "Baud rate to switch to once eflash_loader is running");
+  cmd_read_argtable[index++] = read_address =
+      arg_int0("a", "address", "<address>",
+               "Flash offset to read from (default: 0)");
+  cmd_read_argtable[index++] = read_length =
+      arg_int1("l", "length", "<length>", "Number of bytes to read");
+  cmd_read_argtable[index++] = sparse =
+      arg_lit0(NULL, "sparse",
+               "Leave erased (0xFF) blocks as holes, they read back as 0x00");
+  cmd_read_argtable[index++] = output_file =
+      arg_file1(NULL, NULL, "<output>", "File to store the flash contents in");
+  cmd_read_argtable[index++] = end = arg_end(10);
+
+  if (arg_nullcheck(cmd_read_argtable) != 0) {
+    fprintf(stderr, "insufficient memory\n");
+    return BLISP_ERR_OUT_OF_MEMORY;
+  }
+  return BLISP_OK;
+}
+
+void cmd_read_args_print_glossary(void) {
+  fputs("Usage: blisp", stdout);
+  arg_print_syntax(stdout, cmd_read_argtable, "\n");
+  puts("Reads flash contents into a file");
+  arg_print_glossary(stdout, cmd_read_argtable, "  %-25s %s\n");
+}
+
+blisp_return_t cmd_read_parse_exec(int argc, char** argv) {
+  int errors = arg_parse(argc, argv, cmd_read_argtable);
+  if (errors == 0) {
+    return blisp_read_flash();
+  } else if (cmd->count == 1) {
+    cmd_read_args_print_glossary();
+    return BLISP_OK;
+  }
+  return BLISP_ERR_INVALID_COMMAND;
+}
+
+void cmd_read_args_print_syntax(void) {
+  arg_print_syntax(stdout, cmd_read_argtable, "\n");
+}
+
+void cmd_read_free(void) {
+  arg_freetable(cmd_read_argtable,
+                sizeof(cmd_read_argtable) / sizeof(cmd_read_argtable[0]));
+}
+
+struct cmd cmd_read = {"read", cmd_read_args_init, cmd_read_parse_exec,
+                       cmd_read_args_print_syntax, cmd_read_free};
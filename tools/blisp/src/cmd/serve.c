@@ -0,0 +1,683 @@
+// SPDX-License-Identifier: MIT
+#include <argtable3.h>
+#include <blisp.h>
+#include <blisp_easy.h>
+#include <blisp_util.h>
+#include <inttypes.h>
+#include <stdlib.h>
+#include <string.h>
+#include "../cmd.h"
+#include "../common.h"
+#include "../flash_verify.h"
+#include "../serve.h"
+#include "parse_file.h"
+
+#ifndef _WIN32
+#include <errno.h>
+#include <poll.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdarg.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+#endif
+
+#define REG_EXTENDED 1
+#define REG_ICASE (REG_EXTENDED << 1)
+
+#define SERVE_MAX_PORTS 64
+
+static struct arg_rex* cmd;
+static struct arg_str *port_names, *port_match, *chip_type, *socket_path;
+static struct arg_int *baudrate, *flash_baudrate, *write_window;
+static struct arg_lit* compress;
+static struct arg_end* end;
+static void* cmd_serve_argtable[10];
+static void cmd_serve_args_print_glossary();
+
+#ifndef _WIN32
+
+// A board the daemon owns. Its port stays open and, once the first job has
+// connected, eflash_loader stays running on it until a job fails or resets
+// the chip.
+struct serve_port {
+  char* name;
+  struct blisp_device device;
+  bool opened;
+  bool ready;  // eflash_loader is running and taking commands
+  pthread_mutex_t job_lock;  // Held for the whole of a job
+
+  // Status, guarded by serve_status_lock
+  const char* job;  // Running job, NULL while idle
+  uint64_t job_start_us;
+  uint32_t job_count;
+  uint32_t failed_count;
+  blisp_return_t last_ret;
+};
+
+struct serve {
+  struct serve_port* ports;
+  int32_t port_count;
+  uint32_t baudrate;
+  uint32_t flash_baudrate;
+  // Connected clients, guarded by serve_status_lock. Their threads are
+  // detached, so teardown waits for the list to empty.
+  struct serve_client* clients;
+};
+
+struct serve_client {
+  int fd;
+  struct serve* serve;
+  struct serve_client* next;
+};
+
+static pthread_mutex_t serve_status_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t serve_clients_gone = PTHREAD_COND_INITIALIZER;
+static volatile sig_atomic_t serve_stopping = 0;
+
+static void serve_stop(int signal_number) {
+  (void)signal_number;
+  serve_stopping = 1;
+}
+
+static void serve_reply(int fd, const char* format, ...)
+    __attribute__((format(printf, 2, 3)));
+
+static void serve_reply(int fd, const char* format, ...) {
+  va_list args;
+  va_start(args, format);
+  vdprintf(fd, format, args);
+  va_end(args);
+}
+
+static void serve_set_job(struct serve_port* port, const char* job) {
+  pthread_mutex_lock(&serve_status_lock);
+  port->job = job;
+  port->job_start_us = monotonic_us();
+  pthread_mutex_unlock(&serve_status_lock);
+}
+
+static void serve_finish_job(struct serve_port* port, blisp_return_t ret) {
+  pthread_mutex_lock(&serve_status_lock);
+  port->job = NULL;
+  port->job_count++;
+  if (ret != BLISP_OK) {
+    port->failed_count++;
+  }
+  port->last_ret = ret;
+  pthread_mutex_unlock(&serve_status_lock);
+}
+
+// Connects to the board and starts eflash_loader, unless that is still
+// running from the last job
+static blisp_return_t serve_prepare(struct serve* serve,
+                                    struct serve_port* port) {
+  struct blisp_device* device = &port->device;
+  blisp_return_t ret;
+
+  if (port->ready) {
+    return BLISP_OK;
+  }
+  // A failed job may have left the link at the flashing rate
+  if (device->current_baud_rate != serve->baudrate) {
+    ret = blisp_device_set_baudrate(device, serve->baudrate);
+    if (ret != BLISP_OK) {
+      return ret;
+    }
+  }
+  ret = blisp_common_prepare_flash(device);
+  if (ret != BLISP_OK) {
+    return ret;
+  }
+  ret = blisp_common_escalate_baudrate(device, serve->flash_baudrate);
+  if (ret != BLISP_OK) {
+    return ret;
+  }
+  port->ready = true;
+  return BLISP_OK;
+}
+
+// Adds what a firmware file puts into flash to hashes, boot header first
+static blisp_return_t serve_hash_image(struct flash_verify* hashes,
+                                       const parsed_firmware_file_t* file,
+                                       const struct bfl_boot_header* header) {
+  blisp_return_t ret;
+
+  if (file->needs_boot_struct) {
+    ret = flash_verify_add(hashes, 0x0000, (const uint8_t*)header,
+                           sizeof(struct bfl_boot_header));
+    if (ret != BLISP_OK) {
+      return ret;
+    }
+  }
+  for (size_t i = 0; i < file->segment_count; i++) {
+    ret = flash_verify_add(hashes, file->segments[i].address,
+                           file->segments[i].data, file->segments[i].length);
+    if (ret != BLISP_OK) {
+      return ret;
+    }
+  }
+  return BLISP_OK;
+}
+
+// Checks the flash against hashes, telling the client which sectors differ
+static blisp_return_t serve_verify(struct flash_verify* hashes,
+                                   struct blisp_device* device,
+                                   int fd) {
+  int client_fd = dup(fd);
+  FILE* client = client_fd < 0 ? NULL : fdopen(client_fd, "w");
+  if (client == NULL) {
+    if (client_fd >= 0) {
+      close(client_fd);
+    }
+    return BLISP_ERR_OUT_OF_MEMORY;
+  }
+  blisp_return_t ret = flash_verify_check(hashes, device, client, client);
+  fclose(client);
+  return ret;
+}
+
+static blisp_return_t serve_write(struct serve_port* port,
+                                  const struct serve_request* request,
+                                  int fd) {
+  struct blisp_device* device = &port->device;
+  parsed_firmware_file_t file;
+  struct bfl_boot_header boot_header;
+  struct flash_verify hashes;
+  bool write = strcmp(request->job, "write") == 0;
+  blisp_return_t ret;
+
+  memset(&file, 0, sizeof(file));
+  if (parse_firmware_file(request->path, &file) < 0) {
+    serve_reply(fd, "Failed to read firmware file \"%s\".\n", request->path);
+    return BLISP_ERR_CANT_OPEN_FILE;
+  }
+  flash_verify_init(&hashes);
+  if (file.needs_boot_struct) {
+    fill_up_boot_header(&boot_header);
+    // Move the firmware to-be-flashed beyond the boot header area
+    move_parsed_firmware_file(&file, 0x2000);
+  }
+
+  if (write && file.needs_boot_struct) {
+    ret = blisp_device_flash_erase(device, 0x0000,
+                                   sizeof(struct bfl_boot_header));
+    if (ret == BLISP_OK) {
+      ret = blisp_device_flash_write(device, 0x0000, (uint8_t*)&boot_header,
+                                     sizeof(struct bfl_boot_header));
+    }
+    if (ret != BLISP_OK) {
+      serve_reply(fd, "Failed to write boot header, ret: %d\n", ret);
+      goto exit;
+    }
+  }
+  if (write) {
+    ret = blisp_common_flash_image(device, &file, NULL);
+    if (ret != BLISP_OK) {
+      serve_reply(fd, "Failed to write firmware, ret: %d\n", ret);
+      goto exit;
+    }
+    ret = blisp_device_program_check(device);
+    if (ret != BLISP_OK) {
+      serve_reply(fd, "Failed to check program, ret: %d\n", ret);
+      goto exit;
+    }
+    serve_reply(fd, "Wrote %zu bytes @ 0x%08zx.\n", file.payload_length,
+                file.payload_address);
+  }
+
+  if (!write || request->verify) {
+    ret = serve_hash_image(&hashes, &file, &boot_header);
+    if (ret == BLISP_OK) {
+      ret = serve_verify(&hashes, device, fd);
+    }
+    if (ret == BLISP_ERR_VERIFY_FAILED) {
+      serve_reply(fd, "Flash doesn't match \"%s\".\n", request->path);
+      goto exit;
+    } else if (ret != BLISP_OK) {
+      serve_reply(fd, "Failed to verify, ret: %d\n", ret);
+      goto exit;
+    }
+    serve_reply(fd, "Flash matches \"%s\".\n", request->path);
+  }
+
+exit:
+  flash_verify_free(&hashes);
+  free_parsed_firmware_file(&file);
+  return ret;
+}
+
+static blisp_return_t serve_erase(struct serve_port* port,
+                                  const struct serve_request* request,
+                                  int fd) {
+  blisp_return_t ret;
+
+  if (request->length == 0) {
+    ret = blisp_device_chip_erase(&port->device);
+  } else {
+    ret = blisp_device_flash_erase(&port->device, request->address,
+                                   request->address + request->length - 1);
+  }
+  if (ret != BLISP_OK) {
+    serve_reply(fd, "Failed to erase flash, ret: %d\n", ret);
+  }
+  return ret;
+}
+
+static blisp_return_t serve_run_job(struct serve* serve,
+                                    struct serve_port* port,
+                                    const struct serve_request* request,
+                                    int fd) {
+  blisp_return_t ret;
+
+  pthread_mutex_lock(&port->job_lock);
+  serve_set_job(port, request->job);
+  uint64_t start = monotonic_us();
+
+  if (serve_stopping) {
+    // Queued behind a job that was running when the daemon was stopped
+    serve_reply(fd, "The daemon is stopping.\n");
+    ret = BLISP_ERR_BUSY;
+    goto exit;
+  }
+  if (!port->opened) {
+    serve_reply(fd, "%s could not be opened.\n", port->name);
+    ret = BLISP_ERR_CANT_OPEN_DEVICE;
+    goto exit;
+  }
+  ret = serve_prepare(serve, port);
+  if (ret != BLISP_OK) {
+    serve_reply(fd, "Failed to connect to %s, ret: %d\n", port->name, ret);
+    goto exit;
+  }
+
+  if (strcmp(request->job, "write") == 0 ||
+      strcmp(request->job, "verify") == 0) {
+    ret = serve_write(port, request, fd);
+  } else if (strcmp(request->job, "erase") == 0) {
+    ret = serve_erase(port, request, fd);
+  } else {
+    ret = blisp_device_reset(&port->device);
+    port->ready = false;
+  }
+
+exit:
+  // Anything could have gone wrong on the link, start over next time
+  if (ret != BLISP_OK) {
+    port->ready = false;
+  }
+  printf("%s: %s %s in %.2f s\n", port->name, request->job,
+         ret == BLISP_OK ? "done" : "failed", (monotonic_us() - start) / 1e6);
+  fflush(stdout);
+  serve_finish_job(port, ret);
+  pthread_mutex_unlock(&port->job_lock);
+  return ret;
+}
+
+static void serve_status(struct serve* serve, int fd) {
+  uint64_t now = monotonic_us();
+
+  serve_reply(fd, "%-24s %-8s %-6s %6s %6s  %s\n", "Port", "State", "Loader",
+              "Jobs", "Failed", "Last result");
+  pthread_mutex_lock(&serve_status_lock);
+  for (int32_t i = 0; i < serve->port_count; i++) {
+    struct serve_port* port = &serve->ports[i];
+    char state[32];
+    if (!port->opened) {
+      snprintf(state, sizeof(state), "closed");
+    } else if (port->job != NULL) {
+      snprintf(state, sizeof(state), "%s %.0fs", port->job,
+               (now - port->job_start_us) / 1e6);
+    } else {
+      snprintf(state, sizeof(state), "idle");
+    }
+    // A running job owns ready, and may hold job_lock for minutes
+    const char* loader = "busy";
+    if (pthread_mutex_trylock(&port->job_lock) == 0) {
+      loader = port->ready ? "yes" : "no";
+      pthread_mutex_unlock(&port->job_lock);
+    }
+    serve_reply(fd, "%-24s %-8s %-6s %6" PRIu32 " %6" PRIu32 "  %d\n",
+                port->name, state, loader,
+                port->job_count, port->failed_count, port->last_ret);
+  }
+  pthread_mutex_unlock(&serve_status_lock);
+}
+
+static void* serve_client_thread(void* arg) {
+  struct serve_client* client = arg;
+  struct serve* serve = client->serve;
+  struct serve_request* request = malloc(sizeof(struct serve_request));
+  char* line = malloc(SERVE_LINE_SIZE);
+  blisp_return_t ret = BLISP_ERR_INVALID_COMMAND;
+
+  if (request == NULL || line == NULL) {
+    ret = BLISP_ERR_OUT_OF_MEMORY;
+    goto exit;
+  }
+  if (!serve_read_line(client->fd, line, SERVE_LINE_SIZE) ||
+      !serve_parse_request(line, request)) {
+    serve_reply(client->fd, "Malformed job.\n");
+    goto exit;
+  }
+
+  if (strcmp(request->job, "status") == 0) {
+    serve_status(serve, client->fd);
+    ret = BLISP_OK;
+    goto exit;
+  }
+  if (strcmp(request->job, "write") != 0 &&
+      strcmp(request->job, "verify") != 0 &&
+      strcmp(request->job, "erase") != 0 &&
+      strcmp(request->job, "reset") != 0) {
+    serve_reply(client->fd, "Unknown job \"%s\".\n", request->job);
+    goto exit;
+  }
+  for (int32_t i = 0; i < serve->port_count; i++) {
+    if (strcmp(serve->ports[i].name, request->port) == 0) {
+      ret = serve_run_job(serve, &serve->ports[i], request, client->fd);
+      goto exit;
+    }
+  }
+  serve_reply(client->fd, "%s is not served.\n", request->port);
+  ret = BLISP_ERR_DEVICE_NOT_FOUND;
+
+exit:
+  serve_reply(client->fd, SERVE_DONE "%d\n", ret);
+  // Last touch of serve, the daemon may tear it down right after
+  pthread_mutex_lock(&serve_status_lock);
+  struct serve_client** link = &serve->clients;
+  while (*link != client) {
+    link = &(*link)->next;
+  }
+  *link = client->next;
+  if (serve->clients == NULL) {
+    pthread_cond_signal(&serve_clients_gone);
+  }
+  pthread_mutex_unlock(&serve_status_lock);
+  close(client->fd);
+  free(line);
+  free(request);
+  free(client);
+  return NULL;
+}
+
+// Binds the socket, replacing one left behind by a daemon that is gone
+static int serve_listen(const char* path) {
+  struct sockaddr_un address;
+
+  if (strlen(path) >= sizeof(address.sun_path)) {
+    fprintf(stderr, "Socket path \"%s\" is too long.\n", path);
+    return -1;
+  }
+  memset(&address, 0, sizeof(address));
+  address.sun_family = AF_UNIX;
+  strcpy(address.sun_path, path);
+
+  int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+  if (fd < 0) {
+    perror("socket");
+    return -1;
+  }
+  if (connect(fd, (struct sockaddr*)&address, sizeof(address)) == 0) {
+    fprintf(stderr, "Another blisp serve is listening on %s.\n", path);
+    close(fd);
+    return -1;
+  }
+  unlink(path);
+  if (bind(fd, (struct sockaddr*)&address, sizeof(address)) != 0 ||
+      listen(fd, 16) != 0) {
+    perror(path);
+    close(fd);
+    return -1;
+  }
+  return fd;
+}
+
+static void serve_accept_loop(struct serve* serve, int listener) {
+  struct pollfd poll_fd = {.fd = listener, .events = POLLIN};
+
+  while (!serve_stopping) {
+    // Wakes up now and then, a signal may hit another thread
+    if (poll(&poll_fd, 1, 250) <= 0) {
+      continue;
+    }
+    int fd = accept(listener, NULL, NULL);
+    if (fd < 0) {
+      continue;
+    }
+    struct serve_client* client = malloc(sizeof(struct serve_client));
+    pthread_t thread;
+    if (client == NULL) {
+      close(fd);
+      continue;
+    }
+    client->fd = fd;
+    client->serve = serve;
+    pthread_mutex_lock(&serve_status_lock);
+    client->next = serve->clients;
+    serve->clients = client;
+    if (pthread_create(&thread, NULL, serve_client_thread, client) != 0) {
+      serve->clients = client->next;
+      pthread_mutex_unlock(&serve_status_lock);
+      close(fd);
+      free(client);
+      continue;
+    }
+    pthread_mutex_unlock(&serve_status_lock);
+    pthread_detach(thread);
+  }
+}
+
+// Wakes clients blocked on their socket and waits for all of them to leave.
+// Running jobs finish first, queued ones give up.
+static void serve_wait_for_clients(struct serve* serve) {
+  pthread_mutex_lock(&serve_status_lock);
+  for (struct serve_client* client = serve->clients; client != NULL;
+       client = client->next) {
+    shutdown(client->fd, SHUT_RD);
+  }
+  while (serve->clients != NULL) {
+    pthread_cond_wait(&serve_clients_gone, &serve_status_lock);
+  }
+  pthread_mutex_unlock(&serve_status_lock);
+}
+
+static int32_t serve_collect_ports(char** ports) {
+  int32_t count = 0;
+
+  for (int i = 0; i < port_names->count && count < SERVE_MAX_PORTS; i++) {
+    ports[count] = malloc(strlen(port_names->sval[i]) + 1);
+    if (ports[count] == NULL) {
+      break;
+    }
+    strcpy(ports[count], port_names->sval[i]);
+    count++;
+  }
+  if (port_match->count == 1) {
+    int32_t found = blisp_list_ports(port_match->sval[0], ports + count,
+                                     SERVE_MAX_PORTS - count);
+    if (found < 0) {
+      return found;
+    }
+    count += found;
+  }
+  return count;
+}
+
+blisp_return_t blisp_serve(void) {
+  blisp_return_t ret = BLISP_OK;
+  struct serve serve;
+  char* ports[SERVE_MAX_PORTS];
+  const char* path =
+      socket_path->count == 1 ? socket_path->sval[0] : SERVE_DEFAULT_SOCKET;
+
+  memset(&serve, 0, sizeof(serve));
+  ret = blisp_common_check_link_args(baudrate, flash_baudrate, write_window,
+                                     &serve.baudrate);
+  if (ret != BLISP_OK)
+    return ret;
+  serve.flash_baudrate =
+      flash_baudrate->count == 1 ? *flash_baudrate->ival : 0;
+
+  struct blisp_chip* chip = blisp_common_get_chip(chip_type);
+  if (chip == NULL) {
+    return BLISP_ERR_INVALID_CHIP_TYPE;
+  }
+  // Unpacked once here, jobs on different ports then only read it
+  if (chip->get_eflash_loader != NULL) {
+    uint32_t loader_size;
+    chip->get_eflash_loader(&loader_size);
+  }
+
+  serve.port_count = serve_collect_ports(ports);
+  if (serve.port_count < 0) {
+    return serve.port_count;
+  }
+  if (serve.port_count == 0) {
+    fprintf(stderr, "No ports given or matched.\n");
+    return BLISP_ERR_DEVICE_NOT_FOUND;
+  }
+  serve.ports = calloc(serve.port_count, sizeof(struct serve_port));
+  if (serve.ports == NULL) {
+    ret = BLISP_ERR_OUT_OF_MEMORY;
+    goto exit;
+  }
+
+  // Device setup touches shared chip state, so it stays on this thread.
+  for (int32_t i = 0; i < serve.port_count; i++) {
+    struct serve_port* port = &serve.ports[i];
+    port->name = ports[i];
+    pthread_mutex_init(&port->job_lock, NULL);
+    port->opened = blisp_device_init(&port->device, chip) == BLISP_OK &&
+                   blisp_device_open(&port->device, port->name,
+                                     serve.baudrate) == BLISP_OK;
+    if (!port->opened) {
+      fprintf(stderr, "Failed to open %s.\n", port->name);
+      continue;
+    }
+    if (write_window->count == 1) {
+      port->device.flash_write_window = *write_window->ival;
+    }
+    if (compress->count) {
+      port->device.flash_compress = blisp_easy_flash_compress_supported();
+    }
+  }
+
+  int listener = serve_listen(path);
+  if (listener < 0) {
+    ret = BLISP_ERR_API_ERROR;
+    goto exit;
+  }
+
+  struct sigaction action;
+  memset(&action, 0, sizeof(action));
+  action.sa_handler = serve_stop;
+  sigaction(SIGINT, &action, NULL);
+  sigaction(SIGTERM, &action, NULL);
+  signal(SIGPIPE, SIG_IGN);  // Clients may hang up mid-job
+
+  printf("Serving %" PRId32 " port(s) on %s\n", serve.port_count, path);
+  fflush(stdout);
+  blisp_common_set_quiet(true);
+  serve_accept_loop(&serve, listener);
+  blisp_common_set_quiet(false);
+
+  close(listener);
+  unlink(path);
+  printf("Stopping.\n");
+  fflush(stdout);
+  serve_wait_for_clients(&serve);
+
+exit:
+  for (int32_t i = 0; i < serve.port_count; i++) {
+    if (serve.ports != NULL) {
+      struct serve_port* port = &serve.ports[i];
+      if (port->opened) {
+        blisp_device_close(&port->device);
+      }
+      pthread_mutex_destroy(&port->job_lock);
+    }
+    free(ports[i]);
+  }
+  free(serve.ports);
+  return ret;
+}
+
+#else
+
+blisp_return_t blisp_serve(void) {
+  fprintf(stderr, "blisp serve needs Unix domain sockets, which this build "
+                  "doesn't support.\n");
+  return BLISP_ERR_NOT_IMPLEMENTED;
+}
+
+#endif
+
+blisp_return_t cmd_serve_args_init(void) {
+  size_t index = 0;
+
+  cmd_serve_argtable[index++] = cmd =
+      arg_rex1(NULL, NULL, "serve", NULL, REG_ICASE, NULL);
+  cmd_serve_argtable[index++] = chip_type =
+      arg_str1("c", "chip", "<chip_type>", "Chip Type");
+  cmd_serve_argtable[index++] = port_names =
+      arg_strn("p", "port", "<port_name>", 0, SERVE_MAX_PORTS,
+               "Name/Path to a Serial Port, may be repeated");
+  cmd_serve_argtable[index++] = port_match =
+      arg_str0(NULL, "match", "<prefix>",
+               "Also serve every Serial Port whose name starts with prefix");
+  cmd_serve_argtable[index++] = socket_path =
+      arg_str0(NULL, "socket", "<path>",
+               "Socket to take jobs on (default: " SERVE_DEFAULT_SOCKET ")");
+  cmd_serve_argtable[index++] = baudrate =
+      arg_int0("b", "baudrate", "<baud rate>",
+               "Serial baud rate (default: " XSTR(DEFAULT_BAUDRATE) ")");
+  cmd_serve_argtable[index++] = flash_baudrate =
+      arg_int0(NULL, "flash-baudrate", "<baud rate>",
+               "Baud rate to switch to once eflash_loader is running");
+  cmd_serve_argtable[index++] = write_window =
+      arg_int0(NULL, "window", "<chunks>",
+               "Flash write chunks kept in flight (default: 1)");
+  cmd_serve_argtable[index++] = compress =
+      arg_lit0(NULL, "compress",
+               "Send flash writes compressed where it pays off");
+  cmd_serve_argtable[index++] = end = arg_end(10);
+
+  if (arg_nullcheck(cmd_serve_argtable) != 0) {
+    fprintf(stderr, "insufficient memory\n");
+    return BLISP_ERR_OUT_OF_MEMORY;
+  }
+  return BLISP_OK;
+}
+
+void cmd_serve_args_print_glossary(void) {
+  fputs("Usage: blisp", stdout);
+  arg_print_syntax(stdout, cmd_serve_argtable, "\n");
+  puts("Keeps devices connected and takes jobs from blisp job");
+  arg_print_glossary(stdout, cmd_serve_argtable, "  %-25s %s\n");
+}
+
+blisp_return_t cmd_serve_parse_exec(int argc, char** argv) {
+  int errors = arg_parse(argc, argv, cmd_serve_argtable);
+  if (errors == 0) {
+    return blisp_serve();
+  } else if (cmd->count == 1) {
+    cmd_serve_args_print_glossary();
+    return BLISP_OK;
+  }
+  return BLISP_ERR_INVALID_COMMAND;
+}
+
+void cmd_serve_args_print_syntax(void) {
+  arg_print_syntax(stdout, cmd_serve_argtable, "\n");
+}
+
+void cmd_serve_free(void) {
+  arg_freetable(cmd_serve_argtable,
+                sizeof(cmd_serve_argtable) / sizeof(cmd_serve_argtable[0]));
+}
+
+struct cmd cmd_serve = {"serve", cmd_serve_args_init, cmd_serve_parse_exec,
+                        cmd_serve_args_print_syntax, cmd_serve_free};
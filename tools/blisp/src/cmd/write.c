@@ -2,28 +2,61 @@
 #include <argtable3.h>
 #include <blisp.h>
 #include <blisp_easy.h>
+#include <blisp_sha256.h>
 #include <blisp_struct.h>
+#include <blisp_util.h>
 #include <inttypes.h>
 #include <stdlib.h>
 #include <string.h>
 #include "../cmd.h"
 #include "../common.h"
+#include "../flash_plan.h"
+#include "../flash_verify.h"
+#include "../stats.h"
+#include "../trace.h"
 #include "../util.h"
+#include "firmware_stream.h"
 #include "parse_file.h"
 
+#if defined(_WIN32)
+#include <fcntl.h>
+#include <io.h>
+#endif
+
 #define REG_EXTENDED 1
 #define REG_ICASE (REG_EXTENDED << 1)
 
 static struct arg_rex* cmd;
-static struct arg_file* binary_to_write;
-static struct arg_str *port_name, *chip_type;
-static struct arg_int *baudrate;
-static struct arg_lit* reset;
+static struct arg_file *binary_to_write, *trace_path, *capture_path,
+    *stats_path;
+static struct arg_str *port_name, *chip_type, *stats_format;
+static struct arg_int *baudrate, *flash_baudrate, *write_window;
+static struct arg_lit *reset, *diff, *compress, *verify, *fast_connect;
 static struct arg_end* end;
-static void* cmd_write_argtable[7];
+static void* cmd_write_argtable[17];
 static void cmd_write_args_print_glossary();
 
+// Keeps the JSON apart from the progress on stdout, so tools can parse it
+static void write_stats(const struct blisp_metrics* metrics,
+                        uint64_t duration_us) {
+  if (stats_path->count == 0) {
+    stats_print_json(stderr, metrics, duration_us);
+    return;
+  }
+  FILE* file = fopen(stats_path->filename[0], "w");
+  if (file == NULL) {
+    fprintf(stderr, "Failed to open %s\n", stats_path->filename[0]);
+    return;
+  }
+  stats_print_json(file, metrics, duration_us);
+  if (fclose(file) != 0) {
+    fprintf(stderr, "Failed to write %s\n", stats_path->filename[0]);
+  }
+}
+
 void fill_up_boot_header(struct bfl_boot_header* boot_header) {
+  // Bit fields not set below would otherwise carry whatever was on the stack
+  memset(boot_header, 0, sizeof(struct bfl_boot_header));
   memcpy(boot_header->magiccode, "BFNP", 4);
 
   boot_header->revison = 0x01;
@@ -167,21 +200,411 @@ void fill_up_boot_header(struct bfl_boot_header* boot_header) {
   boot_header->crc32 = 0xDEADBEEF;
 }
 
-blisp_return_t blisp_flash_firmware(void) {
-  struct blisp_device device;
+// Granularity of --diff, matches the flash sector size
+#define DIFF_SECTOR_SIZE 4096
+
+enum diff_sector_state {
+  DIFF_SECTOR_UNCHANGED,
+  DIFF_SECTOR_BLANK,  // Erased on the device, can be written without erase
+  DIFF_SECTOR_CHANGED
+};
+
+/**
+ * Writes data to flash, touching only sectors whose contents differ.
+ * Each sector is compared using the SHA-256 eflash_loader computes on the
+ * device. Changed sectors are erased and written, blank sectors are only
+ * written, and adjacent sectors are merged into a single erase/write.
+ */
+static blisp_return_t blisp_flash_diff(struct blisp_device* device,
+                                       uint8_t* data,
+                                       uint32_t address,
+                                       uint32_t length) {
+  blisp_return_t ret = BLISP_OK;
+  uint8_t device_digest[SHA256_DIGEST_SIZE];
+  uint8_t host_digest[SHA256_DIGEST_SIZE];
+  uint8_t blank_digest[SHA256_DIGEST_SIZE];
+  uint8_t blank[DIFF_SECTOR_SIZE];
+  uint32_t blank_digest_length = 0;
+  uint32_t sector_count = 0, changed_count = 0, blank_count = 0;
+
+  if (length == 0) {
+    return BLISP_OK;
+  }
+
+  // Sectors follow flash boundaries, the first and last may be partial
+  uint32_t first_sector = address / DIFF_SECTOR_SIZE;
+  uint32_t last_sector = (address + length - 1) / DIFF_SECTOR_SIZE;
+  uint32_t total_sectors = last_sector - first_sector + 1;
+  uint8_t* states = malloc(total_sectors);
+  if (states == NULL) {
+    return BLISP_ERR_OUT_OF_MEMORY;
+  }
+  memset(blank, 0xFF, sizeof(blank));
+
+  printf("Comparing %" PRIu32 " sectors with the device...\n", total_sectors);
+  for (uint32_t i = 0; i < total_sectors; i++) {
+    uint32_t start = (first_sector + i) * DIFF_SECTOR_SIZE;
+    uint32_t end = start + DIFF_SECTOR_SIZE;
+    if (start < address)
+      start = address;
+    if (end > address + length)
+      end = address + length;
+
+    ret = blisp_device_flash_read_sha256(device, start, end - start,
+                                         device_digest);
+    if (ret != BLISP_OK) {
+      fprintf(stderr, "Failed to read flash hash at 0x%08" PRIx32 ", ret: %d\n",
+              start, ret);
+      goto exit;
+    }
+
+    sha256_calculate(data + (start - address), end - start, host_digest);
+    if (blank_digest_length != end - start) {
+      blank_digest_length = end - start;
+      sha256_calculate(blank, blank_digest_length, blank_digest);
+    }
+
+    if (memcmp(device_digest, host_digest, SHA256_DIGEST_SIZE) == 0) {
+      states[i] = DIFF_SECTOR_UNCHANGED;
+    } else if (memcmp(device_digest, blank_digest, SHA256_DIGEST_SIZE) == 0) {
+      states[i] = DIFF_SECTOR_BLANK;
+      blank_count++;
+    } else {
+      states[i] = DIFF_SECTOR_CHANGED;
+      changed_count++;
+    }
+    sector_count++;
+  }
+  printf("%" PRIu32 " of %" PRIu32 " sectors differ (%" PRIu32
+         " of them blank).\n",
+         changed_count + blank_count, sector_count, blank_count);
+
+  for (uint32_t i = 0; i < total_sectors;) {
+    if (states[i] == DIFF_SECTOR_UNCHANGED) {
+      i++;
+      continue;
+    }
+    // Find the run of sectors that need writing
+    uint32_t run_end = i;
+    while (run_end < total_sectors && states[run_end] != DIFF_SECTOR_UNCHANGED)
+      run_end++;
+
+    uint32_t start = (first_sector + i) * DIFF_SECTOR_SIZE;
+    uint32_t end = (first_sector + run_end) * DIFF_SECTOR_SIZE;
+    if (start < address)
+      start = address;
+    if (end > address + length)
+      end = address + length;
+
+    // Erase the changed sectors of this run, skipping blank ones
+    for (uint32_t j = i; j < run_end;) {
+      if (states[j] != DIFF_SECTOR_CHANGED) {
+        j++;
+        continue;
+      }
+      uint32_t erase_end = j;
+      while (erase_end < run_end && states[erase_end] == DIFF_SECTOR_CHANGED)
+        erase_end++;
+      uint32_t erase_start_address = (first_sector + j) * DIFF_SECTOR_SIZE;
+      uint32_t erase_end_address =
+          (first_sector + erase_end) * DIFF_SECTOR_SIZE - 1;
+      printf("Erasing 0x%08" PRIx32 " - 0x%08" PRIx32 "...\n",
+             erase_start_address, erase_end_address);
+      ret = blisp_device_flash_erase(device, erase_start_address,
+                                     erase_end_address);
+      if (ret != BLISP_OK) {
+        fprintf(stderr, "Failed to erase flash.\n");
+        goto exit;
+      }
+      j = erase_end;
+    }
+
+    printf("Flashing %" PRIu32 " bytes @ 0x%08" PRIx32 "...\n", end - start,
+           start);
+    struct blisp_easy_transport data_transport =
+        blisp_easy_transport_new_from_memory(data + (start - address),
+                                             end - start);
+    ret = blisp_easy_flash_write(device, &data_transport, start, end - start,
+                                 blisp_common_progress_callback);
+    if (ret != BLISP_OK) {
+      fprintf(stderr, "Failed to write app to flash.\n");
+      goto exit;
+    }
+    i = run_end;
+  }
+
+exit:
+  free(states);
+  return ret;
+}
+
+/**
+ * Diffs every segment of the image. Segments that share a sector are
+ * compared as one, with 0xFF in between, since erasing the sector for one
+ * of them would wipe the other.
+ */
+static blisp_return_t blisp_flash_diff_image(
+    struct blisp_device* device,
+    const parsed_firmware_file_t* file) {
   blisp_return_t ret = BLISP_OK;
 
-  uint32_t baud = DEFAULT_BAUDRATE;
-  if (baudrate->count == 1) {
-    if (*baudrate->ival < 0) {
-      fprintf(stderr, "Baud rate cannot be negative!\n");
-      return BLISP_ERR_INVALID_COMMAND;
+  for (size_t i = 0; i < file->segment_count && ret == BLISP_OK;) {
+    const parsed_firmware_segment_t* first = &file->segments[i];
+    size_t end = first->address + first->length;
+    size_t next = i + 1;
+    while (next < file->segment_count &&
+           file->segments[next].address / DIFF_SECTOR_SIZE <=
+               (end - 1) / DIFF_SECTOR_SIZE) {
+      end = file->segments[next].address + file->segments[next].length;
+      next++;
+    }
+
+    if (next == i + 1) {
+      ret = blisp_flash_diff(device, first->data, first->address,
+                             first->length);
     } else {
-      baud = *baudrate->ival;
+      uint8_t* span = malloc(end - first->address);
+      if (span == NULL) {
+        return BLISP_ERR_OUT_OF_MEMORY;
+      }
+      memset(span, 0xFF, end - first->address);
+      for (size_t j = i; j < next; j++) {
+        memcpy(span + (file->segments[j].address - first->address),
+               file->segments[j].data, file->segments[j].length);
+      }
+      ret = blisp_flash_diff(device, span, first->address,
+                             end - first->address);
+      free(span);
+    }
+    i = next;
+  }
+  return ret;
+}
+
+// Firmware that starts at 0 gets a boot header there and is moved past it
+#define BOOT_HEADER_AREA_SIZE 0x2000
+
+static blisp_return_t blisp_flash_boot_header(struct blisp_device* device,
+                                              bool use_diff,
+                                              struct flash_verify* verify) {
+  blisp_return_t ret;
+
+  // Create a default boot header section in ram to be written out
+  struct bfl_boot_header boot_header;
+  fill_up_boot_header(&boot_header);
+  if (verify != NULL) {
+    ret = flash_verify_add(verify, 0x0000, (uint8_t*)&boot_header,
+                           sizeof(struct bfl_boot_header));
+    if (ret != BLISP_OK) {
+      return ret;
+    }
+  }
+  if (use_diff) {
+    return blisp_flash_diff(device, (uint8_t*)&boot_header, 0x0000,
+                            sizeof(struct bfl_boot_header));
+  }
+
+  printf("Erasing flash to flash boot header\n");
+  ret = blisp_device_flash_erase(device, 0x0000,
+                                 sizeof(struct bfl_boot_header));
+  if (ret != BLISP_OK) {
+    fprintf(stderr, "Failed to erase flash.\n");
+    return ret;
+  }
+  // Now burn the header
+
+  printf("Flashing boot header...\n");
+  ret = blisp_device_flash_write(device, 0x0000, (uint8_t*)&boot_header,
+                                 sizeof(struct bfl_boot_header));
+  if (ret != BLISP_OK) {
+    fprintf(stderr, "Failed to write boot header.\n");
+  }
+  return ret;
+}
+
+// Largest run of a streamed image held in memory before it is flashed
+#define STREAM_RUN_SIZE (64 * 1024)
+
+struct stream_writer {
+  uint8_t* run;  // Data not flashed yet, from run_address on
+  uint32_t run_address;
+  uint32_t run_length;
+  uint32_t erased_end;  // End of the sectors erased so far
+  uint32_t written_end;
+  uint64_t total;
+  struct flash_verify* verify;  // Hashes the runs as they go out if set
+};
+
+static blisp_return_t blisp_stream_flush(struct blisp_device* device,
+                                         struct stream_writer* writer) {
+  blisp_return_t ret;
+
+  if (writer->run_length == 0) {
+    return BLISP_OK;
+  }
+  uint32_t run_end = writer->run_address + writer->run_length;
+  uint32_t erase_start = writer->run_address & ~(FLASH_PLAN_SECTOR_SIZE - 1);
+  uint32_t erase_end = (run_end + FLASH_PLAN_SECTOR_SIZE - 1) &
+                       ~(FLASH_PLAN_SECTOR_SIZE - 1);
+  // The sector the last run ended in is erased already
+  if (erase_start < writer->erased_end) {
+    erase_start = writer->erased_end;
+  }
+  if (erase_end > erase_start) {
+    ret = blisp_device_flash_erase(device, erase_start, erase_end - 1);
+    if (ret != BLISP_OK) {
+      fprintf(stderr, "\nFailed to erase flash.\n");
+      return ret;
+    }
+    writer->erased_end = erase_end;
+  }
+
+  if (writer->verify != NULL) {
+    ret = flash_verify_add(writer->verify, writer->run_address, writer->run,
+                           writer->run_length);
+    if (ret != BLISP_OK) {
+      return ret;
+    }
+  }
+
+  struct blisp_easy_transport data_transport =
+      blisp_easy_transport_new_from_memory(writer->run, writer->run_length);
+  ret = blisp_easy_flash_write(device, &data_transport, writer->run_address,
+                               writer->run_length, NULL);
+  if (ret != BLISP_OK) {
+    fprintf(stderr, "\nFailed to write app to flash.\n");
+    return ret;
+  }
+  writer->written_end = run_end;
+  writer->total += writer->run_length;
+  writer->run_length = 0;
+  printf("\rFlashed %" PRIu64 " bytes", writer->total);
+  fflush(stdout);
+  return BLISP_OK;
+}
+
+/**
+ * Flashes firmware as it comes in from a pipe, holding no more than
+ * STREAM_RUN_SIZE bytes of it in memory. Sectors are erased just ahead of
+ * the data, so it has to arrive in ascending address order.
+ */
+static blisp_return_t blisp_flash_stream(struct blisp_device* device,
+                                         FILE* input,
+                                         struct flash_verify* verify) {
+  blisp_return_t ret = BLISP_OK;
+  struct stream_writer writer = {0};
+  writer.verify = verify;
+  uint32_t offset = 0;
+  bool first = true;
+
+  firmware_stream_t* stream = malloc(sizeof(firmware_stream_t));
+  writer.run = malloc(STREAM_RUN_SIZE);
+  if (stream == NULL || writer.run == NULL) {
+    ret = BLISP_ERR_OUT_OF_MEMORY;
+    goto exit;
+  }
+  if (firmware_stream_open(stream, input) < 0) {
+    ret = BLISP_ERR_CANT_OPEN_FILE;
+    goto exit;
+  }
+
+  for (;;) {
+    uint32_t address;
+    const uint8_t* data;
+    ssize_t length = firmware_stream_next(stream, &address, &data);
+    if (length < 0) {
+      fprintf(stderr, "\nFailed to parse the input, ret: %d\n", (int)length);
+      ret = BLISP_ERR_UNKNOWN;
+      goto exit;
+    }
+    if (length == 0) {
+      break;
+    }
+    // Same rule as parse_firmware_file, firmware at 0 needs a boot header
+    if (first) {
+      first = false;
+      if (address == 0) {
+        ret = blisp_flash_boot_header(device, false, verify);
+        if (ret != BLISP_OK) {
+          goto exit;
+        }
+        offset = BOOT_HEADER_AREA_SIZE;
+      }
+    }
+
+    address += offset;
+    if (address < writer.written_end ||
+        (writer.run_length > 0 &&
+         address < writer.run_address + writer.run_length)) {
+      fprintf(stderr,
+              "\nInput goes back to 0x%08" PRIx32
+              ", streamed firmware has to be in ascending address order.\n",
+              address);
+      ret = BLISP_ERR_INVALID_COMMAND;
+      goto exit;
+    }
+    while (length > 0) {
+      if (writer.run_length > 0 &&
+          (address != writer.run_address + writer.run_length ||
+           writer.run_length == STREAM_RUN_SIZE)) {
+        ret = blisp_stream_flush(device, &writer);
+        if (ret != BLISP_OK) {
+          goto exit;
+        }
+      }
+      if (writer.run_length == 0) {
+        writer.run_address = address;
+      }
+      uint32_t space = STREAM_RUN_SIZE - writer.run_length;
+      uint32_t copied = (size_t)length < space ? (uint32_t)length : space;
+      memcpy(writer.run + writer.run_length, data, copied);
+      writer.run_length += copied;
+      address += copied;
+      data += copied;
+      length -= copied;
     }
   }
+  ret = blisp_stream_flush(device, &writer);
+  printf("\n");
+
+exit:
+  free(writer.run);
+  free(stream);
+  return ret;
+}
+
+blisp_return_t blisp_flash_firmware(void) {
+  struct blisp_device device;
+  blisp_return_t ret = BLISP_OK;
+  // Hashes of everything written, for --verify
+  struct flash_verify hashes;
+  flash_verify_init(&hashes);
+  struct flash_verify* verify_hashes = verify->count ? &hashes : NULL;
+  struct blisp_metrics* metrics = NULL;
+  struct blisp_capture capture = {0};
+  uint64_t start = monotonic_us();
+
+  uint32_t baud;
+  ret = blisp_common_check_link_args(baudrate, flash_baudrate, write_window,
+                                     &baud);
+  if (ret != BLISP_OK)
+    return ret;
+
+  if (stats_format->count == 1 && strcmp(stats_format->sval[0], "json") != 0) {
+    fprintf(stderr, "Unknown stats format \"%s\", only json is supported.\n",
+            stats_format->sval[0]);
+    return BLISP_ERR_INVALID_COMMAND;
+  }
+
+  // stdin and named pipes can only be read once, from start to end
+  const char* input_path = binary_to_write->filename[0];
+  bool streaming = firmware_stream_needed(input_path);
+  if (streaming && diff->count) {
+    fprintf(stderr, "--diff needs the input to be a regular file.\n");
+    return BLISP_ERR_INVALID_COMMAND;
+  }
 
-  if (access(binary_to_write->filename[0], R_OK) != 0) {
+  if (strcmp(input_path, "-") != 0 && access(input_path, R_OK) != 0) {
     // File not accessible, error out.
     fprintf(stderr, "Input firmware not found: %s\n", binary_to_write->filename[0]);
     cmd_write_args_print_glossary(); /* Print help to assist user */
@@ -193,19 +616,92 @@ blisp_return_t blisp_flash_firmware(void) {
   if (ret != BLISP_OK) {
     return ret;
   }
+  if (write_window->count == 1) {
+    device.flash_write_window = *write_window->ival;
+  }
+  if (compress->count) {
+    blisp_common_enable_compression(&device);
+  }
+  if (fast_connect->count) {
+    blisp_common_enable_fast_connect(port_name, chip_type);
+  }
+  if (stats_format->count == 1 || stats_path->count == 1) {
+    metrics = calloc(1, sizeof(struct blisp_metrics));
+    if (metrics == NULL) {
+      ret = BLISP_ERR_OUT_OF_MEMORY;
+      goto exit1;
+    }
+    blisp_device_set_metrics(&device, metrics);
+  }
+  if (trace_path->count == 1) {
+    ret = trace_open(trace_path->filename[0]);
+    if (ret != BLISP_OK) {
+      goto exit1;
+    }
+    trace_attach(&device);
+    trace_begin("write");
+  }
+  if (capture_path->count == 1) {
+    ret = blisp_capture_open(&capture, capture_path->filename[0]);
+    if (ret != BLISP_OK) {
+      fprintf(stderr, "Failed to open %s\n", capture_path->filename[0]);
+      goto exit1;
+    }
+    blisp_device_set_capture(&device, &capture);
+  }
 
+  trace_begin("prepare_flash");
   ret = blisp_common_prepare_flash(&device);
+  trace_end(ret);
   if (ret != BLISP_OK) {
     // TODO: Error handling
     goto exit1;
   }
 
+  if (flash_baudrate->count == 1) {
+    trace_begin("escalate_baudrate");
+    ret = blisp_common_escalate_baudrate(&device, *flash_baudrate->ival);
+    trace_end(ret);
+    if (ret != BLISP_OK) {
+      goto exit1;
+    }
+  }
+
   parsed_firmware_file_t parsed_file;
   memset(&parsed_file, 0, sizeof(parsed_file));
-  if (parse_firmware_file(binary_to_write->filename[0], &parsed_file) < 0) {
+  if (streaming) {
+    FILE* input = stdin;
+    if (strcmp(input_path, "-") == 0) {
+#if defined(_WIN32)
+      _setmode(_fileno(stdin), _O_BINARY);
+#endif
+    } else {
+      input = fopen(input_path, "rb");
+      if (input == NULL) {
+        fprintf(stderr, "Failed to open %s\n", input_path);
+        ret = BLISP_ERR_CANT_OPEN_FILE;
+        goto exit1;
+      }
+    }
+    trace_begin("flash_stream");
+    ret = blisp_flash_stream(&device, input, verify_hashes);
+    trace_end(ret);
+    if (input != stdin) {
+      fclose(input);
+    }
+    if (ret != BLISP_OK) {
+      goto exit1;
+    }
+    goto check;
+  }
+  trace_begin("parse_firmware");
+  if (parse_firmware_file(input_path, &parsed_file) < 0) {
     // `parse_firmware_file` doesn't return `blisp_return_t`
     // so we default to the generic error.
     ret = BLISP_ERR_UNKNOWN;
+  }
+  trace_end(ret);
+  if (ret != BLISP_OK) {
     goto exit1;
   }
 
@@ -215,70 +711,72 @@ blisp_return_t blisp_flash_firmware(void) {
   // __should__
 
   if (parsed_file.needs_boot_struct) {
-    // Create a default boot header section in ram to be written out
-    struct bfl_boot_header boot_header;
-    fill_up_boot_header(&boot_header);
-    printf("Erasing flash to flash boot header\n");
-    ret = blisp_device_flash_erase(&device, 0x0000,
-                                   sizeof(struct bfl_boot_header));
-
+    trace_begin("flash_boot_header");
+    ret = blisp_flash_boot_header(&device, diff->count > 0, verify_hashes);
+    trace_end(ret);
     if (ret != BLISP_OK) {
-      fprintf(stderr, "Failed to erase flash.\n");
-      goto exit2;
-    }
-    // Now burn the header
-
-    printf("Flashing boot header...\n");
-    ret = blisp_device_flash_write(&device, 0x0000, (uint8_t*)&boot_header,
-                                   sizeof(struct bfl_boot_header));
-    if (ret != BLISP_OK) {
-      fprintf(stderr, "Failed to write boot header.\n");
       goto exit2;
     }
     // Move the firmware to-be-flashed beyond the boot header area
-    parsed_file.payload_address += 0x2000;
+    move_parsed_firmware_file(&parsed_file, BOOT_HEADER_AREA_SIZE);
+  }
+  if (verify_hashes != NULL) {
+    for (size_t i = 0; i < parsed_file.segment_count; i++) {
+      ret = flash_verify_add(verify_hashes, parsed_file.segments[i].address,
+                             parsed_file.segments[i].data,
+                             parsed_file.segments[i].length);
+      if (ret != BLISP_OK) {
+        goto exit2;
+      }
+    }
   }
   // Now that optional boot header is done, we clear out the flash for the new
   // firmware; and flash it in.
 
-  printf("Erasing flash for firmware, this might take a while...\n");
-  ret = blisp_device_flash_erase(
-      &device, parsed_file.payload_address,
-      parsed_file.payload_address + parsed_file.payload_length);
-
-  if (ret != BLISP_OK) {
-    fprintf(stderr,
-            "Failed to erase flash. Tried to erase from 0x%08zx to 0x%08zx\n",
-            parsed_file.payload_address,
-            parsed_file.payload_address + parsed_file.payload_length + 1);
-    goto exit2;
-  }
-
-  printf("Flashing the firmware %zu bytes @ 0x%08zx...\n",
-         parsed_file.payload_length, parsed_file.payload_address);
-  struct blisp_easy_transport data_transport =
-      blisp_easy_transport_new_from_memory(parsed_file.payload,
-                                           parsed_file.payload_length);
-
-  ret = blisp_easy_flash_write(
-      &device, &data_transport, parsed_file.payload_address,
-      parsed_file.payload_length, blisp_common_progress_callback);
-
-  if (ret != BLISP_OK) {
-    fprintf(stderr, "Failed to write app to flash.\n");
-    goto exit2;
+  if (diff->count) {
+    trace_begin("flash_diff_image");
+    ret = blisp_flash_diff_image(&device, &parsed_file);
+    trace_end(ret);
+    if (ret != BLISP_OK) {
+      goto exit2;
+    }
+  } else {
+    trace_begin("flash_image");
+    ret = blisp_common_flash_image(&device, &parsed_file,
+                                   blisp_common_progress_callback);
+    trace_end(ret);
+    if (ret != BLISP_OK) {
+      goto exit2;
+    }
   }
 
+check:
   printf("Checking program...\n");
+  trace_begin("program_check");
   ret = blisp_device_program_check(&device);
+  trace_end(ret);
   if (ret != BLISP_OK) {
     fprintf(stderr, "Failed to check program.\n");
     goto exit2;
   }
   printf("Program OK!\n");
+  if (verify_hashes != NULL) {
+    trace_begin("verify");
+    ret = flash_verify_check(verify_hashes, &device, stdout, stderr);
+    trace_end(ret);
+    if (ret != BLISP_OK) {
+      goto exit2;
+    }
+  }
+  if (device.flash_write_settled_size != 0) {
+    printf("Flash writes settled on %u byte chunks.\n",
+           device.flash_write_settled_size);
+  }
 
   if (reset->count > 0) {
-    blisp_device_reset(&device);
+    trace_begin("reset");
+    trace_end(blisp_device_reset(&device));
+    blisp_common_fast_connect_reset();
     printf("Resetting the chip.\n");
     // TODO: It seems that GPIO peripheral is not reset after resetting the chip
   }
@@ -286,10 +784,18 @@ blisp_return_t blisp_flash_firmware(void) {
   printf("Flash complete!\n");
 
 exit2:
-  if (parsed_file.payload != NULL)
-    free(parsed_file.payload);
+  free_parsed_firmware_file(&parsed_file);
 exit1:
+  trace_close(ret);
+  if (metrics != NULL) {
+    write_stats(metrics, monotonic_us() - start);
+    free(metrics);
+  }
+  flash_verify_free(&hashes);
   blisp_device_close(&device);
+  if (blisp_capture_close(&capture) != BLISP_OK) {
+    fprintf(stderr, "Failed to write %s\n", capture_path->filename[0]);
+  }
 
   return ret;
 }
@@ -307,10 +813,40 @@ blisp_return_t cmd_write_args_init(void) {
   cmd_write_argtable[index++] = baudrate =
       arg_int0("b", "baudrate", "<baud rate>",
                "Serial baud rate (default: " XSTR(DEFAULT_BAUDRATE) ")");
+  cmd_write_argtable[index++] = flash_baudrate =
+      arg_int0(NULL, "flash-baudrate", "<baud rate>",
+               "Baud rate to switch to once eflash_loader is running");
+  cmd_write_argtable[index++] = write_window =
+      arg_int0(NULL, "window", "<chunks>",
+               "Flash write chunks kept in flight (default: 1)");
+  cmd_write_argtable[index++] = compress =
+      arg_lit0(NULL, "compress",
+               "Send flash writes compressed where it pays off");
   cmd_write_argtable[index++] = reset =
       arg_lit0(NULL, "reset", "Reset chip after write");
+  cmd_write_argtable[index++] = fast_connect =
+      arg_lit0(NULL, "fast-connect",
+               "Shorten the handshake based on the last one on this port");
+  cmd_write_argtable[index++] = diff =
+      arg_lit0(NULL, "diff", "Only erase and write sectors that changed");
+  cmd_write_argtable[index++] = verify =
+      arg_lit0(NULL, "verify",
+               "Check the written flash against a SHA-256 of the input");
+  cmd_write_argtable[index++] = stats_format =
+      arg_str0(NULL, "stats", "<format>",
+               "Print command counts and latencies to stderr at the end "
+               "(json)");
+  cmd_write_argtable[index++] = stats_path =
+      arg_file0(NULL, "stats-file", "<file>",
+                "Write the --stats json to a file instead of stderr");
+  cmd_write_argtable[index++] = trace_path =
+      arg_file0(NULL, "trace", "<file>",
+                "Write a timeline of the run in Chrome trace format");
+  cmd_write_argtable[index++] = capture_path =
+      arg_file0(NULL, "capture", "<file>",
+                "Record the serial traffic for blisp-replay");
   cmd_write_argtable[index++] = binary_to_write =
-      arg_file1(NULL, NULL, "<input>", "Binary to write");
+      arg_file1(NULL, NULL, "<input>", "Binary to write, - for stdin");
   cmd_write_argtable[index++] = end = arg_end(10);
 
   if (arg_nullcheck(cmd_write_argtable) != 0) {
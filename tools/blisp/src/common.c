@@ -3,47 +3,115 @@
 #include <argtable3.h>
 #include <blisp.h>
 #include <inttypes.h>
+#include <stdarg.h>
+#include <stdbool.h>
 #include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include "blisp_easy.h"
 #include "blisp_util.h"
+#include "connect_cache.h"
 #include "error_codes.h"
+#include "flash_plan.h"
+#include "trace.h"
 #include "util.h"
 
+static bool quiet = false;
+// Cache key of the device while --fast-connect is on, empty otherwise
+static char fast_connect_key[256];
+static struct connect_cache_entry fast_connect_entry;
+
+static void blisp_common_info(const char* format, ...) {
+  if (quiet) {
+    return;
+  }
+  va_list args;
+  va_start(args, format);
+  vprintf(format, args);
+  va_end(args);
+}
+
+static void blisp_common_error(const char* format, ...) {
+  if (quiet) {
+    return;
+  }
+  va_list args;
+  va_start(args, format);
+  vfprintf(stderr, format, args);
+  va_end(args);
+}
+
+/**
+ * Silences the messages of the common helpers and the library's debug log,
+ * for commands that drive several devices at once and report the results
+ * themselves.
+ */
+void blisp_common_set_quiet(bool enable) {
+  quiet = enable;
+  blisp_dlog_set_quiet(enable);
+}
+
+/**
+ * Makes blisp_common_prepare_flash connect the way that worked the last time
+ * for this port, with handshake waits based on how quickly the chip answered
+ * then.
+ */
+void blisp_common_enable_fast_connect(struct arg_str* port_name,
+                                      struct arg_str* chip_type) {
+  snprintf(fast_connect_key, sizeof(fast_connect_key), "%s %s",
+           chip_type->count == 1 ? chip_type->sval[0] : "",
+           port_name->count == 1 ? port_name->sval[0] : "usb");
+}
+
+/**
+ * Notes that the chip was reset, so the next fast connect starts with the
+ * handshake.
+ */
+void blisp_common_fast_connect_reset(void) {
+  if (fast_connect_key[0] == '\0') {
+    return;
+  }
+  fast_connect_entry.skip_handshake = false;
+  connect_cache_store(fast_connect_key, &fast_connect_entry);
+}
+
 void blisp_common_progress_callback(uint32_t current_value,
                                     uint32_t max_value) {
-  printf("%" PRIu32 "b / %u (%.2f%%)\n", current_value, max_value,
-         (((float)current_value / (float)max_value) * 100.0f));
+  blisp_common_info("%" PRIu32 "b / %u (%.2f%%)\n", current_value, max_value,
+                    (((float)current_value / (float)max_value) * 100.0f));
 }
 
-blisp_return_t blisp_common_init_device(struct blisp_device* device,
-                                        struct arg_str* port_name,
-                                        struct arg_str* chip_type,
-                                        uint32_t baudrate) {
+struct blisp_chip* blisp_common_get_chip(struct arg_str* chip_type) {
   if (chip_type->count == 0) {
-    fprintf(stderr, "Chip type is invalid.\n");
-    return BLISP_ERR_INVALID_CHIP_TYPE;
+    blisp_common_error("Chip type is invalid.\n");
+    return NULL;
   }
 
-  struct blisp_chip* chip = NULL;
-
   if (strcmp(chip_type->sval[0], "bl70x") == 0) {
-    chip = &blisp_chip_bl70x;
+    return &blisp_chip_bl70x;
   } else if (strcmp(chip_type->sval[0], "bl60x") == 0) {
-    chip = &blisp_chip_bl60x;
+    return &blisp_chip_bl60x;
   } else if (strcmp(chip_type->sval[0], "bl808") == 0) {
-    chip = &blisp_chip_bl808;
-  } else {
-    fprintf(stderr, "Chip type is invalid.\n");
+    return &blisp_chip_bl808;
+  }
+  blisp_common_error("Chip type is invalid.\n");
+  return NULL;
+}
+
+blisp_return_t blisp_common_init_device(struct blisp_device* device,
+                                        struct arg_str* port_name,
+                                        struct arg_str* chip_type,
+                                        uint32_t baudrate) {
+  struct blisp_chip* chip = blisp_common_get_chip(chip_type);
+  if (chip == NULL) {
     return BLISP_ERR_INVALID_CHIP_TYPE;
   }
 
   blisp_return_t ret;
   ret = blisp_device_init(device, chip);
   if (ret != BLISP_OK) {
-    fprintf(stderr, "Failed to init device, ret: %d\n", ret);
+    blisp_common_error("Failed to init device, ret: %d\n", ret);
     return ret;
   }
   ret = blisp_device_open(device,
@@ -51,9 +119,9 @@ blisp_return_t blisp_common_init_device(struct blisp_device* device,
                           baudrate);
   if (ret != BLISP_OK) {
     if (ret == BLISP_ERR_DEVICE_NOT_FOUND) {
-      fprintf(stderr, "Device not found\n");
+      blisp_common_error("Device not found\n");
     } else {
-      fprintf(stderr, "Failed to open device, ret: %d\n", ret);
+      blisp_common_error("Failed to open device, ret: %d\n", ret);
     }
     return ret;
   }
@@ -61,53 +129,193 @@ blisp_return_t blisp_common_init_device(struct blisp_device* device,
   return BLISP_OK;
 }
 
-/**
- * Prepares chip to access flash
- * this means performing handshake, and loading eflash_loader if needed.
- */
-blisp_return_t blisp_common_prepare_flash(struct blisp_device* device) {
-  blisp_return_t ret = 0;
-  uint32_t previous_timeout;
-  struct blisp_boot_info boot_info;
+void blisp_common_enable_compression(struct blisp_device* device) {
+  if (blisp_easy_flash_compress_supported()) {
+    device->flash_compress = true;
+  } else {
+    blisp_common_info(
+        "Built without compression support, writing uncompressed.\n");
+  }
+}
 
+// Asks for the boot info with a short timeout, which only a chip that went
+// through the handshake before answers
+static blisp_return_t blisp_common_probe(struct blisp_device* device,
+                                         struct blisp_boot_info* boot_info,
+                                         uint32_t timeout_ms) {
+  // NOTE: Modifying the timeout is mandatory for BL808;
+  //       see blisp.c:blisp_device_init()
+  uint32_t previous_timeout = device->serial_timeout;
+  device->serial_timeout = timeout_ms;
+  blisp_common_info("Testing if we can skip the handshake...\n");
+  trace_begin("probe");
+  blisp_return_t ret = blisp_device_get_boot_info(device, boot_info);
+  trace_end(ret);
+  device->serial_timeout = previous_timeout;
+
+  if (ret == BLISP_OK) {
+    blisp_common_info("Skipping handshake!\n");
+  } else {
+    blisp_common_info("We can't; ignore the previous error.\n");
+  }
+  return ret;
+}
+
+static blisp_return_t blisp_common_handshake(
+    struct blisp_device* device,
+    struct blisp_boot_info* boot_info) {
+  blisp_common_info("Sending a handshake...\n");
+  trace_begin("handshake");
+  blisp_return_t ret = blisp_device_handshake(device, false);
+  trace_end(ret);
+  if (ret != BLISP_OK) {
+    blisp_common_error("Failed to handshake with device, ret: %d\n", ret);
+    return ret;
+  }
+
+  blisp_common_info("Handshake successful!\nGetting chip info...\n");
+  trace_begin("get_boot_info");
+  ret = blisp_device_get_boot_info(device, boot_info);
+  trace_end(ret);
+  if (ret != BLISP_OK) {
+    blisp_common_error("Failed to get boot info, ret: %d\n", ret);
+  }
+  return ret;
+}
+
+static blisp_return_t blisp_common_connect(struct blisp_device* device,
+                                           struct blisp_boot_info* boot_info) {
   // We may already be in communication with the chip from a previous
   // invocation of this command. In that case, it will not respond to our
   // handshake. We detect this by trying to send a command to it, using a
   // (relatively) short timeout.
   //
   // NOTE: This appears to be how BouffaloLab software does it as well.
-  //
-  // NOTE: Modifying the timeout is mandatory for BL808;
-  //       see blisp.c:blisp_device_init()
-  previous_timeout = device->serial_timeout;
-  device->serial_timeout = 500;
-  printf("Testing if we can skip the handshake...\n");
-  ret = blisp_device_get_boot_info(device, &boot_info);
-  device->serial_timeout = previous_timeout;
+  if (blisp_common_probe(device, boot_info, 500) == BLISP_OK) {
+    return BLISP_OK;
+  }
+  return blisp_common_handshake(device, boot_info);
+}
 
-  if (ret == BLISP_OK) {
-    printf("Skipping handshake!\n");
+// Like blisp_common_connect, but tries what the last run left the chip
+// ready for first, and remembers the waits that worked
+static blisp_return_t blisp_common_connect_fast(
+    struct blisp_device* device,
+    struct blisp_boot_info* boot_info) {
+  struct connect_cache_entry* entry = &fast_connect_entry;
+  uint32_t probe_timeout_ms = 500;
+  bool probed = false;
+  blisp_return_t ret;
+
+  if (connect_cache_load(fast_connect_key, entry)) {
+    // Plenty for a chip that answers like last time, failed attempts widen
+    // the waits again anyway
+    device->handshake = entry->timing;
+    uint32_t wait_ms = entry->handshake_us * 4 / 1000 + 5;
+    if (entry->handshake_us != 0 &&
+        wait_ms < device->handshake.response_wait_ms) {
+      device->handshake.response_wait_ms = wait_ms;
+    }
+    wait_ms = entry->probe_us * 4 / 1000 + 20;
+    if (entry->probe_us != 0 && wait_ms < probe_timeout_ms) {
+      probe_timeout_ms = wait_ms;
+    }
+  } else {
+    memset(entry, 0, sizeof(struct connect_cache_entry));
+    blisp_device_fast_handshake(device);
+    entry->timing = device->handshake;
+  }
+
+  uint64_t start = monotonic_us();
+  uint64_t probe_start = start;
+  if (entry->skip_handshake) {
+    ret = blisp_common_probe(device, boot_info, probe_timeout_ms);
+    probed = ret == BLISP_OK;
+    if (!probed) {
+      ret = blisp_common_handshake(device, boot_info);
+    }
   } else {
-    printf("We can't; ignore the previous error.\n");
-    printf("Sending a handshake...\n");
-    ret = blisp_device_handshake(device, false);
+    ret = blisp_common_handshake(device, boot_info);
     if (ret != BLISP_OK) {
-      fprintf(stderr, "Failed to handshake with device, ret: %d\n", ret);
-      return ret;
+      probe_start = monotonic_us();
+      ret = blisp_common_probe(device, boot_info, 500);
+      probed = ret == BLISP_OK;
     }
+  }
+  if (ret != BLISP_OK) {
+    return ret;
+  }
+  uint64_t end = monotonic_us();
 
-    printf("Handshake successful!\nGetting chip info...\n");
-    ret = blisp_device_get_boot_info(device, &boot_info);
-    if (ret != BLISP_OK) {
-      fprintf(stderr, "Failed to get boot info, ret: %d\n", ret);
-      return ret;
+  if (probed) {
+    entry->probe_us = (uint32_t)(end - probe_start);
+  } else {
+    entry->timing = device->handshake_settled;
+    entry->handshake_us = device->handshake_response_us;
+  }
+  // Until it is reset, the chip keeps taking commands
+  entry->skip_handshake = true;
+  connect_cache_store(fast_connect_key, entry);
+  blisp_common_info("Connected in %" PRIu64 " ms.\n", (end - start) / 1000);
+  return BLISP_OK;
+}
+
+/**
+ * Checks the --baudrate, --flash-baudrate and --write-window options shared
+ * by the flashing commands and stores the baud rate to connect at in baud.
+ * write_window can be NULL for commands without that option.
+ */
+blisp_return_t blisp_common_check_link_args(struct arg_int* baudrate,
+                                            struct arg_int* flash_baudrate,
+                                            struct arg_int* write_window,
+                                            uint32_t* baud) {
+  *baud = DEFAULT_BAUDRATE;
+  if (baudrate->count == 1) {
+    if (*baudrate->ival < 0) {
+      fprintf(stderr, "Baud rate cannot be negative!\n");
+      return BLISP_ERR_INVALID_COMMAND;
     }
+    *baud = *baudrate->ival;
+  }
+
+  if (flash_baudrate->count == 1 && *flash_baudrate->ival < 0) {
+    fprintf(stderr, "Baud rate cannot be negative!\n");
+    return BLISP_ERR_INVALID_COMMAND;
+  }
+
+  if (write_window != NULL && write_window->count == 1 &&
+      (*write_window->ival < 1 ||
+       *write_window->ival > BLISP_EASY_MAX_WRITE_WINDOW)) {
+    fprintf(stderr, "Write window must be between 1 and %d!\n",
+            BLISP_EASY_MAX_WRITE_WINDOW);
+    return BLISP_ERR_INVALID_COMMAND;
+  }
+  return BLISP_OK;
+}
+
+/**
+ * Prepares chip to access flash
+ * this means performing handshake, and loading eflash_loader if needed.
+ */
+blisp_return_t blisp_common_prepare_flash(struct blisp_device* device) {
+  blisp_return_t ret = 0;
+  struct blisp_boot_info boot_info;
+
+  trace_begin("connect");
+  if (fast_connect_key[0] != '\0') {
+    ret = blisp_common_connect_fast(device, &boot_info);
+  } else {
+    ret = blisp_common_connect(device, &boot_info);
+  }
+  trace_end(ret);
+  if (ret != BLISP_OK) {
+    return ret;
   }
 
   // TODO: Do we want this to print in big endian to match the output
   //       of Bouffalo's software?
   if (device->chip->type == BLISP_CHIP_BL70X) {
-    printf(
+    blisp_common_info(
         "BootROM version %d.%d.%d.%d, ChipID: "
         "%02X%02X%02X%02X%02X%02X%02X%02X\n",
         boot_info.boot_rom_version[0], boot_info.boot_rom_version[1],
@@ -116,7 +324,7 @@ blisp_return_t blisp_common_prepare_flash(struct blisp_device* device) {
         boot_info.chip_id[3], boot_info.chip_id[4], boot_info.chip_id[5],
         boot_info.chip_id[6], boot_info.chip_id[7]);
   } else {
-    printf(
+    blisp_common_info(
         "BootROM version %d.%d.%d.%d, ChipID: "
         "%02X%02X%02X%02X%02X%02X\n",
         boot_info.boot_rom_version[0], boot_info.boot_rom_version[1],
@@ -126,21 +334,25 @@ blisp_return_t blisp_common_prepare_flash(struct blisp_device* device) {
   }
 
   if (device->chip->type == BLISP_CHIP_BL808) {
-    printf("Setting clock parameters ...\n");
+    blisp_common_info("Setting clock parameters ...\n");
+    trace_begin("load_clock_para");
     ret = bl808_load_clock_para(device, true, device->current_baud_rate);
+    trace_end(ret);
     if (ret != BLISP_OK) {
-      fprintf(stderr, "Failed to set clock parameters, ret: %d\n", ret);
+      blisp_common_error("Failed to set clock parameters, ret: %d\n", ret);
       return ret;
     }
-    printf("Setting flash parameters ...\n");
+    blisp_common_info("Setting flash parameters ...\n");
+    trace_begin("load_flash_para");
     ret = bl808_load_flash_para(device);
+    trace_end(ret);
     if (ret != BLISP_OK) {
-      fprintf(stderr, "Failed to set flash parameters, ret: %d\n", ret);
+      blisp_common_error("Failed to set flash parameters, ret: %d\n", ret);
       return ret;
     }
   }
 
-  if (device->chip->load_eflash_loader == NULL) {
+  if (device->chip->get_eflash_loader == NULL) {
     return BLISP_OK;
   }
 
@@ -148,53 +360,174 @@ blisp_return_t blisp_common_prepare_flash(struct blisp_device* device) {
       boot_info.boot_rom_version[1] == 255 &&
       boot_info.boot_rom_version[2] == 255 &&
       boot_info.boot_rom_version[3] == 255) {
-    printf("Device already in eflash_loader.\n");
+    blisp_common_info("Device already in eflash_loader.\n");
     return BLISP_OK;
   }
 
-  uint8_t* eflash_loader_buffer = NULL;
-  // TODO: Error check
-  int64_t eflash_loader_buffer_length =
-      device->chip->load_eflash_loader(0, &eflash_loader_buffer);
-
-  struct blisp_easy_transport eflash_loader_transport =
-      blisp_easy_transport_new_from_memory(eflash_loader_buffer,
-                                           eflash_loader_buffer_length);
+  struct blisp_easy_transport eflash_loader_transport;
+  trace_begin("unpack_eflash_loader");
+  ret = blisp_easy_transport_new_from_eflash_loader(device->chip,
+                                                    &eflash_loader_transport);
+  trace_end(ret);
+  if (ret != BLISP_OK) {
+    blisp_common_error("Failed to unpack eflash_loader, ret: %d\n", ret);
+    return ret;
+  }
 
+  trace_begin("load_eflash_loader");
   ret = blisp_easy_load_ram_app(device, &eflash_loader_transport,
                                 blisp_common_progress_callback);
+  trace_end(ret);
 
   if (ret != BLISP_OK) {
-    fprintf(stderr, "Failed to load eflash_loader, ret: %d\n", ret);
+    blisp_common_error("Failed to load eflash_loader, ret: %d\n", ret);
 
     goto exit1;
   }
 
-  free(eflash_loader_buffer);
-  eflash_loader_buffer = NULL;
-
+  trace_begin("check_image");
   ret = blisp_device_check_image(device);
+  trace_end(ret);
   if (ret != 0) {
-    fprintf(stderr, "Failed to check image, ret: %d\n", ret);
+    blisp_common_error("Failed to check image, ret: %d\n", ret);
     goto exit1;
   }
 
+  trace_begin("run_image");
   ret = blisp_device_run_image(device);
+  trace_end(ret);
   if (ret != BLISP_OK) {
-    fprintf(stderr, "Failed to run image, ret: %d\n", ret);
+    blisp_common_error("Failed to run image, ret: %d\n", ret);
     goto exit1;
   }
 
-  printf("Sending a handshake...\n");
+  blisp_common_info("Sending a handshake...\n");
+  trace_begin("eflash_loader_handshake");
   ret = blisp_device_handshake(device, true);
+  trace_end(ret);
   if (ret != BLISP_OK) {
-    fprintf(stderr, "Failed to handshake with device, ret: %d\n", ret);
+    blisp_common_error("Failed to handshake with device, ret: %d\n", ret);
     goto exit1;
   }
-  printf("Handshake with eflash_loader successful.\n");
+  blisp_common_info("Handshake with eflash_loader successful.\n");
 exit1:
-  if (eflash_loader_buffer != NULL)
-    free(eflash_loader_buffer);
+  return ret;
+}
+
+/**
+ * Moves an already prepared device (see blisp_common_prepare_flash) to a
+ * faster baud rate for the bulk of the transfer. The BootROM handshake and
+ * the eflash_loader upload stay at the conservative rate the device was
+ * opened with. If the loader can't be reached at the new rate, we go back
+ * to the previous one.
+ */
+blisp_return_t blisp_common_escalate_baudrate(struct blisp_device* device,
+                                              uint32_t baudrate) {
+  blisp_return_t ret;
+  uint32_t previous_baudrate = device->current_baud_rate;
+
+  if (baudrate == 0 || baudrate == previous_baudrate) {
+    return BLISP_OK;
+  }
+  if (device->chip->get_eflash_loader == NULL) {
+    blisp_common_info(
+        "Baud rate switching needs eflash_loader, staying at %" PRIu32
+        " baud.\n",
+        previous_baudrate);
+    return BLISP_OK;
+  }
+
+  blisp_common_info("Switching to %" PRIu32 " baud...\n", baudrate);
+  ret = blisp_device_change_baudrate(device, baudrate);
+  if (ret == BLISP_ERR_CHIP_ERR) {
+    // The loader refused and is still listening at the old rate.
+    blisp_common_error(
+        "eflash_loader refused the baud rate, staying at %" PRIu32 " baud.\n",
+        previous_baudrate);
+    return BLISP_OK;
+  }
+
+  if (ret == BLISP_OK) {
+    ret = blisp_device_handshake(device, true);
+    if (ret == BLISP_OK) {
+      blisp_common_info("Handshake at %" PRIu32 " baud successful.\n",
+                        baudrate);
+      return BLISP_OK;
+    }
+  }
+
+  blisp_common_error("Failed to talk to eflash_loader at %" PRIu32
+                     " baud, falling back to %" PRIu32 " baud.\n",
+                     baudrate, previous_baudrate);
+  ret = blisp_device_set_baudrate(device, previous_baudrate);
+  if (ret != BLISP_OK) {
+    return ret;
+  }
+  ret = blisp_device_handshake(device, true);
+  if (ret != BLISP_OK) {
+    blisp_common_error("Failed to handshake with device, ret: %d\n", ret);
+  }
+  return ret;
+}
+
+/**
+ * Flashes the image along a flash_plan. The sector aligned erases go first,
+ * as segments may share a sector, merged where erasing the sectors between
+ * them is cheaper than another command. The writes leave out long runs of
+ * 0xFF, which erased flash already holds, and bridge short gaps with 0xFF.
+ */
+blisp_return_t blisp_common_flash_image(
+    struct blisp_device* device,
+    const parsed_firmware_file_t* file,
+    blisp_easy_progress_callback progress_callback) {
+  struct flash_plan_costs costs;
+  struct flash_plan plan;
+  blisp_return_t ret;
+
+  flash_plan_get_costs(&costs, device->current_baud_rate, device->is_usb);
+  ret = flash_plan_build(&plan, file->segments, file->segment_count, &costs);
+  if (ret != BLISP_OK) {
+    blisp_common_error("Failed to plan the flash writes.\n");
+    return ret;
+  }
+
+  blisp_common_info("Erasing flash for firmware, this might take a while...\n");
+  trace_begin("erase");
+  for (size_t i = 0; i < plan.erase_count; i++) {
+    const struct flash_plan_range* erase = &plan.erases[i];
+    ret = blisp_device_flash_erase(device, erase->address,
+                                   erase->address + erase->length - 1);
+    if (ret != BLISP_OK) {
+      blisp_common_error(
+          "Failed to erase flash. Tried to erase from 0x%08" PRIx32
+          " to 0x%08" PRIx32 "\n",
+          erase->address, erase->address + erase->length - 1);
+      break;
+    }
+  }
+  trace_end(ret);
+  if (ret != BLISP_OK) {
+    goto exit;
+  }
+
+  for (size_t i = 0; i < plan.write_count; i++) {
+    const struct flash_plan_range* write = &plan.writes[i];
+    blisp_common_info("Flashing the firmware %" PRIu32 " bytes @ 0x%08" PRIx32
+                      "...\n",
+                      write->length, write->address);
+    struct blisp_easy_transport data_transport =
+        blisp_easy_transport_new_from_memory(write->data, write->length);
+    trace_begin("write");
+    ret = blisp_easy_flash_write(device, &data_transport, write->address,
+                                 write->length, progress_callback);
+    trace_end(ret);
+    if (ret != BLISP_OK) {
+      blisp_common_error("Failed to write app to flash.\n");
+      goto exit;
+    }
+  }
 
+exit:
+  flash_plan_free(&plan);
   return ret;
 }
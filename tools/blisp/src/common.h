@@ -2,17 +2,40 @@
 #ifndef BLISP_COMMON_H
 #define BLISP_COMMON_H
 
+#include <stdbool.h>
 #include <stdint.h>
 #include <blisp.h>
+#include <blisp_easy.h>
+#include <blisp_struct.h>
 #include <argtable3.h>
+#include "parsed_firmware_file.h"
 
 // https://gcc.gnu.org/onlinedocs/cpp/Stringizing.html
 #define DEFAULT_BAUDRATE 460800
 #define STR(x) #x
 #define XSTR(x) STR(x)
 
+blisp_return_t blisp_common_check_link_args(struct arg_int* baudrate,
+                                            struct arg_int* flash_baudrate,
+                                            struct arg_int* write_window,
+                                            uint32_t* baud);
 blisp_return_t blisp_common_prepare_flash(struct blisp_device* device);
+blisp_return_t blisp_common_escalate_baudrate(struct blisp_device* device,
+                                              uint32_t baudrate);
+blisp_return_t blisp_common_flash_image(
+    struct blisp_device* device,
+    const parsed_firmware_file_t* file,
+    blisp_easy_progress_callback progress_callback);
 void blisp_common_progress_callback(uint32_t current_value, uint32_t max_value);
+void blisp_common_set_quiet(bool enable);
+void blisp_common_enable_fast_connect(struct arg_str* port_name,
+                                      struct arg_str* chip_type);
+void blisp_common_fast_connect_reset(void);
+void blisp_common_enable_compression(struct blisp_device* device);
+struct blisp_chip* blisp_common_get_chip(struct arg_str* chip_type);
 blisp_return_t blisp_common_init_device(struct blisp_device* device, struct arg_str* port_name, struct arg_str* chip_type, uint32_t baudrate);
 
+// Defined in cmd/write.c
+void fill_up_boot_header(struct bfl_boot_header* boot_header);
+
 #endif  // BLISP_COMMON_H
@@ -0,0 +1,140 @@
+// SPDX-License-Identifier: MIT
+#include "connect_cache.h"
+#include <inttypes.h>
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "util.h"
+
+#if defined(_WIN32)
+#include <direct.h>
+#define connect_cache_mkdir(path) _mkdir(path)
+#define CONNECT_CACHE_SEPARATOR "\\"
+#else
+#include <sys/stat.h>
+#define connect_cache_mkdir(path) mkdir(path, 0755)
+#define CONNECT_CACHE_SEPARATOR "/"
+#endif
+
+#define CONNECT_CACHE_LINE_SIZE 512
+
+// Finds the cache file and creates its directory. Returns false if the
+// environment doesn't say where it should go.
+static bool connect_cache_path(char* path, size_t size) {
+#if defined(_WIN32)
+  const char* base = getenv("LOCALAPPDATA");
+  if (base == NULL || base[0] == '\0') {
+    return false;
+  }
+  snprintf(path, size, "%s", base);
+#else
+  const char* base = getenv("XDG_CACHE_HOME");
+  if (base != NULL && base[0] != '\0') {
+    snprintf(path, size, "%s", base);
+  } else {
+    base = getenv("HOME");
+    if (base == NULL || base[0] == '\0') {
+      return false;
+    }
+    snprintf(path, size, "%s/.cache", base);
+    connect_cache_mkdir(path);
+  }
+#endif
+  size_t length = strlen(path);
+  snprintf(path + length, size - length, CONNECT_CACHE_SEPARATOR "blisp");
+  connect_cache_mkdir(path);
+  length = strlen(path);
+  int written = snprintf(path + length, size - length,
+                         CONNECT_CACHE_SEPARATOR "connect");
+  return written > 0 && (size_t)written < size - length;
+}
+
+// Splits a line into its entry and key. Returns the key, or NULL if the
+// line is malformed.
+static const char* connect_cache_parse(char* line,
+                                       struct connect_cache_entry* entry) {
+  int skip_handshake;
+  int key_offset = 0;
+
+  line[strcspn(line, "\r\n")] = '\0';
+  if (sscanf(line,
+             "%d %hu %hu %hu %hu %hu %" SCNu32 " %" SCNu32 " %" SCNu32 " %n",
+             &skip_handshake, &entry->timing.reset_hold_ms,
+             &entry->timing.reset_release_ms, &entry->timing.boot_wait_ms,
+             &entry->timing.response_wait_ms, &entry->timing.second_wait_ms,
+             &entry->timing.sync_us, &entry->handshake_us, &entry->probe_us,
+             &key_offset) != 9 ||
+      key_offset == 0 || line[key_offset] == '\0') {
+    return NULL;
+  }
+  entry->skip_handshake = skip_handshake != 0;
+  return line + key_offset;
+}
+
+bool connect_cache_load(const char* key, struct connect_cache_entry* entry) {
+  char path[PATH_MAX];
+  char line[CONNECT_CACHE_LINE_SIZE];
+  bool found = false;
+
+  if (!connect_cache_path(path, sizeof(path))) {
+    return false;
+  }
+  FILE* file = fopen(path, "r");
+  if (file == NULL) {
+    return false;
+  }
+  while (!found && fgets(line, sizeof(line), file) != NULL) {
+    const char* line_key = connect_cache_parse(line, entry);
+    found = line_key != NULL && strcmp(line_key, key) == 0;
+  }
+  fclose(file);
+  return found;
+}
+
+void connect_cache_store(const char* key,
+                         const struct connect_cache_entry* entry) {
+  char path[PATH_MAX];
+  char temporary_path[PATH_MAX + 4];
+  char line[CONNECT_CACHE_LINE_SIZE];
+
+  if (!connect_cache_path(path, sizeof(path))) {
+    return;
+  }
+  snprintf(temporary_path, sizeof(temporary_path), "%s.new", path);
+  FILE* output = fopen(temporary_path, "w");
+  if (output == NULL) {
+    return;
+  }
+
+  // Keeps the other ports, the entry for this one goes last
+  FILE* input = fopen(path, "r");
+  if (input != NULL) {
+    while (fgets(line, sizeof(line), input) != NULL) {
+      struct connect_cache_entry other;
+      char copy[CONNECT_CACHE_LINE_SIZE];
+      memcpy(copy, line, sizeof(copy));
+      const char* line_key = connect_cache_parse(copy, &other);
+      if (line_key != NULL && strcmp(line_key, key) != 0) {
+        fputs(line, output);
+      }
+    }
+    fclose(input);
+  }
+  fprintf(output,
+          "%d %u %u %u %u %u %" PRIu32 " %" PRIu32 " %" PRIu32 " %s\n",
+          entry->skip_handshake ? 1 : 0, entry->timing.reset_hold_ms,
+          entry->timing.reset_release_ms, entry->timing.boot_wait_ms,
+          entry->timing.response_wait_ms, entry->timing.second_wait_ms,
+          entry->timing.sync_us, entry->handshake_us, entry->probe_us, key);
+  if (fclose(output) != 0) {
+    remove(temporary_path);
+    return;
+  }
+#if defined(_WIN32)
+  remove(path);  // rename doesn't replace files on Windows
+#endif
+  if (rename(temporary_path, path) != 0) {
+    remove(temporary_path);
+  }
+}
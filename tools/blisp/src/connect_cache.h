@@ -0,0 +1,23 @@
+// SPDX-License-Identifier: MIT
+#ifndef BLISP_CONNECT_CACHE_H
+#define BLISP_CONNECT_CACHE_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <blisp.h>
+
+// How the last connection to a port went, for --fast-connect. Kept one line
+// per port and chip in a file in the user's cache directory.
+struct connect_cache_entry {
+  bool skip_handshake;  // The chip was left taking commands, e.g. after
+                        // eflash_loader was started and not reset
+  struct blisp_handshake_timing timing;  // Handshake timing that worked
+  uint32_t handshake_us;  // How long the chip took to answer the handshake
+  uint32_t probe_us;      // and a command without one, 0 if not known
+};
+
+bool connect_cache_load(const char* key, struct connect_cache_entry* entry);
+void connect_cache_store(const char* key,
+                         const struct connect_cache_entry* entry);
+
+#endif  // BLISP_CONNECT_CACHE_H
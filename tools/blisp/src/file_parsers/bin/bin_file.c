@@ -2,14 +2,18 @@
 #include "parse_file.h"
 
 int bin_file_parse(const char* file_path_on_disk,
+                   mapped_file_t* file,
                    uint8_t** payload,
                    size_t* payload_length,
                    size_t* payload_address) {
   // Bin files a dumb so we cant do any fancy logic
   *payload_address = 0;  // We cant know otherwise
-  ssize_t len = get_file_contents(file_path_on_disk, payload);
-  if (len > 0) {
-    *payload_length = len;
+  int res = mapped_file_open(file_path_on_disk, file);
+  if (res < 0) {
+    return res;
   }
-  return len;
+  // The payload is the whole file, no need to copy it
+  *payload = file->data;
+  *payload_length = file->length;
+  return file->length;
 }
\ No newline at end of file
@@ -8,12 +8,15 @@
 #include <stdint.h>
 #include <stdio.h>
 #include <string.h>
+#include "mapped_file.h"
 
 #ifdef __cplusplus
 extern "C" {
 #endif
 
+// payload points into file, which stays open until it is closed
 int bin_file_parse(const char* file_path_on_disk,
+                   mapped_file_t* file,
                    uint8_t** payload,
                    size_t* payload_length,
                    size_t* payload_address);
@@ -2,6 +2,7 @@
 // Created by ralim on 25/09/22.
 //
 #include "dfu_file.h"
+#include <blisp_crc32.h>
 #include <stdlib.h>
 #include "parse_file.h"
 
@@ -52,8 +53,6 @@ ssize_t parse_target(const uint8_t* data,
                      uint8_t** out_data,
                      size_t* out_data_size,
                      size_t* out_data_address);
-ssize_t get_file_contents(const char* file_path_on_disk,
-                          uint8_t** file_contents);
 
 /* Parse a .dfu file and extract its payload and metadata
  * Returns 0 if file parsed correctly, negative on error
@@ -61,33 +60,39 @@ ssize_t get_file_contents(const char* file_path_on_disk,
  * - File path to read from
  *
  * Outputs:
+ * - The mapped file, which the payload points into
  * - File payload contents
  * - File payload start address
  *
  * Usage:
+ *   mapped_file_t file;
  *   uint8_t* payload=NULL;
  *   size_t payload_length=0;
- *   int res = dfu_file_path("test.dfu",&payload,&payload_length);
+ *   size_t payload_address=0;
+ *   int res = dfu_file_parse("test.dfu",&file,&payload,&payload_length,
+ *                            &payload_address);
  *   ...
- *   free(payload);
+ *   mapped_file_close(&file);
  */
 
 int dfu_file_parse(const char* file_path_on_disk,
+                   mapped_file_t* file,
                    uint8_t** payload,
                    size_t* payload_length,
                    size_t* payload_address) {
-  uint8_t* dfu_file_contents = NULL;
-  ssize_t file_size = get_file_contents(file_path_on_disk, &dfu_file_contents);
-  // Bubble up the result if it was an error instead of size (a negative value)
-  if (file_size < 0) {
-    return file_size;
+  int ret = mapped_file_open(file_path_on_disk, file);
+  // Bubble up the result if it was an error
+  if (ret < 0) {
+    return ret;
   }
-  if (file_size == 0 || dfu_file_contents == NULL) {
+  if (file->length == 0) {
+    mapped_file_close(file);
     return PARSED_ERROR_CANT_OPEN_FILE;
   }
   // Parse DFU data
-  struct dfu_file dfu_info = parse_dfu_suffix(dfu_file_contents, file_size);
+  struct dfu_file dfu_info = parse_dfu_suffix(file->data, file->length);
   if (dfu_info.size.firmware == 0) {
+    mapped_file_close(file);
     return PARSED_ERROR_BAD_DFU;
   }
   // Check if its for a BL* chip
@@ -109,17 +114,16 @@ int dfu_file_parse(const char* file_path_on_disk,
       break;
     }
     if (ealt == 0 && blob_size > 0) {
-      // Firmware slot, lets prep this and return
-      *payload = calloc(blob_size, 1);
+      // Firmware slot, hand it out as it is in the file
+      *payload = blob;
       *payload_length = blob_size;
       *payload_address = blob_address;
-      memcpy(*payload, blob, blob_size);
-      free(dfu_file_contents);
       return 1;
     }
     data_consumed += res;
   }
 
+  mapped_file_close(file);
   return 0;
 }
 
@@ -204,7 +208,7 @@ struct dfu_file parse_dfu_suffix(const uint8_t* file_contents,
   output.size.total = (off_t)file_contents_length;
   /* Check for possible DFU file suffix by trying to parse one */
 
-  uint32_t crc = 0xffffffff;
+  uint32_t crc;
   const uint8_t* dfu_suffix;
   int missing_suffix = 0;
   const char* reason;
@@ -224,10 +228,8 @@ struct dfu_file parse_dfu_suffix(const uint8_t* file_contents,
     output.size.firmware = 0;
     return output;
   }
-  // Calculate contents CRC32
-  for (int i = 0; i < file_contents_length - 4; i++) {
-    crc = crc32_byte(crc, file_contents[i]);
-  }
+  // DFU stores the CRC without the final inversion
+  crc = ~crc32_update(0, file_contents, file_contents_length - 4);
 
   output.dwCRC = (dfu_suffix[15] << 24) + (dfu_suffix[14] << 16) +
                  (dfu_suffix[13] << 8) + dfu_suffix[12];
@@ -8,18 +8,18 @@
 #include <stdint.h>
 #include <stdio.h>
 #include <string.h>
+#include "mapped_file.h"
 
 #ifdef __cplusplus
 extern "C" {
 #endif
-// Parse the dfu file and returns 0 if ok, or -ve on error parsing
+// Parse the dfu file and returns 0 if ok, or -ve on error parsing. payload
+// points into file, which stays open until it is closed.
 int dfu_file_parse(const char* file_path_on_disk,
+                   mapped_file_t* file,
                    uint8_t** payload,
                    size_t* payload_length,
                    size_t* payload_address);
-// Internal
-
-uint32_t crc32_byte(uint32_t accum, uint8_t delta);
 #ifdef __cplusplus
 };
 #endif
@@ -0,0 +1,95 @@
+// CRC32 benchmark. Times the byte-at-a-time table lookup the DFU parser and
+// the library used to have, portable slicing-by-8 and whatever crc32_update
+// dispatches to on this CPU, over buffers of a few sizes. Prints one JSON
+// object.
+#include <blisp_crc32.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#define BENCH_SEED 0x2545F491
+
+static double bench_now(void) {
+  struct timespec now;
+  timespec_get(&now, TIME_UTC);
+  return now.tv_sec + now.tv_nsec / 1e9;
+}
+
+static uint32_t reference_table[256];
+
+static void reference_init(void) {
+  for (uint32_t i = 0; i < 256; i++) {
+    uint32_t crc = i;
+    for (int bit = 0; bit < 8; bit++) {
+      crc = crc & 1 ? (crc >> 1) ^ 0xEDB88320 : crc >> 1;
+    }
+    reference_table[i] = crc;
+  }
+}
+
+static uint32_t reference_update(uint32_t crc, const void* data,
+                                 size_t data_len) {
+  const uint8_t* bytes = data;
+  crc = ~crc;
+  while (data_len--) {
+    crc = reference_table[(crc ^ *bytes++) & 0xff] ^ (crc >> 8);
+  }
+  return ~crc;
+}
+
+typedef uint32_t (*bench_crc)(uint32_t, const void*, size_t);
+
+// MiB/s for checksumming total bytes in pieces of the given size
+static double bench_run(const uint8_t* data, size_t size, size_t total,
+                        bench_crc crc, uint32_t* result) {
+  uint32_t value = 0;
+  double start = bench_now();
+  for (size_t done = 0; done < total; done += size) {
+    value = crc(value, data, size);
+  }
+  double seconds = bench_now() - start;
+  *result = value;
+  return total / (1024.0 * 1024.0) / seconds;
+}
+
+int main(int argc, char** argv) {
+  size_t total = (argc > 1 ? strtoul(argv[1], NULL, 0) : 256) << 20;
+  static const size_t sizes[] = {64, 176, 4096, 1 << 20};
+
+  reference_init();
+  uint8_t* data = malloc(sizes[3]);
+  if (data == NULL) {
+    fprintf(stderr, "Out of memory\n");
+    return 1;
+  }
+  uint32_t state = BENCH_SEED;
+  for (size_t i = 0; i < sizes[3]; i++) {
+    state ^= state << 13;
+    state ^= state >> 17;
+    state ^= state << 5;
+    data[i] = state;
+  }
+
+  printf("{\"kernel\":\"%s\",\"total_bytes\":%zu,\"results\":[",
+         crc32_kernel_name(), total);
+  for (size_t i = 0; i < sizeof(sizes) / sizeof(sizes[0]); i++) {
+    uint32_t reference, portable, dispatched;
+    double reference_mib =
+        bench_run(data, sizes[i], total, reference_update, &reference);
+    double portable_mib =
+        bench_run(data, sizes[i], total, crc32_update_portable, &portable);
+    double dispatched_mib =
+        bench_run(data, sizes[i], total, crc32_update, &dispatched);
+    if (portable != reference || dispatched != reference) {
+      fprintf(stderr, "CRC mismatch for %zu byte pieces\n", sizes[i]);
+      return 1;
+    }
+    printf(
+        "%s{\"piece_bytes\":%zu,\"bytewise_mib_per_s\":%.1f,"
+        "\"slice8_mib_per_s\":%.1f,\"dispatched_mib_per_s\":%.1f}",
+        i ? "," : "", sizes[i], reference_mib, portable_mib, dispatched_mib);
+  }
+  printf("]}\n");
+  free(data);
+  return 0;
+}
@@ -2,16 +2,48 @@
 // Created by ralim on 26/09/22.
 //
 
+#include <blisp_crc32.h>
 #include <gtest/gtest.h>
+#include <vector>
 #include "dfu_file.h"
 TEST(DFU_FILE_PARSER, ParseTestFile) {
+  mapped_file_t file;
   uint8_t* payload = nullptr;
   size_t payload_size = 0;
   size_t payload_address = 0;
   int res = dfu_file_parse(SOURCE_DIR
                            "/tools/blisp/src/file_parsers/dfu/tests/test.dfu",
-                           &payload, &payload_size, &payload_address);
+                           &file, &payload, &payload_size, &payload_address);
   ASSERT_EQ(res, 1);
   ASSERT_EQ(payload_size, 1337);
   ASSERT_EQ(payload_address, 0x11223344);
+  // The payload is a view into the file, not a copy
+  ASSERT_GE(payload, file.data);
+  ASSERT_LE(payload + payload_size, file.data + file.length);
+  mapped_file_close(&file);
+}
+
+TEST(DFU_FILE_PARSER, Crc32MatchesPortable) {
+  ASSERT_EQ(crc32_update(0, "123456789", 9), 0xCBF43926u);
+
+  std::vector<uint8_t> data(4096 + 64);
+  uint32_t state = 0x2545F491;
+  for (auto& byte : data) {
+    state = state * 1103515245 + 12345;
+    byte = state >> 24;
+  }
+  // Every alignment and length around the vector kernels' block sizes
+  for (size_t offset = 0; offset < 16; offset++) {
+    for (size_t length = 0; length <= 4096; length += length < 256 ? 1 : 61) {
+      const uint8_t* start = data.data() + offset;
+      uint32_t expected = crc32_update_portable(0, start, length);
+      ASSERT_EQ(crc32_update(0, start, length), expected)
+          << crc32_kernel_name() << " offset " << offset << " length "
+          << length;
+      size_t split = length / 3;
+      ASSERT_EQ(crc32_update(crc32_update(0, start, split), start + split,
+                             length - split),
+                expected);
+    }
+  }
 }
@@ -0,0 +1,295 @@
+#include "firmware_stream.h"
+#include <blisp_crc32.h>
+#include <string.h>
+#include <sys/stat.h>
+#include "dfu_file.h"
+
+// DfuSe layout, see dfu_file.c
+#define DFUSE_PREFIX_LENGTH 11
+#define DFUSE_TARGET_PREFIX_LENGTH 274
+#define DFUSE_ELEMENT_PREFIX_LENGTH 8
+
+static uint32_t firmware_stream_le32(const uint8_t* bytes) {
+  return bytes[0] | (bytes[1] << 8) | (bytes[2] << 16) |
+         ((uint32_t)bytes[3] << 24);
+}
+
+bool firmware_stream_needed(const char* file_path_on_disk) {
+  if (strcmp(file_path_on_disk, "-") == 0) {
+    return true;
+  }
+  struct stat info;
+  return stat(file_path_on_disk, &info) == 0 &&
+         (info.st_mode & S_IFMT) != S_IFREG;
+}
+
+// Runs the bytes read through the CRC, held back by the size of the suffix
+static void firmware_stream_track(firmware_stream_t* stream,
+                                  const uint8_t* data,
+                                  size_t length) {
+  size_t total = stream->tail_count + length;
+  size_t leaving =
+      total > sizeof(stream->tail) ? total - sizeof(stream->tail) : 0;
+  size_t from_tail =
+      leaving < stream->tail_count ? leaving : stream->tail_count;
+  stream->crc = crc32_update(stream->crc, stream->tail, from_tail);
+  memmove(stream->tail, stream->tail + from_tail,
+          stream->tail_count - from_tail);
+  stream->tail_count -= from_tail;
+
+  size_t from_data = leaving - from_tail;
+  stream->crc = crc32_update(stream->crc, data, from_data);
+  memcpy(stream->tail + stream->tail_count, data + from_data,
+         length - from_data);
+  stream->tail_count += length - from_data;
+}
+
+// Makes at least want bytes available, unless the input ends first. Returns
+// how many are.
+static size_t firmware_stream_fill(firmware_stream_t* stream, size_t want) {
+  if (want > FIRMWARE_STREAM_BUFFER_SIZE) {
+    want = FIRMWARE_STREAM_BUFFER_SIZE;
+  }
+  if (stream->end - stream->start >= want) {
+    return stream->end - stream->start;
+  }
+  if (stream->start + want > FIRMWARE_STREAM_BUFFER_SIZE) {
+    memmove(stream->buffer, stream->buffer + stream->start,
+            stream->end - stream->start);
+    stream->end -= stream->start;
+    stream->start = 0;
+  }
+  while (stream->end - stream->start < want) {
+    size_t read_count =
+        fread(stream->buffer + stream->end, 1,
+              FIRMWARE_STREAM_BUFFER_SIZE - stream->end, stream->file);
+    if (read_count == 0) {
+      break;
+    }
+    if (stream->format == FIRMWARE_STREAM_DFU) {
+      firmware_stream_track(stream, stream->buffer + stream->end, read_count);
+    }
+    stream->end += read_count;
+  }
+  return stream->end - stream->start;
+}
+
+static bool firmware_stream_skip(firmware_stream_t* stream, size_t length) {
+  while (length > 0) {
+    size_t available = firmware_stream_fill(stream, length);
+    if (available == 0) {
+      return false;
+    }
+    size_t skipped = available < length ? available : length;
+    stream->start += skipped;
+    length -= skipped;
+  }
+  return true;
+}
+
+int firmware_stream_open(firmware_stream_t* stream, FILE* file) {
+  memset(stream, 0, sizeof(firmware_stream_t));
+  stream->file = file;
+
+  size_t available = firmware_stream_fill(stream, 5);
+  if (available == 0) {
+    fprintf(stderr, "Input is empty\n");
+    return PARSED_ERROR_INVALID_FILETYPE;
+  }
+  if (stream->buffer[0] == ':') {
+    printf("Input stream identified as Intel HEX\n");
+    stream->format = FIRMWARE_STREAM_HEX;
+  } else if (available >= 5 && memcmp(stream->buffer, "DfuSe", 5) == 0) {
+    printf("Input stream identified as DfuSe\n");
+    stream->format = FIRMWARE_STREAM_DFU;
+    firmware_stream_track(stream, stream->buffer, stream->end);
+    if (!firmware_stream_skip(stream, DFUSE_PREFIX_LENGTH)) {
+      return PARSED_ERROR_BAD_DFU;
+    }
+  } else {
+    printf("Input stream identified as a raw binary\n");
+    stream->format = FIRMWARE_STREAM_BIN;
+  }
+  return 0;
+}
+
+static ssize_t firmware_stream_next_bin(firmware_stream_t* stream,
+                                        uint32_t* address,
+                                        const uint8_t** data) {
+  size_t available =
+      firmware_stream_fill(stream, FIRMWARE_STREAM_BUFFER_SIZE);
+  if (available == 0) {
+    stream->done = true;
+    return 0;
+  }
+  *address = stream->address;
+  *data = stream->buffer + stream->start;
+  stream->address += available;
+  stream->start += available;
+  return available;
+}
+
+static ssize_t firmware_stream_next_hex(firmware_stream_t* stream,
+                                        uint32_t* address,
+                                        const uint8_t** data) {
+  bool skipping = false;  // Through a line that isn't a record
+  for (;;) {
+    size_t available =
+        firmware_stream_fill(stream, HEX_RECORD_TEXT_LENGTH(255));
+    if (available == 0) {
+      stream->done = true;
+      return 0;
+    }
+    uint8_t c = stream->buffer[stream->start];
+    if (c == '\n' || c == '\r') {
+      skipping = false;
+      stream->start++;
+      continue;
+    }
+    if (skipping || c != ':') {
+      skipping = true;
+      stream->start++;
+      continue;
+    }
+
+    hex_record_t* record = &stream->record;
+    int result = hex_parse_record(
+        (const char*)stream->buffer + stream->start, available, record);
+    if (result < 0) {
+      return result;
+    }
+    stream->start += HEX_RECORD_TEXT_LENGTH(record->length);
+
+    if (result == HEX_RECORD_EOF) {
+      stream->done = true;
+      return 0;
+    }
+    if (result == HEX_RECORD_EXTENDED_SEGMENT ||
+        result == HEX_RECORD_EXTENDED_LINEAR) {
+      if (record->length != 2) {
+        return HEX_PARSE_ERROR_INVALID_FORMAT;
+      }
+      uint32_t value = (record->data[0] << 8) | record->data[1];
+      stream->base_address =
+          result == HEX_RECORD_EXTENDED_SEGMENT ? value << 4 : value << 16;
+      continue;
+    }
+    if (result == HEX_RECORD_DATA && record->length > 0) {
+      *address = stream->base_address + record->address;
+      *data = record->data;
+      return record->length;
+    }
+  }
+}
+
+// Finds the first element of the first target for alternate setting 0, which
+// is what dfu_file_parse takes as the firmware
+static int firmware_stream_find_element(firmware_stream_t* stream) {
+  for (;;) {
+    if (firmware_stream_fill(stream, DFUSE_TARGET_PREFIX_LENGTH) <
+        DFUSE_TARGET_PREFIX_LENGTH) {
+      fprintf(stderr, "No firmware target in DFU stream\n");
+      return PARSED_ERROR_BAD_DFU;
+    }
+    const uint8_t* target = stream->buffer + stream->start;
+    if (target[0] != 'T' || target[1] != 'a') {
+      return PARSED_ERROR_BAD_DFU;
+    }
+    uint8_t alternate = target[6];
+    uint32_t target_size = firmware_stream_le32(target + 266);
+    uint32_t element_count = firmware_stream_le32(target + 270);
+    stream->start += DFUSE_TARGET_PREFIX_LENGTH;
+
+    if (alternate == 0 && element_count > 0) {
+      if (firmware_stream_fill(stream, DFUSE_ELEMENT_PREFIX_LENGTH) <
+          DFUSE_ELEMENT_PREFIX_LENGTH) {
+        return PARSED_ERROR_BAD_DFU;
+      }
+      const uint8_t* element = stream->buffer + stream->start;
+      stream->address = firmware_stream_le32(element);
+      stream->remaining = firmware_stream_le32(element + 4);
+      stream->start += DFUSE_ELEMENT_PREFIX_LENGTH;
+      if (stream->remaining > 0) {
+        stream->element_found = true;
+        return 0;
+      }
+      target_size -= DFUSE_ELEMENT_PREFIX_LENGTH;
+    }
+    if (!firmware_stream_skip(stream, target_size)) {
+      return PARSED_ERROR_BAD_DFU;
+    }
+  }
+}
+
+// Reads to the end of the input and checks the DFU suffix
+static int firmware_stream_check_suffix(firmware_stream_t* stream) {
+  while (firmware_stream_fill(stream, FIRMWARE_STREAM_BUFFER_SIZE) > 0) {
+    stream->start = stream->end;
+  }
+  if (stream->tail_count < sizeof(stream->tail)) {
+    return PARSED_ERROR_BAD_DFU;
+  }
+  const uint8_t* suffix = stream->tail;
+  if (suffix[10] != 'D' || suffix[9] != 'F' || suffix[8] != 'U') {
+    fprintf(stderr, "Invalid DFU suffix signature\n");
+    return PARSED_ERROR_BAD_DFU;
+  }
+  // Stored without the final inversion
+  uint32_t crc = ~crc32_update(stream->crc, suffix, 12);
+  if (crc != firmware_stream_le32(suffix + 12)) {
+    fprintf(stderr, "DFU suffix CRC does not match\n");
+    return PARSED_ERROR_BAD_DFU;
+  }
+  return 0;
+}
+
+static ssize_t firmware_stream_next_dfu(firmware_stream_t* stream,
+                                        uint32_t* address,
+                                        const uint8_t** data) {
+  if (!stream->element_found) {
+    int ret = firmware_stream_find_element(stream);
+    if (ret < 0) {
+      return ret;
+    }
+  }
+  if (stream->remaining == 0) {
+    stream->done = true;
+    return firmware_stream_check_suffix(stream);
+  }
+
+  size_t available = firmware_stream_fill(stream, stream->remaining);
+  if (available == 0) {
+    return PARSED_ERROR_BAD_DFU;
+  }
+  size_t length = available < stream->remaining ? available : stream->remaining;
+  *address = stream->address;
+  *data = stream->buffer + stream->start;
+  stream->address += length;
+  stream->remaining -= length;
+  stream->start += length;
+  return length;
+}
+
+ssize_t firmware_stream_next(firmware_stream_t* stream,
+                             uint32_t* address,
+                             const uint8_t** data) {
+  if (stream->done) {
+    return 0;
+  }
+  ssize_t length;
+  switch (stream->format) {
+    case FIRMWARE_STREAM_HEX:
+      length = firmware_stream_next_hex(stream, address, data);
+      break;
+    case FIRMWARE_STREAM_DFU:
+      length = firmware_stream_next_dfu(stream, address, data);
+      break;
+    default:
+      length = firmware_stream_next_bin(stream, address, data);
+      break;
+  }
+  if (length > 0 && *address >= FLASH_MAP_ADDR) {
+    *address -= FLASH_MAP_ADDR;
+  }
+  return length;
+}
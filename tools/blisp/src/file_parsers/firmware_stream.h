@@ -0,0 +1,67 @@
+#ifndef BLISP_FIRMWARE_STREAM_H
+#define BLISP_FIRMWARE_STREAM_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include "hex_file.h"
+#include "parse_file.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Firmware read incrementally from a pipe or stdin, for inputs that can't be
+// mapped or seeked. The format is detected from the first bytes: Intel HEX
+// starts with ':', DfuSe with "DfuSe", anything else is a raw binary. Only a
+// buffer's worth of the input is held in memory at any time.
+
+#define FIRMWARE_STREAM_BUFFER_SIZE (64 * 1024)
+
+typedef enum {
+  FIRMWARE_STREAM_BIN,
+  FIRMWARE_STREAM_HEX,
+  FIRMWARE_STREAM_DFU,
+} firmware_stream_format_t;
+
+typedef struct {
+  FILE* file;
+  firmware_stream_format_t format;
+  uint8_t buffer[FIRMWARE_STREAM_BUFFER_SIZE];
+  size_t start;  // Unconsumed input is buffer[start, end)
+  size_t end;
+  bool done;
+
+  uint32_t address;  // Of the next data byte, bin and DFU
+  uint32_t base_address;  // HEX
+  hex_record_t record;
+  uint32_t remaining;  // Left of the DFU element being streamed
+  bool element_found;
+
+  // The DFU suffix CRC covers all but its last 4 bytes, so the last 16 bytes
+  // read are held back until the end
+  uint32_t crc;
+  uint8_t tail[16];
+  size_t tail_count;
+} firmware_stream_t;
+
+// True for "-" (stdin) and for paths that aren't regular files
+bool firmware_stream_needed(const char* file_path_on_disk);
+
+// Reads the first bytes of file to find its format. Returns 0 on success,
+// negative on error.
+int firmware_stream_open(firmware_stream_t* stream, FILE* file);
+
+// Next piece of data in the order of the input, at *address onwards with
+// addresses normalised like parse_firmware_file does. Returns its length, 0
+// at the end of the firmware or negative on error. *data stays valid until
+// the next call.
+ssize_t firmware_stream_next(firmware_stream_t* stream,
+                             uint32_t* address,
+                             const uint8_t** data);
+
+#ifdef __cplusplus
+};
+#endif
+
+#endif  // BLISP_FIRMWARE_STREAM_H
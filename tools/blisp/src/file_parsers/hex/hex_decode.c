@@ -0,0 +1,122 @@
+#include "hex_decode.h"
+
+#if defined(__SSE2__) || defined(_M_X64) || \
+    (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define HEX_DECODE_SSE2
+#include <emmintrin.h>
+#elif defined(__aarch64__) || defined(_M_ARM64)
+#define HEX_DECODE_NEON
+#include <arm_neon.h>
+#endif
+
+// Value of each hex digit plus one, 0 for everything else
+static const uint8_t hex_values[256] = {
+    ['0'] = 1,  ['1'] = 2,  ['2'] = 3,  ['3'] = 4,  ['4'] = 5,  ['5'] = 6,
+    ['6'] = 7,  ['7'] = 8,  ['8'] = 9,  ['9'] = 10, ['A'] = 11, ['B'] = 12,
+    ['C'] = 13, ['D'] = 14, ['E'] = 15, ['F'] = 16, ['a'] = 11, ['b'] = 12,
+    ['c'] = 13, ['d'] = 14, ['e'] = 15, ['f'] = 16,
+};
+
+bool hex_decode_scalar(const char* text,
+                       size_t count,
+                       uint8_t* bytes,
+                       uint8_t* sum) {
+  uint8_t total = 0;
+  uint8_t invalid = 0;
+  for (size_t i = 0; i < count; i++) {
+    uint8_t high = hex_values[(uint8_t)text[i * 2]];
+    uint8_t low = hex_values[(uint8_t)text[i * 2 + 1]];
+    // Checked once at the end, invalid digits only spoil the output
+    invalid |= (high == 0) | (low == 0);
+    bytes[i] = ((high - 1) << 4) | ((low - 1) & 0x0F);
+    total += bytes[i];
+  }
+  *sum = total;
+  return invalid == 0;
+}
+
+#if defined(HEX_DECODE_SSE2)
+
+// Nibble values of 16 hex digits, all bits of *invalid set for bad ones
+static inline __m128i hex_decode_nibbles(__m128i text, __m128i* invalid) {
+  __m128i digit = _mm_sub_epi8(text, _mm_set1_epi8('0'));
+  __m128i letter = _mm_sub_epi8(_mm_or_si128(text, _mm_set1_epi8(0x20)),
+                                _mm_set1_epi8('a'));
+  // Unsigned range checks: x <= n exactly when min(x, n) == x
+  __m128i is_digit =
+      _mm_cmpeq_epi8(_mm_min_epu8(digit, _mm_set1_epi8(9)), digit);
+  __m128i is_letter =
+      _mm_cmpeq_epi8(_mm_min_epu8(letter, _mm_set1_epi8(5)), letter);
+  *invalid = _mm_or_si128(
+      *invalid, _mm_xor_si128(_mm_or_si128(is_digit, is_letter),
+                              _mm_set1_epi8(-1)));
+  return _mm_or_si128(
+      _mm_and_si128(is_digit, digit),
+      _mm_and_si128(is_letter, _mm_add_epi8(letter, _mm_set1_epi8(10))));
+}
+
+// Joins the nibble pairs into bytes, in the low half of each 16 bit lane
+static inline __m128i hex_decode_join(__m128i nibbles) {
+  __m128i joined =
+      _mm_or_si128(_mm_slli_epi16(nibbles, 4), _mm_srli_epi16(nibbles, 8));
+  return _mm_and_si128(joined, _mm_set1_epi16(0x00FF));
+}
+
+bool hex_decode(const char* text, size_t count, uint8_t* bytes, uint8_t* sum) {
+  __m128i invalid = _mm_setzero_si128();
+  __m128i total = _mm_setzero_si128();
+  size_t i = 0;
+  for (; i + 16 <= count; i += 16) {
+    __m128i first = hex_decode_nibbles(
+        _mm_loadu_si128((const __m128i*)(text + i * 2)), &invalid);
+    __m128i second = hex_decode_nibbles(
+        _mm_loadu_si128((const __m128i*)(text + i * 2 + 16)), &invalid);
+    __m128i decoded =
+        _mm_packus_epi16(hex_decode_join(first), hex_decode_join(second));
+    _mm_storeu_si128((__m128i*)(bytes + i), decoded);
+    total = _mm_add_epi64(total, _mm_sad_epu8(decoded, _mm_setzero_si128()));
+  }
+  uint8_t tail_sum;
+  bool valid = hex_decode_scalar(text + i * 2, count - i, bytes + i, &tail_sum);
+  total = _mm_add_epi64(total, _mm_srli_si128(total, 8));
+  *sum = (uint8_t)(_mm_cvtsi128_si32(total) + tail_sum);
+  return valid && _mm_movemask_epi8(invalid) == 0;
+}
+
+#elif defined(HEX_DECODE_NEON)
+
+bool hex_decode(const char* text, size_t count, uint8_t* bytes, uint8_t* sum) {
+  uint8x16_t invalid = vdupq_n_u8(0);
+  uint8_t total = 0;
+  size_t i = 0;
+  for (; i + 16 <= count; i += 16) {
+    // De-interleaves into the high and the low digits of 16 bytes
+    uint8x16x2_t digits = vld2q_u8((const uint8_t*)text + i * 2);
+    uint8x16_t nibbles[2];
+    for (int j = 0; j < 2; j++) {
+      uint8x16_t digit = vsubq_u8(digits.val[j], vdupq_n_u8('0'));
+      uint8x16_t letter = vsubq_u8(vorrq_u8(digits.val[j], vdupq_n_u8(0x20)),
+                                   vdupq_n_u8('a'));
+      uint8x16_t is_digit = vcltq_u8(digit, vdupq_n_u8(10));
+      uint8x16_t is_letter = vcltq_u8(letter, vdupq_n_u8(6));
+      invalid = vorrq_u8(invalid, vmvnq_u8(vorrq_u8(is_digit, is_letter)));
+      nibbles[j] =
+          vbslq_u8(is_digit, digit, vaddq_u8(letter, vdupq_n_u8(10)));
+    }
+    uint8x16_t decoded = vorrq_u8(vshlq_n_u8(nibbles[0], 4), nibbles[1]);
+    vst1q_u8(bytes + i, decoded);
+    total += vaddvq_u8(decoded);
+  }
+  uint8_t tail_sum;
+  bool valid = hex_decode_scalar(text + i * 2, count - i, bytes + i, &tail_sum);
+  *sum = total + tail_sum;
+  return valid && vmaxvq_u8(invalid) == 0;
+}
+
+#else
+
+bool hex_decode(const char* text, size_t count, uint8_t* bytes, uint8_t* sum) {
+  return hex_decode_scalar(text, count, bytes, sum);
+}
+
+#endif
@@ -0,0 +1,27 @@
+#ifndef BLISP_HEX_DECODE_H
+#define BLISP_HEX_DECODE_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Decode count bytes from 2 * count ASCII hex characters (either case) and
+// sum them up modulo 256, as the record checksum needs. Returns false if a
+// character isn't a hex digit, bytes and sum are undefined then.
+bool hex_decode(const char* text, size_t count, uint8_t* bytes, uint8_t* sum);
+
+// Same without SSE2/NEON, which hex_decode uses where the target has them
+bool hex_decode_scalar(const char* text,
+                       size_t count,
+                       uint8_t* bytes,
+                       uint8_t* sum);
+
+#ifdef __cplusplus
+};
+#endif
+
+#endif  // BLISP_HEX_DECODE_H
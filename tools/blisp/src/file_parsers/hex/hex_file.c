@@ -2,260 +2,254 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include "hex_decode.h"
 #include "parse_file.h"
 
-// Convert ASCII hex character to integer
-static int hex_to_int(char c) {
-  if (c >= '0' && c <= '9')
-    return c - '0';
-  if (c >= 'A' && c <= 'F')
-    return c - 'A' + 10;
-  if (c >= 'a' && c <= 'f')
-    return c - 'a' + 10;
-  return -1;
-}
+// Limit to 128 MB of data, holes don't count
+#define HEX_MAX_DATA_SIZE (1024 * 1024 * 128)
 
-// Convert 2 ASCII hex characters to a byte
-static int hex_byte_to_int(const char* str) {
-  int high = hex_to_int(str[0]);
-  int low = hex_to_int(str[1]);
-  if (high < 0 || low < 0)
-    return -1;
-  return (high << 4) | low;
-}
-
-// Parse a single Intel HEX line into the record type and data
-// Returns: Record Type on success, negative error code on failure
-static int parse_hex_line(const char* line,
-                          uint8_t* data_buffer,
-                          uint32_t* address,
-                          uint32_t* base_address,
-                          uint32_t* max_address,
-                          uint32_t min_address) {
-  size_t len = strlen(line);
+// Bytes of the image at consecutive addresses, in the order of the file
+typedef struct {
+  uint32_t address;
+  size_t offset;  // Into the collected data
+  size_t length;
+} hex_run_t;
 
+int hex_parse_record(const char* line, size_t len, hex_record_t* record) {
   // Line must start with ':' and have at least 11 characters (:BBAAAATTCC)
-  if (line[0] != ':' || len < 11) {
+  if (line[0] != ':' || len < HEX_RECORD_TEXT_LENGTH(0)) {
     return HEX_PARSE_ERROR_INVALID_FORMAT;
   }
 
-  // Extract record fields
-  int byte_count = hex_byte_to_int(line + 1);
-  if (byte_count < 0)
-    return HEX_PARSE_ERROR_INVALID_FORMAT;
-
-  // Make sure line is long enough
-  if (len < (size_t)(11 + byte_count * 2)) {
+  // Decode the length first to know how much follows it
+  uint8_t checksum;
+  if (!hex_decode(line + 1, 1, record->raw, &checksum)) {
     return HEX_PARSE_ERROR_INVALID_FORMAT;
   }
+  uint8_t byte_count = record->raw[0];
 
-  int addr_high = hex_byte_to_int(line + 3);
-  int addr_low = hex_byte_to_int(line + 5);
-  if (addr_high < 0 || addr_low < 0)
+  // Make sure the record is complete
+  if (len < HEX_RECORD_TEXT_LENGTH(byte_count)) {
     return HEX_PARSE_ERROR_INVALID_FORMAT;
-
-  uint16_t record_address = (addr_high << 8) | addr_low;
-
-  int record_type = hex_byte_to_int(line + 7);
-  if (record_type < 0)
-    return HEX_PARSE_ERROR_INVALID_FORMAT;
-
-  // Verify checksum
-  uint8_t checksum = 0;
-  for (int i = 1; i < 9 + byte_count * 2; i += 2) {
-    int value = hex_byte_to_int(line + i);
-    if (value < 0) {
-      return HEX_PARSE_ERROR_INVALID_FORMAT;
-    }
-    checksum += value;
   }
 
-  int file_checksum = hex_byte_to_int(line + 9 + byte_count * 2);
-  if (file_checksum < 0) {
+  // Everything after the length in one go, the checksum included. All bytes
+  // of a valid record add up to 0.
+  uint8_t sum;
+  if (!hex_decode(line + 3, 4 + byte_count, record->raw + 1, &sum)) {
     return HEX_PARSE_ERROR_INVALID_FORMAT;
   }
-  checksum = ~checksum + 1;  // Two's complement
-  // Verify checksum
-  if (checksum != file_checksum) {
+  if ((uint8_t)(checksum + sum) != 0) {
     return HEX_PARSE_ERROR_CHECKSUM;
   }
 
-  // Process the record based on record type
-  switch (record_type) {
-    case HEX_RECORD_DATA: {
-      uint32_t absolute_address = *base_address + record_address;
-      *address = absolute_address;
-
-      // Update max address if this data extends beyond current max
-      if (absolute_address + byte_count > *max_address) {
-        *max_address = absolute_address + byte_count;
-      }
+  record->address = (record->raw[1] << 8) | record->raw[2];
+  record->type = record->raw[3];
+  record->length = byte_count;
+  record->data = record->raw + 4;
+  if (record->type > HEX_RECORD_START_LINEAR) {
+    return HEX_PARSE_ERROR_UNSUPPORTED_RECORD;
+  }
+  return record->type;
+}
 
-      // Parse data bytes
-      for (int i = 0; i < byte_count; i++) {
-        int value = hex_byte_to_int(line + 9 + i * 2);
-        if (value < 0)
-          return HEX_PARSE_ERROR_INVALID_FORMAT;
+static int compare_runs(const void* a, const void* b) {
+  const hex_run_t* run_a = a;
+  const hex_run_t* run_b = b;
+  if (run_a->address != run_b->address)
+    return run_a->address < run_b->address ? -1 : 1;
+  return 0;
+}
 
-        // Make sure we don't write outside our buffer
-        if (data_buffer != NULL) {
-          size_t buf_offset = absolute_address - min_address + i;
-          data_buffer[buf_offset] = value;
+// Coalesces the runs into segments and copies their data into place. Runs
+// are copied in file order, so where records overlap the later one wins.
+static int hex_build_segments(const hex_run_t* runs,
+                              size_t run_count,
+                              const uint8_t* data,
+                              parsed_firmware_file_t* parsed_results) {
+  hex_run_t* sorted = malloc(run_count * sizeof(hex_run_t));
+  parsed_firmware_segment_t* segments =
+      malloc(run_count * sizeof(parsed_firmware_segment_t));
+  uint8_t* payload = NULL;
+  size_t segment_count = 0;
+  size_t payload_length = 0;
+
+  if (sorted == NULL || segments == NULL) {
+    goto error;
+  }
+  memcpy(sorted, runs, run_count * sizeof(hex_run_t));
+  qsort(sorted, run_count, sizeof(hex_run_t), compare_runs);
+
+  for (size_t i = 0; i < run_count; i++) {
+    uint64_t end = (uint64_t)sorted[i].address + sorted[i].length;
+    if (segment_count > 0) {
+      parsed_firmware_segment_t* last = &segments[segment_count - 1];
+      if (sorted[i].address <= last->address + last->length) {
+        if (end > last->address + last->length) {
+          last->length = end - last->address;
         }
+        continue;
       }
-      break;
     }
+    segments[segment_count].address = sorted[i].address;
+    segments[segment_count].length = sorted[i].length;
+    segment_count++;
+  }
+  for (size_t i = 0; i < segment_count; i++) {
+    payload_length += segments[i].length;
+  }
 
-    case HEX_RECORD_EOF:
-      // End of file, nothing to do
-      break;
-
-    case HEX_RECORD_EXTENDED_SEGMENT:
-      // Set segment base address (offset = value * 16)
-      if (byte_count != 2)
-        return HEX_PARSE_ERROR_INVALID_FORMAT;
-      int value_high = hex_byte_to_int(line + 9);
-      int value_low = hex_byte_to_int(line + 11);
-      if (value_high < 0 || value_low < 0)
-        return HEX_PARSE_ERROR_INVALID_FORMAT;
-      *base_address = ((value_high << 8) | value_low) << 4;
-      break;
-
-    case HEX_RECORD_EXTENDED_LINEAR:
-      // Set high-order 16 bits of address
-      if (byte_count != 2)
-        return HEX_PARSE_ERROR_INVALID_FORMAT;
-      value_high = hex_byte_to_int(line + 9);
-      value_low = hex_byte_to_int(line + 11);
-      if (value_high < 0 || value_low < 0)
-        return HEX_PARSE_ERROR_INVALID_FORMAT;
-      *base_address = ((value_high << 8) | value_low) << 16;
-      break;
-
-    case HEX_RECORD_START_LINEAR:
-      // Start linear address - store as a potential entry point
-      // but not crucial for firmware extraction
-      break;
-
-    case HEX_RECORD_START_SEGMENT:
-      // Start segment address - similar to above
-      break;
-
-    default:
-      return HEX_PARSE_ERROR_UNSUPPORTED_RECORD;
+  payload = malloc(payload_length);
+  if (payload == NULL) {
+    goto error;
   }
+  size_t offset = 0;
+  for (size_t i = 0; i < segment_count; i++) {
+    segments[i].data = payload + offset;
+    offset += segments[i].length;
+  }
+  for (size_t i = 0; i < run_count; i++) {
+    // Last segment starting at or below the run
+    size_t low = 0, high = segment_count;
+    while (high - low > 1) {
+      size_t middle = (low + high) / 2;
+      if (segments[middle].address <= runs[i].address) {
+        low = middle;
+      } else {
+        high = middle;
+      }
+    }
+    memcpy(segments[low].data + (runs[i].address - segments[low].address),
+           data + runs[i].offset, runs[i].length);
+  }
+
+  free(sorted);
+  parsed_results->payload = payload;
+  parsed_results->payload_length = payload_length;
+  parsed_results->payload_address = segments[0].address;
+  parsed_results->segments = segments;
+  parsed_results->segment_count = segment_count;
+  return 0;
 
-  return record_type;
+error:
+  free(sorted);
+  free(segments);
+  free(payload);
+  return -1;
 }
 
 int hex_file_parse(const char* file_path_on_disk,
-                   uint8_t** payload,
-                   size_t* payload_length,
-                   size_t* payload_address) {
-  FILE* file = fopen(file_path_on_disk, "r");
-  if (!file) {
-    fprintf(stderr, "Could not open file %s for reading\n", file_path_on_disk);
+                   parsed_firmware_file_t* parsed_results) {
+  mapped_file_t file;
+  if (mapped_file_open(file_path_on_disk, &file) < 0) {
     return PARSED_ERROR_CANT_OPEN_FILE;
   }
+  const uint8_t* contents = file.data;
+  size_t size = file.length;
 
-  // First pass: Find start and end addresses, and thus size of the payload
-  char line[512];
+  // Data records are collected in a single pass. Consecutive records extend
+  // the current run, so the usual file needs only a handful of runs.
+  hex_record_t record;
   uint32_t base_address = 0;
-  uint32_t address = 0;
-  uint32_t min_address = 0xFFFFFFFF;
-  uint32_t max_address = 0;
-  bool found_data = false;
-
-  // First pass to determine memory range
-  while (fgets(line, sizeof(line), file)) {
-    size_t len = strlen(line);
-    // Trim trailing newline and carriage return
-    while (len > 0 && (line[len - 1] == '\n' || line[len - 1] == '\r')) {
-      line[--len] = 0;
-    }
-    if (len == 0 || line[0] != ':')
+  uint8_t* data = NULL;
+  size_t data_length = 0;
+  size_t data_capacity = 0;
+  hex_run_t* runs = NULL;
+  size_t run_count = 0;
+  size_t run_capacity = 0;
+  int ret = 0;
+
+  for (size_t position = 0; position < size;) {
+    const char* line = (const char*)contents + position;
+    if (line[0] != ':') {
+      // Line endings, and whatever else is on a line up to its end
+      while (position < size && contents[position] != '\n' &&
+             contents[position] != '\r') {
+        position++;
+      }
+      position++;
       continue;
-
-    int result =
-        parse_hex_line(line, NULL, &address, &base_address, &max_address, 0);
-    if (result < 0) {
-      fclose(file);
-      return result;
     }
 
-    // Check if this is a data record (type 0)
-    if (result == HEX_RECORD_DATA) {
-      found_data = true;
-      if (address < min_address) {
-        min_address = address;
-      }
+    int result = hex_parse_record(line, size - position, &record);
+    if (result < 0) {
+      ret = result;
+      goto exit;
     }
+    position += HEX_RECORD_TEXT_LENGTH(record.length);
 
-    // If we hit EOF record, we're done
     if (result == HEX_RECORD_EOF) {
       break;
     }
-  }
-
-  // If no data was found, return error
-  if (!found_data) {
-    fclose(file);
-    return HEX_PARSE_ERROR_INVALID_FORMAT;
-  }
-
-  // Calculate payload size
-  size_t size = max_address - min_address;
-  if (size > (1024 * 1024 * 128)) {  // Limit to 128 MB
-    fclose(file);
-    return HEX_PARSE_ERROR_TOO_LARGE;
-  }
-  // Allocate memory for the payload
-  *payload = (uint8_t*)calloc(size, sizeof(uint8_t));
-  if (!*payload) {
-    fclose(file);
-    return -1;
-  }
-
-  // Clear the memory to ensure all bytes are initialized
-  memset(*payload, 0, size);
-
-  // Second pass: actually parse the data and fill out the buffer with the data
-  rewind(file);
-  base_address = 0;
-
-  while (fgets(line, sizeof(line), file)) {
-    size_t len = strlen(line);
-    // Trim trailing newline and carriage return
-    while (len > 0 && (line[len - 1] == '\n' || line[len - 1] == '\r')) {
-      line[--len] = 0;
+    if (result == HEX_RECORD_EXTENDED_SEGMENT ||
+        result == HEX_RECORD_EXTENDED_LINEAR) {
+      if (record.length != 2) {
+        ret = HEX_PARSE_ERROR_INVALID_FORMAT;
+        goto exit;
+      }
+      uint32_t value = (record.data[0] << 8) | record.data[1];
+      // Segment addresses are paragraphs (16 bytes), linear ones 64 KiB
+      base_address =
+          result == HEX_RECORD_EXTENDED_SEGMENT ? value << 4 : value << 16;
+      continue;
     }
-    if (len == 0 || line[0] != ':')
+    // Start addresses are entry points, not needed to flash the image
+    if (result != HEX_RECORD_DATA || record.length == 0) {
       continue;
-
-    // When parsing for real, data is written to the payload buffer
-    // with addresses relative to min_address
-    uint32_t dummy_max = 0;
-
-    int result = parse_hex_line(line, *payload, &address, &base_address,
-                                &dummy_max, min_address);
-    if (result < 0) {
-      free(*payload);
-      *payload = NULL;
-      fclose(file);
-      return result;
     }
 
-    // If we hit EOF record, we're done
-    if (result == HEX_RECORD_EOF) {
-      break;
+    uint32_t address = base_address + record.address;
+    if (data_length + record.length > HEX_MAX_DATA_SIZE) {
+      ret = HEX_PARSE_ERROR_TOO_LARGE;
+      goto exit;
+    }
+    if (data_length + record.length > data_capacity) {
+      size_t capacity = data_capacity == 0 ? 64 * 1024 : data_capacity * 2;
+      if (capacity > HEX_MAX_DATA_SIZE) {
+        capacity = HEX_MAX_DATA_SIZE;
+      }
+      uint8_t* grown = realloc(data, capacity);
+      if (grown == NULL) {
+        ret = -1;
+        goto exit;
+      }
+      data = grown;
+      data_capacity = capacity;
+    }
+    memcpy(data + data_length, record.data, record.length);
+
+    hex_run_t* last = run_count > 0 ? &runs[run_count - 1] : NULL;
+    if (last != NULL && (uint64_t)last->address + last->length == address) {
+      last->length += record.length;
+    } else {
+      if (run_count == run_capacity) {
+        size_t capacity = run_capacity == 0 ? 16 : run_capacity * 2;
+        hex_run_t* grown = realloc(runs, capacity * sizeof(hex_run_t));
+        if (grown == NULL) {
+          ret = -1;
+          goto exit;
+        }
+        runs = grown;
+        run_capacity = capacity;
+      }
+      runs[run_count].address = address;
+      runs[run_count].offset = data_length;
+      runs[run_count].length = record.length;
+      run_count++;
     }
+    data_length += record.length;
   }
 
-  fclose(file);
-
-  // Set output parameters
-  *payload_length = size;
-  *payload_address = min_address;
+  // If no data was found, return error
+  if (run_count == 0) {
+    ret = HEX_PARSE_ERROR_INVALID_FORMAT;
+    goto exit;
+  }
+  ret = hex_build_segments(runs, run_count, data, parsed_results);
 
-  return 0;
+exit:
+  free(runs);
+  free(data);
+  mapped_file_close(&file);
+  return ret;
 }
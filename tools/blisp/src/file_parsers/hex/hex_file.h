@@ -8,6 +8,7 @@
 #include <stdint.h>
 #include <stdio.h>
 #include <string.h>
+#include "parsed_firmware_file.h"
 
 #ifdef __cplusplus
 extern "C" {
@@ -29,18 +30,31 @@ typedef enum {
   HEX_RECORD_START_LINEAR = 0x05       // Start linear address record
 } hex_record_type_t;
 
-// Parse an Intel HEX file and return a contiguous memory block
+typedef struct {
+  uint8_t type;
+  uint16_t address;
+  uint8_t length;
+  const uint8_t* data;  // Points into raw
+  uint8_t raw[4 + 255 + 1];  // Length, address, type, data and checksum
+} hex_record_t;
+
+// Length of a record with the given byte count, without the line ending
+#define HEX_RECORD_TEXT_LENGTH(byte_count) ((size_t)11 + (byte_count) * 2)
+
+// Parse the Intel HEX record at the start of line into a record. len is what
+// is left of the input, the record's own length follows from its byte count.
+// Returns: Record Type on success, negative error code on failure
+int hex_parse_record(const char* line, size_t len, hex_record_t* record);
+
+// Parse an Intel HEX file into the segments it has data for
 // Parameters:
 //   file_path_on_disk: Path to the Intel HEX file
-//   payload: Pointer to the buffer that will hold the parsed data
-//   payload_length: Size of the payload
-//   payload_address: Start address of the payload
+//   parsed_results: Receives the payload and its segments, nothing else is
+//                   touched
 // Returns:
 //   0 on success, negative value on error
 int hex_file_parse(const char* file_path_on_disk,
-                   uint8_t** payload,
-                   size_t* payload_length,
-                   size_t* payload_address);
+                   parsed_firmware_file_t* parsed_results);
 
 #ifdef __cplusplus
 };
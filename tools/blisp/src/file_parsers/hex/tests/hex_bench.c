@@ -0,0 +1,161 @@
+// Intel HEX parsing benchmark. Generates an image of the given size as HEX
+// text, then times decoding every record with the per-character decoder the
+// parser used to have, the scalar and the vector decoder, and a full
+// hex_file_parse of the file. Prints one JSON object.
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "hex_decode.h"
+#include "hex_file.h"
+#include "parse_file.h"
+
+#define BENCH_RECORD_SIZE 32
+#define BENCH_SEED 0x2545F491
+
+static double bench_now(void) {
+  struct timespec now;
+  timespec_get(&now, TIME_UTC);
+  return now.tv_sec + now.tv_nsec / 1e9;
+}
+
+// The decoder hex_file.c used before hex_decode
+static int reference_hex_to_int(char c) {
+  if (c >= '0' && c <= '9')
+    return c - '0';
+  if (c >= 'A' && c <= 'F')
+    return c - 'A' + 10;
+  if (c >= 'a' && c <= 'f')
+    return c - 'a' + 10;
+  return -1;
+}
+
+static bool reference_decode(const char* text,
+                             size_t count,
+                             uint8_t* bytes,
+                             uint8_t* sum) {
+  uint8_t total = 0;
+  for (size_t i = 0; i < count; i++) {
+    int high = reference_hex_to_int(text[i * 2]);
+    int low = reference_hex_to_int(text[i * 2 + 1]);
+    if (high < 0 || low < 0)
+      return false;
+    bytes[i] = (high << 4) | low;
+    total += bytes[i];
+  }
+  *sum = total;
+  return true;
+}
+
+static size_t bench_put_record(char* out,
+                               uint8_t type,
+                               uint16_t address,
+                               const uint8_t* data,
+                               uint8_t length) {
+  static const char digits[] = "0123456789ABCDEF";
+  uint8_t bytes[4 + 255 + 1] = {length, address >> 8, address & 0xFF, type};
+  uint8_t checksum = length + bytes[1] + bytes[2] + type;
+  for (uint8_t i = 0; i < length; i++) {
+    bytes[4 + i] = data[i];
+    checksum += data[i];
+  }
+  bytes[4 + length] = ~checksum + 1;
+  size_t n = 0;
+  out[n++] = ':';
+  for (size_t i = 0; i < 5u + length; i++) {
+    out[n++] = digits[bytes[i] >> 4];
+    out[n++] = digits[bytes[i] & 0x0F];
+  }
+  out[n++] = '\r';
+  out[n++] = '\n';
+  return n;
+}
+
+typedef bool (*bench_decoder)(const char*, size_t, uint8_t*, uint8_t*);
+
+// Decodes every record of text, returns the seconds it took
+static double bench_decode(const char* text,
+                           size_t length,
+                           bench_decoder decode) {
+  uint8_t bytes[4 + 255 + 1];
+  uint8_t sum;
+  double start = bench_now();
+  for (size_t position = 0; position < length;) {
+    uint8_t count;
+    decode(text + position + 1, 1, &count, &sum);
+    if (!decode(text + position + 3, 4 + count, bytes, &sum)) {
+      fprintf(stderr, "Decoding failed at %zu\n", position);
+      exit(1);
+    }
+    position += 11 + count * 2 + 2;
+  }
+  return bench_now() - start;
+}
+
+int main(int argc, char** argv) {
+  size_t data_size = (argc > 1 ? strtoul(argv[1], NULL, 0) : 32) << 20;
+  const char* path = argc > 2 ? argv[2] : "hex_file_bench.hex";
+
+  size_t record_count = data_size / BENCH_RECORD_SIZE;
+  size_t capacity =
+      (record_count + data_size / 0x10000 + 1) * (13 + BENCH_RECORD_SIZE * 2);
+  char* text = malloc(capacity);
+  if (text == NULL) {
+    fprintf(stderr, "Out of memory\n");
+    return 1;
+  }
+
+  uint32_t state = BENCH_SEED;
+  uint8_t data[BENCH_RECORD_SIZE];
+  size_t length = 0;
+  for (size_t i = 0; i < record_count; i++) {
+    uint32_t address = i * BENCH_RECORD_SIZE;
+    if (address % 0x10000 == 0) {
+      uint8_t upper[2] = {address >> 24, (address >> 16) & 0xFF};
+      length += bench_put_record(text + length, HEX_RECORD_EXTENDED_LINEAR, 0,
+                                 upper, 2);
+    }
+    for (size_t j = 0; j < BENCH_RECORD_SIZE; j++) {
+      state ^= state << 13;
+      state ^= state >> 17;
+      state ^= state << 5;
+      data[j] = state;
+    }
+    length += bench_put_record(text + length, HEX_RECORD_DATA,
+                               address & 0xFFFF, data, BENCH_RECORD_SIZE);
+  }
+  size_t records_length = length;
+  length += bench_put_record(text + length, HEX_RECORD_EOF, 0, NULL, 0);
+
+  FILE* file = fopen(path, "wb");
+  if (file == NULL || fwrite(text, 1, length, file) != length) {
+    fprintf(stderr, "Failed to write %s\n", path);
+    return 1;
+  }
+  fclose(file);
+
+  double reference_s = bench_decode(text, records_length, reference_decode);
+  double scalar_s = bench_decode(text, records_length, hex_decode_scalar);
+  double vector_s = bench_decode(text, records_length, hex_decode);
+
+  parsed_firmware_file_t parsed = {0};
+  double start = bench_now();
+  int ret = hex_file_parse(path, &parsed);
+  double parse_s = bench_now() - start;
+  remove(path);
+  if (ret != 0 || parsed.payload_length != record_count * BENCH_RECORD_SIZE) {
+    fprintf(stderr, "Parsing failed: %d\n", ret);
+    return 1;
+  }
+  free_parsed_firmware_file(&parsed);
+  free(text);
+
+  double mib = length / (1024.0 * 1024.0);
+  printf(
+      "{\"hex_bytes\":%zu,\"data_bytes\":%zu,"
+      "\"reference_decode_mib_per_s\":%.1f,\"scalar_decode_mib_per_s\":%.1f,"
+      "\"vector_decode_mib_per_s\":%.1f,\"parse_mib_per_s\":%.1f}\n",
+      length, data_size, mib / reference_s, mib / scalar_s, mib / vector_s,
+      mib / parse_s);
+  return 0;
+}
@@ -1,40 +1,111 @@
 // Intel hex file parser test
 
 #include <gtest/gtest.h>
+#include "hex_decode.h"
 #include "hex_file.h"
 #include "parse_file.h"
 
 TEST(HEX_FILE_PARSER, ParseTestFile) {
-  uint8_t* payload = nullptr;
-  size_t payload_size = 0;
-  size_t payload_address = 0;
+  parsed_firmware_file_t parsed = {};
   int res = hex_file_parse(SOURCE_DIR
                            "/tools/blisp/src/file_parsers/hex/tests/test.hex",
-                           &payload, &payload_size, &payload_address);
+                           &parsed);
   // Shall return 0 on success
   ASSERT_EQ(res, 0);
   // The expected base address is 0x230F0000 + 0xFC00 = 0x230FFC00
-  ASSERT_EQ(payload_address, 0x230FFC00);
+  ASSERT_EQ(parsed.payload_address, 0x230FFC00);
   // There are 7 data records of 16 bytes each, so payload size should be 0x70
   // (112 bytes)
-  ASSERT_EQ(payload_size, 0x70);
+  ASSERT_EQ(parsed.payload_length, 0x70);
+  // The records are contiguous, so they form a single segment
+  ASSERT_EQ(parsed.segment_count, 1);
+  ASSERT_EQ(parsed.segments[0].address, 0x230FFC00);
+  ASSERT_EQ(parsed.segments[0].length, 0x70);
+  ASSERT_EQ(parsed.segments[0].data, parsed.payload);
 
   // Optionally, check the first few bytes for expected values
-  ASSERT_EQ(payload[0], 0x40);
-  ASSERT_EQ(payload[1], 0x01);
-  ASSERT_EQ(payload[2], 0x96);
-  ASSERT_EQ(payload[3], 0x00);
+  ASSERT_EQ(parsed.payload[0], 0x40);
+  ASSERT_EQ(parsed.payload[1], 0x01);
+  ASSERT_EQ(parsed.payload[2], 0x96);
+  ASSERT_EQ(parsed.payload[3], 0x00);
 
   // Clean up
-  free(payload);
+  free_parsed_firmware_file(&parsed);
+}
+
+TEST(HEX_FILE_PARSER, ParseSparseFile) {
+  parsed_firmware_file_t parsed = {};
+  int res = hex_file_parse(
+      SOURCE_DIR "/tools/blisp/src/file_parsers/hex/tests/test_sparse.hex",
+      &parsed);
+  ASSERT_EQ(res, 0);
+  // Records come out of order and with holes, segments are sorted and only
+  // hold the bytes the file has
+  ASSERT_EQ(parsed.segment_count, 3);
+  ASSERT_EQ(parsed.payload_address, 0);
+  ASSERT_EQ(parsed.payload_length, 0x18 + 0x18 + 0x20);
+
+  ASSERT_EQ(parsed.segments[0].address, 0);
+  ASSERT_EQ(parsed.segments[0].length, 0x18);
+  ASSERT_EQ(parsed.segments[0].data[0], 0xAA);
+  ASSERT_EQ(parsed.segments[0].data[0x17], 0xBB);
+
+  // Overlapping records merge, the later one wins
+  ASSERT_EQ(parsed.segments[1].address, 0x100);
+  ASSERT_EQ(parsed.segments[1].length, 0x18);
+  ASSERT_EQ(parsed.segments[1].data[7], 0x11);
+  ASSERT_EQ(parsed.segments[1].data[8], 0x22);
+  ASSERT_EQ(parsed.segments[1].data[0x17], 0x22);
+
+  ASSERT_EQ(parsed.segments[2].address, 0x800000);
+  ASSERT_EQ(parsed.segments[2].length, 0x20);
+  for (int i = 0; i < 0x20; i++) {
+    ASSERT_EQ(parsed.segments[2].data[i], 0x10 + i);
+  }
+
+  free_parsed_firmware_file(&parsed);
+}
+
+TEST(HEX_FILE_PARSER, DecodeMatchesScalar) {
+  // Long enough for a few vector blocks and a scalar tail, in both cases
+  char text[2 * 70];
+  uint8_t expected[70];
+  for (size_t i = 0; i < sizeof(expected); i++) {
+    expected[i] = i * 37 + 5;
+    const char* digits = i % 2 ? "0123456789abcdef" : "0123456789ABCDEF";
+    text[i * 2] = digits[expected[i] >> 4];
+    text[i * 2 + 1] = digits[expected[i] & 0x0F];
+  }
+  for (size_t count = 0; count <= sizeof(expected); count++) {
+    uint8_t bytes[70], scalar_bytes[70];
+    uint8_t sum, scalar_sum, expected_sum = 0;
+    for (size_t i = 0; i < count; i++) {
+      expected_sum += expected[i];
+    }
+    ASSERT_TRUE(hex_decode(text, count, bytes, &sum));
+    ASSERT_TRUE(hex_decode_scalar(text, count, scalar_bytes, &scalar_sum));
+    ASSERT_EQ(memcmp(bytes, expected, count), 0);
+    ASSERT_EQ(memcmp(scalar_bytes, expected, count), 0);
+    ASSERT_EQ(sum, expected_sum);
+    ASSERT_EQ(scalar_sum, expected_sum);
+  }
+
+  // A single bad character anywhere fails the whole run
+  for (size_t i = 0; i < sizeof(text); i++) {
+    for (char bad : {'g', 'G', '/', ':', '@', '`', ' ', '\xB0'}) {
+      char broken[sizeof(text)];
+      uint8_t bytes[70], sum;
+      memcpy(broken, text, sizeof(text));
+      broken[i] = bad;
+      ASSERT_FALSE(hex_decode(broken, sizeof(expected), bytes, &sum));
+      ASSERT_FALSE(hex_decode_scalar(broken, sizeof(expected), bytes, &sum));
+    }
+  }
 }
 
 TEST(HEX_FILE_PARSER, ParseNonExistentFile) {
-  uint8_t* payload = nullptr;
-  size_t payload_size = 0;
-  size_t payload_address = 0;
-  int res = hex_file_parse(SOURCE_DIR "/non_existent_file.hex", &payload,
-                           &payload_size, &payload_address);
+  parsed_firmware_file_t parsed = {};
+  int res = hex_file_parse(SOURCE_DIR "/non_existent_file.hex", &parsed);
 
   ASSERT_EQ(res, PARSED_ERROR_CANT_OPEN_FILE);
 }
@@ -0,0 +1,123 @@
+#include "mapped_file.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "parse_file.h"
+
+#if defined(_WIN32)
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+// Fallback for whatever can't be mapped, reads until the end of the stream
+static int mapped_file_read(FILE* f, mapped_file_t* file) {
+  size_t capacity = 0;
+  for (;;) {
+    if (file->length == capacity) {
+      capacity = capacity == 0 ? 64 * 1024 : capacity * 2;
+      uint8_t* grown = realloc(file->data, capacity);
+      if (grown == NULL) {
+        return -1;
+      }
+      file->data = grown;
+    }
+    size_t read_count =
+        fread(file->data + file->length, 1, capacity - file->length, f);
+    file->length += read_count;
+    if (read_count == 0) {
+      return ferror(f) ? -1 : 0;
+    }
+  }
+}
+
+// Maps the file if it is a regular one. Returns false if it should be read
+// instead, which includes empty files as they can't be mapped.
+static bool mapped_file_map(const char* file_path_on_disk,
+                            mapped_file_t* file) {
+#if defined(_WIN32)
+  HANDLE handle =
+      CreateFileA(file_path_on_disk, GENERIC_READ, FILE_SHARE_READ, NULL,
+                  OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+  if (handle == INVALID_HANDLE_VALUE) {
+    return false;
+  }
+  LARGE_INTEGER size;
+  if (GetFileType(handle) != FILE_TYPE_DISK || !GetFileSizeEx(handle, &size) ||
+      size.QuadPart == 0 || (uint64_t)size.QuadPart > SIZE_MAX) {
+    CloseHandle(handle);
+    return false;
+  }
+  HANDLE mapping = CreateFileMappingA(handle, NULL, PAGE_READONLY, 0, 0, NULL);
+  CloseHandle(handle);
+  if (mapping == NULL) {
+    return false;
+  }
+  void* view = MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+  if (view == NULL) {
+    CloseHandle(mapping);
+    return false;
+  }
+  file->data = view;
+  file->length = (size_t)size.QuadPart;
+  file->mapping = mapping;
+#else
+  int fd = open(file_path_on_disk, O_RDONLY);
+  if (fd < 0) {
+    return false;
+  }
+  struct stat info;
+  if (fstat(fd, &info) != 0 || !S_ISREG(info.st_mode) || info.st_size == 0 ||
+      (uint64_t)info.st_size > SIZE_MAX) {
+    close(fd);
+    return false;
+  }
+  void* view = mmap(NULL, info.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+  close(fd);
+  if (view == MAP_FAILED) {
+    return false;
+  }
+  file->data = view;
+  file->length = info.st_size;
+#endif
+  file->mapped = true;
+  return true;
+}
+
+int mapped_file_open(const char* file_path_on_disk, mapped_file_t* file) {
+  memset(file, 0, sizeof(mapped_file_t));
+  if (mapped_file_map(file_path_on_disk, file)) {
+    return 0;
+  }
+
+  FILE* f = fopen(file_path_on_disk, "rb");
+  if (f == NULL) {
+    fprintf(stderr, "Could not open file %s for reading\n", file_path_on_disk);
+    return PARSED_ERROR_CANT_OPEN_FILE;
+  }
+  int ret = mapped_file_read(f, file);
+  fclose(f);
+  if (ret != 0) {
+    fprintf(stderr, "Could not read %s\n", file_path_on_disk);
+    mapped_file_close(file);
+    return PARSED_ERROR_CANT_OPEN_FILE;
+  }
+  return 0;
+}
+
+void mapped_file_close(mapped_file_t* file) {
+  if (file->mapped) {
+#if defined(_WIN32)
+    UnmapViewOfFile(file->data);
+    CloseHandle(file->mapping);
+#else
+    munmap(file->data, file->length);
+#endif
+  } else {
+    free(file->data);
+  }
+  memset(file, 0, sizeof(mapped_file_t));
+}
@@ -0,0 +1,30 @@
+#ifndef BLISP_MAPPED_FILE_H
+#define BLISP_MAPPED_FILE_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Contents of an input file. Regular files are mapped read-only, so their
+// payloads can be handed out as views without copying them to the heap.
+// Pipes and other files that can't be mapped are read into the heap.
+typedef struct {
+  uint8_t* data;  // Must not be written to
+  size_t length;
+  bool mapped;
+  void* mapping;  // Windows only, the file mapping object
+} mapped_file_t;
+
+// Returns 0 on success, PARSED_ERROR_CANT_OPEN_FILE otherwise
+int mapped_file_open(const char* file_path_on_disk, mapped_file_t* file);
+void mapped_file_close(mapped_file_t* file);
+
+#ifdef __cplusplus
+};
+#endif
+
+#endif  // BLISP_MAPPED_FILE_H
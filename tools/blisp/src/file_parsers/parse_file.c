@@ -10,7 +10,6 @@ const char* get_filename_ext(const char* filename) {
     return "";
   return dot + 1;
 }
-#define FLASH_MAP_ADDR 0x23000000
 int parse_firmware_file(const char* file_path_on_disk,
                         parsed_firmware_file_t* parsed_results) {
   // Switchcase on the extension of the file
@@ -19,31 +18,70 @@ int parse_firmware_file(const char* file_path_on_disk,
   if (strncmp(ext, "dfu", 3) == 0 || strncmp(ext, "DFU", 3) == 0) {
     printf("Input file identified as a .dfu file\n");
     // Handle as a .dfu file
-    res = dfu_file_parse(file_path_on_disk, &parsed_results->payload,
+    res = dfu_file_parse(file_path_on_disk, &parsed_results->source,
+                         &parsed_results->payload,
                          &parsed_results->payload_length,
                          &parsed_results->payload_address);
   } else if (strncmp(ext, "bin", 3) == 0 || strncmp(ext, "BIN", 3) == 0) {
     printf("Input file identified as a .bin file\n");
     // Raw binary file
-    res = bin_file_parse(file_path_on_disk, &parsed_results->payload,
+    res = bin_file_parse(file_path_on_disk, &parsed_results->source,
+                         &parsed_results->payload,
                          &parsed_results->payload_length,
                          &parsed_results->payload_address);
   } else if (strncmp(ext, "hex", 3) == 0 || strncmp(ext, "HEX", 3) == 0) {
     printf("Input file identified as a .hex file\n");
     // Intel HEX file
-    res = hex_file_parse(file_path_on_disk, &parsed_results->payload,
-                         &parsed_results->payload_length,
-                         &parsed_results->payload_address);
+    res = hex_file_parse(file_path_on_disk, parsed_results);
+  }
+  if (res < 0 || parsed_results->payload == NULL) {
+    return res;
+  }
+
+  // Formats without holes are a single segment
+  if (parsed_results->segments == NULL) {
+    parsed_results->segments = malloc(sizeof(parsed_firmware_segment_t));
+    if (parsed_results->segments == NULL) {
+      free_parsed_firmware_file(parsed_results);
+      return -1;
+    }
+    parsed_results->segments[0].address = parsed_results->payload_address;
+    parsed_results->segments[0].length = parsed_results->payload_length;
+    parsed_results->segments[0].data = parsed_results->payload;
+    parsed_results->segment_count = 1;
   }
 
   // Normalise address, some builds will base the firmware at flash start but
   // for the flasher we use 0 base (i.e. offsets into flash)
-  if (parsed_results->payload_address >= FLASH_MAP_ADDR) {
-    parsed_results->payload_address -= FLASH_MAP_ADDR;
+  for (size_t i = 0; i < parsed_results->segment_count; i++) {
+    if (parsed_results->segments[i].address >= FLASH_MAP_ADDR) {
+      parsed_results->segments[i].address -= FLASH_MAP_ADDR;
+    }
   }
+  parsed_results->payload_address = parsed_results->segments[0].address;
   // If the firmware starts at "0" we need to pre-pend a boot sector later on
 
   parsed_results->needs_boot_struct = parsed_results->payload_address == 0;
 
   return res;
 }
+
+void move_parsed_firmware_file(parsed_firmware_file_t* parsed_file,
+                               size_t offset) {
+  for (size_t i = 0; i < parsed_file->segment_count; i++) {
+    parsed_file->segments[i].address += offset;
+  }
+  parsed_file->payload_address += offset;
+}
+
+void free_parsed_firmware_file(parsed_firmware_file_t* parsed_file) {
+  if (parsed_file->source.data != NULL) {
+    mapped_file_close(&parsed_file->source);
+  } else {
+    free(parsed_file->payload);
+  }
+  free(parsed_file->segments);
+  parsed_file->payload = NULL;
+  parsed_file->segments = NULL;
+  parsed_file->segment_count = 0;
+}
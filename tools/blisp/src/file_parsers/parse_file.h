@@ -7,23 +7,36 @@
 #include <BaseTsd.h>
 typedef SSIZE_T ssize_t;
 #endif
+#include "mapped_file.h"
 #include "parsed_firmware_file.h"
 
+#ifdef __cplusplus
+extern "C" {
+#endif
+
 #define PARSED_ERROR_INVALID_FILETYPE -0x1000
 #define PARSED_ERROR_CANT_OPEN_FILE -0x1001
 #define PARSED_ERROR_TOO_BIG -0x1001 /* Input expands to be too big */
 #define PARSED_ERROR_BAD_DFU -0x1002 /* DFU file provided but not valid */
 
+// Some builds base the firmware at where flash is mapped into memory, the
+// flasher uses offsets into flash
+#define FLASH_MAP_ADDR 0x23000000
+
 // This attempts to parse the given file, and returns the parsed version of that
-// file. This will handle any repacking required to create one contigious file
-// Eg if the input file has holes,they will be 0x00 filled
-// And headers etc are parsed to determine start position
+// file. Files with holes (Intel HEX) come back as several segments, other
+// formats as a single one. Headers etc are parsed to determine start position
 
 int parse_firmware_file(const char* file_path_on_disk,
                         parsed_firmware_file_t* parsed_results);
 
-// Internal util
-ssize_t get_file_contents(const char* file_path_on_disk,
-                          uint8_t** file_contents);
+// Moves every segment of the image by offset
+void move_parsed_firmware_file(parsed_firmware_file_t* parsed_file,
+                               size_t offset);
+void free_parsed_firmware_file(parsed_firmware_file_t* parsed_file);
+
+#ifdef __cplusplus
+};
+#endif
 
 #endif  // PARSE_FILE_H_
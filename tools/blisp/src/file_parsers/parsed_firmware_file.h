@@ -3,15 +3,31 @@
 #include <stdbool.h>
 #include <stdint.h>
 #include <stdio.h>
+#include "mapped_file.h"
 
 // Parsed firmware file is a generic struct that we parse from a user input
 // firmware file This is used so that we can (relatively) seamlessly handle
 // .bin, .hex and .def files
 
+// A run of bytes at consecutive addresses
+typedef struct {
+  size_t address;  // Start address of the segment
+  size_t length;   // Size of the segment
+  uint8_t* data;   // Points into the payload
+} parsed_firmware_segment_t;
+
 typedef struct {
   bool needs_boot_struct;  // If true, boot struct should be generated
   uint8_t* payload;        // The main firmware payload
   size_t payload_length;   // Size of the payload
   size_t payload_address;  // Start address of the payload
+  // Where the payload goes, sorted by address and neither overlapping nor
+  // touching. The segments lie back to back in payload, so with more than
+  // one segment payload_address only is the start of the first.
+  parsed_firmware_segment_t* segments;
+  size_t segment_count;
+  // The input file, if payload points into it rather than being decoded
+  // into the heap
+  mapped_file_t source;
 } parsed_firmware_file_t;
 #endif  // PARSED_FIRMWARE_H_
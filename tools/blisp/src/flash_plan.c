@@ -0,0 +1,205 @@
+// SPDX-License-Identifier: MIT
+#include "flash_plan.h"
+#include <stdlib.h>
+#include <string.h>
+
+// Ballpark figures for BL602/BL702 modules, the planner only compares them
+#define FLASH_PLAN_UART_COMMAND_US 2000
+#define FLASH_PLAN_USB_COMMAND_US 1000
+#define FLASH_PLAN_USB_BYTE_NS 1000
+#define FLASH_PLAN_ERASE_US_PER_SECTOR 30000
+
+void flash_plan_get_costs(struct flash_plan_costs* costs,
+                          uint32_t baud_rate,
+                          bool is_usb) {
+  costs->erase_us_per_sector = FLASH_PLAN_ERASE_US_PER_SECTOR;
+  if (is_usb || baud_rate == 0) {
+    costs->command_us = FLASH_PLAN_USB_COMMAND_US;
+    costs->byte_ns = FLASH_PLAN_USB_BYTE_NS;
+  } else {
+    costs->command_us = FLASH_PLAN_UART_COMMAND_US;
+    costs->byte_ns = 10000000000ull / baud_rate;  // 8N1
+  }
+}
+
+// Splits a segment at runs of 0xFF longer than max_blank. Only counts the
+// pieces if pieces is NULL.
+static size_t flash_plan_split(const parsed_firmware_segment_t* segment,
+                               uint32_t max_blank,
+                               struct flash_plan_range* pieces) {
+  size_t count = 0;
+  size_t piece_start = 0;
+  size_t i = 0;
+  while (i < segment->length) {
+    if (segment->data[i] != 0xFF) {
+      i++;
+      continue;
+    }
+    size_t blank_start = i;
+    while (i < segment->length && segment->data[i] == 0xFF) {
+      i++;
+    }
+    if (i - blank_start <= max_blank) {
+      continue;
+    }
+    if (blank_start > piece_start) {
+      if (pieces != NULL) {
+        pieces[count].address = segment->address + piece_start;
+        pieces[count].length = blank_start - piece_start;
+        pieces[count].data = segment->data + piece_start;
+      }
+      count++;
+    }
+    piece_start = i;
+  }
+  if (segment->length > piece_start) {
+    if (pieces != NULL) {
+      pieces[count].address = segment->address + piece_start;
+      pieces[count].length = segment->length - piece_start;
+      pieces[count].data = segment->data + piece_start;
+    }
+    count++;
+  }
+  return count;
+}
+
+// Index past the last piece that gets bridged into one write with pieces[i]
+static size_t flash_plan_group_end(const struct flash_plan_range* pieces,
+                                   size_t piece_count,
+                                   size_t i,
+                                   uint32_t max_gap) {
+  uint32_t end = pieces[i].address + pieces[i].length;
+  for (i++; i < piece_count && pieces[i].address - end <= max_gap; i++) {
+    end = pieces[i].address + pieces[i].length;
+  }
+  return i;
+}
+
+static blisp_return_t flash_plan_build_writes(
+    struct flash_plan* plan,
+    const parsed_firmware_segment_t* segments,
+    size_t segment_count,
+    uint32_t max_gap) {
+  blisp_return_t ret = BLISP_OK;
+  size_t piece_count = 0;
+  for (size_t i = 0; i < segment_count; i++) {
+    piece_count += flash_plan_split(&segments[i], max_gap, NULL);
+  }
+  if (piece_count == 0) {
+    return BLISP_OK;
+  }
+  struct flash_plan_range* pieces =
+      malloc(piece_count * sizeof(struct flash_plan_range));
+  if (pieces == NULL) {
+    return BLISP_ERR_OUT_OF_MEMORY;
+  }
+  piece_count = 0;
+  for (size_t i = 0; i < segment_count; i++) {
+    piece_count +=
+        flash_plan_split(&segments[i], max_gap, &pieces[piece_count]);
+  }
+
+  size_t write_count = 0;
+  size_t fill_size = 0;
+  for (size_t i = 0, j; i < piece_count; i = j) {
+    j = flash_plan_group_end(pieces, piece_count, i, max_gap);
+    if (j - i > 1) {
+      fill_size +=
+          pieces[j - 1].address + pieces[j - 1].length - pieces[i].address;
+    }
+    write_count++;
+  }
+
+  plan->writes = malloc(write_count * sizeof(struct flash_plan_range));
+  if (fill_size > 0) {
+    plan->fill = malloc(fill_size);
+  }
+  if (plan->writes == NULL || (fill_size > 0 && plan->fill == NULL)) {
+    ret = BLISP_ERR_OUT_OF_MEMORY;
+    goto exit;
+  }
+
+  uint8_t* fill = plan->fill;
+  for (size_t i = 0, j; i < piece_count; i = j) {
+    j = flash_plan_group_end(pieces, piece_count, i, max_gap);
+    struct flash_plan_range* write = &plan->writes[plan->write_count++];
+    write->address = pieces[i].address;
+    write->length =
+        pieces[j - 1].address + pieces[j - 1].length - pieces[i].address;
+    if (j - i == 1) {
+      write->data = pieces[i].data;
+      continue;
+    }
+    memset(fill, 0xFF, write->length);
+    for (size_t k = i; k < j; k++) {
+      memcpy(fill + (pieces[k].address - write->address), pieces[k].data,
+             pieces[k].length);
+    }
+    write->data = fill;
+    fill += write->length;
+  }
+
+exit:
+  free(pieces);
+  return ret;
+}
+
+blisp_return_t flash_plan_build(struct flash_plan* plan,
+                                const parsed_firmware_segment_t* segments,
+                                size_t segment_count,
+                                const struct flash_plan_costs* costs) {
+  memset(plan, 0, sizeof(struct flash_plan));
+  if (segment_count == 0) {
+    return BLISP_OK;
+  }
+
+  // Erasing a few sectors more can be cheaper than another command
+  uint32_t max_erase_gap = 0;
+  if (costs->erase_us_per_sector != 0) {
+    max_erase_gap = (uint64_t)costs->command_us * FLASH_PLAN_SECTOR_SIZE /
+                    costs->erase_us_per_sector;
+    max_erase_gap &= ~(FLASH_PLAN_SECTOR_SIZE - 1);
+  }
+  plan->erases = malloc(segment_count * sizeof(struct flash_plan_range));
+  if (plan->erases == NULL) {
+    return BLISP_ERR_OUT_OF_MEMORY;
+  }
+  for (size_t i = 0; i < segment_count; i++) {
+    if (segments[i].length == 0) {
+      continue;
+    }
+    uint32_t start = segments[i].address & ~(FLASH_PLAN_SECTOR_SIZE - 1);
+    uint32_t end = (segments[i].address + segments[i].length +
+                    FLASH_PLAN_SECTOR_SIZE - 1) &
+                   ~(FLASH_PLAN_SECTOR_SIZE - 1);
+    struct flash_plan_range* last =
+        plan->erase_count > 0 ? &plan->erases[plan->erase_count - 1] : NULL;
+    if (last != NULL && start <= last->address + last->length + max_erase_gap) {
+      last->length = end - last->address;
+    } else {
+      plan->erases[plan->erase_count].address = start;
+      plan->erases[plan->erase_count].length = end - start;
+      plan->erases[plan->erase_count].data = NULL;
+      plan->erase_count++;
+    }
+  }
+
+  // Bytes that take as long to send as another command takes
+  uint32_t max_gap = 0;
+  if (costs->byte_ns != 0) {
+    max_gap = (uint64_t)costs->command_us * 1000 / costs->byte_ns;
+  }
+  blisp_return_t ret =
+      flash_plan_build_writes(plan, segments, segment_count, max_gap);
+  if (ret != BLISP_OK) {
+    flash_plan_free(plan);
+  }
+  return ret;
+}
+
+void flash_plan_free(struct flash_plan* plan) {
+  free(plan->erases);
+  free(plan->writes);
+  free(plan->fill);
+  memset(plan, 0, sizeof(struct flash_plan));
+}
@@ -0,0 +1,56 @@
+// SPDX-License-Identifier: MIT
+#ifndef BLISP_FLASH_PLAN_H
+#define BLISP_FLASH_PLAN_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <blisp.h>
+#include "parsed_firmware_file.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define FLASH_PLAN_SECTOR_SIZE 4096
+
+// Rough prices the planner weighs against each other
+struct flash_plan_costs {
+  uint32_t command_us;           // Round trip of one more command
+  uint32_t erase_us_per_sector;  // Erasing one sector
+  uint32_t byte_ns;              // Sending one byte
+};
+
+struct flash_plan_range {
+  uint32_t address;
+  uint32_t length;
+  uint8_t* data;  // Writes only
+};
+
+// Turns the segments of an image into sector aligned erases and the writes
+// that follow them. Erases are merged where erasing the sectors in between
+// is cheaper than another command. Writes skip runs of 0xFF, which erased
+// flash already holds, and bridge gaps too short to be worth a command of
+// their own with 0xFF.
+struct flash_plan {
+  struct flash_plan_range* erases;
+  size_t erase_count;
+  struct flash_plan_range* writes;
+  size_t write_count;
+  uint8_t* fill;  // Backs the writes that bridge gaps
+};
+
+void flash_plan_get_costs(struct flash_plan_costs* costs,
+                          uint32_t baud_rate,
+                          bool is_usb);
+blisp_return_t flash_plan_build(struct flash_plan* plan,
+                                const parsed_firmware_segment_t* segments,
+                                size_t segment_count,
+                                const struct flash_plan_costs* costs);
+void flash_plan_free(struct flash_plan* plan);
+
+#ifdef __cplusplus
+};
+#endif
+
+#endif  // BLISP_FLASH_PLAN_H
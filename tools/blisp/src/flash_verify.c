@@ -0,0 +1,196 @@
+// SPDX-License-Identifier: MIT
+#include "flash_verify.h"
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "flash_plan.h"
+
+void flash_verify_init(struct flash_verify* verify) {
+  memset(verify, 0, sizeof(struct flash_verify));
+}
+
+// Stores the digest of the part of a sector hashed so far
+static blisp_return_t flash_verify_close_sector(struct flash_verify* verify) {
+  if (verify->sector_length == 0) {
+    return BLISP_OK;
+  }
+  if (verify->sector_count == verify->sector_capacity) {
+    size_t capacity =
+        verify->sector_capacity == 0 ? 64 : verify->sector_capacity * 2;
+    void* grown =
+        realloc(verify->sector_digests, capacity * SHA256_DIGEST_SIZE);
+    if (grown == NULL) {
+      return BLISP_ERR_OUT_OF_MEMORY;
+    }
+    verify->sector_digests = grown;
+    verify->sector_capacity = capacity;
+  }
+  sha256_final(&verify->sector_context,
+               verify->sector_digests[verify->sector_count++]);
+  verify->sector_length = 0;
+  return BLISP_OK;
+}
+
+static blisp_return_t flash_verify_close_range(struct flash_verify* verify) {
+  if (!verify->range_open) {
+    return BLISP_OK;
+  }
+  verify->range_open = false;
+  sha256_final(&verify->range_context,
+               verify->ranges[verify->range_count - 1].digest);
+  return flash_verify_close_sector(verify);
+}
+
+blisp_return_t flash_verify_add(struct flash_verify* verify,
+                                uint32_t address,
+                                const uint8_t* data,
+                                uint32_t length) {
+  blisp_return_t ret;
+
+  if (length == 0) {
+    return BLISP_OK;
+  }
+  struct flash_verify_range* range =
+      verify->range_count > 0 ? &verify->ranges[verify->range_count - 1]
+                              : NULL;
+  if (range != NULL && address < range->address + range->length) {
+    return BLISP_ERR_INVALID_COMMAND;
+  }
+  if (range == NULL || !verify->range_open ||
+      address != range->address + range->length) {
+    ret = flash_verify_close_range(verify);
+    if (ret != BLISP_OK) {
+      return ret;
+    }
+    if (verify->range_count == verify->range_capacity) {
+      size_t capacity =
+          verify->range_capacity == 0 ? 8 : verify->range_capacity * 2;
+      void* grown = realloc(verify->ranges,
+                            capacity * sizeof(struct flash_verify_range));
+      if (grown == NULL) {
+        return BLISP_ERR_OUT_OF_MEMORY;
+      }
+      verify->ranges = grown;
+      verify->range_capacity = capacity;
+    }
+    range = &verify->ranges[verify->range_count++];
+    range->address = address;
+    range->length = 0;
+    range->first_sector = verify->sector_count;
+    sha256_init(&verify->range_context);
+    verify->range_open = true;
+  }
+
+  sha256_update(&verify->range_context, data, length);
+  range->length += length;
+  while (length > 0) {
+    uint32_t room =
+        FLASH_PLAN_SECTOR_SIZE - address % FLASH_PLAN_SECTOR_SIZE;
+    uint32_t piece = length < room ? length : room;
+    if (verify->sector_length == 0) {
+      sha256_init(&verify->sector_context);
+    }
+    sha256_update(&verify->sector_context, data, piece);
+    verify->sector_length += piece;
+    address += piece;
+    data += piece;
+    length -= piece;
+    if (piece == room) {
+      ret = flash_verify_close_sector(verify);
+      if (ret != BLISP_OK) {
+        return ret;
+      }
+    }
+  }
+  return BLISP_OK;
+}
+
+// Checks the sectors of a range one by one, adding those that differ to
+// *bad_count
+static blisp_return_t flash_verify_sectors(
+    struct flash_verify* verify,
+    struct blisp_device* device,
+    const struct flash_verify_range* range,
+    FILE* err,
+    uint32_t* bad_count) {
+  uint32_t address = range->address;
+  uint32_t end = range->address + range->length;
+
+  for (size_t i = range->first_sector; address < end; i++) {
+    uint32_t sector_end =
+        address - address % FLASH_PLAN_SECTOR_SIZE + FLASH_PLAN_SECTOR_SIZE;
+    if (sector_end > end || sector_end < address) {
+      sector_end = end;
+    }
+    uint8_t digest[SHA256_DIGEST_SIZE];
+    blisp_return_t ret = blisp_device_flash_read_sha256(
+        device, address, sector_end - address, digest);
+    if (ret != BLISP_OK) {
+      return ret;
+    }
+    if (memcmp(digest, verify->sector_digests[i], SHA256_DIGEST_SIZE) != 0) {
+      fprintf(err, "  0x%08" PRIx32 " - 0x%08" PRIx32 " differs\n",
+              address, sector_end - 1);
+      (*bad_count)++;
+    }
+    address = sector_end;
+  }
+  return BLISP_OK;
+}
+
+blisp_return_t flash_verify_check(struct flash_verify* verify,
+                                  struct blisp_device* device,
+                                  FILE* out,
+                                  FILE* err) {
+  uint64_t total = 0;
+  uint32_t bad_count = 0;
+
+  blisp_return_t ret = flash_verify_close_range(verify);
+  if (ret != BLISP_OK) {
+    return ret;
+  }
+
+  fprintf(out, "Verifying %zu range(s) against the device...\n",
+          verify->range_count);
+  for (size_t i = 0; i < verify->range_count; i++) {
+    const struct flash_verify_range* range = &verify->ranges[i];
+    uint8_t digest[SHA256_DIGEST_SIZE];
+    ret = blisp_device_flash_read_sha256(device, range->address,
+                                         range->length, digest);
+    if (ret != BLISP_OK) {
+      fprintf(err, "Failed to read flash hash at 0x%08" PRIx32 ", ret: %d\n",
+              range->address, ret);
+      return ret;
+    }
+    total += range->length;
+    if (memcmp(digest, range->digest, SHA256_DIGEST_SIZE) == 0) {
+      continue;
+    }
+
+    fprintf(err, "0x%08" PRIx32 " - 0x%08" PRIx32 " does not match:\n",
+            range->address, range->address + range->length - 1);
+    uint32_t range_bad_count = 0;
+    ret = flash_verify_sectors(verify, device, range, err, &range_bad_count);
+    if (ret != BLISP_OK) {
+      fprintf(err, "Failed to read flash hash, ret: %d\n", ret);
+      return ret;
+    }
+    // Sectors only miss what the range catches if the device is flaky
+    bad_count += range_bad_count > 0 ? range_bad_count : 1;
+  }
+
+  if (bad_count > 0) {
+    fprintf(err, "Verification failed, %" PRIu32 " sector(s) differ.\n",
+            bad_count);
+    return BLISP_ERR_VERIFY_FAILED;
+  }
+  fprintf(out, "Verified %" PRIu64 " bytes.\n", total);
+  return BLISP_OK;
+}
+
+void flash_verify_free(struct flash_verify* verify) {
+  free(verify->ranges);
+  free(verify->sector_digests);
+  memset(verify, 0, sizeof(struct flash_verify));
+}
@@ -0,0 +1,53 @@
+// SPDX-License-Identifier: MIT
+#ifndef BLISP_FLASH_VERIFY_H
+#define BLISP_FLASH_VERIFY_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <blisp.h>
+#include <blisp_sha256.h>
+
+struct flash_verify_range {
+  uint32_t address;
+  uint32_t length;
+  size_t first_sector;  // Index of its first entry in sector_digests
+  uint8_t digest[SHA256_DIGEST_SIZE];
+};
+
+// SHA-256 of everything written, checked against the hashes eflash_loader
+// computes over the same flash afterwards. Data is added as it is sent, in
+// ascending address order, and contiguous data is checked as one range.
+// The part of a range in each 4 KiB sector is hashed on its own as well, so
+// a range that doesn't match can be narrowed down to the sectors at fault
+// without the data, which a streamed image doesn't keep.
+struct flash_verify {
+  struct flash_verify_range* ranges;
+  size_t range_count;
+  size_t range_capacity;
+  uint8_t (*sector_digests)[SHA256_DIGEST_SIZE];
+  size_t sector_count;
+  size_t sector_capacity;
+
+  // Hashes of the last range and sector while they are still open
+  bool range_open;
+  struct sha256_context range_context;
+  struct sha256_context sector_context;
+  uint32_t sector_length;
+};
+
+void flash_verify_init(struct flash_verify* verify);
+blisp_return_t flash_verify_add(struct flash_verify* verify,
+                                uint32_t address,
+                                const uint8_t* data,
+                                uint32_t length);
+// Compares every range with the device, prints progress to out and the
+// sectors that differ to err. Returns BLISP_ERR_VERIFY_FAILED if any do.
+blisp_return_t flash_verify_check(struct flash_verify* verify,
+                                  struct blisp_device* device,
+                                  FILE* out,
+                                  FILE* err);
+void flash_verify_free(struct flash_verify* verify);
+
+#endif  // BLISP_FLASH_VERIFY_H
@@ -5,7 +5,8 @@
 #include "argtable3.h"
 #include "cmd.h"
 
-struct cmd* cmds[] = {&cmd_write, &cmd_iot};
+struct cmd* cmds[] = {&cmd_write, &cmd_iot, &cmd_read,
+                      &cmd_multi, &cmd_serve, &cmd_job};
 
 static uint8_t cmds_count = sizeof(cmds) / sizeof(cmds[0]);
 
@@ -0,0 +1,45 @@
+// SPDX-License-Identifier: MIT
+#ifndef BLISP_SERVE_H
+#define BLISP_SERVE_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// `blisp serve` and `blisp job` talk over a Unix domain socket. A job is one
+// line of tab separated fields:
+//
+//   <job> <port> <address> <length> <verify> <path>
+//
+// with <job> one of write, verify, erase, reset or status, numbers in
+// decimal and <path> absolute. The answer is any number of lines of text
+// for the user, followed by "DONE <blisp_return_t>".
+#define SERVE_DEFAULT_SOCKET "/tmp/blisp.sock"
+#define SERVE_LINE_SIZE 4096
+#define SERVE_DONE "DONE "
+
+struct serve_request {
+  char job[16];
+  char port[256];
+  uint32_t address;
+  uint32_t length;
+  bool verify;
+  char path[SERVE_LINE_SIZE];
+};
+
+// Splits a job line into request, which it rejects if a field is missing,
+// too long or not a number where one belongs. Modifies line.
+bool serve_parse_request(char* line, struct serve_request* request);
+// Reads one line from a client, without the newline. Fails if the line
+// doesn't fit into size bytes.
+bool serve_read_line(int fd, char* line, size_t size);
+
+#ifdef __cplusplus
+};
+#endif
+
+#endif  // BLISP_SERVE_H
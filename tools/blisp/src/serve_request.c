@@ -0,0 +1,86 @@
+// SPDX-License-Identifier: MIT
+#include <stdlib.h>
+#include <string.h>
+#include "serve.h"
+
+#ifndef _WIN32
+#include <unistd.h>
+#endif
+
+// Parses the next field of a request line, returns NULL if it is missing
+static char* serve_next_field(char** line) {
+  char* field = *line;
+  if (field == NULL) {
+    return NULL;
+  }
+  char* tab = strchr(field, '\t');
+  if (tab != NULL) {
+    *tab = '\0';
+    *line = tab + 1;
+  } else {
+    *line = NULL;
+  }
+  return field;
+}
+
+// Decimal only, without sign or spaces, and no larger than 32 bits
+static bool serve_parse_number(const char* field, uint32_t* value) {
+  char* end;
+  if (*field < '0' || *field > '9') {
+    return false;
+  }
+  unsigned long long number = strtoull(field, &end, 10);
+  if (*end != '\0' || number > UINT32_MAX) {
+    return false;
+  }
+  *value = number;
+  return true;
+}
+
+bool serve_parse_request(char* line, struct serve_request* request) {
+  char* fields[6];
+  for (int i = 0; i < 6; i++) {
+    fields[i] = serve_next_field(&line);
+    if (fields[i] == NULL) {
+      return false;
+    }
+  }
+  if (line != NULL) {
+    return false;  // More fields than a job has
+  }
+  if (strlen(fields[0]) >= sizeof(request->job) ||
+      strlen(fields[1]) >= sizeof(request->port) ||
+      strlen(fields[5]) >= sizeof(request->path)) {
+    return false;
+  }
+  if (!serve_parse_number(fields[2], &request->address) ||
+      !serve_parse_number(fields[3], &request->length) ||
+      (strcmp(fields[4], "0") != 0 && strcmp(fields[4], "1") != 0)) {
+    return false;
+  }
+  strcpy(request->job, fields[0]);
+  strcpy(request->port, fields[1]);
+  request->verify = strcmp(fields[4], "1") == 0;
+  strcpy(request->path, fields[5]);
+  return true;
+}
+
+#ifndef _WIN32
+
+bool serve_read_line(int fd, char* line, size_t size) {
+  size_t length = 0;
+  while (length + 1 < size) {
+    ssize_t ret = read(fd, line + length, 1);
+    if (ret <= 0) {
+      return false;
+    }
+    if (line[length] == '\n') {
+      line[length] = '\0';
+      return true;
+    }
+    length++;
+  }
+  return false;
+}
+
+#endif
@@ -0,0 +1,63 @@
+// SPDX-License-Identifier: MIT
+#include "stats.h"
+#include <inttypes.h>
+
+static void stats_print_command(FILE* out,
+                                uint8_t opcode,
+                                const struct blisp_command_metrics* command) {
+  const char* name = blisp_command_name(opcode);
+
+  fprintf(out, "{\"opcode\":\"0x%02" PRIX8 "\",\"name\":\"%s\"", opcode,
+          name != NULL ? name : "unknown");
+  fprintf(out,
+          ",\"count\":%" PRIu32 ",\"errors\":%" PRIu32 ",\"timeouts\":%" PRIu32
+          ",\"retries\":%" PRIu32 ",\"pending\":%" PRIu32
+          ",\"pending_us\":%" PRIu64,
+          command->count, command->errors, command->timeouts, command->retries,
+          command->pending, command->pending_us);
+  fprintf(out,
+          ",\"bytes_out\":%" PRIu64 ",\"bytes_in\":%" PRIu64
+          ",\"total_us\":%" PRIu64 ",\"min_us\":%" PRIu32
+          ",\"max_us\":%" PRIu32 ",\"histogram\":[",
+          command->bytes_out, command->bytes_in, command->total_us,
+          command->min_us, command->max_us);
+  for (int i = 0; i < BLISP_METRICS_BUCKETS; i++) {
+    fprintf(out, "%s%" PRIu32, i == 0 ? "" : ",", command->histogram[i]);
+  }
+  fputs("]}", out);
+}
+
+void stats_print_json(FILE* out,
+                      const struct blisp_metrics* metrics,
+                      uint64_t duration_us) {
+  fprintf(out,
+          "{\"duration_us\":%" PRIu64 ",\"bytes_out\":%" PRIu64
+          ",\"bytes_in\":%" PRIu64 ",\"garbage_bytes\":%" PRIu64,
+          duration_us, metrics->bytes_out, metrics->bytes_in,
+          metrics->garbage_bytes);
+  fprintf(out,
+          ",\"handshakes\":%" PRIu32 ",\"handshake_failures\":%" PRIu32
+          ",\"handshake_attempts\":%" PRIu32 ",\"handshake_us\":%" PRIu64,
+          metrics->handshakes, metrics->handshake_failures,
+          metrics->handshake_attempts, metrics->handshake_us);
+
+  // Upper bounds of the histogram buckets, the last one has none
+  fputs(",\"histogram_bounds_us\":[", out);
+  for (int i = 0; i < BLISP_METRICS_BUCKETS - 1; i++) {
+    fprintf(out, "%s%" PRIu64, i == 0 ? "" : ",",
+            (uint64_t)BLISP_METRICS_BUCKET_0_US << i);
+  }
+  fputs("],\"commands\":[", out);
+  bool first = true;
+  for (int opcode = 0; opcode < 256; opcode++) {
+    if (metrics->commands[opcode].count == 0) {
+      continue;
+    }
+    if (!first) {
+      fputc(',', out);
+    }
+    first = false;
+    stats_print_command(out, opcode, &metrics->commands[opcode]);
+  }
+  fputs("]}\n", out);
+}
@@ -0,0 +1,15 @@
+// SPDX-License-Identifier: MIT
+#ifndef BLISP_STATS_H
+#define BLISP_STATS_H
+
+#include <stdint.h>
+#include <stdio.h>
+#include <blisp_metrics.h>
+
+// Prints the metrics of a run as a single line of JSON, for --stats json.
+// Commands that were never sent are left out.
+void stats_print_json(FILE* out,
+                      const struct blisp_metrics* metrics,
+                      uint64_t duration_us);
+
+#endif  // BLISP_STATS_H
@@ -0,0 +1,115 @@
+// Flash planner test
+
+#include <gtest/gtest.h>
+#include <string.h>
+#include "flash_plan.h"
+
+// A command costs as much as erasing three sectors and a bit, or as sending
+// 1000 bytes
+static const struct flash_plan_costs costs = {100000, 30000, 100000};
+
+static uint8_t data[2][16];
+
+static void build(struct flash_plan* plan, uint32_t second_address) {
+  memset(data, 0x55, sizeof(data));
+  parsed_firmware_segment_t segments[2] = {
+      {0x2000, sizeof(data[0]), data[0]},
+      {second_address, sizeof(data[1]), data[1]},
+  };
+  ASSERT_EQ(flash_plan_build(plan, segments, 2, &costs), BLISP_OK);
+}
+
+TEST(FLASH_PLAN, MergesEraseOverSmallGap) {
+  struct flash_plan plan;
+  // Two sectors apart, erasing them is cheaper than another command
+  build(&plan, 0x5000);
+  ASSERT_EQ(plan.erase_count, 1);
+  ASSERT_EQ(plan.erases[0].address, 0x2000);
+  ASSERT_EQ(plan.erases[0].length, 0x4000);
+  // The writes stay apart, the gap takes longer to send than a command
+  ASSERT_EQ(plan.write_count, 2);
+  flash_plan_free(&plan);
+}
+
+TEST(FLASH_PLAN, KeepsEraseApartOverLargeGap) {
+  struct flash_plan plan;
+  // Sixteen sectors apart
+  build(&plan, 0x13000);
+  ASSERT_EQ(plan.erase_count, 2);
+  ASSERT_EQ(plan.erases[0].address, 0x2000);
+  ASSERT_EQ(plan.erases[0].length, FLASH_PLAN_SECTOR_SIZE);
+  ASSERT_EQ(plan.erases[1].address, 0x13000);
+  ASSERT_EQ(plan.erases[1].length, FLASH_PLAN_SECTOR_SIZE);
+  flash_plan_free(&plan);
+}
+
+TEST(FLASH_PLAN, BridgesShortWriteGap) {
+  struct flash_plan plan;
+  // 1000 bytes take as long to send as another command
+  build(&plan, 0x2000 + sizeof(data[0]) + 1000);
+  ASSERT_EQ(plan.write_count, 1);
+  ASSERT_EQ(plan.writes[0].address, 0x2000);
+  ASSERT_EQ(plan.writes[0].length, 2 * sizeof(data[0]) + 1000);
+  const uint8_t* write = plan.writes[0].data;
+  ASSERT_EQ(memcmp(write, data[0], sizeof(data[0])), 0);
+  for (size_t i = sizeof(data[0]); i < sizeof(data[0]) + 1000; i++) {
+    ASSERT_EQ(write[i], 0xFF);
+  }
+  ASSERT_EQ(memcmp(write + sizeof(data[0]) + 1000, data[1], sizeof(data[1])),
+            0);
+  flash_plan_free(&plan);
+}
+
+TEST(FLASH_PLAN, KeepsWritesApartOverLongGap) {
+  struct flash_plan plan;
+  build(&plan, 0x2000 + sizeof(data[0]) + 1001);
+  ASSERT_EQ(plan.erase_count, 1);
+  ASSERT_EQ(plan.write_count, 2);
+  ASSERT_EQ(plan.writes[0].address, 0x2000);
+  ASSERT_EQ(plan.writes[0].length, sizeof(data[0]));
+  ASSERT_EQ(plan.writes[0].data, data[0]);
+  ASSERT_EQ(plan.writes[1].address, 0x2000 + sizeof(data[0]) + 1001);
+  ASSERT_EQ(plan.writes[1].length, sizeof(data[1]));
+  ASSERT_EQ(plan.writes[1].data, data[1]);
+  flash_plan_free(&plan);
+}
+
+TEST(FLASH_PLAN, SkipsLongBlankRuns) {
+  struct flash_plan plan;
+  static uint8_t image[0x2000];
+  // Code, a short blank run that stays in, code, a long one and a blank tail
+  memset(image, 0x55, sizeof(image));
+  memset(image + 0x100, 0xFF, 1000);
+  memset(image + 0x800, 0xFF, 0x800);
+  memset(image + 0x1800, 0xFF, 0x800);
+  parsed_firmware_segment_t segment = {0x10000, sizeof(image), image};
+  ASSERT_EQ(flash_plan_build(&plan, &segment, 1, &costs), BLISP_OK);
+  // The blank runs are still erased
+  ASSERT_EQ(plan.erase_count, 1);
+  ASSERT_EQ(plan.erases[0].address, 0x10000);
+  ASSERT_EQ(plan.erases[0].length, sizeof(image));
+  ASSERT_EQ(plan.write_count, 2);
+  ASSERT_EQ(plan.writes[0].address, 0x10000);
+  ASSERT_EQ(plan.writes[0].length, 0x800);
+  ASSERT_EQ(plan.writes[0].data, image);
+  ASSERT_EQ(plan.writes[1].address, 0x11000);
+  ASSERT_EQ(plan.writes[1].length, 0x800);
+  ASSERT_EQ(plan.writes[1].data, image + 0x1000);
+  flash_plan_free(&plan);
+}
+
+TEST(FLASH_PLAN, WritesUnalignedSegmentEndsAsTheyAre) {
+  struct flash_plan plan;
+  // Straddles a sector boundary and ends short of the next
+  memset(data, 0x55, sizeof(data));
+  parsed_firmware_segment_t segment = {0x2FF8, sizeof(data[0]), data[0]};
+  ASSERT_EQ(flash_plan_build(&plan, &segment, 1, &costs), BLISP_OK);
+  // Both sectors are erased, the write doesn't grow to them
+  ASSERT_EQ(plan.erase_count, 1);
+  ASSERT_EQ(plan.erases[0].address, 0x2000);
+  ASSERT_EQ(plan.erases[0].length, 2 * FLASH_PLAN_SECTOR_SIZE);
+  ASSERT_EQ(plan.write_count, 1);
+  ASSERT_EQ(plan.writes[0].address, 0x2FF8);
+  ASSERT_EQ(plan.writes[0].length, sizeof(data[0]));
+  flash_plan_free(&plan);
+}
@@ -0,0 +1,92 @@
+// Request parser test for blisp serve
+
+#include <gtest/gtest.h>
+#include <string.h>
+#include <string>
+#include "serve.h"
+
+#ifndef _WIN32
+#include <unistd.h>
+#endif
+
+static bool parse(std::string line, struct serve_request* request) {
+  return serve_parse_request(&line[0], request);
+}
+
+TEST(SERVE_REQUEST, ParsesJob) {
+  struct serve_request request;
+  ASSERT_TRUE(parse("erase\t/dev/ttyUSB0\t8192\t4096\t1\t/tmp/fw.bin",
+                    &request));
+  ASSERT_STREQ(request.job, "erase");
+  ASSERT_STREQ(request.port, "/dev/ttyUSB0");
+  ASSERT_EQ(request.address, 8192);
+  ASSERT_EQ(request.length, 4096);
+  ASSERT_TRUE(request.verify);
+  ASSERT_STREQ(request.path, "/tmp/fw.bin");
+  // status leaves the port and path empty
+  ASSERT_TRUE(parse("status\t\t0\t0\t0\t", &request));
+  ASSERT_STREQ(request.job, "status");
+  ASSERT_STREQ(request.port, "");
+  ASSERT_FALSE(request.verify);
+}
+
+TEST(SERVE_REQUEST, RejectsMalformedJobs) {
+  struct serve_request request;
+  ASSERT_FALSE(parse("", &request));
+  ASSERT_FALSE(parse("write", &request));
+  ASSERT_FALSE(parse("write\t/dev/ttyUSB0\t0\t0\t0", &request));
+  ASSERT_FALSE(parse("write\t/dev/ttyUSB0\t0\t0\t0\t/tmp/fw.bin\textra",
+                     &request));
+  ASSERT_FALSE(parse("erase\tp\t0x2000\t0\t0\t", &request));
+  ASSERT_FALSE(parse("erase\tp\t-1\t0\t0\t", &request));
+  ASSERT_FALSE(parse("erase\tp\t 1\t0\t0\t", &request));
+  ASSERT_FALSE(parse("erase\tp\t\t0\t0\t", &request));
+  ASSERT_FALSE(parse("erase\tp\t0\t12ab\t0\t", &request));
+  ASSERT_FALSE(parse("erase\tp\t0\t0\tyes\t", &request));
+}
+
+TEST(SERVE_REQUEST, RejectsOversizedFields) {
+  struct serve_request request;
+  std::string job(sizeof(request.job), 'w');
+  std::string port(sizeof(request.port), 'p');
+  ASSERT_FALSE(parse(job + "\tp\t0\t0\t0\t", &request));
+  ASSERT_FALSE(parse("reset\t" + port + "\t0\t0\t0\t", &request));
+  ASSERT_TRUE(parse("reset\t" + port.substr(1) + "\t0\t0\t0\t", &request));
+  // 2^32 doesn't fit an address
+  ASSERT_FALSE(parse("erase\tp\t4294967296\t0\t0\t", &request));
+  ASSERT_TRUE(parse("erase\tp\t4294967295\t0\t0\t", &request));
+  ASSERT_EQ(request.address, 4294967295u);
+}
+
+#ifndef _WIN32
+
+static bool read_line(const std::string& input, char* line, size_t size) {
+  int fds[2];
+  if (pipe(fds) != 0) {
+    return false;
+  }
+  bool sent = write(fds[1], input.data(), input.size()) ==
+              (ssize_t)input.size();
+  close(fds[1]);
+  bool ret = sent && serve_read_line(fds[0], line, size);
+  close(fds[0]);
+  return ret;
+}
+
+TEST(SERVE_REQUEST, ReadsLine) {
+  char line[16];
+  ASSERT_TRUE(read_line("status\t\t0\t0\t0\t\nrest", line, sizeof(line)));
+  ASSERT_STREQ(line, "status\t\t0\t0\t0\t");
+}
+
+TEST(SERVE_REQUEST, RejectsOversizedAndUnterminatedLines) {
+  char line[16];
+  // The newline and the terminator take two of the bytes
+  ASSERT_TRUE(read_line(std::string(14, 'x') + "\n", line, sizeof(line)));
+  ASSERT_FALSE(read_line(std::string(15, 'x') + "\n", line, sizeof(line)));
+  ASSERT_FALSE(read_line(std::string(4096, 'x') + "\n", line, sizeof(line)));
+  // The client hung up mid line
+  ASSERT_FALSE(read_line("status", line, sizeof(line)));
+}
+
+#endif
@@ -0,0 +1,79 @@
+// SHA-256 test
+
+#include <blisp_sha256.h>
+#include <gtest/gtest.h>
+#include <string>
+#include <vector>
+
+static std::string hex(const uint8_t digest[SHA256_DIGEST_SIZE]) {
+  std::string text;
+  char byte[3];
+  for (int i = 0; i < SHA256_DIGEST_SIZE; i++) {
+    snprintf(byte, sizeof(byte), "%02x", digest[i]);
+    text += byte;
+  }
+  return text;
+}
+
+// Examples of FIPS 180-4, through whatever kernel this CPU gets
+TEST(SHA256, KnownAnswers) {
+  static const struct {
+    std::string message;
+    const char* digest;
+  } vectors[] = {
+      {"", "e3b0c44298fc1c149afbf4c8996fb92427ae41e4649b934ca495991b7852b855"},
+      {"abc",
+       "ba7816bf8f01cfea414140de5dae2223b00361a396177a9cb410ff61f20015ad"},
+      {"abcdbcdecdefdefgefghfghighijhijkijkljklmklmnlmnomnopnopq",
+       "248d6a61d20638b8e5c026930c3e6039a33ce45964ff2167f6ecedd419db06c1"},
+      {std::string(1000000, 'a'),
+       "cdc76e5c9914fb9281a1c7e284d73e67f1809a48a497200e046d39ccc7112cd0"},
+  };
+  uint8_t digest[SHA256_DIGEST_SIZE];
+
+  for (const auto& vector : vectors) {
+    sha256_calculate(vector.message.data(), vector.message.size(), digest);
+    ASSERT_EQ(hex(digest), vector.digest)
+        << sha256_kernel_name() << " length " << vector.message.size();
+    sha256_calculate_portable(vector.message.data(), vector.message.size(),
+                              digest);
+    ASSERT_EQ(hex(digest), vector.digest)
+        << "portable length " << vector.message.size();
+  }
+}
+
+TEST(SHA256, MatchesPortable) {
+  std::vector<uint8_t> data(4096 + 64);
+  uint32_t state = 0x2545F491;
+  for (auto& byte : data) {
+    state = state * 1103515245 + 12345;
+    byte = state >> 24;
+  }
+  // Every alignment, lengths around the block size, and updates that
+  // start and end inside a block
+  for (size_t offset = 0; offset < 16; offset++) {
+    for (size_t length = 0; length <= 4096; length += length < 256 ? 1 : 61) {
+      const uint8_t* start = data.data() + offset;
+      uint8_t expected[SHA256_DIGEST_SIZE];
+      uint8_t digest[SHA256_DIGEST_SIZE];
+      sha256_calculate_portable(start, length, expected);
+
+      sha256_calculate(start, length, digest);
+      ASSERT_EQ(hex(digest), hex(expected))
+          << sha256_kernel_name() << " offset " << offset << " length "
+          << length;
+
+      struct sha256_context ctx;
+      size_t first = length / 3;
+      size_t second = length / 2;
+      sha256_init(&ctx);
+      sha256_update(&ctx, start, first);
+      sha256_update(&ctx, start + first, second - first);
+      sha256_update(&ctx, start + second, length - second);
+      sha256_final(&ctx, digest);
+      ASSERT_EQ(hex(digest), hex(expected))
+          << sha256_kernel_name() << " split, offset " << offset
+          << " length " << length;
+    }
+  }
+}
@@ -0,0 +1,154 @@
+// SPDX-License-Identifier: MIT
+#include "trace.h"
+#include <inttypes.h>
+#include <stdio.h>
+#include <blisp_metrics.h>
+#include <blisp_util.h>
+
+#define TRACE_MAX_DEPTH 16
+#define TRACE_TID_PHASES 1
+#define TRACE_TID_COMMANDS 2
+
+static FILE* trace_file = NULL;
+static const char* trace_file_name;
+static uint64_t trace_start_us;
+static uint32_t trace_command_id;
+static bool trace_first_event;
+// Only used when --stats didn't give the device metrics already
+static struct blisp_metrics trace_metrics;
+
+static struct {
+  const char* name;
+  uint64_t start_us;
+} trace_phases[TRACE_MAX_DEPTH];
+static uint32_t trace_depth;  // May exceed TRACE_MAX_DEPTH, those are dropped
+
+static void trace_event_start(void) {
+  // Every event but the first follows a comma
+  fputs(trace_first_event ? "\n" : ",\n", trace_file);
+  trace_first_event = false;
+}
+
+static void trace_name_thread(uint32_t tid, const char* name) {
+  trace_event_start();
+  fprintf(trace_file,
+          "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":%" PRIu32
+          ",\"args\":{\"name\":\"%s\"}}",
+          tid, name);
+}
+
+blisp_return_t trace_open(const char* path) {
+  trace_file = fopen(path, "w");
+  if (trace_file == NULL) {
+    perror(path);
+    return BLISP_ERR_CANT_OPEN_FILE;
+  }
+  trace_file_name = path;
+  trace_start_us = monotonic_us();
+  trace_first_event = true;
+  fputs("{\"displayTimeUnit\":\"ms\",\"traceEvents\":[", trace_file);
+  trace_event_start();
+  fputs(
+      "{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":1,"
+      "\"args\":{\"name\":\"blisp\"}}",
+      trace_file);
+  trace_name_thread(TRACE_TID_PHASES, "phases");
+  trace_name_thread(TRACE_TID_COMMANDS, "commands");
+  return BLISP_OK;
+}
+
+static const char* trace_result_name(enum blisp_response_type result) {
+  switch (result) {
+    case BLISP_RESPONSE_OK:
+      return "ok";
+    case BLISP_RESPONSE_ERROR:
+      return "error";
+    case BLISP_RESPONSE_NONE:
+      return "timeout";
+    default:
+      return "pending";
+  }
+}
+
+// Commands overlap while flash writes are pipelined, so they are async
+// events, which the viewers stack instead of nesting
+static void trace_command(void* user_data,
+                          uint8_t command,
+                          uint64_t sent_us,
+                          uint64_t done_us,
+                          enum blisp_response_type result) {
+  (void)user_data;
+  if (trace_file == NULL) {
+    return;
+  }
+  const char* name = blisp_command_name(command);
+  uint32_t id = ++trace_command_id;
+  for (int i = 0; i < 2; i++) {
+    trace_event_start();
+    fprintf(trace_file,
+            "{\"name\":\"%s\",\"cat\":\"command\",\"ph\":\"%s\",\"id\":%" PRIu32
+            ",\"ts\":%" PRIu64 ",\"pid\":1,\"tid\":%d",
+            name != NULL ? name : "unknown", i == 0 ? "b" : "e", id,
+            (i == 0 ? sent_us : done_us) - trace_start_us, TRACE_TID_COMMANDS);
+    if (i == 0) {
+      fprintf(trace_file, ",\"args\":{\"opcode\":\"0x%02" PRIX8 "\"}}",
+              command);
+    } else {
+      fprintf(trace_file, ",\"args\":{\"result\":\"%s\"}}",
+              trace_result_name(result));
+    }
+  }
+}
+
+void trace_attach(struct blisp_device* device) {
+  if (trace_file == NULL) {
+    return;
+  }
+  if (device->metrics == NULL) {
+    blisp_device_set_metrics(device, &trace_metrics);
+  }
+  device->metrics->command_callback = trace_command;
+  device->metrics->command_callback_data = NULL;
+}
+
+void trace_begin(const char* name) {
+  if (trace_file == NULL) {
+    return;
+  }
+  if (trace_depth < TRACE_MAX_DEPTH) {
+    trace_phases[trace_depth].name = name;
+    trace_phases[trace_depth].start_us = monotonic_us();
+  }
+  trace_depth++;
+}
+
+void trace_end(blisp_return_t ret) {
+  if (trace_file == NULL || trace_depth == 0) {
+    return;
+  }
+  trace_depth--;
+  if (trace_depth >= TRACE_MAX_DEPTH) {
+    return;
+  }
+  uint64_t start_us = trace_phases[trace_depth].start_us;
+  trace_event_start();
+  fprintf(trace_file,
+          "{\"name\":\"%s\",\"cat\":\"phase\",\"ph\":\"X\",\"ts\":%" PRIu64
+          ",\"dur\":%" PRIu64 ",\"pid\":1,\"tid\":%d,\"args\":{\"ret\":%d}}",
+          trace_phases[trace_depth].name, start_us - trace_start_us,
+          monotonic_us() - start_us, TRACE_TID_PHASES, ret);
+}
+
+void trace_close(blisp_return_t ret) {
+  if (trace_file == NULL) {
+    return;
+  }
+  while (trace_depth > 0) {
+    trace_end(ret);
+  }
+  fputs("\n]}\n", trace_file);
+  if (fclose(trace_file) != 0) {
+    perror(trace_file_name);
+  }
+  trace_file = NULL;
+}
@@ -0,0 +1,23 @@
+// SPDX-License-Identifier: MIT
+#ifndef BLISP_TRACE_H
+#define BLISP_TRACE_H
+
+#include <stdbool.h>
+#include <blisp.h>
+
+// Timeline of a run for --trace, in Chrome's trace event format (open it in
+// chrome://tracing or ui.perfetto.dev). Phases are spans on one track, the
+// commands sent during them on another. Everything does nothing until
+// trace_open, so the flashing code calls it unconditionally.
+
+blisp_return_t trace_open(const char* path);
+// Records every command the device sends. Shares the metrics of --stats if
+// the device has them already.
+void trace_attach(struct blisp_device* device);
+// Phases nest, every trace_begin needs a trace_end
+void trace_begin(const char* name);
+void trace_end(blisp_return_t ret);
+// Ends the phases still open with ret and writes out the file
+void trace_close(blisp_return_t ret);
+
+#endif  // BLISP_TRACE_H
@@ -0,0 +1,271 @@
+// SPDX-License-Identifier: MIT
+// Build step: reads one of the data/*_eflash_loader.h byte arrays and writes
+// it out again as an LZ4 block, which lib/chip decodes on first use.
+//
+//   blisp-loader-pack <input.h> <output.h> <name>
+#include <ctype.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define MIN_MATCH 4
+#define MAX_OFFSET 65535
+// The LZ4 block format wants the last match to start 12 bytes before the
+// end and the last 5 bytes to be literals
+#define MATCH_START_LIMIT 12
+#define LAST_LITERALS 5
+#define HASH_BITS 16
+// Candidates looked at per position, the images are small enough to not care
+#define MAX_CHAIN 4096
+
+static uint8_t* read_file(const char* path, size_t* size) {
+  FILE* file = fopen(path, "rb");
+  if (file == NULL) {
+    perror(path);
+    return NULL;
+  }
+  size_t capacity = 1 << 20;
+  uint8_t* data = malloc(capacity);
+  *size = 0;
+  while (data != NULL) {
+    size_t read = fread(data + *size, 1, capacity - *size, file);
+    *size += read;
+    if (read == 0) {
+      break;
+    }
+    if (*size == capacity) {
+      capacity *= 2;
+      uint8_t* grown = realloc(data, capacity);
+      if (grown == NULL) {
+        free(data);
+      }
+      data = grown;
+    }
+  }
+  fclose(file);
+  if (data == NULL) {
+    fprintf(stderr, "Out of memory reading %s\n", path);
+  }
+  return data;
+}
+
+// Collects the 0x.. values between the first { and the following }
+static uint8_t* parse_array(const char* text, size_t text_size, size_t* size) {
+  const char* p = memchr(text, '{', text_size);
+  const char* end = p == NULL ? NULL : memchr(p, '}', text + text_size - p);
+  if (end == NULL) {
+    return NULL;
+  }
+  uint8_t* bytes = malloc(end - p);
+  if (bytes == NULL) {
+    return NULL;
+  }
+  *size = 0;
+  while (p < end) {
+    if (p[0] == '0' && (p[1] == 'x' || p[1] == 'X')) {
+      char* next;
+      unsigned long value = strtoul(p, &next, 16);
+      if (value > 0xFF) {
+        free(bytes);
+        return NULL;
+      }
+      bytes[(*size)++] = value;
+      p = next;
+    } else {
+      p++;
+    }
+  }
+  return bytes;
+}
+
+static uint32_t hash4(const uint8_t* p) {
+  uint32_t value = p[0] | p[1] << 8 | p[2] << 16 | (uint32_t)p[3] << 24;
+  return (value * 2654435761u) >> (32 - HASH_BITS);
+}
+
+static size_t put_length(uint8_t* out, size_t length) {
+  size_t n = 0;
+  for (; length >= 255; length -= 255) {
+    out[n++] = 255;
+  }
+  out[n++] = length;
+  return n;
+}
+
+static size_t put_sequence(uint8_t* out,
+                           const uint8_t* literals,
+                           size_t literal_length,
+                           size_t offset,
+                           size_t match_length) {
+  size_t n = 0;
+  uint8_t* token = &out[n++];
+  *token = (literal_length < 15 ? literal_length : 15) << 4;
+  if (literal_length >= 15) {
+    n += put_length(out + n, literal_length - 15);
+  }
+  memcpy(out + n, literals, literal_length);
+  n += literal_length;
+  if (match_length == 0) {
+    return n;  // Last sequence
+  }
+  out[n++] = offset & 0xFF;
+  out[n++] = offset >> 8;
+  match_length -= MIN_MATCH;
+  *token |= match_length < 15 ? match_length : 15;
+  if (match_length >= 15) {
+    n += put_length(out + n, match_length - 15);
+  }
+  return n;
+}
+
+struct matcher {
+  const uint8_t* data;
+  size_t size;
+  int32_t* head;   // Last position with a hash
+  int32_t* chain;  // Previous position with the same hash
+  size_t inserted;
+};
+
+static void matcher_insert_until(struct matcher* m, size_t position) {
+  for (; m->inserted < position; m->inserted++) {
+    uint32_t h = hash4(m->data + m->inserted);
+    m->chain[m->inserted] = m->head[h];
+    m->head[h] = m->inserted;
+  }
+}
+
+static size_t matcher_find(struct matcher* m, size_t position,
+                           size_t* offset) {
+  size_t limit = m->size - LAST_LITERALS;
+  size_t best = 0;
+
+  matcher_insert_until(m, position);
+  int32_t candidate = m->head[hash4(m->data + position)];
+  for (int chain = 0; candidate >= 0 && chain < MAX_CHAIN; chain++) {
+    if (position - candidate > MAX_OFFSET) {
+      break;
+    }
+    size_t length = 0;
+    while (position + length < limit &&
+           m->data[candidate + length] == m->data[position + length]) {
+      length++;
+    }
+    if (length > best) {
+      best = length;
+      *offset = position - candidate;
+    }
+    candidate = m->chain[candidate];
+  }
+  return best >= MIN_MATCH ? best : 0;
+}
+
+// Greedy parse with one step of lazy matching. Returns the packed size.
+static size_t compress(const uint8_t* data, size_t size, uint8_t* out) {
+  struct matcher m = {data, size, malloc((1 << HASH_BITS) * sizeof(int32_t)),
+                      malloc((size + 1) * sizeof(int32_t)), 0};
+  size_t n = 0;
+  size_t anchor = 0;
+  size_t position = 0;
+
+  if (m.head == NULL || m.chain == NULL) {
+    free(m.head);
+    free(m.chain);
+    return 0;
+  }
+  memset(m.head, 0xFF, (1 << HASH_BITS) * sizeof(int32_t));
+  while (size >= MATCH_START_LIMIT && position < size - MATCH_START_LIMIT) {
+    size_t offset = 0;
+    size_t length = matcher_find(&m, position, &offset);
+    if (length == 0) {
+      position++;
+      continue;
+    }
+    size_t next_offset = 0;
+    if (position + 1 < size - MATCH_START_LIMIT &&
+        matcher_find(&m, position + 1, &next_offset) > length + 1) {
+      position++;
+      continue;
+    }
+    n += put_sequence(out + n, data + anchor, position - anchor, offset,
+                      length);
+    position += length;
+    anchor = position;
+  }
+  n += put_sequence(out + n, data + anchor, size - anchor, 0, 0);
+  free(m.head);
+  free(m.chain);
+  return n;
+}
+
+int main(int argc, char** argv) {
+  int ret = EXIT_FAILURE;
+  size_t text_size, size;
+  uint8_t* image = NULL;
+  uint8_t* packed = NULL;
+  FILE* output = NULL;
+
+  if (argc != 4) {
+    fprintf(stderr, "Usage: %s <input.h> <output.h> <name>\n", argv[0]);
+    return EXIT_FAILURE;
+  }
+  uint8_t* text = read_file(argv[1], &text_size);
+  if (text == NULL) {
+    return EXIT_FAILURE;
+  }
+  image = parse_array((const char*)text, text_size, &size);
+  if (image == NULL || size == 0) {
+    fprintf(stderr, "%s: no byte array found\n", argv[1]);
+    goto exit;
+  }
+  // Worst case: everything as literals, plus the length bytes
+  packed = malloc(size + size / 255 + 16);
+  if (packed == NULL) {
+    fprintf(stderr, "Out of memory\n");
+    goto exit;
+  }
+  size_t packed_size = compress(image, size, packed);
+  if (packed_size == 0) {
+    fprintf(stderr, "Out of memory\n");
+    goto exit;
+  }
+
+  output = fopen(argv[2], "w");
+  if (output == NULL) {
+    perror(argv[2]);
+    goto exit;
+  }
+  const char* input_name = strrchr(argv[1], '/');
+  input_name = input_name == NULL ? argv[1] : input_name + 1;
+  fprintf(output,
+          "// Generated from %s by blisp-loader-pack, do not edit.\n"
+          "// LZ4 block, %zu bytes unpacked.\n",
+          input_name, size);
+  fputs("#define ", output);
+  for (const char* c = argv[3]; *c != '\0'; c++) {
+    fputc(toupper((unsigned char)*c), output);
+  }
+  fprintf(output, "_EFLASH_LOADER_SIZE %zu\n\n", size);
+  fprintf(output, "static const unsigned char %s_eflash_loader_lz4[] = {",
+          argv[3]);
+  for (size_t i = 0; i < packed_size; i++) {
+    fprintf(output, "%s0x%02x,", i % 12 == 0 ? "\n    " : " ", packed[i]);
+  }
+  fputs("\n};\n", output);
+  if (fclose(output) != 0) {
+    perror(argv[2]);
+    output = NULL;
+    goto exit;
+  }
+  output = NULL;
+  ret = EXIT_SUCCESS;
+
+exit:
+  if (output != NULL) {
+    fclose(output);
+  }
+  free(text);
+  free(image);
+  free(packed);
+  return ret;
+}